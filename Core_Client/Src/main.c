@@ -1,15 +1,312 @@
+#define _GNU_SOURCE
 #include <stdlib.h>
+#include <stdint.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
 #include <arpa/inet.h>
+#include <sys/socket.h>
+
+#define LOAD_MAX_THREADS 64
+#define LOAD_MAX_BATCH 1024
+#define LOAD_MAGIC 0x4c4f4144u      // "LOAD"
+#define LOAD_MIN_SIZE 24            // magic + 线程号 + seq + 发送时刻
+#define LOAD_MAX_SIZE 65507
+// 结束后再等这么久收迟到的回包，之后还没回来的算丢
+#define LOAD_DRAIN_MS 200
+
+/*
+ * 压测模式：每个线程一个 connect 过的 UDP socket，按 --rate 均匀（或按 --inflight 保持在途数）
+ * 用 sendmmsg 成批发探测包，包里带发送时刻，回包到了就把往返时延记进直方图。
+ * 直方图按 2 的幂分段、每段再分 HIST_SUB 格，相对误差不超过 1/HIST_SUB，最后合并各线程算分位数。
+ */
+#define HIST_SUB_BITS 4
+#define HIST_SUB (1u << HIST_SUB_BITS)
+#define HIST_BUCKETS (64 * HIST_SUB)
+
+typedef struct
+{
+    uint64_t n[HIST_BUCKETS];
+    uint64_t count;
+    uint64_t max;
+}hist_t;
+
+typedef struct
+{
+    struct sockaddr_in server;
+    int      threads;
+    uint64_t rate;          // 合计包/秒，0 表示不限速、只按 inflight 控制
+    uint32_t inflight;      // 每线程最多在途的包数
+    uint32_t duration_s;
+    uint32_t size;
+    uint32_t batch;
+}load_opts_t;
+
+typedef struct
+{
+    const load_opts_t *o;
+    uint32_t id;
+    uint64_t sent;
+    uint64_t recvd;
+    uint64_t bad;           // 不是本线程发的、或长度不对的回包
+    uint64_t given_up;      // inflight 模式下等了 LOAD_DRAIN_MS 还没回的，当丢了不再占在途名额
+    hist_t   h;
+}load_worker_t;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static uint32_t hist_index(uint64_t v)
+{
+    if (v < HIST_SUB) return (uint32_t)v;
+    uint32_t msb = 63u - (uint32_t)__builtin_clzll(v);
+    uint32_t sub = (uint32_t)(v >> (msb - HIST_SUB_BITS)) & (HIST_SUB - 1);
+    return (msb - HIST_SUB_BITS + 1) * HIST_SUB + sub;
+}
+
+/* 格子的下界，报分位数时用 */
+static uint64_t hist_value(uint32_t idx)
+{
+    if (idx < HIST_SUB) return idx;
+    uint32_t msb = idx / HIST_SUB + HIST_SUB_BITS - 1;
+    uint64_t sub = idx % HIST_SUB;
+    return (1ull << msb) | (sub << (msb - HIST_SUB_BITS));
+}
+
+static void hist_add(hist_t *h, uint64_t v)
+{
+    h->n[hist_index(v)]++;
+    h->count++;
+    if (v > h->max) h->max = v;
+}
+
+static uint64_t hist_quantile(const hist_t *h, double q)
+{
+    if (h->count == 0) return 0;
+    uint64_t want = (uint64_t)((double)h->count * q);
+    if (want >= h->count) want = h->count - 1;
+    uint64_t seen = 0;
+    for (uint32_t i = 0; i < HIST_BUCKETS; ++i) {
+        seen += h->n[i];
+        if (seen > want) return hist_value(i);
+    }
+    return h->max;
+}
+
+static void put_u32(uint8_t *p, uint32_t v) { memcpy(p, &v, 4); }
+static void put_u64(uint8_t *p, uint64_t v) { memcpy(p, &v, 8); }
+static uint32_t get_u32(const uint8_t *p) { uint32_t v; memcpy(&v, p, 4); return v; }
+static uint64_t get_u64(const uint8_t *p) { uint64_t v; memcpy(&v, p, 8); return v; }
+
+/* 非阻塞收一批回包，返回收到的个数 */
+static int load_recv(load_worker_t *w, int fd, struct mmsghdr *rm, struct iovec *riov, uint8_t *rbufs)
+{
+    const load_opts_t *o = w->o;
+    for (uint32_t i = 0; i < o->batch; ++i) {
+        riov[i].iov_base = rbufs + (size_t)i * o->size;
+        riov[i].iov_len = o->size;
+        memset(&rm[i].msg_hdr, 0, sizeof(rm[i].msg_hdr));
+        rm[i].msg_hdr.msg_iov = &riov[i];
+        rm[i].msg_hdr.msg_iovlen = 1;
+    }
+    int n = recvmmsg(fd, rm, o->batch, MSG_DONTWAIT, NULL);
+    if (n <= 0) return 0;
+    uint64_t now = now_ns();
+    for (int i = 0; i < n; ++i) {
+        const uint8_t *p = riov[i].iov_base;
+        if (rm[i].msg_len != o->size || get_u32(p) != LOAD_MAGIC || get_u32(p + 4) != w->id) {
+            w->bad++;
+            continue;
+        }
+        uint64_t ts = get_u64(p + 16);
+        hist_add(&w->h, now > ts ? now - ts : 0);
+        w->recvd++;
+    }
+    return n;
+}
+
+static void *load_worker(void *arg)
+{
+    load_worker_t *w = arg;
+    const load_opts_t *o = w->o;
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0) { perror("socket"); return NULL; }
+    int sz = 4 * 1024 * 1024;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &sz, sizeof(sz));
+    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sz, sizeof(sz));
+    if (connect(fd, (const struct sockaddr *)&o->server, sizeof(o->server)) < 0) {
+        perror("connect");
+        close(fd);
+        return NULL;
+    }
+
+    uint8_t *sbufs = calloc(o->batch, o->size);
+    uint8_t *rbufs = calloc(o->batch, o->size);
+    struct mmsghdr *sm = calloc(o->batch, sizeof(*sm));
+    struct mmsghdr *rm = calloc(o->batch, sizeof(*rm));
+    struct iovec *siov = calloc(o->batch, sizeof(*siov));
+    struct iovec *riov = calloc(o->batch, sizeof(*riov));
+    if (!sbufs || !rbufs || !sm || !rm || !siov || !riov) { perror("calloc"); goto out; }
+
+    // 每个线程分到的速率，单位 包/秒
+    double rate = o->rate ? (double)o->rate / o->threads : 0.0;
+    uint64_t start = now_ns();
+    uint64_t end = start + (uint64_t)o->duration_s * 1000000000ull;
+    uint64_t last_rx = start;
+    for (;;) {
+        uint64_t now = now_ns();
+        if (now >= end) break;
+
+        uint64_t allow;
+        if (rate > 0) {
+            uint64_t due = (uint64_t)((double)(now - start) * rate / 1e9);
+            allow = due > w->sent ? due - w->sent : 0;
+        } else {
+            int64_t out = (int64_t)(w->sent - w->recvd - w->bad - w->given_up);
+            if (out >= (int64_t)o->inflight && now - last_rx > LOAD_DRAIN_MS * 1000000ull) {
+                w->given_up += (uint64_t)out;
+                out = 0;
+            }
+            allow = out < (int64_t)o->inflight ? (uint64_t)((int64_t)o->inflight - out) : 0;
+        }
+        if (allow > o->batch) allow = o->batch;
+
+        if (allow) {
+            for (uint32_t i = 0; i < allow; ++i) {
+                uint8_t *p = sbufs + (size_t)i * o->size;
+                put_u32(p, LOAD_MAGIC);
+                put_u32(p + 4, w->id);
+                put_u64(p + 8, w->sent + i);
+                put_u64(p + 16, now_ns());
+                siov[i].iov_base = p;
+                siov[i].iov_len = o->size;
+                memset(&sm[i].msg_hdr, 0, sizeof(sm[i].msg_hdr));
+                sm[i].msg_hdr.msg_iov = &siov[i];
+                sm[i].msg_hdr.msg_iovlen = 1;
+            }
+            int m = sendmmsg(fd, sm, (unsigned)allow, MSG_DONTWAIT);
+            // 发送缓冲满或收到 ICMP 不可达时这一轮少发，接着收
+            if (m > 0) w->sent += (uint64_t)m;
+        }
+
+        if (load_recv(w, fd, rm, riov, rbufs) > 0) {
+            last_rx = now_ns();
+        } else if (!allow) {
+            // 没有要发的也没有回包：等回包，最多 1ms 再看要不要发
+            struct pollfd pfd = { .fd = fd, .events = POLLIN };
+            poll(&pfd, 1, 1);
+        }
+    }
+
+    uint64_t drain_end = now_ns() + LOAD_DRAIN_MS * 1000000ull;
+    while (w->recvd + w->bad < w->sent && now_ns() < drain_end) {
+        if (load_recv(w, fd, rm, riov, rbufs) == 0) {
+            struct pollfd pfd = { .fd = fd, .events = POLLIN };
+            poll(&pfd, 1, 10);
+        }
+    }
+
+out:
+    free(sbufs); free(rbufs); free(sm); free(rm); free(siov); free(riov);
+    close(fd);
+    return NULL;
+}
+
+static int run_load(const load_opts_t *o)
+{
+    load_worker_t *ws = calloc((size_t)o->threads, sizeof(*ws));
+    pthread_t *th = calloc((size_t)o->threads, sizeof(*th));
+    if (!ws || !th) { perror("calloc"); return 1; }
+    for (int i = 0; i < o->threads; ++i) {
+        ws[i].o = o;
+        ws[i].id = (uint32_t)i;
+        if (pthread_create(&th[i], NULL, load_worker, &ws[i]) != 0) {
+            perror("pthread_create");
+            return 1;
+        }
+    }
+
+    hist_t *h = calloc(1, sizeof(*h));
+    if (!h) { perror("calloc"); return 1; }
+    uint64_t sent = 0, recvd = 0, bad = 0;
+    for (int i = 0; i < o->threads; ++i) {
+        pthread_join(th[i], NULL);
+        sent += ws[i].sent;
+        recvd += ws[i].recvd;
+        bad += ws[i].bad;
+        for (uint32_t k = 0; k < HIST_BUCKETS; ++k) h->n[k] += ws[i].h.n[k];
+        h->count += ws[i].h.count;
+        if (ws[i].h.max > h->max) h->max = ws[i].h.max;
+    }
+
+    double secs = o->duration_s ? (double)o->duration_s : 1.0;
+    printf("sent %llu, received %llu (%.3f%% lost), %llu bad, %.0f pkt/s sent, %.0f pkt/s echoed\n",
+           (unsigned long long)sent, (unsigned long long)recvd,
+           sent ? 100.0 * (double)(sent - recvd) / (double)sent : 0.0, (unsigned long long)bad,
+           (double)sent / secs, (double)recvd / secs);
+    printf("rtt us: p50=%.1f p90=%.1f p99=%.1f p99.9=%.1f max=%.1f\n",
+           hist_quantile(h, 0.50) / 1e3, hist_quantile(h, 0.90) / 1e3, hist_quantile(h, 0.99) / 1e3,
+           hist_quantile(h, 0.999) / 1e3, h->max / 1e3);
+    free(h);
+    free(ws);
+    free(th);
+    return recvd ? 0 : 1;
+}
+
+static int parse_load_opts(int argc, char const *argv[], load_opts_t *o)
+{
+    o->threads = 1;
+    o->inflight = 64;
+    o->duration_s = 5;
+    o->size = 64;
+    o->batch = 32;
+    for (int i = 4; i < argc; ++i) {
+        const char *v = (i + 1 < argc) ? argv[i + 1] : NULL;
+        if (!v) return -1;
+        long n = atol(v);
+        if (strcmp(argv[i], "--threads") == 0 && n >= 1 && n <= LOAD_MAX_THREADS) o->threads = (int)n;
+        else if (strcmp(argv[i], "--rate") == 0 && n >= 0) o->rate = (uint64_t)n;
+        else if (strcmp(argv[i], "--inflight") == 0 && n >= 1) o->inflight = (uint32_t)n;
+        else if (strcmp(argv[i], "--duration") == 0 && n >= 1) o->duration_s = (uint32_t)n;
+        else if (strcmp(argv[i], "--size") == 0 && n >= LOAD_MIN_SIZE && n <= LOAD_MAX_SIZE) o->size = (uint32_t)n;
+        else if (strcmp(argv[i], "--batch") == 0 && n >= 1 && n <= LOAD_MAX_BATCH) o->batch = (uint32_t)n;
+        else return -1;
+        ++i;
+    }
+    return 0;
+}
 
 int main(int argc, char const *argv[])
 {
-    if (argc < 3) {
-        fprintf(stderr, "用法: %s <SERVER_IP> <PORT>\n", argv[0]);
+    if (argc < 3 || (argc >= 4 && strcmp(argv[3], "--load") != 0)) {
+        fprintf(stderr, "用法: %s <SERVER_IP> <PORT>\n"
+                        "      %s <SERVER_IP> <PORT> --load [--threads N] [--rate PPS] [--inflight N]"
+                        " [--duration S] [--size BYTES] [--batch N]\n", argv[0], argv[0]);
         return 1;
     }
+    if (argc >= 4) {
+        load_opts_t lo;
+        memset(&lo, 0, sizeof(lo));
+        lo.server.sin_family = AF_INET;
+        lo.server.sin_port = htons((uint16_t)atoi(argv[2]));
+        if (inet_pton(AF_INET, argv[1], &lo.server.sin_addr) != 1) {
+            perror("inet_pton");
+            return 1;
+        }
+        if (parse_load_opts(argc, argv, &lo) < 0) {
+            fprintf(stderr, "bad --load options\n");
+            return 1;
+        }
+        return run_load(&lo);
+    }
     int socket_fd = socket(AF_INET,SOCK_DGRAM,0);
     if(socket_fd < 0)
     {
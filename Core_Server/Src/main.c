@@ -1,10 +1,270 @@
+#define _GNU_SOURCE
 #include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <sys/socket.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <unistd.h>
 
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+
+#define ECHO_PORT 9000
+#define ECHO_MAX_THREADS 64
+#define ECHO_MAX_BATCH 1024
+#define ECHO_DEFAULT_BATCH 64
+// 单个数据报的缓冲；开了 GRO 时内核会把同一条流的多个数据报拼成一个最大 64 KiB 的大包交上来
+#define ECHO_BUF 2048
+#define ECHO_GRO_BUF 65536
+
+/*
+ * 批量模式：N 个线程各开一个 socket，用 SO_REUSEPORT 绑同一个端口，内核按四元组把
+ * 数据报分给各个 socket。每个线程一次 recvmmsg 收一批，原样 sendmmsg 发回各自的来源，
+ * 一批只用两次系统调用。开 --gro 时一次收到的可能是多个同样大小的数据报拼成的大包，
+ * 发回时带 UDP_SEGMENT 让内核（或网卡）再切开，每个数据报仍然原样回给对方。
+ */
+typedef struct
+{
+    int port;
+    int threads;
+    int batch;
+    int gro;
+}echo_opts_t;
+
+typedef struct
+{
+    const echo_opts_t *o;
+    int id;
+    _Atomic uint64_t pkts;      // 回出去的数据报数（GRO 大包按切开后的个数算）
+    _Atomic uint64_t bytes;
+}echo_worker_t;
+
+static int echo_socket(const echo_opts_t *o)
+{
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0) { perror("socket"); return -1; }
+    int one = 1;
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0) perror("SO_REUSEPORT");
+    int sz = 4 * 1024 * 1024;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &sz, sizeof(sz));
+    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sz, sizeof(sz));
+    if (o->gro && setsockopt(fd, IPPROTO_UDP, UDP_GRO, &one, sizeof(one)) < 0) {
+        perror("UDP_GRO");      // 老内核不支持，退回逐个收
+    }
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons((uint16_t)o->port);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("bind");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* GRO 拼过的包在控制消息里带着原来每个数据报的长度，没有则返回 0 */
+static int gro_segment_size(struct msghdr *mh)
+{
+    for (struct cmsghdr *c = CMSG_FIRSTHDR(mh); c; c = CMSG_NXTHDR(mh, c)) {
+        if (c->cmsg_level == IPPROTO_UDP && c->cmsg_type == UDP_GRO) {
+            int seg;
+            memcpy(&seg, CMSG_DATA(c), sizeof(seg));
+            return seg;
+        }
+    }
+    return 0;
+}
+
+static void *echo_worker(void *arg)
+{
+    echo_worker_t *w = arg;
+    const echo_opts_t *o = w->o;
+    int fd = echo_socket(o);
+    if (fd < 0) return NULL;
+
+    size_t bufsz = o->gro ? ECHO_GRO_BUF : ECHO_BUF;
+    size_t ctlsz = CMSG_SPACE(sizeof(int));
+    uint8_t *bufs = malloc((size_t)o->batch * bufsz);
+    uint8_t *ctl = calloc((size_t)o->batch, ctlsz);
+    uint8_t *sctl = calloc((size_t)o->batch, ctlsz);
+    struct mmsghdr *rm = calloc((size_t)o->batch, sizeof(*rm));
+    struct mmsghdr *sm = calloc((size_t)o->batch, sizeof(*sm));
+    struct iovec *iov = calloc((size_t)o->batch, sizeof(*iov));
+    struct iovec *siov = calloc((size_t)o->batch, sizeof(*siov));
+    struct sockaddr_in *from = calloc((size_t)o->batch, sizeof(*from));
+    if (!bufs || !ctl || !sctl || !rm || !sm || !iov || !siov || !from) {
+        perror("calloc");
+        goto out;
+    }
+
+    for (;;) {
+        for (int i = 0; i < o->batch; ++i) {
+            iov[i].iov_base = bufs + (size_t)i * bufsz;
+            iov[i].iov_len = bufsz;
+            memset(&rm[i].msg_hdr, 0, sizeof(rm[i].msg_hdr));
+            rm[i].msg_hdr.msg_name = &from[i];
+            rm[i].msg_hdr.msg_namelen = sizeof(from[i]);
+            rm[i].msg_hdr.msg_iov = &iov[i];
+            rm[i].msg_hdr.msg_iovlen = 1;
+            if (o->gro) {
+                rm[i].msg_hdr.msg_control = ctl + (size_t)i * ctlsz;
+                rm[i].msg_hdr.msg_controllen = ctlsz;
+            }
+        }
+        // 至少等到一个，之后有多少拿多少（最多 batch 个）
+        int n = recvmmsg(fd, rm, (unsigned)o->batch, MSG_WAITFORONE, NULL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("recvmmsg");
+            break;
+        }
+
+        uint64_t pkts = 0, bytes = 0;
+        for (int i = 0; i < n; ++i) {
+            uint32_t len = rm[i].msg_len;
+            siov[i].iov_base = iov[i].iov_base;
+            siov[i].iov_len = len;
+            memset(&sm[i].msg_hdr, 0, sizeof(sm[i].msg_hdr));
+            sm[i].msg_hdr.msg_name = &from[i];
+            sm[i].msg_hdr.msg_namelen = rm[i].msg_hdr.msg_namelen;
+            sm[i].msg_hdr.msg_iov = &siov[i];
+            sm[i].msg_hdr.msg_iovlen = 1;
+            int seg = o->gro ? gro_segment_size(&rm[i].msg_hdr) : 0;
+            if (seg > 0 && (uint32_t)seg < len) {
+                // GSO：按收到时的段长切回一个个数据报
+                uint8_t *c = sctl + (size_t)i * ctlsz;
+                sm[i].msg_hdr.msg_control = c;
+                sm[i].msg_hdr.msg_controllen = ctlsz;
+                struct cmsghdr *cm = CMSG_FIRSTHDR(&sm[i].msg_hdr);
+                cm->cmsg_level = IPPROTO_UDP;
+                cm->cmsg_type = UDP_SEGMENT;
+                cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+                uint16_t gso = (uint16_t)seg;
+                memcpy(CMSG_DATA(cm), &gso, sizeof(gso));
+                sm[i].msg_hdr.msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+                pkts += (len + (uint32_t)seg - 1) / (uint32_t)seg;
+            } else {
+                pkts++;
+            }
+            bytes += len;
+        }
+
+        // 发送缓冲满时剩下的丢掉：回声探测本来就按丢包统计，不为它阻塞收包
+        int done = 0;
+        while (done < n) {
+            int m = sendmmsg(fd, sm + done, (unsigned)(n - done), 0);
+            if (m < 0) {
+                if (errno == EINTR) continue;
+                if (errno != EAGAIN && errno != ENOBUFS && errno != ECONNREFUSED) perror("sendmmsg");
+                break;
+            }
+            done += m;
+        }
+        atomic_fetch_add_explicit(&w->pkts, pkts, memory_order_relaxed);
+        atomic_fetch_add_explicit(&w->bytes, bytes, memory_order_relaxed);
+    }
+
+out:
+    free(bufs); free(ctl); free(sctl); free(rm); free(sm); free(iov); free(siov); free(from);
+    close(fd);
+    return NULL;
+}
+
+/* 批量模式的主线程只负责每秒打印一次各线程合计的吞吐 */
+static int run_batched(const echo_opts_t *o)
+{
+    echo_worker_t *ws = calloc((size_t)o->threads, sizeof(*ws));
+    if (!ws) { perror("calloc"); return 1; }
+    for (int i = 0; i < o->threads; ++i) {
+        ws[i].o = o;
+        ws[i].id = i;
+        pthread_t th;
+        if (pthread_create(&th, NULL, echo_worker, &ws[i]) != 0) {
+            perror("pthread_create");
+            return 1;
+        }
+        pthread_detach(th);
+    }
+    printf("UDP echo on :%d, %d thread(s) x batch %d%s\n", o->port, o->threads, o->batch,
+           o->gro ? ", GRO/GSO" : "");
+    fflush(stdout);
+
+    uint64_t last_pkts = 0, last_bytes = 0;
+    for (;;) {
+        sleep(1);
+        uint64_t pkts = 0, bytes = 0;
+        for (int i = 0; i < o->threads; ++i) {
+            pkts += atomic_load_explicit(&ws[i].pkts, memory_order_relaxed);
+            bytes += atomic_load_explicit(&ws[i].bytes, memory_order_relaxed);
+        }
+        if (pkts != last_pkts) {
+            printf("%llu pkt/s, %.1f MB/s\n", (unsigned long long)(pkts - last_pkts),
+                   (double)(bytes - last_bytes) / 1e6);
+            fflush(stdout);
+        }
+        last_pkts = pkts;
+        last_bytes = bytes;
+    }
+    return 0;
+}
+
+static int parse_opts(int argc, char const *argv[], echo_opts_t *o)
+{
+    memset(o, 0, sizeof(*o));
+    o->port = ECHO_PORT;
+    o->threads = 1;
+    for (int i = 1; i < argc; ++i) {
+        const char *v = (i + 1 < argc) ? argv[i + 1] : NULL;
+        if (strcmp(argv[i], "--port") == 0 && v) {
+            o->port = atoi(v);
+            ++i;
+        } else if (strcmp(argv[i], "--threads") == 0 && v) {
+            o->threads = atoi(v);
+            if (o->threads < 1 || o->threads > ECHO_MAX_THREADS) return -1;
+            ++i;
+        } else if (strcmp(argv[i], "--batch") == 0 && v) {
+            o->batch = atoi(v);
+            if (o->batch < 1 || o->batch > ECHO_MAX_BATCH) return -1;
+            ++i;
+        } else if (strcmp(argv[i], "--gro") == 0) {
+            o->gro = 1;
+        } else {
+            return -1;
+        }
+    }
+    return 0;
+}
+
 int main(int argc, char const *argv[])
 {
+    echo_opts_t opts;
+    if (parse_opts(argc, argv, &opts) < 0) {
+        fprintf(stderr, "用法: %s [--port PORT] [--threads N] [--batch N] [--gro]\n"
+                        "  不带 --threads/--batch/--gro 时逐个收发并打印每个数据报\n"
+                        "  --threads N : N 个线程以 SO_REUSEPORT 共用端口（最多 %d）\n"
+                        "  --batch N   : 每次 recvmmsg/sendmmsg 最多 N 个数据报（默认 %d）\n"
+                        "  --gro       : 开 UDP_GRO 收、UDP_SEGMENT 回\n",
+                argv[0], ECHO_MAX_THREADS, ECHO_DEFAULT_BATCH);
+        return 1;
+    }
+    if (opts.threads > 1 || opts.batch > 0 || opts.gro) {
+        if (opts.batch == 0) opts.batch = ECHO_DEFAULT_BATCH;
+        return run_batched(&opts);
+    }
+
     /**
      * int socket (int __domain, int __type, int __protocol) __THROW;
      * int __domain:地址族 指定套接字用于哪种协议 AF_INET:ipv4 AF_INET6:ipv6 AF_UNIX:本地通信
@@ -35,7 +295,7 @@ int main(int argc, char const *argv[])
     struct sockaddr_in addr;
     addr.sin_family = AF_INET;
     addr.sin_addr.s_addr = htonl(INADDR_ANY);
-    addr.sin_port = htons(9000); 
+    addr.sin_port = htons((uint16_t)opts.port);
     /**
      * int bind(int sockfd, const struct sockaddr *addr, socklen_t addrlen);
      * int sockfd:套接字描述符
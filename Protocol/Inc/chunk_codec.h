@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * FILE_DATA 的分块压缩。codec 编号同时用作 TLV_COMPRESS 里的位掩码位；
+ * 只有编译时找到 zlib 才支持 CODEC_ZLIB。
+ */
+enum {
+    CODEC_NONE = 0,
+    CODEC_ZLIB = 1,
+};
+
+#define CODEC_MASK(c) (1u << ((c) - 1))
+
+/* 本端支持的 codec 位掩码 */
+uint32_t codec_supported(void);
+
+/* 从对端提供的掩码里挑一个本端也支持的 codec，没有返回 CODEC_NONE */
+int codec_pick(uint32_t offered);
+
+/* 压缩输出缓冲至少要这么大 */
+uint32_t codec_bound(int codec, uint32_t n);
+
+/* 压缩 src；压不小（结果 >= n）返回 0，出错返回 -1，否则返回压缩后长度 */
+int codec_compress(int codec, const uint8_t *src, uint32_t n, uint8_t *dst, uint32_t cap);
+
+/* 解压到 dst，结果必须正好 raw_len 字节；成功返回 0 */
+int codec_decompress(int codec, const uint8_t *src, uint32_t n, uint8_t *dst, uint32_t raw_len);
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * CRC32C（Castagnoli）。x86-64 上 CPU 支持 SSE4.2 时用 crc32 指令，
+ * 否则退回 slicing-by-8 查表。crc 参数传上一次的结果，从 0 开始。
+ */
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len);
+
+/* 已知 A 段的 crc1 和紧随其后的 B 段（长 len2）的 crc2，求 A+B 的 crc，不需要数据 */
+uint32_t crc32c_combine(uint32_t crc1, uint32_t crc2, uint64_t len2);
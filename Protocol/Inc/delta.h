@@ -0,0 +1,77 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * 增量同步用的块签名。服务器把已有文件按 block 切块，每块算一个 rsync 式的
+ * 滚动弱校验和一个 CRC32C 作强校验；客户端在新文件上逐字节滚动弱校验，
+ * 弱校验命中再比 CRC32C，命中的块用 FILE_COPY 让服务器从旧文件里复制。
+ * 强校验只有 32 位，碰撞由 FILE_COPY 自带的块 CRC 和 FILE_END 的整文件 CRC 兜底。
+ */
+
+#ifndef DELTA_MIN_BLOCK
+#define DELTA_MIN_BLOCK (2 * 1024)
+#endif
+#ifndef DELTA_MAX_AUTO_BLOCK
+#define DELTA_MAX_AUTO_BLOCK (64 * 1024)
+#endif
+// 一次签名应答最多多少块，文件再大就加大块长
+#ifndef DELTA_MAX_BLOCKS
+#define DELTA_MAX_BLOCKS (1u << 20)
+#endif
+
+#define DELTA_SIG_LEN 8     // 弱校验 u32 + 强校验 u32，网络字节序
+
+typedef struct {
+    uint32_t weak;
+    uint32_t strong;
+} delta_sig_t;
+
+/* 滚动弱校验的状态：a 是字节和，b 是加权和，都取低 16 位 */
+typedef struct {
+    uint32_t a, b;
+    uint32_t len;
+} delta_roll_t;
+
+static inline void delta_roll_init(delta_roll_t *r, const uint8_t *p, uint32_t n)
+{
+    uint32_t a = 0, b = 0;
+    for (uint32_t i = 0; i < n; ++i) {
+        a += p[i];
+        b += (n - i) * (uint32_t)p[i];
+    }
+    r->a = a & 0xffff;
+    r->b = b & 0xffff;
+    r->len = n;
+}
+
+/* 窗口右移一个字节：out 移出，in 移入 */
+static inline void delta_roll(delta_roll_t *r, uint8_t out, uint8_t in)
+{
+    r->a = (r->a - out + in) & 0xffff;
+    r->b = (r->b - r->len * (uint32_t)out + r->a) & 0xffff;
+}
+
+static inline uint32_t delta_roll_digest(const delta_roll_t *r)
+{
+    return r->a | (r->b << 16);
+}
+
+/* 按旧文件大小和客户端请求的块长（0 表示自动）定块长 */
+uint32_t delta_pick_block(uint64_t old_size, uint32_t requested);
+
+/* 读 fd 的 [0, size) 算每个整块的签名，尾部不满一块的不算；*sigs 由调用者 free */
+int delta_signatures(int fd, uint64_t size, uint32_t block, delta_sig_t **sigs, uint32_t *n);
+
+/* SIGNATURES 的 payload：BLOCK_SIZE + FILESIZE（旧文件大小）+ SIGS */
+uint32_t delta_sigs_payload_len(uint32_t n);
+
+int build_payload_signatures(uint32_t block, uint64_t old_size, const delta_sig_t *sigs, uint32_t n,
+                             uint8_t *out, uint32_t cap, uint32_t *out_len);
+
+/* *raw 指向 payload 里的签名数组，用 delta_sig_at 取第 i 个 */
+int parse_payload_signatures(const uint8_t *p, uint32_t L, uint32_t *block, uint64_t *old_size,
+                             const uint8_t **raw, uint32_t *n);
+
+delta_sig_t delta_sig_at(const uint8_t *raw, uint32_t i);
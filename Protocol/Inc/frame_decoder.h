@@ -0,0 +1,38 @@
+#pragma once
+#include <stdint.h>
+#include <sys/types.h>
+#include "tcp_protocol.h"
+
+/*
+ * 流式拆帧：每次 recv 尽量多读，之后从缓冲里逐个取出完整的 protocol_msg。
+ * 取出的 msg.payload 直接指向内部缓冲（不拷贝），在下一次 recv/feed 之前有效；
+ * 跨两次 recv 的半帧留在缓冲里，下次读入前挪到缓冲开头继续拼。
+ * 单帧超过当前容量时缓冲会扩到刚好放下（不超过 max_payload）。
+ */
+
+typedef struct
+{
+    uint8_t  *buf;
+    uint32_t  cap;
+    uint32_t  rd;           // 下一帧的起点
+    uint32_t  wr;           // 已收数据的末尾
+    uint32_t  max_payload;
+}frame_decoder_t;
+
+int  frame_decoder_init(frame_decoder_t *d, uint32_t cap, uint32_t max_payload);
+
+void frame_decoder_destroy(frame_decoder_t *d);
+
+/* 一次 recv：返回读到的字节数，0 表示对端关闭，-1 表示出错（含 EAGAIN，见 errno） */
+ssize_t frame_decoder_recv(frame_decoder_t *d, int fd);
+
+/* 把已经收到的字节拷进来（例如 io_uring 的 provided buffer），成功返回 0 */
+int frame_decoder_feed(frame_decoder_t *d, const void *p, uint32_t n);
+
+/* 返回 1 表示取到一帧，0 表示数据不够，-1 表示帧超过 max_payload（errno=EMSGSIZE） */
+int frame_decoder_next(frame_decoder_t *d, protocol_msg *msg);
+
+static inline uint32_t frame_decoder_pending(const frame_decoder_t *d)
+{
+    return d->wr - d->rd;
+}
\ No newline at end of file
@@ -0,0 +1,142 @@
+#pragma once
+#include <stdint.h>
+#include <stdatomic.h>
+
+/*
+ * 分级的异步日志。热路径上只把格式串指针和参数原样拷进本线程的环形缓冲（单生产者单消费者，
+ * 无锁），后台线程按时间戳归并各线程的记录，格式化后批量 write 到 stderr。
+ * 级别不够时 LOG_xxx 只有一次 relaxed 读和一次比较，参数不求值。
+ *
+ * 限制：格式串必须是字面量（记录里只存指针）；最多 LOG_MAX_ARGS 个参数；%s 的内容在记录时
+ * 拷贝，合计最多 LOG_REC_STR 字节，超出截断；其他指针参数要先转成 void *；不支持 %n 和 *。
+ * 缓冲满了直接丢弃并计数，不阻塞；每个线程每级每秒最多 log_set_rate 条，超出的也丢弃计数，
+ * 后台线程每秒汇报一次丢了多少。log_init 之前（或没调用过）同步格式化写 stderr。
+ */
+
+enum {
+    LOG_LVL_DEBUG = 0,
+    LOG_LVL_INFO,
+    LOG_LVL_WARN,
+    LOG_LVL_ERROR,
+    LOG_LEVELS,
+};
+
+#define LOG_MAX_ARGS 16
+
+// 每个线程的环形缓冲有多少条记录，必须是 2 的幂
+#ifndef LOG_RING_SLOTS
+#define LOG_RING_SLOTS 256
+#endif
+
+// 一条记录里 %s 参数的内容最多拷多少字节
+#ifndef LOG_REC_STR
+#define LOG_REC_STR 192
+#endif
+
+// 后台线程没东西可写时睡多久
+#ifndef LOG_DRAIN_US
+#define LOG_DRAIN_US 1000
+#endif
+
+// 默认每个线程每级每秒最多多少条，0 为不限
+#ifndef LOG_RATE_DEFAULT
+#define LOG_RATE_DEFAULT 10000
+#endif
+
+enum {
+    LOG_ARG_INT = 0,
+    LOG_ARG_DBL,
+    LOG_ARG_PTR,
+    LOG_ARG_STR,
+};
+
+typedef struct
+{
+    int type;
+    union {
+        uint64_t    u;
+        double      d;
+        const void *p;
+        const char *s;
+    } v;
+}log_arg_t;
+
+extern _Atomic int g_log_level;
+
+static inline int log_enabled(int level)
+{
+    return level >= atomic_load_explicit(&g_log_level, memory_order_relaxed);
+}
+
+static inline log_arg_t log_arg_int(unsigned long long x) { log_arg_t a = { LOG_ARG_INT, { .u = x } }; return a; }
+static inline log_arg_t log_arg_dbl(double x)             { log_arg_t a = { LOG_ARG_DBL, { .d = x } }; return a; }
+static inline log_arg_t log_arg_ptr(const void *x)        { log_arg_t a = { LOG_ARG_PTR, { .p = x } }; return a; }
+static inline log_arg_t log_arg_str(const char *x)        { log_arg_t a = { LOG_ARG_STR, { .s = x } }; return a; }
+
+#define LOG_ARG(x) _Generic((x),                                    \
+    char *: log_arg_str, const char *: log_arg_str,                 \
+    float: log_arg_dbl, double: log_arg_dbl,                        \
+    void *: log_arg_ptr, const void *: log_arg_ptr,                 \
+    default: log_arg_int)(x)
+
+// 参数个数和逐个包装；没有参数时 ## 吞掉逗号
+#define LOG_NARG_(_0, _1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _13, _14, _15, _16, N, ...) N
+#define LOG_NARG(...) LOG_NARG_(0, ##__VA_ARGS__, 16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define LOG_A0()
+#define LOG_A1(a)       LOG_ARG(a)
+#define LOG_A2(a, ...)  LOG_ARG(a), LOG_A1(__VA_ARGS__)
+#define LOG_A3(a, ...)  LOG_ARG(a), LOG_A2(__VA_ARGS__)
+#define LOG_A4(a, ...)  LOG_ARG(a), LOG_A3(__VA_ARGS__)
+#define LOG_A5(a, ...)  LOG_ARG(a), LOG_A4(__VA_ARGS__)
+#define LOG_A6(a, ...)  LOG_ARG(a), LOG_A5(__VA_ARGS__)
+#define LOG_A7(a, ...)  LOG_ARG(a), LOG_A6(__VA_ARGS__)
+#define LOG_A8(a, ...)  LOG_ARG(a), LOG_A7(__VA_ARGS__)
+#define LOG_A9(a, ...)  LOG_ARG(a), LOG_A8(__VA_ARGS__)
+#define LOG_A10(a, ...) LOG_ARG(a), LOG_A9(__VA_ARGS__)
+#define LOG_A11(a, ...) LOG_ARG(a), LOG_A10(__VA_ARGS__)
+#define LOG_A12(a, ...) LOG_ARG(a), LOG_A11(__VA_ARGS__)
+#define LOG_A13(a, ...) LOG_ARG(a), LOG_A12(__VA_ARGS__)
+#define LOG_A14(a, ...) LOG_ARG(a), LOG_A13(__VA_ARGS__)
+#define LOG_A15(a, ...) LOG_ARG(a), LOG_A14(__VA_ARGS__)
+#define LOG_A16(a, ...) LOG_ARG(a), LOG_A15(__VA_ARGS__)
+// 只给编译器检查格式串和参数是否匹配，从不调用
+static inline __attribute__((format(printf, 1, 2))) void log_check_fmt(const char *fmt, ...) { (void)fmt; }
+
+#define LOG_CAT_(a, b) a##b
+#define LOG_CAT(a, b) LOG_CAT_(a, b)
+
+#define LOG_AT(level, fmt, ...) do {                                                        \
+    if (0) log_check_fmt(fmt, ##__VA_ARGS__);                                               \
+    if (log_enabled(level)) {                                                               \
+        const log_arg_t log_args_[] = { { 0, { 0 } },                                       \
+            LOG_CAT(LOG_A, LOG_NARG(__VA_ARGS__))(__VA_ARGS__) };                           \
+        log_emit((level), "" fmt "", log_args_ + 1, LOG_NARG(__VA_ARGS__));                 \
+    }                                                                                       \
+} while (0)
+
+#define LOG_D(fmt, ...) LOG_AT(LOG_LVL_DEBUG, fmt, ##__VA_ARGS__)
+#define LOG_I(fmt, ...) LOG_AT(LOG_LVL_INFO,  fmt, ##__VA_ARGS__)
+#define LOG_W(fmt, ...) LOG_AT(LOG_LVL_WARN,  fmt, ##__VA_ARGS__)
+#define LOG_E(fmt, ...) LOG_AT(LOG_LVL_ERROR, fmt, ##__VA_ARGS__)
+
+// 代替 perror：errno 在记录时就转成字符串
+#define LOG_ERRNO(what) LOG_E("%s: %s\n", what, log_strerror(errno))
+
+/* 启动后台线程，之后的日志都走环形缓冲；进程退出时（atexit）写完剩下的。失败返回 -1 */
+int log_init(void);
+
+/* 停掉后台线程并写完所有缓冲里的记录，之后退回同步写 */
+void log_shutdown(void);
+
+/* 按名字（debug/info/warn/error）设置最低级别，名字不对返回 -1 */
+int log_set_level_name(const char *name);
+
+void log_set_level(int level);
+
+/* 每个线程 level 级别每秒最多记多少条，0 为不限 */
+void log_set_rate(int level, uint32_t per_sec);
+
+/* 线程安全的 strerror */
+const char *log_strerror(int err);
+
+void log_emit(int level, const char *fmt, const log_arg_t *args, int nargs);
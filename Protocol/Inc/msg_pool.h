@@ -0,0 +1,36 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * 可回收的消息缓冲池（非线程安全，按连接或按 worker 各持一个）。
+ * 不超过 buf_size 的请求都返回一块 buf_size 大小的缓冲，用完放回空闲链表，
+ * 稳定状态下收发不再走 malloc/free；超过 buf_size 的请求单独分配、用完直接释放。
+ * 使用方把同时借出的块数控制在 max_free 以内时，池子最多长到 max_free 块就不再 malloc；
+ * n_over 记的是池子已经持有 max_free 块还得 malloc 的次数（含超过 buf_size 的请求），即稳定状态的分配。
+ */
+
+typedef struct msg_buf msg_buf;
+
+typedef struct msg_pool
+{
+    msg_buf  *free_list;
+    uint32_t  buf_size;
+    uint32_t  max_free;    // 空闲链表最多保留多少块
+    uint32_t  n_free;
+    uint64_t  n_get;       // 统计：取缓冲次数
+    uint64_t  n_alloc;     // 统计：真正调用 malloc 的次数
+    uint64_t  n_over;      // 统计：其中超出池子容量的次数
+    uint32_t  n_out;       // 借出未还的块数
+    uint32_t  n_owned;     // 池子持有的 buf_size 块（借出的加空闲的）
+}msg_pool_t;
+
+void msg_pool_init(msg_pool_t *pool, uint32_t buf_size, uint32_t max_free);
+
+void msg_pool_destroy(msg_pool_t *pool);
+
+/* 取一块至少 size 字节的缓冲，失败返回 NULL */
+void *msg_pool_get(msg_pool_t *pool, uint32_t size);
+
+/* 归还 msg_pool_get 得到的缓冲，buf 可以为 NULL */
+void msg_pool_put(msg_pool_t *pool, void *buf);
\ No newline at end of file
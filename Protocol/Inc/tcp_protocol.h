@@ -1,6 +1,9 @@
 #pragma once
 
 #include <stdint.h>
+#include <sys/uio.h>
+
+struct msg_pool;
 
 typedef struct protocol_header {
     uint8_t  version_major;
@@ -16,18 +19,52 @@ typedef struct protocol_msg
     void *payload;
 }protocol_msg;
 
+/* payload 由若干段拼成，发送时不需要先拷成连续内存 */
+typedef struct protocol_msgv
+{
+    protocol_header hdr;          // payload_length 由 send_messagev 按 iov 总长填写
+    const struct iovec *iov;
+    int iovcnt;
+}protocol_msgv;
+
 enum 
 {
     MSG_ECHO = 1,
     MSG_FILE_START = 2,
     MSG_FILE_DATA = 3,
     MSG_FILE_END = 4, 
+    MSG_FILE_ACCEPT = 5,      // 服务器对带 TLV_COMPRESS 的 FILE_START 的应答
+    MSG_FILE_QUERY = 6,       // 客户端询问某次续传服务器已落盘的范围
+    MSG_FILE_RANGES = 7,      // 对 FILE_QUERY 的应答，每个 TLV_RANGE 是一段已落盘的数据
+    MSG_SIG_REQUEST = 8,      // 增量同步：客户端请求服务器已有文件的块签名
+    MSG_SIGNATURES = 9,       // 对 SIG_REQUEST 的应答
+    MSG_FILE_COPY = 10,       // 增量同步：这一段从旧文件的 SRC_OFFSET 处复制，和 FILE_DATA 共用 seq
+    MSG_FILE_CREDIT = 11,     // 服务器 -> 客户端：ACK_SEQ 之前都已收妥，还能再收 CREDIT 个 seq
+    MSG_STATS = 12,           // 请求服务器的运行指标；应答同类型，每个 TLV_STAT 是一项
 };
 
+#define PROTOCOL_HEADER_LEN (sizeof(protocol_header))
+
+/* 网络字节序 <-> 主机字节序，供非阻塞收发路径自己拼帧时使用 */
+void protocol_header_to_wire(const protocol_header *host,protocol_header *wire);
+
+void protocol_header_to_host(const protocol_header *wire,protocol_header *host);
+
+/* 头和 payload 一次 sendmsg 发出；payload 归调用者，发完即可复用 */
 int send_message(int fd,protocol_msg *msg);
 
+/* 把 n 条消息的头和各段 payload 合进尽量少的 sendmsg；返回 0 表示全部发完 */
+int send_messagev(int fd,protocol_msgv *msgs,int n);
+
+/* payload 每次 malloc，用完由调用者 free */
 int read_message(int fd,protocol_msg *msg);
 
+/* payload 收进调用者提供的 buf；payload 超过 cap 返回 -3（errno=EMSGSIZE），此时连接已不可用 */
+int read_message_into(int fd,protocol_msg *msg,void *buf,uint32_t cap);
+
+/* payload 从 pool 取缓冲（msg_pool.h），用完由调用者 msg_pool_put 归还 */
+int read_message_pooled(int fd,protocol_msg *msg,struct msg_pool *pool);
+
 uint32_t u8_to_u32_be(const uint8_t buf[4]);
 
 void u32_to_u8_be(uint32_t value, uint8_t buf[4]);
\ No newline at end of file
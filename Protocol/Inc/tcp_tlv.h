@@ -1,6 +1,7 @@
 #pragma once
 #include <stdint.h>
 #include <stddef.h>
+#include <sys/uio.h>
 
 #define TLV_TYPE_LEN (1)
 #define TLV_LEN_LEN  (4)
@@ -14,9 +15,46 @@ enum {
     TLV_FILESIZE = 0x02,  
     TLV_OFFSET   = 0x03, 
     TLV_DATA     = 0x04,  
-    TLV_CRC32    = 0x05,  
+    TLV_CRC32    = 0x05,  // FILE_DATA：本块数据的 CRC32C；FILE_END：本连接发送的整段数据的 CRC32C
+    TLV_WINDOW   = 0x06,  // FILE_START 可选：请求的重排窗口大小（u32）
+    TLV_XFER_ID  = 0x07,  // FILE_START 可选：多连接分段上传共用的传输 id（u64）
+    TLV_STREAMS  = 0x08,  // FILE_START 可选：该传输的连接总数（u32）
+    TLV_COMPRESS = 0x09,  // FILE_START：客户端可用的 codec 位掩码；FILE_ACCEPT：服务器选中的 codec（u32）
+    TLV_ZDATA    = 0x0A,  // FILE_DATA：按协商 codec 压缩后的数据，代替 TLV_DATA
+    TLV_RAW_LEN  = 0x0B,  // FILE_DATA：TLV_ZDATA 解压后的长度（u32）
+    TLV_RESUME_ID = 0x0C, // FILE_QUERY / FILE_START 可选：续传 id，同名同大小同 id 才沿用已收范围（u64）
+    TLV_RANGE    = 0x0D,  // FILE_RANGES：一段 [off, off+len)，两个 u64
+    TLV_BLOCK_SIZE = 0x0E,// SIG_REQUEST / SIGNATURES：签名块长（u32）；出现在 FILE_START 里表示增量同步
+    TLV_SIGS     = 0x0F,  // SIGNATURES：每块 8 字节（弱校验 u32 + CRC32C u32）
+    TLV_SRC_OFFSET = 0x10,// FILE_COPY：旧文件里的源 offset（u64）
+    TLV_LENGTH   = 0x11,  // FILE_COPY：复制的字节数（u32）
+    TLV_CREDIT   = 0x12,  // FILE_START 可选：要求服务器发 FILE_CREDIT；FILE_CREDIT：ACK_SEQ 起可发的 seq 数（u32）
+    TLV_ACK_SEQ  = 0x13,  // FILE_CREDIT：服务器下一个要落盘的 seq（u32）
+    TLV_NACK     = 0x14,  // FILE_CREDIT：要求重发的一段 seq，起始 seq + 个数（两个 u32）
+    TLV_CHANNEL  = 0x15,  // 任意消息的第一个 TLV：一条连接上多路复用的通道号（u32），没有即通道 0
+    TLV_STAT     = 0x16,  // STATS：一项指标，u64 值后面跟名字（不带结尾 0）；名字以 _total 结尾的是累计计数
 };
 
+#define TLV_RANGE_LEN (2 * TLV_U64_LEN)
+#define TLV_NACK_LEN  (2 * TLV_U32_LEN)
+#define TLV_CHANNEL_PREFIX_LEN (TLV_HEADER_LEN + TLV_U32_LEN)
+
+typedef struct {
+    uint64_t off;
+    uint64_t len;
+} file_range_t;
+
+typedef struct {
+    uint32_t seq;
+    uint32_t count;
+} seq_range_t;
+
+typedef struct {
+    const char *name;       // 指向 payload 内部，不以 0 结尾
+    uint32_t    name_len;
+    uint64_t    value;
+} stat_entry_t;
+
 
 uint64_t htonll_u64(uint64_t x);
 uint64_t ntohll_u64(uint64_t x);
@@ -25,19 +63,55 @@ uint8_t* tlv_put(uint8_t *out, uint8_t type, const void *val, uint32_t len);
 
 uint8_t* tlv_put_u64(uint8_t *out, uint8_t type, uint64_t v);
 uint8_t* tlv_put_u32(uint8_t *out, uint8_t type, uint32_t v);
+uint8_t* tlv_put_range(uint8_t *out, uint64_t off, uint64_t len);
+uint8_t* tlv_put_nack(uint8_t *out, uint32_t seq, uint32_t count);
+/* 写一个 TLV_STAT，占 TLV_HEADER_LEN + TLV_U64_LEN + strlen(name) 字节 */
+uint8_t* tlv_put_stat(uint8_t *out, const char *name, uint64_t v);
 
 int tlv_walk(const uint8_t *buf, uint32_t total_len,
              void (*cb)(uint8_t, const uint8_t*, uint32_t, void*),
              void *user);
 
+/* payload 以 TLV_CHANNEL 开头时取出通道号并把 *p / *L 移到它后面，返回 1；否则返回 0 不动 */
+int tlv_take_channel(const uint8_t **p, uint32_t *L, uint32_t *chan);
+
+/* 找第一个 type 的 u32 字段：0 找到，1 没有，<0 payload 格式错误 */
+int tlv_find_u32(const uint8_t *buf, uint32_t total_len, uint8_t type, uint32_t *out);
+int tlv_find_u64(const uint8_t *buf, uint32_t total_len, uint8_t type, uint64_t *out);
+
 
 int build_payload_file_start(const char *filename, uint64_t file_size,
                              uint8_t *out_buf, uint32_t out_cap, uint32_t *out_len);
 
 
+/* OFFSET + DATA + CRC32 */
 int build_payload_file_data(uint64_t offset, const uint8_t *data, uint32_t data_len,
                             uint8_t *out_buf, uint32_t out_cap, uint32_t *out_len);
 
+/* FILE_DATA 中 DATA 值之前的部分（OFFSET TLV + DATA 的 TLV 头），数据本身由调用者另行发送 */
+#define FILE_DATA_PREFIX_LEN (TLV_HEADER_LEN + TLV_U64_LEN + TLV_HEADER_LEN)
+
+int build_payload_file_data_prefix(uint64_t offset, uint32_t data_len,
+                                   uint8_t *out_buf, uint32_t out_cap, uint32_t *out_len);
+
+/* DATA 之后的 CRC32 TLV */
+#define FILE_DATA_SUFFIX_LEN (TLV_HEADER_LEN + TLV_U32_LEN)
+#define FILE_DATA_FRAMING_LEN (FILE_DATA_PREFIX_LEN + FILE_DATA_SUFFIX_LEN)
+
+/*
+ * 不拷贝数据的 FILE_DATA：framing 由调用者提供（至少 FILE_DATA_FRAMING_LEN），
+ * iov[0] 是 OFFSET 和 DATA 头，iov[1] 指向 data，iov[2] 是携带 crc 的 CRC32 TLV
+ */
+int build_iov_file_data(uint64_t offset, const uint8_t *data, uint32_t data_len, uint32_t crc,
+                        uint8_t *framing, struct iovec iov[3]);
+
+/* 压缩块：OFFSET + ZDATA 头 | zdata | RAW_LEN + CRC32（crc 是原始数据的） */
+#define FILE_ZDATA_FRAMING_LEN (FILE_DATA_PREFIX_LEN + 2 * (TLV_HEADER_LEN + TLV_U32_LEN))
+
+int build_iov_file_zdata(uint64_t offset, const uint8_t *zdata, uint32_t zlen,
+                         uint32_t raw_len, uint32_t crc,
+                         uint8_t *framing, struct iovec iov[3]);
+
 static inline int build_payload_file_end(uint8_t *out_buf, uint32_t out_cap, uint32_t *out_len) {
     (void)out_buf; (void)out_cap; *out_len = 0; return 0;
 }
@@ -49,3 +123,39 @@ int parse_payload_file_start(const uint8_t *p, uint32_t L,
 int parse_payload_file_data(const uint8_t *p, uint32_t L,
                             uint64_t *offset,
                             const uint8_t **data_ptr, uint32_t *data_len);
+
+typedef struct {
+    uint64_t       offset;
+    const uint8_t *data;        // TLV_DATA 或 TLV_ZDATA 的值，指向 payload 内部
+    uint32_t       len;
+    int            compressed;  // data 来自 TLV_ZDATA
+    uint32_t       raw_len;     // 压缩时解压后的长度
+    int            has_crc;     // 对端带了 CRC32（原始数据的）
+    uint32_t       crc;
+} file_data_view_t;
+
+/* 取出 FILE_DATA 的全部字段；parse_payload_file_data 只接受未压缩的块 */
+int parse_payload_file_data_view(const uint8_t *p, uint32_t L, file_data_view_t *fv);
+
+/* FILE_COPY：OFFSET（新文件）+ SRC_OFFSET（旧文件）+ LENGTH + CRC32（这段数据的） */
+#define FILE_COPY_PAYLOAD_LEN (2 * (TLV_HEADER_LEN + TLV_U64_LEN) + 2 * (TLV_HEADER_LEN + TLV_U32_LEN))
+
+typedef struct {
+    uint64_t offset;
+    uint64_t src_offset;
+    uint32_t len;
+    uint32_t crc;
+} file_copy_t;
+
+int build_payload_file_copy(const file_copy_t *fc, uint8_t *out_buf, uint32_t out_cap, uint32_t *out_len);
+
+int parse_payload_file_copy(const uint8_t *p, uint32_t L, file_copy_t *fc);
+
+/* 取出 FILE_RANGES 里的 TLV_RANGE，最多存 cap 个；返回总个数（可能大于 cap），格式错误返回 <0 */
+int parse_payload_file_ranges(const uint8_t *p, uint32_t L, file_range_t *out, uint32_t cap);
+
+/* 取出 FILE_CREDIT 里的 TLV_NACK，用法同 parse_payload_file_ranges */
+int parse_payload_nacks(const uint8_t *p, uint32_t L, seq_range_t *out, uint32_t cap);
+
+/* 取出 STATS 里的 TLV_STAT，用法同 parse_payload_file_ranges */
+int parse_payload_stats(const uint8_t *p, uint32_t L, stat_entry_t *out, uint32_t cap);
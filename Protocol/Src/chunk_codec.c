@@ -0,0 +1,63 @@
+#include <stddef.h>
+
+#include "chunk_codec.h"
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+
+// 追求速度：日志/CSV 在 1 级下通常已经能压到 1/5 以下
+#ifndef CODEC_ZLIB_LEVEL
+#define CODEC_ZLIB_LEVEL 1
+#endif
+#endif
+
+uint32_t codec_supported(void)
+{
+#ifdef HAVE_ZLIB
+    return CODEC_MASK(CODEC_ZLIB);
+#else
+    return 0;
+#endif
+}
+
+int codec_pick(uint32_t offered)
+{
+    uint32_t both = offered & codec_supported();
+    if (both & CODEC_MASK(CODEC_ZLIB)) return CODEC_ZLIB;
+    return CODEC_NONE;
+}
+
+uint32_t codec_bound(int codec, uint32_t n)
+{
+#ifdef HAVE_ZLIB
+    if (codec == CODEC_ZLIB) return (uint32_t)compressBound(n);
+#endif
+    (void)codec;
+    return n;
+}
+
+int codec_compress(int codec, const uint8_t *src, uint32_t n, uint8_t *dst, uint32_t cap)
+{
+#ifdef HAVE_ZLIB
+    if (codec == CODEC_ZLIB) {
+        uLongf out = cap;
+        if (compress2(dst, &out, src, n, CODEC_ZLIB_LEVEL) != Z_OK) return -1;
+        return out < n ? (int)out : 0;
+    }
+#endif
+    (void)src; (void)n; (void)dst; (void)cap; (void)codec;
+    return -1;
+}
+
+int codec_decompress(int codec, const uint8_t *src, uint32_t n, uint8_t *dst, uint32_t raw_len)
+{
+#ifdef HAVE_ZLIB
+    if (codec == CODEC_ZLIB) {
+        uLongf out = raw_len;
+        if (uncompress(dst, &out, src, n) != Z_OK || out != raw_len) return -1;
+        return 0;
+    }
+#endif
+    (void)src; (void)n; (void)dst; (void)raw_len; (void)codec;
+    return -1;
+}
@@ -0,0 +1,124 @@
+#include <string.h>
+#include <pthread.h>
+
+#include "crc32c.h"
+
+#define CRC32C_POLY 0x82F63B78u   // 反射形式
+
+static uint32_t g_table[8][256];
+static uint32_t g_x2n[32];        // x^(2^n) mod P，crc32c_combine 用
+static int g_have_sse42;
+static pthread_once_t g_once = PTHREAD_ONCE_INIT;
+
+/* a*b mod P（反射表示） */
+static uint32_t multmodp(uint32_t a, uint32_t b)
+{
+    uint32_t m = 1u << 31, p = 0;
+    for (;;) {
+        if (a & m) {
+            p ^= b;
+            if ((a & (m - 1)) == 0) break;
+        }
+        m >>= 1;
+        b = (b & 1) ? (b >> 1) ^ CRC32C_POLY : b >> 1;
+    }
+    return p;
+}
+
+/* x^(n*2^k) mod P */
+static uint32_t x2nmodp(uint64_t n, unsigned k)
+{
+    uint32_t p = 1u << 31;    // x^0
+    while (n) {
+        if (n & 1) p = multmodp(g_x2n[k & 31], p);
+        n >>= 1;
+        k++;
+    }
+    return p;
+}
+
+static void crc32c_init(void)
+{
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; ++k) c = (c & 1) ? (c >> 1) ^ CRC32C_POLY : c >> 1;
+        g_table[0][i] = c;
+    }
+    for (uint32_t i = 0; i < 256; ++i) {
+        for (int t = 1; t < 8; ++t)
+            g_table[t][i] = (g_table[t - 1][i] >> 8) ^ g_table[0][g_table[t - 1][i] & 0xff];
+    }
+
+    uint32_t p = 1u << 30;    // x^1
+    g_x2n[0] = p;
+    for (int n = 1; n < 32; ++n) g_x2n[n] = p = multmodp(p, p);
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+    __builtin_cpu_init();
+    g_have_sse42 = __builtin_cpu_supports("sse4.2");
+#endif
+}
+
+static uint32_t crc32c_sw(uint32_t crc, const uint8_t *p, size_t len)
+{
+    while (len && ((uintptr_t)p & 7)) {
+        crc = (crc >> 8) ^ g_table[0][(crc ^ *p++) & 0xff];
+        len--;
+    }
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    while (len >= 8) {
+        uint64_t w;
+        memcpy(&w, p, 8);
+        w ^= crc;   // 小端：低 4 字节与 crc 异或
+        crc = g_table[7][w & 0xff] ^
+              g_table[6][(w >> 8) & 0xff] ^
+              g_table[5][(w >> 16) & 0xff] ^
+              g_table[4][(w >> 24) & 0xff] ^
+              g_table[3][(w >> 32) & 0xff] ^
+              g_table[2][(w >> 40) & 0xff] ^
+              g_table[1][(w >> 48) & 0xff] ^
+              g_table[0][w >> 56];
+        p += 8;
+        len -= 8;
+    }
+#endif
+    while (len--) crc = (crc >> 8) ^ g_table[0][(crc ^ *p++) & 0xff];
+    return crc;
+}
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hw(uint32_t crc, const uint8_t *p, size_t len)
+{
+    uint64_t c = crc;
+    while (len && ((uintptr_t)p & 7)) {
+        c = __builtin_ia32_crc32qi((uint32_t)c, *p++);
+        len--;
+    }
+    while (len >= 8) {
+        uint64_t w;
+        memcpy(&w, p, 8);
+        c = __builtin_ia32_crc32di(c, w);
+        p += 8;
+        len -= 8;
+    }
+    while (len--) c = __builtin_ia32_crc32qi((uint32_t)c, *p++);
+    return (uint32_t)c;
+}
+#endif
+
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len)
+{
+    pthread_once(&g_once, crc32c_init);
+    crc = ~crc;
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+    if (g_have_sse42) return ~crc32c_hw(crc, buf, len);
+#endif
+    return ~crc32c_sw(crc, buf, len);
+}
+
+uint32_t crc32c_combine(uint32_t crc1, uint32_t crc2, uint64_t len2)
+{
+    pthread_once(&g_once, crc32c_init);
+    return multmodp(x2nmodp(len2, 3), crc1) ^ crc2;
+}
@@ -0,0 +1,133 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+#include "delta.h"
+#include "tcp_tlv.h"
+#include "crc32c.h"
+
+// 算签名时一次读这么多
+#define DELTA_READ_BUF (4 * 1024 * 1024)
+
+uint32_t delta_pick_block(uint64_t old_size, uint32_t requested)
+{
+    uint32_t block = requested;
+    if (block == 0) {
+        // 和 rsync 一样取约 sqrt(size)，限制在 [DELTA_MIN_BLOCK, DELTA_MAX_AUTO_BLOCK]
+        block = DELTA_MIN_BLOCK;
+        while (block < DELTA_MAX_AUTO_BLOCK && (uint64_t)block * block < old_size) block *= 2;
+    }
+    if (block < DELTA_MIN_BLOCK) block = DELTA_MIN_BLOCK;
+    while ((old_size + block - 1) / block > DELTA_MAX_BLOCKS) block *= 2;
+    return block;
+}
+
+int delta_signatures(int fd, uint64_t size, uint32_t block, delta_sig_t **sigs, uint32_t *n)
+{
+    uint64_t nblk = size / block;
+    *sigs = NULL;
+    *n = 0;
+    if (nblk == 0) return 0;
+    if (nblk > DELTA_MAX_BLOCKS) { errno = EFBIG; return -1; }
+
+    delta_sig_t *out = malloc((size_t)nblk * sizeof(*out));
+    size_t cap = block > DELTA_READ_BUF ? block : (DELTA_READ_BUF / block) * block;
+    uint8_t *buf = malloc(cap);
+    if (!out || !buf) { free(out); free(buf); return -1; }
+
+    uint64_t i = 0;
+    while (i < nblk) {
+        uint64_t want_blk = (nblk - i) < cap / block ? (nblk - i) : cap / block;
+        size_t want = (size_t)want_blk * block;
+        size_t got = 0;
+        while (got < want) {
+            ssize_t m = pread(fd, buf + got, want - got, (off_t)(i * block + got));
+            if (m < 0 && errno == EINTR) continue;
+            if (m <= 0) { free(out); free(buf); if (m == 0) errno = EIO; return -1; }
+            got += (size_t)m;
+        }
+        for (uint64_t k = 0; k < want_blk; ++k, ++i) {
+            const uint8_t *p = buf + k * block;
+            delta_roll_t r;
+            delta_roll_init(&r, p, block);
+            out[i].weak = delta_roll_digest(&r);
+            out[i].strong = crc32c(0, p, block);
+        }
+    }
+    free(buf);
+    *sigs = out;
+    *n = (uint32_t)nblk;
+    return 0;
+}
+
+uint32_t delta_sigs_payload_len(uint32_t n)
+{
+    return TLV_HEADER_LEN + TLV_U32_LEN + TLV_HEADER_LEN + TLV_U64_LEN +
+           TLV_HEADER_LEN + n * DELTA_SIG_LEN;
+}
+
+int build_payload_signatures(uint32_t block, uint64_t old_size, const delta_sig_t *sigs, uint32_t n,
+                             uint8_t *out, uint32_t cap, uint32_t *out_len)
+{
+    uint32_t need = delta_sigs_payload_len(n);
+    if (cap < need) return -1;
+    uint8_t *w = out;
+    w = tlv_put_u32(w, TLV_BLOCK_SIZE, block);
+    w = tlv_put_u64(w, TLV_FILESIZE, old_size);
+    w = tlv_put(w, TLV_SIGS, NULL, n * DELTA_SIG_LEN);
+    // 值直接写在 TLV 头后面
+    uint8_t *v = w - n * DELTA_SIG_LEN;
+    for (uint32_t i = 0; i < n; ++i) {
+        uint32_t be[2] = { htonl(sigs[i].weak), htonl(sigs[i].strong) };
+        memcpy(v + (size_t)i * DELTA_SIG_LEN, be, DELTA_SIG_LEN);
+    }
+    *out_len = (uint32_t)(w - out);
+    return 0;
+}
+
+typedef struct {
+    uint32_t      *block;
+    uint64_t      *old_size;
+    const uint8_t *raw;
+    uint32_t       raw_len;
+    int            has_block;
+} _sigs_parse_ctx;
+
+static void _cb_sigs(uint8_t t, const uint8_t *v, uint32_t n, void *arg) {
+    _sigs_parse_ctx *ctx = (_sigs_parse_ctx*)arg;
+    if (t == TLV_BLOCK_SIZE && n == TLV_U32_LEN) {
+        uint32_t be; memcpy(&be, v, TLV_U32_LEN);
+        *ctx->block = ntohl(be);
+        ctx->has_block = 1;
+    } else if (t == TLV_FILESIZE && n == TLV_U64_LEN) {
+        uint64_t be; memcpy(&be, v, TLV_U64_LEN);
+        *ctx->old_size = ntohll_u64(be);
+    } else if (t == TLV_SIGS) {
+        ctx->raw = v;
+        ctx->raw_len = n;
+    }
+}
+
+int parse_payload_signatures(const uint8_t *p, uint32_t L, uint32_t *block, uint64_t *old_size,
+                             const uint8_t **raw, uint32_t *n)
+{
+    *block = 0;
+    *old_size = 0;
+    _sigs_parse_ctx ctx = { .block = block, .old_size = old_size };
+    int r = tlv_walk(p, L, _cb_sigs, &ctx);
+    if (r < 0) return r;
+    if (!ctx.has_block || *block == 0) return -10;
+    if (ctx.raw_len % DELTA_SIG_LEN) return -11;
+    *raw = ctx.raw;
+    *n = ctx.raw_len / DELTA_SIG_LEN;
+    return 0;
+}
+
+delta_sig_t delta_sig_at(const uint8_t *raw, uint32_t i)
+{
+    uint32_t be[2];
+    memcpy(be, raw + (size_t)i * DELTA_SIG_LEN, DELTA_SIG_LEN);
+    return (delta_sig_t){ .weak = ntohl(be[0]), .strong = ntohl(be[1]) };
+}
@@ -0,0 +1,106 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include "frame_decoder.h"
+
+int frame_decoder_init(frame_decoder_t *d, uint32_t cap, uint32_t max_payload)
+{
+    if (cap < PROTOCOL_HEADER_LEN) cap = PROTOCOL_HEADER_LEN;
+    d->buf = malloc(cap);
+    if (!d->buf) return -1;
+    d->cap = cap;
+    d->rd = 0;
+    d->wr = 0;
+    d->max_payload = max_payload;
+    return 0;
+}
+
+void frame_decoder_destroy(frame_decoder_t *d)
+{
+    free(d->buf);
+    d->buf = NULL;
+    d->cap = d->rd = d->wr = 0;
+}
+
+/* 当前这帧一共需要多少字节；头部还没收全时只知道至少要一个头，长度非法返回 0 */
+static uint32_t frame_need(const frame_decoder_t *d)
+{
+    if (frame_decoder_pending(d) < PROTOCOL_HEADER_LEN) return (uint32_t)PROTOCOL_HEADER_LEN;
+    protocol_header wire, host;
+    memcpy(&wire, d->buf + d->rd, PROTOCOL_HEADER_LEN);
+    protocol_header_to_host(&wire, &host);
+    if (host.payload_length > d->max_payload) return 0;
+    return (uint32_t)PROTOCOL_HEADER_LEN + host.payload_length;
+}
+
+/* 挪走已消费的数据，必要时扩容，保证至少能再写 1 字节 */
+static int reserve(frame_decoder_t *d)
+{
+    if (d->rd > 0) {
+        uint32_t pending = frame_decoder_pending(d);
+        if (pending) memmove(d->buf, d->buf + d->rd, pending);
+        d->rd = 0;
+        d->wr = pending;
+    }
+    if (d->wr < d->cap) return 0;
+
+    uint32_t need = frame_need(d);
+    if (need == 0) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    // 一帧放不下就扩到刚好；缓冲里是还没取走的完整帧（feed 一次给太多）就翻倍
+    if (need <= d->cap) need = d->cap * 2;
+    uint8_t *nb = realloc(d->buf, need);
+    if (!nb) return -1;
+    d->buf = nb;
+    d->cap = need;
+    return 0;
+}
+
+ssize_t frame_decoder_recv(frame_decoder_t *d, int fd)
+{
+    if (reserve(d) < 0) return -1;
+    for (;;) {
+        ssize_t m = recv(fd, d->buf + d->wr, d->cap - d->wr, 0);
+        if (m < 0 && errno == EINTR) continue;
+        if (m > 0) d->wr += (uint32_t)m;
+        return m;
+    }
+}
+
+int frame_decoder_feed(frame_decoder_t *d, const void *p, uint32_t n)
+{
+    const uint8_t *src = p;
+    while (n > 0) {
+        if (reserve(d) < 0) return -1;
+        uint32_t take = d->cap - d->wr;
+        if (take > n) take = n;
+        memcpy(d->buf + d->wr, src, take);
+        d->wr += take;
+        src += take;
+        n -= take;
+        // 缓冲被一帧的前半段填满时，下一轮 reserve 会按帧长扩容
+    }
+    return 0;
+}
+
+int frame_decoder_next(frame_decoder_t *d, protocol_msg *msg)
+{
+    uint32_t pending = frame_decoder_pending(d);
+    if (pending < PROTOCOL_HEADER_LEN) return 0;
+
+    protocol_header wire;
+    memcpy(&wire, d->buf + d->rd, PROTOCOL_HEADER_LEN);
+    protocol_header_to_host(&wire, &msg->hdr);
+    if (msg->hdr.payload_length > d->max_payload) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    if (pending - PROTOCOL_HEADER_LEN < msg->hdr.payload_length) return 0;
+
+    msg->payload = d->buf + d->rd + PROTOCOL_HEADER_LEN;
+    d->rd += (uint32_t)PROTOCOL_HEADER_LEN + msg->hdr.payload_length;
+    return 1;
+}
\ No newline at end of file
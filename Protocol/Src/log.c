@@ -0,0 +1,456 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "log.h"
+
+// 一行最长多少字节，超出截断
+#define LOG_LINE_MAX 1024
+// 后台线程攒多少字节 write 一次
+#define LOG_OUT_BUF  (64 * 1024)
+
+enum {
+    RING_FREE = 0,      // 没有线程在用，可以被新线程认领
+    RING_OWNED,
+    RING_RETIRED,       // 线程已退出，写完剩下的记录后变回 FREE
+};
+
+typedef union
+{
+    uint64_t    u;      // 整数；%s 参数是在 str 里的偏移
+    double      d;
+    const void *p;
+}log_val_t;
+
+typedef struct
+{
+    uint64_t    ts;
+    const char *fmt;
+    uint8_t     level;
+    uint8_t     nargs;
+    uint8_t     type[LOG_MAX_ARGS];
+    uint16_t    str_used;
+    log_val_t   val[LOG_MAX_ARGS];
+    char        str[LOG_REC_STR];
+}log_rec_t;
+
+typedef struct log_ring
+{
+    _Alignas(64) _Atomic uint32_t head;     // 只有所属线程写
+    _Alignas(64) _Atomic uint32_t tail;     // 只有持 drain_lock 的消费者写
+    _Alignas(64) _Atomic int      state;
+    _Atomic uint64_t dropped;               // 缓冲满丢掉的
+    _Atomic uint64_t suppressed[LOG_LEVELS];// 超出限速丢掉的
+    uint64_t         win_sec;               // 限速窗口，只有所属线程用
+    uint32_t         win_cnt[LOG_LEVELS];
+    struct log_ring *next;                  // 链表只增不删，环形缓冲被线程轮流复用
+    log_rec_t        rec[LOG_RING_SLOTS];
+}log_ring_t;
+
+_Atomic int g_log_level = LOG_LVL_INFO;
+
+static struct
+{
+    _Atomic(log_ring_t *) rings;
+    _Atomic int      running;
+    _Atomic int      stop;
+    _Atomic uint32_t rate[LOG_LEVELS];
+    pthread_mutex_t  drain_lock;
+    pthread_t        thread;
+    pthread_key_t    key;
+    int              key_ok;
+    // 以下只有持 drain_lock 时用
+    log_ring_t     **snap;
+    uint32_t        *pos;
+    size_t           snap_cap;
+    char            *out;
+    size_t           out_len;
+    uint64_t         report_sec;
+}g_log = {
+    .rate = { LOG_RATE_DEFAULT, LOG_RATE_DEFAULT, LOG_RATE_DEFAULT, LOG_RATE_DEFAULT },
+    .drain_lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static __thread log_ring_t *t_ring;
+
+static const char *const level_names[LOG_LEVELS] = { "debug", "info", "warn", "error" };
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void write_all(const char *p, size_t n)
+{
+    while (n > 0) {
+        ssize_t w = write(STDERR_FILENO, p, n);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            return;
+        }
+        p += w;
+        n -= (size_t)w;
+    }
+}
+
+static void fill_rec(log_rec_t *r, uint64_t ts, int level, const char *fmt, const log_arg_t *args, int nargs)
+{
+    r->ts = ts;
+    r->fmt = fmt;
+    r->level = (uint8_t)level;
+    r->nargs = (uint8_t)(nargs < LOG_MAX_ARGS ? nargs : LOG_MAX_ARGS);
+    r->str_used = 0;
+    for (int i = 0; i < r->nargs; ++i) {
+        r->type[i] = (uint8_t)args[i].type;
+        if (args[i].type != LOG_ARG_STR) {
+            r->val[i].u = args[i].v.u;
+            continue;
+        }
+        // 字符串在记录时拷贝，调用方的缓冲之后可能就变了；放不下的截断
+        const char *s = args[i].v.s ? args[i].v.s : "(null)";
+        size_t room = LOG_REC_STR - r->str_used;
+        if (room == 0) { r->val[i].u = UINT64_MAX; continue; }
+        size_t n = strnlen(s, room - 1);
+        memcpy(r->str + r->str_used, s, n);
+        r->str[r->str_used + n] = '\0';
+        r->val[i].u = r->str_used;
+        r->str_used = (uint16_t)(r->str_used + n + 1);
+    }
+}
+
+static int fmt_int(char *out, size_t room, const char *spec, char conv, const char *lm, size_t lm_len,
+                   int type, const log_val_t *v)
+{
+    uint64_t u = type == LOG_ARG_DBL ? (uint64_t)(int64_t)v->d : v->u;
+    int sign = conv == 'd' || conv == 'i';
+    if (lm_len == 0 || lm[0] == 'h' || conv == 'c') {
+        return sign || conv == 'c' ? snprintf(out, room, spec, (int)u) : snprintf(out, room, spec, (unsigned)u);
+    }
+    switch (lm[0]) {
+    case 'l':
+        if (lm_len == 1) return sign ? snprintf(out, room, spec, (long)u) : snprintf(out, room, spec, (unsigned long)u);
+        /* fall through */
+    case 'q': case 'L':
+        return sign ? snprintf(out, room, spec, (long long)u) : snprintf(out, room, spec, (unsigned long long)u);
+    case 'j':
+        return sign ? snprintf(out, room, spec, (intmax_t)u) : snprintf(out, room, spec, (uintmax_t)u);
+    case 'z':
+        return sign ? snprintf(out, room, spec, (ssize_t)u) : snprintf(out, room, spec, (size_t)u);
+    case 't':
+        return snprintf(out, room, spec, (ptrdiff_t)u);
+    default:
+        return snprintf(out, room, "?");
+    }
+}
+
+/* 按格式串逐个转换说明取参数格式化，参数类型和说明对不上的输出 '?' */
+static size_t format_rec(const log_rec_t *r, char *out, size_t cap)
+{
+    size_t n = 0;
+    int ai = 0;
+    const char *f = r->fmt;
+    while (*f && n + 1 < cap) {
+        if (*f != '%') { out[n++] = *f++; continue; }
+        if (f[1] == '%') { out[n++] = '%'; f += 2; continue; }
+
+        // %[flags][width][.prec][length]conv
+        const char *s = f++;
+        while (*f && strchr("-+ #0'", *f)) f++;
+        while (*f >= '0' && *f <= '9') f++;
+        if (*f == '.') {
+            f++;
+            while (*f >= '0' && *f <= '9') f++;
+        }
+        const char *lm = f;
+        while (*f && strchr("hlLqjzt", *f)) f++;
+        size_t lm_len = (size_t)(f - lm);
+        char conv = *f;
+        if (!conv) break;
+        f++;
+
+        char spec[32];
+        size_t sl = (size_t)(f - s);
+        if (sl >= sizeof(spec)) sl = sizeof(spec) - 1;
+        memcpy(spec, s, sl);
+        spec[sl] = '\0';
+
+        size_t room = cap - n;
+        int w;
+        if (ai >= r->nargs) {
+            w = snprintf(out + n, room, "?");
+        } else {
+            int type = r->type[ai];
+            const log_val_t *v = &r->val[ai++];
+            switch (conv) {
+            case 'd': case 'i': case 'u': case 'o': case 'x': case 'X': case 'c':
+                w = type == LOG_ARG_STR || type == LOG_ARG_PTR ? snprintf(out + n, room, "?")
+                                                               : fmt_int(out + n, room, spec, conv, lm, lm_len, type, v);
+                break;
+            case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+                if (type == LOG_ARG_STR || type == LOG_ARG_PTR) w = snprintf(out + n, room, "?");
+                else {
+                    double d = type == LOG_ARG_DBL ? v->d : (double)v->u;
+                    w = lm_len && lm[0] == 'L' ? snprintf(out + n, room, spec, (long double)d)
+                                               : snprintf(out + n, room, spec, d);
+                }
+                break;
+            case 'p':
+                w = type == LOG_ARG_STR ? snprintf(out + n, room, "?")
+                                        : snprintf(out + n, room, spec, type == LOG_ARG_PTR ? v->p : (void *)(uintptr_t)v->u);
+                break;
+            case 's':
+                if (type != LOG_ARG_STR) w = snprintf(out + n, room, "?");
+                else w = snprintf(out + n, room, spec, v->u == UINT64_MAX ? "" : r->str + v->u);
+                break;
+            default:
+                // %n、* 宽度等不支持，原样输出
+                w = snprintf(out + n, room, "%s", spec);
+                break;
+            }
+        }
+        if (w > 0) n += (size_t)w < room ? (size_t)w : room - 1;
+    }
+    out[n] = '\0';
+    return n;
+}
+
+/* 认领一个空闲的环形缓冲，没有就新建一个挂到链表头 */
+static log_ring_t *my_ring(void)
+{
+    if (t_ring) return t_ring;
+    log_ring_t *r;
+    for (r = atomic_load_explicit(&g_log.rings, memory_order_acquire); r; r = r->next) {
+        int expect = RING_FREE;
+        if (atomic_compare_exchange_strong(&r->state, &expect, RING_OWNED)) break;
+    }
+    if (!r) {
+        void *mem = NULL;
+        if (posix_memalign(&mem, 64, sizeof(log_ring_t)) != 0) return NULL;
+        r = memset(mem, 0, sizeof(log_ring_t));
+        atomic_init(&r->state, RING_OWNED);
+        log_ring_t *old = atomic_load_explicit(&g_log.rings, memory_order_relaxed);
+        do {
+            r->next = old;
+        } while (!atomic_compare_exchange_weak_explicit(&g_log.rings, &old, r,
+                                                        memory_order_release, memory_order_relaxed));
+    }
+    r->win_sec = 0;
+    memset(r->win_cnt, 0, sizeof(r->win_cnt));
+    t_ring = r;
+    // 线程退出时由 key 的析构交还
+    if (g_log.key_ok) pthread_setspecific(g_log.key, r);
+    return r;
+}
+
+static void ring_retire(void *arg)
+{
+    log_ring_t *r = arg;
+    atomic_store_explicit(&r->state, RING_RETIRED, memory_order_release);
+}
+
+void log_emit(int level, const char *fmt, const log_arg_t *args, int nargs)
+{
+    if (level < 0) level = 0;
+    if (level >= LOG_LEVELS) level = LOG_LEVELS - 1;
+    uint64_t ts = now_ns();
+    log_ring_t *r = atomic_load_explicit(&g_log.running, memory_order_acquire) ? my_ring() : NULL;
+    if (!r) {
+        // 后台线程没起来：同步写
+        log_rec_t rec;
+        char line[LOG_LINE_MAX];
+        fill_rec(&rec, ts, level, fmt, args, nargs);
+        size_t n = format_rec(&rec, line, sizeof(line));
+        fwrite(line, 1, n, stderr);
+        return;
+    }
+
+    uint32_t lim = atomic_load_explicit(&g_log.rate[level], memory_order_relaxed);
+    uint64_t sec = ts / 1000000000ull;
+    if (sec != r->win_sec) {
+        r->win_sec = sec;
+        memset(r->win_cnt, 0, sizeof(r->win_cnt));
+    }
+    if (lim && r->win_cnt[level]++ >= lim) {
+        atomic_fetch_add_explicit(&r->suppressed[level], 1, memory_order_relaxed);
+        return;
+    }
+
+    uint32_t h = atomic_load_explicit(&r->head, memory_order_relaxed);
+    uint32_t t = atomic_load_explicit(&r->tail, memory_order_acquire);
+    if (h - t >= LOG_RING_SLOTS) {
+        atomic_fetch_add_explicit(&r->dropped, 1, memory_order_relaxed);
+        return;
+    }
+    fill_rec(&r->rec[h & (LOG_RING_SLOTS - 1)], ts, level, fmt, args, nargs);
+    atomic_store_explicit(&r->head, h + 1, memory_order_release);
+}
+
+static void out_flush(void)
+{
+    write_all(g_log.out, g_log.out_len);
+    g_log.out_len = 0;
+}
+
+static char *out_reserve(void)
+{
+    if (LOG_OUT_BUF - g_log.out_len < LOG_LINE_MAX) out_flush();
+    return g_log.out + g_log.out_len;
+}
+
+/* 汇报并清零各缓冲的丢弃计数 */
+static void report_drops(void)
+{
+    uint64_t dropped = 0, supp[LOG_LEVELS] = { 0 };
+    for (log_ring_t *r = atomic_load_explicit(&g_log.rings, memory_order_acquire); r; r = r->next) {
+        dropped += atomic_exchange_explicit(&r->dropped, 0, memory_order_relaxed);
+        for (int l = 0; l < LOG_LEVELS; ++l)
+            supp[l] += atomic_exchange_explicit(&r->suppressed[l], 0, memory_order_relaxed);
+    }
+    if (dropped) {
+        g_log.out_len += (size_t)snprintf(out_reserve(), LOG_LINE_MAX,
+                                          "[log] %llu record(s) dropped, ring buffer full\n",
+                                          (unsigned long long)dropped);
+    }
+    for (int l = 0; l < LOG_LEVELS; ++l) {
+        if (!supp[l]) continue;
+        g_log.out_len += (size_t)snprintf(out_reserve(), LOG_LINE_MAX,
+                                          "[log] %llu %s record(s) suppressed by rate limit\n",
+                                          (unsigned long long)supp[l], level_names[l]);
+    }
+}
+
+/* 把所有缓冲里已有的记录按时间戳归并写出，返回写了几条。调用方持 drain_lock */
+static size_t drain_once(void)
+{
+    size_t k = 0;
+    for (log_ring_t *r = atomic_load_explicit(&g_log.rings, memory_order_acquire); r; r = r->next) {
+        if (k == g_log.snap_cap) {
+            size_t cap = g_log.snap_cap ? g_log.snap_cap * 2 : 16;
+            log_ring_t **ns = realloc(g_log.snap, cap * sizeof(*ns));
+            if (!ns) break;
+            g_log.snap = ns;
+            uint32_t *np = realloc(g_log.pos, cap * 2 * sizeof(*np));
+            if (!np) break;
+            g_log.pos = np;
+            g_log.snap_cap = cap;
+        }
+        g_log.snap[k] = r;
+        g_log.pos[2 * k]     = atomic_load_explicit(&r->tail, memory_order_relaxed);
+        g_log.pos[2 * k + 1] = atomic_load_explicit(&r->head, memory_order_acquire);
+        k++;
+    }
+
+    size_t done = 0;
+    for (;;) {
+        size_t best = k;
+        uint64_t best_ts = 0;
+        for (size_t i = 0; i < k; ++i) {
+            uint32_t p = g_log.pos[2 * i];
+            if (p == g_log.pos[2 * i + 1]) continue;
+            uint64_t ts = g_log.snap[i]->rec[p & (LOG_RING_SLOTS - 1)].ts;
+            if (best == k || ts < best_ts) { best = i; best_ts = ts; }
+        }
+        if (best == k) break;
+        log_ring_t *r = g_log.snap[best];
+        uint32_t p = g_log.pos[2 * best]++;
+        g_log.out_len += format_rec(&r->rec[p & (LOG_RING_SLOTS - 1)], out_reserve(), LOG_LINE_MAX);
+        done++;
+    }
+
+    for (size_t i = 0; i < k; ++i) {
+        log_ring_t *r = g_log.snap[i];
+        atomic_store_explicit(&r->tail, g_log.pos[2 * i], memory_order_release);
+        // 退出的线程留下的缓冲写空了就可以给别的线程用
+        if (atomic_load_explicit(&r->state, memory_order_acquire) == RING_RETIRED &&
+            atomic_load_explicit(&r->head, memory_order_acquire) == g_log.pos[2 * i])
+            atomic_store_explicit(&r->state, RING_FREE, memory_order_release);
+    }
+
+    uint64_t sec = now_ns() / 1000000000ull;
+    if (sec != g_log.report_sec) {
+        g_log.report_sec = sec;
+        report_drops();
+    }
+    out_flush();
+    return done;
+}
+
+static void *drain_main(void *arg)
+{
+    (void)arg;
+    while (!atomic_load_explicit(&g_log.stop, memory_order_acquire)) {
+        pthread_mutex_lock(&g_log.drain_lock);
+        size_t n = drain_once();
+        pthread_mutex_unlock(&g_log.drain_lock);
+        if (n == 0) {
+            struct timespec ts = { 0, LOG_DRAIN_US * 1000L };
+            nanosleep(&ts, NULL);
+        }
+    }
+    return NULL;
+}
+
+int log_init(void)
+{
+    if (atomic_load(&g_log.running)) return 0;
+    if (!g_log.out) {
+        g_log.out = malloc(LOG_OUT_BUF);
+        if (!g_log.out) return -1;
+    }
+    if (!g_log.key_ok) {
+        if (pthread_key_create(&g_log.key, ring_retire) != 0) return -1;
+        g_log.key_ok = 1;
+        atexit(log_shutdown);
+    }
+    atomic_store(&g_log.stop, 0);
+    if (pthread_create(&g_log.thread, NULL, drain_main, NULL) != 0) return -1;
+    atomic_store_explicit(&g_log.running, 1, memory_order_release);
+    return 0;
+}
+
+void log_shutdown(void)
+{
+    if (!atomic_exchange(&g_log.running, 0)) return;
+    atomic_store(&g_log.stop, 1);
+    pthread_join(g_log.thread, NULL);
+    pthread_mutex_lock(&g_log.drain_lock);
+    drain_once();
+    report_drops();
+    out_flush();
+    pthread_mutex_unlock(&g_log.drain_lock);
+}
+
+void log_set_level(int level)
+{
+    atomic_store_explicit(&g_log_level, level, memory_order_relaxed);
+}
+
+int log_set_level_name(const char *name)
+{
+    for (int l = 0; l < LOG_LEVELS; ++l) {
+        if (strcmp(name, level_names[l]) == 0) {
+            log_set_level(l);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+void log_set_rate(int level, uint32_t per_sec)
+{
+    if (level < 0 || level >= LOG_LEVELS) return;
+    atomic_store_explicit(&g_log.rate[level], per_sec, memory_order_relaxed);
+}
+
+const char *log_strerror(int err)
+{
+    static __thread char buf[64];
+    return strerror_r(err, buf, sizeof(buf));
+}
@@ -0,0 +1,79 @@
+#include <stdlib.h>
+#include <stddef.h>
+#include "msg_pool.h"
+
+struct msg_buf
+{
+    msg_buf  *next;
+    uint32_t  cap;
+    _Alignas(16) uint8_t data[];
+};
+
+static inline msg_buf *buf_of(void *data)
+{
+    return (msg_buf *)((uint8_t *)data - offsetof(msg_buf, data));
+}
+
+void msg_pool_init(msg_pool_t *pool, uint32_t buf_size, uint32_t max_free)
+{
+    pool->free_list = NULL;
+    pool->buf_size = buf_size;
+    pool->max_free = max_free;
+    pool->n_free = 0;
+    pool->n_get = 0;
+    pool->n_alloc = 0;
+    pool->n_over = 0;
+    pool->n_out = 0;
+    pool->n_owned = 0;
+}
+
+void msg_pool_destroy(msg_pool_t *pool)
+{
+    msg_buf *b = pool->free_list;
+    while (b) {
+        msg_buf *next = b->next;
+        free(b);
+        b = next;
+    }
+    pool->free_list = NULL;
+    pool->n_owned -= pool->n_free;
+    pool->n_free = 0;
+}
+
+void *msg_pool_get(msg_pool_t *pool, uint32_t size)
+{
+    pool->n_get++;
+    if (size <= pool->buf_size && pool->free_list) {
+        msg_buf *b = pool->free_list;
+        pool->free_list = b->next;
+        pool->n_free--;
+        pool->n_out++;
+        return b->data;
+    }
+
+    uint32_t cap = (size <= pool->buf_size) ? pool->buf_size : size;
+    msg_buf *b = malloc(sizeof(msg_buf) + cap);
+    if (!b) return NULL;
+    pool->n_alloc++;
+    pool->n_out++;
+    if (cap != pool->buf_size || pool->n_owned >= pool->max_free) pool->n_over++;
+    if (cap == pool->buf_size) pool->n_owned++;
+    b->next = NULL;
+    b->cap = cap;
+    return b->data;
+}
+
+void msg_pool_put(msg_pool_t *pool, void *buf)
+{
+    if (!buf) return;
+    msg_buf *b = buf_of(buf);
+    pool->n_out--;
+    if (b->cap != pool->buf_size || pool->n_free >= pool->max_free) {
+        if (b->cap == pool->buf_size) pool->n_owned--;
+        free(b);
+        return;
+    }
+    b->next = pool->free_list;
+    pool->free_list = b;
+    pool->n_free++;
+}
\ No newline at end of file
@@ -3,7 +3,20 @@
 #include <stdlib.h>
 #include <arpa/inet.h>
 #include <stdio.h>
+#include <limits.h>
+#include <sys/socket.h>
 #include "tcp_protocol.h"
+#include "msg_pool.h"
+
+// 没有 _XOPEN_SOURCE 时 limits.h 不给 IOV_MAX，Linux 上是 1024
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+// send_messagev 每次 sendmsg 最多合并的消息数
+#ifndef SENDV_MAX_MSGS
+#define SENDV_MAX_MSGS 64
+#endif
 
 static inline int seq_before(uint32_t a,uint32_t b)
 {
@@ -86,28 +99,110 @@ int send_all(int fd,const void *buf,size_t n)
     return 0;
 }
 
-int send_message(int fd,protocol_msg *msg)
+void protocol_header_to_wire(const protocol_header *host,protocol_header *wire)
+{
+    wire->version_major = host->version_major;
+    wire->version_minor = host->version_minor;
+    wire->payload_length = htonl(host->payload_length);
+    wire->message_type = htons(host->message_type);
+    wire->seq = htonl(host->seq);
+}
+
+void protocol_header_to_host(const protocol_header *wire,protocol_header *host)
 {
-    protocol_msg msg_copy;
-    msg_copy.hdr.version_major = msg->hdr.version_major;
-    msg_copy.hdr.version_minor = msg->hdr.version_minor;
-    msg_copy.hdr.payload_length = htonl(msg->hdr.payload_length);
-    msg_copy.hdr.message_type = htons(msg->hdr.message_type);
-    msg_copy.hdr.seq = htonl(msg->hdr.seq);
-    int res = send_all(fd,&msg_copy.hdr,sizeof(protocol_header));
-    if(res < 0)
+    host->message_type = ntohs(wire->message_type);
+    host->seq = ntohl(wire->seq);
+    host->payload_length = ntohl(wire->payload_length);
+    host->version_major = wire->version_major;
+    host->version_minor = wire->version_minor;
+}
+
+/* 发完 iov 里的全部数据，会修改 iov */
+static int sendmsg_all(int fd,struct iovec *iov,int cnt)
+{
+    while(cnt > 0)
     {
-        return -1;
+        struct msghdr mh = {0};
+        mh.msg_iov = iov;
+        mh.msg_iovlen = (size_t)(cnt > IOV_MAX ? IOV_MAX : cnt);
+        ssize_t m = sendmsg(fd,&mh,0);
+        if(m < 0)
+        {
+            if(errno == EINTR) continue;
+            return -1;
+        }
+        size_t done = (size_t)m;
+        while(cnt > 0 && done >= iov->iov_len)
+        {
+            done -= iov->iov_len;
+            iov++;
+            cnt--;
+        }
+        if(cnt > 0 && done > 0)
+        {
+            iov->iov_base = (uint8_t *)iov->iov_base + done;
+            iov->iov_len -= done;
+        }
     }
-    int data_res = send_all(fd,msg->payload,msg->hdr.payload_length);
-    if(data_res < 0)
+    return 0;
+}
+
+int send_message(int fd,protocol_msg *msg)
+{
+    protocol_header wire;
+    protocol_header_to_wire(&msg->hdr,&wire);
+    struct iovec iov[2];
+    iov[0].iov_base = &wire;
+    iov[0].iov_len = sizeof(protocol_header);
+    iov[1].iov_base = msg->payload;
+    iov[1].iov_len = msg->payload ? msg->hdr.payload_length : 0;
+    return sendmsg_all(fd,iov,2);
+}
+
+int send_messagev(int fd,protocol_msgv *msgs,int n)
+{
+    protocol_header wire[SENDV_MAX_MSGS];
+    struct iovec iov[IOV_MAX];
+    int i = 0;
+    while(i < n)
     {
-        return -1;
+        int nmsg = 0;
+        int cnt = 0;
+        // 装满头数组或 iov 数组就先发一批
+        while(i < n && nmsg < SENDV_MAX_MSGS && cnt + 1 + msgs[i].iovcnt <= IOV_MAX)
+        {
+            protocol_msgv *m = &msgs[i];
+            uint64_t total = 0;
+            for(int k = 0;k < m->iovcnt;k++) total += m->iov[k].iov_len;
+            if(total > UINT32_MAX)
+            {
+                errno = EMSGSIZE;
+                return -1;
+            }
+            m->hdr.payload_length = (uint32_t)total;
+            protocol_header_to_wire(&m->hdr,&wire[nmsg]);
+            iov[cnt].iov_base = &wire[nmsg];
+            iov[cnt].iov_len = sizeof(protocol_header);
+            cnt++;
+            for(int k = 0;k < m->iovcnt;k++) iov[cnt++] = m->iov[k];
+            nmsg++;
+            i++;
+        }
+        if(nmsg == 0)
+        {
+            // 单条消息的段数超过 IOV_MAX
+            errno = EINVAL;
+            return -1;
+        }
+        if(sendmsg_all(fd,iov,cnt) < 0)
+        {
+            return -1;
+        }
     }
     return 0;
 }
 
-int read_message(int fd,protocol_msg *msg)
+static int read_header(int fd,protocol_header *hdr)
 {
     protocol_header hdr_copy;
     int rec_res = recv_all(fd,&hdr_copy,sizeof(protocol_header));
@@ -119,11 +214,17 @@ int read_message(int fd,protocol_msg *msg)
     {
         return 1;
     }
-    msg->hdr.message_type = ntohs(hdr_copy.message_type);
-    msg->hdr.seq = ntohl(hdr_copy.seq);
-    msg->hdr.payload_length = ntohl(hdr_copy.payload_length);
-    msg->hdr.version_major = hdr_copy.version_major;
-    msg->hdr.version_minor = hdr_copy.version_minor;
+    protocol_header_to_host(&hdr_copy,hdr);
+    return 0;
+}
+
+int read_message(int fd,protocol_msg *msg)
+{
+    int hr = read_header(fd,&msg->hdr);
+    if(hr != 0)
+    {
+        return hr;
+    }
     uint8_t *data = malloc(sizeof(uint8_t) * msg->hdr.payload_length);
     if(data == NULL)
     {
@@ -138,4 +239,45 @@ int read_message(int fd,protocol_msg *msg)
     msg->payload = data;
     
     return 0;
-}
\ No newline at end of file
+}
+
+int read_message_into(int fd,protocol_msg *msg,void *buf,uint32_t cap)
+{
+    int hr = read_header(fd,&msg->hdr);
+    if(hr != 0)
+    {
+        return hr;
+    }
+    if(msg->hdr.payload_length > cap)
+    {
+        errno = EMSGSIZE;
+        return -3;
+    }
+    if(recv_all(fd,buf,msg->hdr.payload_length) < 0)
+    {
+        return -1;
+    }
+    msg->payload = buf;
+    return 0;
+}
+
+int read_message_pooled(int fd,protocol_msg *msg,msg_pool_t *pool)
+{
+    int hr = read_header(fd,&msg->hdr);
+    if(hr != 0)
+    {
+        return hr;
+    }
+    uint8_t *data = msg_pool_get(pool,msg->hdr.payload_length);
+    if(data == NULL)
+    {
+        return -2;
+    }
+    if(recv_all(fd,data,msg->hdr.payload_length) < 0)
+    {
+        msg_pool_put(pool,data);
+        return -1;
+    }
+    msg->payload = data;
+    return 0;
+}
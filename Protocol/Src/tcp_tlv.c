@@ -1,4 +1,5 @@
 #include "tcp_tlv.h"
+#include "crc32c.h"
 #include <string.h>
 #include <arpa/inet.h>
 
@@ -31,6 +32,40 @@ uint8_t* tlv_put_u32(uint8_t *out, uint8_t type, uint32_t v) {
     return tlv_put(out, type, &be, TLV_U32_LEN); 
 }
 
+uint8_t* tlv_put_range(uint8_t *out, uint64_t off, uint64_t len) {
+    uint64_t be[2] = { htonll_u64(off), htonll_u64(len) };
+    return tlv_put(out, TLV_RANGE, be, TLV_RANGE_LEN);
+}
+
+uint8_t* tlv_put_nack(uint8_t *out, uint32_t seq, uint32_t count) {
+    uint32_t be[2] = { htonl(seq), htonl(count) };
+    return tlv_put(out, TLV_NACK, be, TLV_NACK_LEN);
+}
+
+uint8_t* tlv_put_stat(uint8_t *out, const char *name, uint64_t v) {
+    uint32_t nlen = (uint32_t)strlen(name);
+    uint32_t n = htonl(TLV_U64_LEN + nlen);
+    uint64_t be = htonll_u64(v);
+    out[0] = TLV_STAT;
+    memcpy(out + TLV_TYPE_LEN, &n, TLV_LEN_LEN);
+    memcpy(out + TLV_HEADER_LEN, &be, TLV_U64_LEN);
+    memcpy(out + TLV_HEADER_LEN + TLV_U64_LEN, name, nlen);
+    return out + TLV_HEADER_LEN + TLV_U64_LEN + nlen;
+}
+
+int tlv_take_channel(const uint8_t **p, uint32_t *L, uint32_t *chan) {
+    const uint8_t *b = *p;
+    if (*L < TLV_CHANNEL_PREFIX_LEN || b[0] != TLV_CHANNEL) return 0;
+    uint32_t n, v;
+    memcpy(&n, b + TLV_TYPE_LEN, TLV_LEN_LEN);
+    if (ntohl(n) != TLV_U32_LEN) return 0;
+    memcpy(&v, b + TLV_HEADER_LEN, TLV_U32_LEN);
+    *chan = ntohl(v);
+    *p = b + TLV_CHANNEL_PREFIX_LEN;
+    *L -= TLV_CHANNEL_PREFIX_LEN;
+    return 1;
+}
+
 int tlv_walk(const uint8_t *p, uint32_t L,
              void (*cb)(uint8_t, const uint8_t*, uint32_t, void*),
              void *arg) {
@@ -47,6 +82,41 @@ int tlv_walk(const uint8_t *p, uint32_t L,
     return (off == L) ? 0 : -2;
 }
 
+typedef struct {
+    uint8_t   type;
+    uint32_t  width;
+    void     *out;
+    int       found;
+} _find_int_ctx;
+
+static void _cb_find_int(uint8_t t, const uint8_t *v, uint32_t n, void *arg) {
+    _find_int_ctx *ctx = (_find_int_ctx*)arg;
+    if (ctx->found || t != ctx->type || n != ctx->width) return;
+    if (n == TLV_U32_LEN) {
+        uint32_t be; memcpy(&be, v, TLV_U32_LEN);
+        *(uint32_t *)ctx->out = ntohl(be);
+    } else {
+        uint64_t be; memcpy(&be, v, TLV_U64_LEN);
+        *(uint64_t *)ctx->out = ntohll_u64(be);
+    }
+    ctx->found = 1;
+}
+
+static int _find_int(const uint8_t *p, uint32_t L, uint8_t type, uint32_t width, void *out) {
+    _find_int_ctx ctx = { .type = type, .width = width, .out = out, .found = 0 };
+    int r = tlv_walk(p, L, _cb_find_int, &ctx);
+    if (r < 0) return r;
+    return ctx.found ? 0 : 1;
+}
+
+int tlv_find_u32(const uint8_t *p, uint32_t L, uint8_t type, uint32_t *out) {
+    return _find_int(p, L, type, TLV_U32_LEN, out);
+}
+
+int tlv_find_u64(const uint8_t *p, uint32_t L, uint8_t type, uint64_t *out) {
+    return _find_int(p, L, type, TLV_U64_LEN, out);
+}
+
 int build_payload_file_start(const char *filename, uint64_t file_size,
                              uint8_t *out_buf, uint32_t out_cap, uint32_t *out_len) {
     uint32_t name_len = (uint32_t)strlen(filename);
@@ -63,17 +133,65 @@ int build_payload_file_start(const char *filename, uint64_t file_size,
 
 int build_payload_file_data(uint64_t offset, const uint8_t *data, uint32_t data_len,
                             uint8_t *out_buf, uint32_t out_cap, uint32_t *out_len) {
-    uint32_t need = TLV_HEADER_LEN + TLV_U64_LEN + TLV_HEADER_LEN + data_len;
+    uint32_t need = FILE_DATA_FRAMING_LEN + data_len;
     if (out_cap < need) return -1;
     uint8_t *w = out_buf;
     w = tlv_put_u64(w, TLV_OFFSET, offset);
     if (!w) return -2;
     w = tlv_put(w, TLV_DATA, data, data_len);
     if (!w) return -3;
+    w = tlv_put_u32(w, TLV_CRC32, crc32c(0, data, data_len));
+    *out_len = (uint32_t)(w - out_buf);
+    return 0;
+}
+
+static uint8_t *put_data_prefix(uint8_t *w, uint64_t offset, uint8_t type, uint32_t data_len) {
+    w = tlv_put_u64(w, TLV_OFFSET, offset);
+    uint32_t be = htonl(data_len);
+    *w++ = type;
+    memcpy(w, &be, TLV_LEN_LEN);
+    return w + TLV_LEN_LEN;
+}
+
+int build_payload_file_data_prefix(uint64_t offset, uint32_t data_len,
+                                   uint8_t *out_buf, uint32_t out_cap, uint32_t *out_len) {
+    if (out_cap < FILE_DATA_PREFIX_LEN) return -1;
+    uint8_t *w = put_data_prefix(out_buf, offset, TLV_DATA, data_len);
     *out_len = (uint32_t)(w - out_buf);
     return 0;
 }
 
+int build_iov_file_data(uint64_t offset, const uint8_t *data, uint32_t data_len, uint32_t crc,
+                        uint8_t *framing, struct iovec iov[3]) {
+    uint32_t plen = 0;
+    if (build_payload_file_data_prefix(offset, data_len, framing, FILE_DATA_PREFIX_LEN, &plen) < 0)
+        return -1;
+    uint8_t *suffix = framing + plen;
+    uint8_t *end = tlv_put_u32(suffix, TLV_CRC32, crc);
+    iov[0].iov_base = framing;
+    iov[0].iov_len  = plen;
+    iov[1].iov_base = (void *)data;
+    iov[1].iov_len  = data_len;
+    iov[2].iov_base = suffix;
+    iov[2].iov_len  = (size_t)(end - suffix);
+    return 0;
+}
+
+int build_iov_file_zdata(uint64_t offset, const uint8_t *zdata, uint32_t zlen,
+                         uint32_t raw_len, uint32_t crc,
+                         uint8_t *framing, struct iovec iov[3]) {
+    uint8_t *suffix = put_data_prefix(framing, offset, TLV_ZDATA, zlen);
+    uint8_t *end = tlv_put_u32(suffix, TLV_RAW_LEN, raw_len);
+    end = tlv_put_u32(end, TLV_CRC32, crc);
+    iov[0].iov_base = framing;
+    iov[0].iov_len  = (size_t)(suffix - framing);
+    iov[1].iov_base = (void *)zdata;
+    iov[1].iov_len  = zlen;
+    iov[2].iov_base = suffix;
+    iov[2].iov_len  = (size_t)(end - suffix);
+    return 0;
+}
+
 typedef struct {
     char     *fname;
     uint32_t  fname_cap;
@@ -108,30 +226,196 @@ int parse_payload_file_start(const uint8_t *p, uint32_t L,
     return 0;
 }
 
-typedef struct {
-    uint64_t     *off;
-    const uint8_t**data;
-    uint32_t     *len;
-} _data_parse_ctx;
-
 static void _cb_data(uint8_t t, const uint8_t *v, uint32_t n, void *arg) {
-    _data_parse_ctx *ctx = (_data_parse_ctx*)arg;
+    file_data_view_t *fv = (file_data_view_t*)arg;
     if (t == TLV_OFFSET && n == TLV_U64_LEN) {
         uint64_t be; memcpy(&be, v, TLV_U64_LEN); 
-        if (ctx->off) *ctx->off = ntohll_u64(be);
-    } else if (t == TLV_DATA) {
-        if (ctx->data) *ctx->data = v;
-        if (ctx->len)  *ctx->len  = n;
+        fv->offset = ntohll_u64(be);
+    } else if (t == TLV_DATA || t == TLV_ZDATA) {
+        fv->data = v;
+        fv->len  = n;
+        fv->compressed = (t == TLV_ZDATA);
+    } else if (t == TLV_RAW_LEN && n == TLV_U32_LEN) {
+        uint32_t be; memcpy(&be, v, TLV_U32_LEN);
+        fv->raw_len = ntohl(be);
+    } else if (t == TLV_CRC32 && n == TLV_U32_LEN) {
+        uint32_t be; memcpy(&be, v, TLV_U32_LEN);
+        fv->crc = ntohl(be);
+        fv->has_crc = 1;
     }
 }
 
+static inline uint32_t rd_be32(const uint8_t *p) {
+    uint32_t be; memcpy(&be, p, TLV_U32_LEN);
+    return ntohl(be);
+}
+
+static inline uint64_t rd_be64(const uint8_t *p) {
+    uint64_t be; memcpy(&be, p, TLV_U64_LEN);
+    return ntohll_u64(be);
+}
+
+/*
+ * build_iov_file_data 的固定布局：OFFSET(u64) + DATA，后面要么什么都没有要么正好一个 CRC32。
+ * 按固定位置取字段，类型和长度一起比较，对上了返回 1；别的形状（压缩、顺序不同、多余字段、
+ * 长度越界）返回 0 交给 tlv_walk，由它给出和以前一样的结果和错误码。
+ */
+static inline int file_data_fast(const uint8_t *p, uint32_t L, file_data_view_t *fv) {
+    if (L < FILE_DATA_PREFIX_LEN) return 0;
+    const uint8_t *d = p + TLV_HEADER_LEN + TLV_U64_LEN;
+    uint32_t dlen = rd_be32(d + TLV_TYPE_LEN);
+    uint32_t rest = L - FILE_DATA_PREFIX_LEN;
+    if (((uint32_t)(p[0] ^ TLV_OFFSET) | (uint32_t)(d[0] ^ TLV_DATA) |
+         (rd_be32(p + TLV_TYPE_LEN) ^ TLV_U64_LEN)) != 0 || dlen > rest) return 0;
+    rest -= dlen;
+    const uint8_t *c = d + TLV_HEADER_LEN + dlen;
+    int has_crc = rest != 0;
+    if (has_crc && (rest != FILE_DATA_SUFFIX_LEN || c[0] != TLV_CRC32 ||
+                    rd_be32(c + TLV_TYPE_LEN) != TLV_U32_LEN)) return 0;
+
+    fv->offset     = rd_be64(p + TLV_HEADER_LEN);
+    fv->data       = d + TLV_HEADER_LEN;
+    fv->len        = dlen;
+    fv->compressed = 0;
+    fv->raw_len    = 0;
+    fv->has_crc    = has_crc;
+    fv->crc        = has_crc ? rd_be32(c + TLV_HEADER_LEN) : 0;
+    return 1;
+}
+
+int parse_payload_file_data_view(const uint8_t *p, uint32_t L, file_data_view_t *fv) {
+    if (file_data_fast(p, L, fv)) return fv->len ? 0 : -11;
+
+    memset(fv, 0, sizeof(*fv));
+    int r = tlv_walk(p, L, _cb_data, fv);
+    if (r < 0) return r;
+    if (!fv->data) return -10;
+    if (fv->len == 0) return -11;
+    if (fv->compressed && fv->raw_len == 0) return -12;
+    return 0;
+}
+
 int parse_payload_file_data(const uint8_t *p, uint32_t L,
                             uint64_t *offset,
                             const uint8_t **data_ptr, uint32_t *data_len) {
-    _data_parse_ctx ctx = { .off = offset, .data = data_ptr, .len = data_len };
-    int r = tlv_walk(p, L, _cb_data, &ctx);
+    file_data_view_t fv;
+    int r = parse_payload_file_data_view(p, L, &fv);
     if (r < 0) return r;
-    if (!data_ptr || !*data_ptr) return -10;
-    if (data_len && *data_len == 0) return -11;
+    if (fv.compressed) return -13;
+    if (offset)   *offset   = fv.offset;
+    if (data_ptr) *data_ptr = fv.data;
+    if (data_len) *data_len = fv.len;
     return 0;
-}
\ No newline at end of file
+}
+
+typedef struct {
+    file_range_t *out;
+    uint32_t      cap;
+    uint32_t      n;
+} _ranges_parse_ctx;
+
+static void _cb_ranges(uint8_t t, const uint8_t *v, uint32_t n, void *arg) {
+    _ranges_parse_ctx *ctx = (_ranges_parse_ctx*)arg;
+    if (t != TLV_RANGE || n != TLV_RANGE_LEN) return;
+    if (ctx->n < ctx->cap) {
+        uint64_t be[2]; memcpy(be, v, TLV_RANGE_LEN);
+        ctx->out[ctx->n].off = ntohll_u64(be[0]);
+        ctx->out[ctx->n].len = ntohll_u64(be[1]);
+    }
+    ctx->n++;
+}
+
+int parse_payload_file_ranges(const uint8_t *p, uint32_t L, file_range_t *out, uint32_t cap) {
+    _ranges_parse_ctx ctx = { .out = out, .cap = cap, .n = 0 };
+    int r = tlv_walk(p, L, _cb_ranges, &ctx);
+    if (r < 0) return r;
+    return (int)ctx.n;
+}
+
+typedef struct {
+    seq_range_t *out;
+    uint32_t     cap;
+    uint32_t     n;
+} _nacks_parse_ctx;
+
+static void _cb_nacks(uint8_t t, const uint8_t *v, uint32_t n, void *arg) {
+    _nacks_parse_ctx *ctx = (_nacks_parse_ctx*)arg;
+    if (t != TLV_NACK || n != TLV_NACK_LEN) return;
+    if (ctx->n < ctx->cap) {
+        uint32_t be[2]; memcpy(be, v, TLV_NACK_LEN);
+        ctx->out[ctx->n].seq   = ntohl(be[0]);
+        ctx->out[ctx->n].count = ntohl(be[1]);
+    }
+    ctx->n++;
+}
+
+int parse_payload_nacks(const uint8_t *p, uint32_t L, seq_range_t *out, uint32_t cap) {
+    _nacks_parse_ctx ctx = { .out = out, .cap = cap, .n = 0 };
+    int r = tlv_walk(p, L, _cb_nacks, &ctx);
+    if (r < 0) return r;
+    return (int)ctx.n;
+}
+
+typedef struct {
+    stat_entry_t *out;
+    uint32_t      cap;
+    uint32_t      n;
+} _stats_parse_ctx;
+
+static void _cb_stats(uint8_t t, const uint8_t *v, uint32_t n, void *arg) {
+    _stats_parse_ctx *ctx = (_stats_parse_ctx*)arg;
+    if (t != TLV_STAT || n <= TLV_U64_LEN) return;
+    if (ctx->n < ctx->cap) {
+        uint64_t be; memcpy(&be, v, TLV_U64_LEN);
+        ctx->out[ctx->n].value    = ntohll_u64(be);
+        ctx->out[ctx->n].name     = (const char *)v + TLV_U64_LEN;
+        ctx->out[ctx->n].name_len = n - TLV_U64_LEN;
+    }
+    ctx->n++;
+}
+
+int parse_payload_stats(const uint8_t *p, uint32_t L, stat_entry_t *out, uint32_t cap) {
+    _stats_parse_ctx ctx = { .out = out, .cap = cap, .n = 0 };
+    int r = tlv_walk(p, L, _cb_stats, &ctx);
+    if (r < 0) return r;
+    return (int)ctx.n;
+}
+
+int build_payload_file_copy(const file_copy_t *fc, uint8_t *out_buf, uint32_t out_cap, uint32_t *out_len) {
+    if (out_cap < FILE_COPY_PAYLOAD_LEN) return -1;
+    uint8_t *w = out_buf;
+    w = tlv_put_u64(w, TLV_OFFSET, fc->offset);
+    w = tlv_put_u64(w, TLV_SRC_OFFSET, fc->src_offset);
+    w = tlv_put_u32(w, TLV_LENGTH, fc->len);
+    w = tlv_put_u32(w, TLV_CRC32, fc->crc);
+    *out_len = (uint32_t)(w - out_buf);
+    return 0;
+}
+
+typedef struct {
+    file_copy_t *fc;
+    uint32_t     seen;    // 四个字段各占一位
+} _copy_parse_ctx;
+
+static void _cb_copy(uint8_t t, const uint8_t *v, uint32_t n, void *arg) {
+    _copy_parse_ctx *ctx = (_copy_parse_ctx*)arg;
+    if (n == TLV_U64_LEN && (t == TLV_OFFSET || t == TLV_SRC_OFFSET)) {
+        uint64_t be; memcpy(&be, v, TLV_U64_LEN);
+        if (t == TLV_OFFSET) { ctx->fc->offset = ntohll_u64(be); ctx->seen |= 1; }
+        else { ctx->fc->src_offset = ntohll_u64(be); ctx->seen |= 2; }
+    } else if (n == TLV_U32_LEN && (t == TLV_LENGTH || t == TLV_CRC32)) {
+        uint32_t be; memcpy(&be, v, TLV_U32_LEN);
+        if (t == TLV_LENGTH) { ctx->fc->len = ntohl(be); ctx->seen |= 4; }
+        else { ctx->fc->crc = ntohl(be); ctx->seen |= 8; }
+    }
+}
+
+int parse_payload_file_copy(const uint8_t *p, uint32_t L, file_copy_t *fc) {
+    memset(fc, 0, sizeof(*fc));
+    _copy_parse_ctx ctx = { .fc = fc, .seen = 0 };
+    int r = tlv_walk(p, L, _cb_copy, &ctx);
+    if (r < 0) return r;
+    if (ctx.seen != 0xF) return -10;
+    if (fc->len == 0) return -11;
+    return 0;
+}
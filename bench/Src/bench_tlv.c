@@ -0,0 +1,336 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <sys/uio.h>
+#include "tcp_tlv.h"
+
+/*
+ * TLV 编解码的微基准。每项先预热，再跑 --rounds 轮、每轮 --iters 次，取最快一轮的
+ * 每次耗时，一项一行 JSON 输出到 stdout。--data 是 FILE_DATA 类测试里数据段的长度，
+ * 只影响会拷贝或算 CRC 的构造函数；解析只看头，不碰数据。
+ * file_data_view 分别用 build_iov_file_data 的布局（走固定布局快路径）和把 CRC32 放在
+ * 最前面的同样字段（走通用 tlv_walk）测，两者之差就是快路径省下的。例如：
+ *   bench_tlv --iters 2000000 --data 1400 --filter parse
+ */
+
+#ifndef BENCH_ITERS
+#define BENCH_ITERS  1000000
+#endif
+
+#ifndef BENCH_ROUNDS
+#define BENCH_ROUNDS 5
+#endif
+
+#define BENCH_DATA_MAX (16 * 1024 * 1024)
+
+/* 让编译器认为 p 指向的内容被读过，避免整段被优化掉 */
+#define SINK(p) __asm__ volatile("" : : "r"(p) : "memory")
+
+typedef struct
+{
+    uint8_t  *data;
+    uint32_t  data_len;
+    uint8_t  *out;              // 构造类测试的输出缓冲
+    uint32_t  out_cap;
+    uint8_t   start[256];       // FILE_START，带常见的可选字段
+    uint32_t  start_len;
+    uint8_t  *fd_fast;          // OFFSET + DATA + CRC32 连续拼好
+    uint32_t  fd_fast_len;
+    uint8_t  *fd_nocrc;         // OFFSET + DATA
+    uint32_t  fd_nocrc_len;
+    uint8_t  *fd_generic;       // CRC32 + OFFSET + DATA，同样的字段换个顺序
+    uint32_t  fd_generic_len;
+    uint8_t   credit[256];      // FILE_CREDIT：ACK_SEQ + CREDIT + 若干 NACK
+    uint32_t  credit_len;
+}bench_ctx_t;
+
+typedef struct
+{
+    const char *name;
+    void      (*fn)(bench_ctx_t *c, uint64_t iters);
+}bench_case_t;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void b_put_u32(bench_ctx_t *c, uint64_t iters)
+{
+    for (uint64_t i = 0; i < iters; ++i) {
+        uint8_t *w = tlv_put_u32(c->out, TLV_WINDOW, (uint32_t)i);
+        SINK(w);
+    }
+}
+
+static void b_put_u64(bench_ctx_t *c, uint64_t iters)
+{
+    for (uint64_t i = 0; i < iters; ++i) {
+        uint8_t *w = tlv_put_u64(c->out, TLV_OFFSET, i);
+        SINK(w);
+    }
+}
+
+static void b_put_stat(bench_ctx_t *c, uint64_t iters)
+{
+    for (uint64_t i = 0; i < iters; ++i) {
+        uint8_t *w = tlv_put_stat(c->out, "frames_in_total", i);
+        SINK(w);
+    }
+}
+
+static void b_build_start(bench_ctx_t *c, uint64_t iters)
+{
+    uint32_t len;
+    for (uint64_t i = 0; i < iters; ++i) {
+        build_payload_file_start("some/dir/file_name.bin", i, c->out, c->out_cap, &len);
+        SINK(c->out);
+    }
+}
+
+static void b_build_iov(bench_ctx_t *c, uint64_t iters)
+{
+    uint8_t framing[FILE_DATA_FRAMING_LEN];
+    struct iovec iov[3];
+    for (uint64_t i = 0; i < iters; ++i) {
+        build_iov_file_data(i * c->data_len, c->data, c->data_len, (uint32_t)i, framing, iov);
+        SINK(framing);
+        SINK(iov);
+    }
+}
+
+/* 拷贝数据并算 CRC32C，吞吐主要由数据长度决定 */
+static void b_build_data(bench_ctx_t *c, uint64_t iters)
+{
+    uint32_t len;
+    for (uint64_t i = 0; i < iters; ++i) {
+        build_payload_file_data(i, c->data, c->data_len, c->out, c->out_cap, &len);
+        SINK(c->out);
+    }
+}
+
+static void b_walk_data(bench_ctx_t *c, uint64_t iters)
+{
+    for (uint64_t i = 0; i < iters; ++i) {
+        int r = tlv_walk(c->fd_fast, c->fd_fast_len, NULL, NULL);
+        SINK(&r);
+    }
+}
+
+static void b_walk_start(bench_ctx_t *c, uint64_t iters)
+{
+    for (uint64_t i = 0; i < iters; ++i) {
+        int r = tlv_walk(c->start, c->start_len, NULL, NULL);
+        SINK(&r);
+    }
+}
+
+static void b_find_u32(bench_ctx_t *c, uint64_t iters)
+{
+    uint32_t v;
+    for (uint64_t i = 0; i < iters; ++i) {
+        int r = tlv_find_u32(c->start, c->start_len, TLV_CREDIT, &v);
+        SINK(&r);
+        SINK(&v);
+    }
+}
+
+static void b_parse_start(bench_ctx_t *c, uint64_t iters)
+{
+    char name[256];
+    uint64_t size;
+    for (uint64_t i = 0; i < iters; ++i) {
+        name[0] = '\0';
+        int r = parse_payload_file_start(c->start, c->start_len, name, sizeof(name), &size);
+        SINK(&r);
+        SINK(name);
+    }
+}
+
+static void parse_view(const uint8_t *p, uint32_t L, uint64_t iters)
+{
+    file_data_view_t fv;
+    for (uint64_t i = 0; i < iters; ++i) {
+        int r = parse_payload_file_data_view(p, L, &fv);
+        SINK(&r);
+        SINK(&fv);
+    }
+}
+
+static void b_parse_view_fast(bench_ctx_t *c, uint64_t iters)
+{
+    parse_view(c->fd_fast, c->fd_fast_len, iters);
+}
+
+static void b_parse_view_nocrc(bench_ctx_t *c, uint64_t iters)
+{
+    parse_view(c->fd_nocrc, c->fd_nocrc_len, iters);
+}
+
+static void b_parse_view_generic(bench_ctx_t *c, uint64_t iters)
+{
+    parse_view(c->fd_generic, c->fd_generic_len, iters);
+}
+
+static void b_parse_data(bench_ctx_t *c, uint64_t iters)
+{
+    uint64_t off;
+    const uint8_t *d;
+    uint32_t n;
+    for (uint64_t i = 0; i < iters; ++i) {
+        int r = parse_payload_file_data(c->fd_fast, c->fd_fast_len, &off, &d, &n);
+        SINK(&r);
+        SINK(&off);
+        SINK(&d);
+    }
+}
+
+static void b_parse_nacks(bench_ctx_t *c, uint64_t iters)
+{
+    seq_range_t out[8];
+    for (uint64_t i = 0; i < iters; ++i) {
+        int r = parse_payload_nacks(c->credit, c->credit_len, out, 8);
+        SINK(&r);
+        SINK(out);
+    }
+}
+
+static const bench_case_t g_cases[] = {
+    { "tlv_put_u32",                   b_put_u32 },
+    { "tlv_put_u64",                   b_put_u64 },
+    { "tlv_put_stat",                  b_put_stat },
+    { "build_payload_file_start",      b_build_start },
+    { "build_iov_file_data",           b_build_iov },
+    { "build_payload_file_data",       b_build_data },
+    { "tlv_walk/file_data",            b_walk_data },
+    { "tlv_walk/file_start",           b_walk_start },
+    { "tlv_find_u32/file_start",       b_find_u32 },
+    { "parse_payload_file_start",      b_parse_start },
+    { "parse_payload_file_data",       b_parse_data },
+    { "parse_file_data_view/fast",     b_parse_view_fast },
+    { "parse_file_data_view/no_crc",   b_parse_view_nocrc },
+    { "parse_file_data_view/generic",  b_parse_view_generic },
+    { "parse_payload_nacks",           b_parse_nacks },
+};
+
+static int setup(bench_ctx_t *c, uint32_t data_len)
+{
+    memset(c, 0, sizeof(*c));
+    c->data_len = data_len;
+    c->out_cap = FILE_DATA_FRAMING_LEN + data_len + 256;
+    c->data = malloc(data_len);
+    c->out = malloc(c->out_cap);
+    c->fd_fast = malloc(c->out_cap);
+    c->fd_nocrc = malloc(c->out_cap);
+    c->fd_generic = malloc(c->out_cap);
+    if (!c->data || !c->out || !c->fd_fast || !c->fd_nocrc || !c->fd_generic) return -1;
+    for (uint32_t i = 0; i < data_len; ++i) c->data[i] = (uint8_t)(i * 131u + 7u);
+
+    // 和线路上一样：framing 前缀 + 数据 + CRC32 后缀
+    uint8_t framing[FILE_DATA_FRAMING_LEN];
+    struct iovec iov[3];
+    build_iov_file_data(123456789, c->data, data_len, 0xdeadbeef, framing, iov);
+    uint8_t *w = c->fd_fast;
+    for (int i = 0; i < 3; ++i) {
+        memcpy(w, iov[i].iov_base, iov[i].iov_len);
+        w += iov[i].iov_len;
+    }
+    c->fd_fast_len = (uint32_t)(w - c->fd_fast);
+    c->fd_nocrc_len = c->fd_fast_len - FILE_DATA_SUFFIX_LEN;
+    memcpy(c->fd_nocrc, c->fd_fast, c->fd_nocrc_len);
+
+    w = tlv_put_u32(c->fd_generic, TLV_CRC32, 0xdeadbeef);
+    memcpy(w, c->fd_fast, c->fd_nocrc_len);
+    c->fd_generic_len = (uint32_t)(w - c->fd_generic) + c->fd_nocrc_len;
+
+    if (build_payload_file_start("some/dir/file_name.bin", 1ull << 30, c->start, 128, &c->start_len) < 0) return -1;
+    w = c->start + c->start_len;
+    w = tlv_put_u32(w, TLV_WINDOW, 64);
+    w = tlv_put_u64(w, TLV_XFER_ID, 0x1122334455667788ull);
+    w = tlv_put_u32(w, TLV_STREAMS, 4);
+    w = tlv_put_u32(w, TLV_CREDIT, 1);
+    c->start_len = (uint32_t)(w - c->start);
+
+    w = tlv_put_u32(c->credit, TLV_ACK_SEQ, 1000);
+    w = tlv_put_u32(w, TLV_CREDIT, 64);
+    for (uint32_t i = 0; i < 4; ++i) w = tlv_put_nack(w, 1000 + 8 * i, 2);
+    c->credit_len = (uint32_t)(w - c->credit);
+
+    // 快路径和通用路径必须给出同样的结果
+    file_data_view_t a, b;
+    if (parse_payload_file_data_view(c->fd_fast, c->fd_fast_len, &a) != 0 ||
+        parse_payload_file_data_view(c->fd_generic, c->fd_generic_len, &b) != 0 ||
+        a.offset != b.offset || a.len != b.len || a.crc != b.crc || a.has_crc != b.has_crc ||
+        memcmp(a.data, b.data, a.len) != 0) {
+        fprintf(stderr, "file_data_view fast/generic mismatch\n");
+        return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    uint64_t iters = BENCH_ITERS;
+    int rounds = BENCH_ROUNDS;
+    long data_len = 1400;
+    const char *filter = NULL;
+    for (int i = 1; i < argc; ++i) {
+        const char *v = (i + 1 < argc) ? argv[i + 1] : NULL;
+        if (strcmp(argv[i], "--iters") == 0 && v) {
+            iters = strtoull(v, NULL, 10);
+            ++i;
+        } else if (strcmp(argv[i], "--rounds") == 0 && v) {
+            rounds = atoi(v);
+            ++i;
+        } else if (strcmp(argv[i], "--data") == 0 && v) {
+            data_len = atol(v);
+            ++i;
+        } else if (strcmp(argv[i], "--filter") == 0 && v) {
+            filter = v;
+            ++i;
+        } else {
+            iters = 0;
+            break;
+        }
+    }
+    if (iters == 0 || rounds <= 0 || data_len <= 0 || data_len > BENCH_DATA_MAX) {
+        fprintf(stderr, "用法: %s [--iters N] [--rounds N] [--data BYTES] [--filter SUBSTR]\n"
+                        "  --iters  : 每轮次数（默认 %d）\n"
+                        "  --rounds : 轮数，取最快一轮（默认 %d）\n"
+                        "  --data   : FILE_DATA 数据段长度（默认 1400，最大 %d）\n"
+                        "  --filter : 只跑名字里含 SUBSTR 的项\n",
+                argv[0], BENCH_ITERS, BENCH_ROUNDS, BENCH_DATA_MAX);
+        return 1;
+    }
+
+    bench_ctx_t c;
+    if (setup(&c, (uint32_t)data_len) < 0) { fprintf(stderr, "setup failed\n"); return 1; }
+
+    for (size_t k = 0; k < sizeof(g_cases) / sizeof(g_cases[0]); ++k) {
+        const bench_case_t *bc = &g_cases[k];
+        if (filter && !strstr(bc->name, filter)) continue;
+        bc->fn(&c, iters / 10 + 1);
+        uint64_t best = UINT64_MAX;
+        for (int r = 0; r < rounds; ++r) {
+            uint64_t t0 = now_ns();
+            bc->fn(&c, iters);
+            uint64_t dt = now_ns() - t0;
+            if (dt < best) best = dt;
+        }
+        double ns = (double)best / (double)iters;
+        printf("{\"op\":\"%s\",\"data\":%ld,\"iters\":%llu,\"ns_per_op\":%.2f,\"mops\":%.2f}\n",
+               bc->name, data_len, (unsigned long long)iters, ns, ns > 0 ? 1e3 / ns : 0.0);
+        fflush(stdout);
+    }
+
+    free(c.data);
+    free(c.out);
+    free(c.fd_fast);
+    free(c.fd_nocrc);
+    free(c.fd_generic);
+    return 0;
+}
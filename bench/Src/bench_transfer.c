@@ -0,0 +1,735 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <libgen.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <linux/perf_event.h>
+#include "tcp_protocol.h"
+#include "tcp_tlv.h"
+#include "crc32c.h"
+
+/*
+ * 回环上传压测。每个组合起一个新的 tcp_n_server 子进程（工作目录在 --dir 下），
+ * 本进程按组合的块大小、连接数和乱序方式把内存里的一份随机数据当作文件上传，
+ * 每条连接发完 FILE_END 后半关闭并读到 EOF，再等服务器的活动连接只剩查询指标的那一条
+ * 且没有在途的异步写才算结束（io_uring 的写在连接关掉后可能还没完成）。
+ * 每个组合输出一行 JSON：吞吐、每 GB 的 CPU 秒和系统调用数，以及服务器 MSG_STATS 里
+ * 每块落盘耗时和在重排窗口里等待时间的 p50 / p99，io_uring 模式下还有缓冲池的取用次数、其中
+ * 真正 malloc 的次数（只是开头把池子填满的那些）和池子长满以后还要 malloc 的次数（应当为 0，
+ * --max-steady-allocs 给出上限时超过的组合算失败）。系统调用用 raw_syscalls:sys_enter
+ * tracepoint 的 perf 计数（含之后创建的线程）；tracefs 没挂载或没有权限时这几项输出 null。
+ * 例如：
+ *   bench_transfer --size 256m --chunk 16k,64k --window 8,256 --conns 1,4 --order seq,reverse32
+ *   bench_transfer --mode uring --size 64m --chunk 16k,64k --max-steady-allocs 0
+ */
+
+#ifndef BENCH_BATCH
+#define BENCH_BATCH 32              // 一次 send_messagev 合并的 FILE_DATA 数
+#endif
+
+#ifndef BENCH_PORT
+#define BENCH_PORT 9400
+#endif
+
+#define BENCH_FILE  "bench.bin"
+#define BENCH_LIST  16              // 每个维度最多几个取值
+
+enum { ORDER_SEQ, ORDER_SWAP, ORDER_SHUFFLE, ORDER_REVERSE };
+
+typedef struct
+{
+    const char *name;
+    int         kind;
+    uint32_t    n;                  // SHUFFLE / REVERSE 的块组大小
+}bench_order_t;
+
+typedef struct
+{
+    const char   *server;
+    const char   *dir;
+    uint64_t      size;
+    int           port;
+    int           repeat;
+    uint64_t      seed;
+    int64_t       max_steady;       // pool_steady_allocs 的上限，<0 不检查
+    const char   *modes[BENCH_LIST];    int nmodes;
+    uint64_t      chunks[BENCH_LIST];   int nchunks;
+    uint64_t      windows[BENCH_LIST];  int nwindows;
+    uint64_t      conns[BENCH_LIST];    int nconns;
+    bench_order_t orders[BENCH_LIST];   int norders;
+}bench_opts_t;
+
+typedef struct
+{
+    struct sockaddr_in addr;
+    const uint8_t *data;
+    uint64_t       fsize;
+    uint32_t       chunk;
+    const uint32_t *crcs;           // 每块的 CRC32C
+    uint64_t       lo, hi;          // 本连接负责的块号 [lo, hi)
+    uint32_t      *perm;            // 发送顺序，元素是相对 lo 的块号
+    uint32_t       range_crc;
+    uint64_t       xfer_id;
+    uint32_t       streams;
+    int            rc;
+}sender_t;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t xorshift(uint64_t *s)
+{
+    uint64_t x = *s;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *s = x;
+}
+
+static int parse_size(const char *v, uint64_t *out)
+{
+    char *end = NULL;
+    errno = 0;
+    unsigned long long n = strtoull(v, &end, 10);
+    if (errno || end == v) return -1;
+    switch (*end) {
+    case 'k': case 'K': n <<= 10; end++; break;
+    case 'm': case 'M': n <<= 20; end++; break;
+    case 'g': case 'G': n <<= 30; end++; break;
+    default: break;
+    }
+    if (*end != '\0' || n == 0) return -1;
+    *out = n;
+    return 0;
+}
+
+static int parse_order(const char *v, bench_order_t *o)
+{
+    static const struct { const char *prefix; int kind; } names[] = {
+        { "seq", ORDER_SEQ }, { "swap", ORDER_SWAP },
+        { "shuffle", ORDER_SHUFFLE }, { "reverse", ORDER_REVERSE },
+    };
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); ++i) {
+        size_t len = strlen(names[i].prefix);
+        if (strncmp(v, names[i].prefix, len) != 0) continue;
+        o->name = v;
+        o->kind = names[i].kind;
+        o->n = 0;
+        if (o->kind == ORDER_SHUFFLE || o->kind == ORDER_REVERSE) {
+            int n = atoi(v + len);
+            if (n < 2) return -1;
+            o->n = (uint32_t)n;
+        } else if (v[len] != '\0') {
+            return -1;
+        }
+        return 0;
+    }
+    return -1;
+}
+
+/* 逗号分隔的列表，原地切开 v；按 kind 解析每一项 */
+static int parse_list(char *v, int kind, bench_opts_t *o, const char *what)
+{
+    int n = 0;
+    for (char *save = NULL, *t = strtok_r(v, ",", &save); t; t = strtok_r(NULL, ",", &save)) {
+        if (n == BENCH_LIST) { fprintf(stderr, "too many values for %s\n", what); return -1; }
+        int bad = 0;
+        switch (kind) {
+        case 'm':
+            if (strcmp(t, "thread") && strcmp(t, "epoll") && strcmp(t, "uring")) bad = 1;
+            o->modes[n] = t;
+            break;
+        case 'c': bad = parse_size(t, &o->chunks[n]) < 0 || o->chunks[n] > 8 * 1024 * 1024; break;
+        case 'w': bad = parse_size(t, &o->windows[n]) < 0; break;
+        case 'n': bad = parse_size(t, &o->conns[n]) < 0 || o->conns[n] > 64; break;
+        case 'o': bad = parse_order(t, &o->orders[n]) < 0; break;
+        }
+        if (bad) { fprintf(stderr, "bad %s value '%s'\n", what, t); return -1; }
+        ++n;
+    }
+    if (n == 0) { fprintf(stderr, "empty %s\n", what); return -1; }
+    switch (kind) {
+    case 'm': o->nmodes = n; break;
+    case 'c': o->nchunks = n; break;
+    case 'w': o->nwindows = n; break;
+    case 'n': o->nconns = n; break;
+    case 'o': o->norders = n; break;
+    }
+    return 0;
+}
+
+static int parse_opts(int argc, char **argv, bench_opts_t *o)
+{
+    static char def_modes[] = "thread", def_chunks[] = "16k,64k,256k", def_windows[] = "8,256",
+                def_conns[] = "1,4", def_orders[] = "seq,swap,reverse32";
+    memset(o, 0, sizeof(*o));
+    o->size = 128ull << 20;
+    o->port = BENCH_PORT;
+    o->repeat = 1;
+    o->seed = 0x9e3779b97f4a7c15ull;
+    o->max_steady = -1;
+    parse_list(def_modes, 'm', o, "--mode");
+    parse_list(def_chunks, 'c', o, "--chunk");
+    parse_list(def_windows, 'w', o, "--window");
+    parse_list(def_conns, 'n', o, "--conns");
+    parse_list(def_orders, 'o', o, "--order");
+
+    for (int i = 1; i < argc; ++i) {
+        char *v = (i + 1 < argc) ? argv[i + 1] : NULL;
+        int r = 0;
+        if (!v) {
+            r = -1;
+        } else if (strcmp(argv[i], "--server") == 0) {
+            o->server = v;
+        } else if (strcmp(argv[i], "--dir") == 0) {
+            o->dir = v;
+        } else if (strcmp(argv[i], "--size") == 0) {
+            r = parse_size(v, &o->size);
+        } else if (strcmp(argv[i], "--port") == 0) {
+            o->port = atoi(v);
+            if (o->port <= 0 || o->port > 65535) r = -1;
+        } else if (strcmp(argv[i], "--repeat") == 0) {
+            o->repeat = atoi(v);
+            if (o->repeat <= 0) r = -1;
+        } else if (strcmp(argv[i], "--max-steady-allocs") == 0) {
+            o->max_steady = strtoll(v, NULL, 0);
+            if (o->max_steady < 0) r = -1;
+        } else if (strcmp(argv[i], "--seed") == 0) {
+            o->seed = strtoull(v, NULL, 0) | 1;
+        } else if (strcmp(argv[i], "--mode") == 0) {
+            r = parse_list(v, 'm', o, argv[i]);
+        } else if (strcmp(argv[i], "--chunk") == 0) {
+            r = parse_list(v, 'c', o, argv[i]);
+        } else if (strcmp(argv[i], "--window") == 0) {
+            r = parse_list(v, 'w', o, argv[i]);
+        } else if (strcmp(argv[i], "--conns") == 0) {
+            r = parse_list(v, 'n', o, argv[i]);
+        } else if (strcmp(argv[i], "--order") == 0) {
+            r = parse_list(v, 'o', o, argv[i]);
+        } else {
+            r = -1;
+        }
+        if (r < 0) { fprintf(stderr, "bad option '%s'\n", argv[i]); return -1; }
+        ++i;
+    }
+    return 0;
+}
+
+/* 没给 --server 时用和自己同目录的 tcp_n_server */
+static int default_server(char *out, size_t cap)
+{
+    char self[PATH_MAX];
+    ssize_t n = readlink("/proc/self/exe", self, sizeof(self) - 1);
+    if (n < 0) { perror("readlink /proc/self/exe"); return -1; }
+    self[n] = '\0';
+    if ((size_t)snprintf(out, cap, "%s/tcp_n_server", dirname(self)) >= cap) return -1;
+    return 0;
+}
+
+/* 进程累计的 CPU 时间（utime + stime）；pid 为 0 表示自己 */
+static uint64_t proc_cpu_ns(pid_t pid)
+{
+    if (pid == 0) {
+        struct rusage ru;
+        getrusage(RUSAGE_SELF, &ru);
+        return ((uint64_t)ru.ru_utime.tv_sec + (uint64_t)ru.ru_stime.tv_sec) * 1000000000ull +
+               ((uint64_t)ru.ru_utime.tv_usec + (uint64_t)ru.ru_stime.tv_usec) * 1000ull;
+    }
+
+    char path[64], buf[1024];
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+    FILE *f = fopen(path, "r");
+    if (!f) return 0;
+    size_t n = fread(buf, 1, sizeof(buf) - 1, f);
+    buf[n] = '\0';
+    fclose(f);
+    // comm 里可能有空格，从最后一个 ')' 之后数：state ... utime 是第 14 个字段，单位是时钟滴答
+    const char *p = strrchr(buf, ')');
+    unsigned long long ut = 0, st = 0;
+    if (!p || sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu", &ut, &st) != 2) return 0;
+    return (ut + st) * (1000000000ull / (uint64_t)sysconf(_SC_CLK_TCK));
+}
+
+static uint64_t g_sys_enter_id;     // raw_syscalls:sys_enter 的 tracepoint id，0 表示不可用
+
+static void find_sys_enter_id(void)
+{
+    static const char *const paths[] = {
+        "/sys/kernel/tracing/events/raw_syscalls/sys_enter/id",
+        "/sys/kernel/debug/tracing/events/raw_syscalls/sys_enter/id",
+    };
+    for (size_t i = 0; i < sizeof(paths) / sizeof(paths[0]) && !g_sys_enter_id; ++i) {
+        FILE *f = fopen(paths[i], "r");
+        if (!f) continue;
+        unsigned long long id = 0;
+        if (fscanf(f, "%llu", &id) == 1) g_sys_enter_id = id;
+        fclose(f);
+    }
+    if (!g_sys_enter_id) fprintf(stderr, "raw_syscalls:sys_enter not found (tracefs not mounted?), syscall counts disabled\n");
+}
+
+/*
+ * 数 pid 及其之后创建的线程的系统调用；on_exec 时计数从 pid 下一次 exec 开始。
+ * 不可用返回 -1。
+ */
+static int sys_counter_open(pid_t pid, int on_exec)
+{
+    if (!g_sys_enter_id) return -1;
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_TRACEPOINT;
+    attr.size = sizeof(attr);
+    attr.config = g_sys_enter_id;
+    attr.inherit = 1;
+    attr.disabled = on_exec ? 1 : 0;
+    attr.enable_on_exec = on_exec ? 1 : 0;
+    int fd = (int)syscall(SYS_perf_event_open, &attr, pid, -1, -1, PERF_FLAG_FD_CLOEXEC);
+    if (fd < 0) {
+        perror("perf_event_open raw_syscalls:sys_enter");
+        g_sys_enter_id = 0;
+    }
+    return fd;
+}
+
+static uint64_t sys_counter_read(int fd)
+{
+    uint64_t v = 0;
+    if (fd < 0 || read(fd, &v, sizeof(v)) != (ssize_t)sizeof(v)) return 0;
+    return v;
+}
+
+/* 起服务器并等到能连上；*sys_fd 是它的系统调用计数，不可用为 -1 */
+static pid_t start_server(const bench_opts_t *o, const char *mode, uint64_t window, int port, int *sys_fd)
+{
+    char port_s[16], win_s[24], win_max_s[24];
+    snprintf(port_s, sizeof(port_s), "%d", port);
+    snprintf(win_s, sizeof(win_s), "%llu", (unsigned long long)window);
+    // 初始窗口比默认上限大时一并抬高上限，否则服务器会把它截下来
+    snprintf(win_max_s, sizeof(win_max_s), "%llu", (unsigned long long)(window > 4096 ? window : 4096));
+
+    // 子进程等父进程把计数挂上再 exec，这样 exec 之后创建的 worker 线程都算在内
+    int go[2];
+    if (pipe2(go, O_CLOEXEC) < 0) { perror("pipe2"); return -1; }
+    pid_t pid = fork();
+    if (pid < 0) { perror("fork"); close(go[0]); close(go[1]); return -1; }
+    if (pid == 0) {
+        char c;
+        close(go[1]);
+        if (read(go[0], &c, 1) != 1) _exit(127);
+        if (chdir(o->dir) < 0) { perror("chdir"); _exit(127); }
+        int lfd = open("server.log", O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (lfd >= 0) { dup2(lfd, STDOUT_FILENO); dup2(lfd, STDERR_FILENO); }
+        execl(o->server, o->server, "--mode", mode, "--port", port_s, "--window", win_s,
+              "--window-max", win_max_s, "--log-level", "warn", (char *)NULL);
+        perror("exec tcp_n_server");
+        _exit(127);
+    }
+    close(go[0]);
+    *sys_fd = sys_counter_open(pid, 1);
+    if (write(go[1], "g", 1) != 1) perror("write");
+    close(go[1]);
+
+    // 等到能连上为止
+    struct sockaddr_in a = { .sin_family = AF_INET, .sin_port = htons((uint16_t)port) };
+    a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    for (int i = 0; i < 500; ++i) {
+        int status;
+        if (waitpid(pid, &status, WNOHANG) == pid) {
+            fprintf(stderr, "tcp_n_server exited early, see %s/server.log\n", o->dir);
+            if (*sys_fd >= 0) close(*sys_fd);
+            return -1;
+        }
+        int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd >= 0 && connect(fd, (struct sockaddr *)&a, sizeof(a)) == 0) {
+            close(fd);
+            return pid;
+        }
+        if (fd >= 0) close(fd);
+        usleep(10000);
+    }
+    fprintf(stderr, "tcp_n_server did not come up on port %d\n", port);
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+    if (*sys_fd >= 0) close(*sys_fd);
+    return -1;
+}
+
+static void stop_server(pid_t pid)
+{
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+}
+
+static int send_batch(int fd, protocol_msgv *msgs, int *n)
+{
+    int r = *n ? send_messagev(fd, msgs, *n) : 0;
+    *n = 0;
+    return r;
+}
+
+static int run_sender(sender_t *s, int fd)
+{
+    if (connect(fd, (struct sockaddr *)&s->addr, sizeof(s->addr)) < 0) { perror("connect"); return -1; }
+
+    uint8_t start[512];
+    uint32_t len = 0;
+    if (build_payload_file_start(BENCH_FILE, s->fsize, start,
+                                 sizeof(start) - 2 * TLV_HEADER_LEN - TLV_U64_LEN - TLV_U32_LEN, &len) < 0) {
+        return -1;
+    }
+    uint8_t *w = start + len;
+    if (s->streams > 1) {
+        w = tlv_put_u64(w, TLV_XFER_ID, s->xfer_id);
+        w = tlv_put_u32(w, TLV_STREAMS, s->streams);
+    }
+    protocol_msg m = {0};
+    m.hdr.version_major  = 1;
+    m.hdr.message_type   = MSG_FILE_START;
+    m.hdr.payload_length = (uint32_t)(w - start);
+    m.hdr.seq            = 0;
+    m.payload            = start;
+    if (send_message(fd, &m) < 0) { perror("send FILE_START"); return -1; }
+
+    // seq 按 offset 顺序编号（FILE_START 占 0），按 perm 的顺序发出去
+    protocol_msgv msgs[BENCH_BATCH];
+    struct iovec iov[BENCH_BATCH][3];
+    uint8_t framing[BENCH_BATCH][FILE_DATA_FRAMING_LEN];
+    int nb = 0;
+    uint64_t k = s->hi - s->lo;
+    for (uint64_t j = 0; j < k; ++j) {
+        uint64_t c = s->lo + s->perm[j];
+        uint64_t off = c * s->chunk;
+        uint32_t n = (uint32_t)(s->fsize - off < s->chunk ? s->fsize - off : s->chunk);
+        build_iov_file_data(off, s->data + off, n, s->crcs[c], framing[nb], iov[nb]);
+        memset(&msgs[nb], 0, sizeof(msgs[nb]));
+        msgs[nb].hdr.version_major = 1;
+        msgs[nb].hdr.message_type  = MSG_FILE_DATA;
+        msgs[nb].hdr.seq           = 1u + s->perm[j];
+        msgs[nb].iov               = iov[nb];
+        msgs[nb].iovcnt            = 3;
+        if (++nb == BENCH_BATCH && send_batch(fd, msgs, &nb) < 0) { perror("send FILE_DATA"); return -1; }
+    }
+    if (send_batch(fd, msgs, &nb) < 0) { perror("send FILE_DATA"); return -1; }
+
+    uint8_t end[TLV_HEADER_LEN + TLV_U32_LEN];
+    memset(&m, 0, sizeof(m));
+    m.hdr.version_major  = 1;
+    m.hdr.message_type   = MSG_FILE_END;
+    m.hdr.payload_length = (uint32_t)(tlv_put_u32(end, TLV_CRC32, s->range_crc) - end);
+    m.hdr.seq            = 1u + (uint32_t)k;
+    m.payload            = end;
+    if (send_message(fd, &m) < 0) { perror("send FILE_END"); return -1; }
+
+    // 半关闭后服务器处理完已收到的帧才会关连接，读到 EOF 就说明这条连接的数据都落盘了
+    shutdown(fd, SHUT_WR);
+    char sink[4096];
+    ssize_t r;
+    while ((r = read(fd, sink, sizeof(sink))) > 0 || (r < 0 && errno == EINTR)) {}
+    return r == 0 ? 0 : -1;
+}
+
+static void *sender_thread(void *arg)
+{
+    sender_t *s = arg;
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) { perror("socket"); s->rc = -1; return NULL; }
+    s->rc = run_sender(s, fd);
+    close(fd);
+    return NULL;
+}
+
+/* 按乱序方式排出 [0, k) 的发送顺序 */
+static void build_perm(uint32_t *perm, uint64_t k, const bench_order_t *o, uint64_t *seed)
+{
+    for (uint64_t i = 0; i < k; ++i) perm[i] = (uint32_t)i;
+    if (o->kind == ORDER_SWAP) {
+        // 和 tcp_client 的默认发送顺序一样：每两块先发后一块
+        for (uint64_t i = 0; i + 1 < k; i += 2) { perm[i] = (uint32_t)(i + 1); perm[i + 1] = (uint32_t)i; }
+        return;
+    }
+    if (o->kind == ORDER_SEQ) return;
+    for (uint64_t base = 0; base < k; base += o->n) {
+        uint64_t n = k - base < o->n ? k - base : o->n;
+        uint32_t *g = perm + base;
+        if (o->kind == ORDER_REVERSE) {
+            for (uint64_t i = 0; i < n / 2; ++i) {
+                uint32_t t = g[i]; g[i] = g[n - 1 - i]; g[n - 1 - i] = t;
+            }
+        } else {
+            for (uint64_t i = n - 1; i > 0; --i) {
+                uint64_t j = xorshift(seed) % (i + 1);
+                uint32_t t = g[i]; g[i] = g[j]; g[j] = t;
+            }
+        }
+    }
+}
+
+/* 服务器 MSG_STATS 里的指标，names 里每个名字取到 vals 对应位置，没有的留 0 */
+static int fetch_stats(int port, const char *const *names, uint64_t *vals, int n)
+{
+    struct sockaddr_in a = { .sin_family = AF_INET, .sin_port = htons((uint16_t)port) };
+    a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&a, sizeof(a)) < 0) {
+        perror("connect stats");
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    protocol_msg req = {0};
+    req.hdr.version_major = 1;
+    req.hdr.message_type  = MSG_STATS;
+    protocol_msg m = {0};
+    if (send_message(fd, &req) < 0 || read_message(fd, &m) != 0 || m.hdr.message_type != MSG_STATS) {
+        fprintf(stderr, "MSG_STATS failed\n");
+        free(m.payload);
+        close(fd);
+        return -1;
+    }
+    close(fd);
+
+    stat_entry_t ent[128];
+    int ne = parse_payload_stats(m.payload, m.hdr.payload_length, ent, 128);
+    memset(vals, 0, (size_t)n * sizeof(*vals));
+    for (int i = 0; i < ne; ++i) {
+        for (int k = 0; k < n; ++k) {
+            if (strlen(names[k]) == ent[i].name_len && memcmp(names[k], ent[i].name, ent[i].name_len) == 0) {
+                vals[k] = ent[i].value;
+            }
+        }
+    }
+    free(m.payload);
+    return ne < 0 ? -1 : 0;
+}
+
+/* 收到的文件和源数据逐字节比较，比完删掉 */
+static int verify_output(const char *dir, const uint8_t *data, uint64_t size)
+{
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/recv/%s", dir, BENCH_FILE);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) { perror(path); return -1; }
+    static uint8_t buf[1 << 20];
+    uint64_t off = 0;
+    int ok = 1;
+    ssize_t r;
+    while (ok && (r = read(fd, buf, sizeof(buf))) > 0) {
+        if (off + (uint64_t)r > size || memcmp(buf, data + off, (size_t)r) != 0) ok = 0;
+        off += (uint64_t)r;
+    }
+    close(fd);
+    unlink(path);
+    return ok && off == size ? 0 : -1;
+}
+
+static const char *const g_stat_names[] = {
+    "connections_active", "writes_inflight", "write_ns_p50", "write_ns_p99", "drain_ns_p50", "drain_ns_p99", "drain_ns_count_total",
+    "drop_old_total", "drop_far_total", "drop_budget_total", "crc_bad_total", "pool_gets_total", "pool_allocs_total",
+    "pool_steady_allocs_total",
+};
+enum { ST_ACTIVE, ST_INFLIGHT, ST_WRITE_P50, ST_WRITE_P99, ST_DRAIN_P50, ST_DRAIN_P99, ST_PARKED,
+       ST_DROP_OLD, ST_DROP_FAR, ST_DROP_BUDGET, ST_CRC_BAD, ST_POOL_GETS, ST_POOL_ALLOCS,
+       ST_POOL_STEADY, ST_N };
+
+static int run_case(const bench_opts_t *o, const uint8_t *data, const char *mode, uint32_t chunk,
+                    uint64_t window, uint32_t conns, const bench_order_t *order, int port, uint64_t *seed)
+{
+    uint64_t nchunks = (o->size + chunk - 1) / chunk;
+    if (conns > nchunks) conns = (uint32_t)nchunks;
+    uint64_t per = (nchunks + conns - 1) / conns;
+
+    uint32_t *crcs = malloc(nchunks * sizeof(*crcs));
+    sender_t *ss = calloc(conns, sizeof(*ss));
+    pthread_t *ths = calloc(conns, sizeof(*ths));
+    if (!crcs || !ss || !ths) { perror("malloc"); free(crcs); free(ss); free(ths); return -1; }
+    for (uint64_t c = 0; c < nchunks; ++c) {
+        uint64_t off = c * chunk;
+        crcs[c] = crc32c(0, data + off, o->size - off < chunk ? o->size - off : chunk);
+    }
+
+    struct sockaddr_in a = { .sin_family = AF_INET, .sin_port = htons((uint16_t)port) };
+    a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    uint64_t xfer_id = xorshift(seed);
+    int rc = 0;
+    for (uint32_t i = 0; i < conns; ++i) {
+        sender_t *s = &ss[i];
+        s->addr    = a;
+        s->data    = data;
+        s->fsize   = o->size;
+        s->chunk   = chunk;
+        s->crcs    = crcs;
+        s->lo      = (uint64_t)i * per < nchunks ? (uint64_t)i * per : nchunks;
+        s->hi      = s->lo + per < nchunks ? s->lo + per : nchunks;
+        s->xfer_id = xfer_id;
+        s->streams = conns;
+        uint64_t lo_off = s->lo * chunk, hi_off = s->hi * chunk < o->size ? s->hi * chunk : o->size;
+        s->range_crc = crc32c(0, data + lo_off, hi_off - lo_off);
+        s->perm = malloc((s->hi - s->lo + 1) * sizeof(*s->perm));
+        if (!s->perm) { perror("malloc"); rc = -1; break; }
+        build_perm(s->perm, s->hi - s->lo, order, seed);
+    }
+
+    int srv_sys = -1;
+    pid_t pid = rc == 0 ? start_server(o, mode, window, port, &srv_sys) : -1;
+    if (pid < 0) rc = -1;
+
+    if (rc == 0) {
+        int cli_sys = sys_counter_open(0, 0);
+        uint64_t s_cpu0 = proc_cpu_ns(pid), c_cpu0 = proc_cpu_ns(0);
+        uint64_t s_sys0 = sys_counter_read(srv_sys), c_sys0 = sys_counter_read(cli_sys);
+        uint64_t t0 = now_ns();
+
+        uint32_t started = 0;
+        for (; started < conns; ++started) {
+            if (pthread_create(&ths[started], NULL, sender_thread, &ss[started]) != 0) {
+                perror("pthread_create");
+                rc = -1;
+                break;
+            }
+        }
+        for (uint32_t i = 0; i < started; ++i) {
+            pthread_join(ths[i], NULL);
+            if (ss[i].rc < 0) rc = -1;
+        }
+
+        uint64_t c_sys1 = sys_counter_read(cli_sys), c_cpu1 = proc_cpu_ns(0);
+
+        // 除了查询自己的这条连接都关了、异步写也都完成了才算服务器处理完
+        uint64_t st[ST_N];
+        for (int tries = 0; ; ++tries) {
+            if (fetch_stats(port, g_stat_names, st, ST_N) < 0) { memset(st, 0, sizeof(st)); rc = -1; break; }
+            if (st[ST_ACTIVE] <= 1 && st[ST_INFLIGHT] == 0) break;
+            if (tries == 30000) { fprintf(stderr, "server still has open connections\n"); rc = -1; break; }
+            usleep(1000);
+        }
+        uint64_t t1 = now_ns();
+        uint64_t s_sys1 = sys_counter_read(srv_sys), s_cpu1 = proc_cpu_ns(pid);
+        stop_server(pid);
+        int ok = rc == 0 && verify_output(o->dir, data, o->size) == 0;
+
+        double secs = (double)(t1 - t0) / 1e9;
+        double gb = (double)o->size / 1e9;
+        double srv_cpu = (double)(s_cpu1 - s_cpu0) / 1e9, cli_cpu = (double)(c_cpu1 - c_cpu0) / 1e9;
+        printf("{\"mode\":\"%s\",\"chunk\":%u,\"window\":%llu,\"conns\":%u,\"order\":\"%s\",\"bytes\":%llu,"
+               "\"secs\":%.6f,\"mb_s\":%.1f,\"cpu_s_per_gb\":%.3f,\"server_cpu_s_per_gb\":%.3f,"
+               "\"client_cpu_s_per_gb\":%.3f,",
+               mode, chunk, (unsigned long long)window, conns, order->name, (unsigned long long)o->size,
+               secs, (double)o->size / 1e6 / secs, (srv_cpu + cli_cpu) / gb, srv_cpu / gb, cli_cpu / gb);
+        if (srv_sys >= 0 && cli_sys >= 0) {
+            double srv_sc = (double)(s_sys1 - s_sys0), cli_sc = (double)(c_sys1 - c_sys0);
+            printf("\"syscalls_per_gb\":%.0f,\"server_syscalls_per_gb\":%.0f,\"client_syscalls_per_gb\":%.0f,",
+                   (srv_sc + cli_sc) / gb, srv_sc / gb, cli_sc / gb);
+        } else {
+            printf("\"syscalls_per_gb\":null,\"server_syscalls_per_gb\":null,\"client_syscalls_per_gb\":null,");
+        }
+        printf("\"write_p50_ns\":%llu,\"write_p99_ns\":%llu,\"parked\":%llu,\"window_wait_p50_ns\":%llu,"
+               "\"window_wait_p99_ns\":%llu,\"dropped\":%llu,\"crc_bad\":%llu,\"pool_gets\":%llu,\"pool_allocs\":%llu,"
+               "\"pool_steady_allocs\":%llu,\"ok\":%s}\n",
+               (unsigned long long)st[ST_WRITE_P50], (unsigned long long)st[ST_WRITE_P99],
+               (unsigned long long)st[ST_PARKED],
+               (unsigned long long)st[ST_DRAIN_P50], (unsigned long long)st[ST_DRAIN_P99],
+               (unsigned long long)(st[ST_DROP_OLD] + st[ST_DROP_FAR] + st[ST_DROP_BUDGET]),
+               (unsigned long long)st[ST_CRC_BAD], (unsigned long long)st[ST_POOL_GETS],
+               (unsigned long long)st[ST_POOL_ALLOCS], (unsigned long long)st[ST_POOL_STEADY],
+               ok ? "true" : "false");
+        fflush(stdout);
+        if (!ok) rc = -1;
+        if (o->max_steady >= 0 && st[ST_POOL_STEADY] > (uint64_t)o->max_steady) {
+            fprintf(stderr, "%s: %llu pool allocations after the pool was full (max %lld)\n",
+                    mode, (unsigned long long)st[ST_POOL_STEADY], (long long)o->max_steady);
+            rc = -1;
+        }
+        if (cli_sys >= 0) close(cli_sys);
+        if (srv_sys >= 0) close(srv_sys);
+    }
+
+    for (uint32_t i = 0; i < conns; ++i) free(ss[i].perm);
+    free(crcs);
+    free(ss);
+    free(ths);
+    return rc;
+}
+
+int main(int argc, char **argv)
+{
+    bench_opts_t o;
+    char server[PATH_MAX];
+    if (parse_opts(argc, argv, &o) < 0) {
+        fprintf(stderr, "用法: %s [--server PATH] [--dir DIR] [--size BYTES] [--port PORT] [--repeat N] [--seed N]\n"
+                        "          [--mode LIST] [--chunk LIST] [--window LIST] [--conns LIST] [--order LIST] [--max-steady-allocs N]\n"
+                        "  LIST 逗号分隔，按所有组合各跑 --repeat 次，每次一行 JSON 输出到 stdout\n"
+                        "  --mode   : thread|epoll|uring（默认 thread）\n"
+                        "  --chunk  : FILE_DATA 块大小（默认 16k,64k,256k）\n"
+                        "  --window : 服务器初始重排窗口（默认 8,256）\n"
+                        "  --conns  : 分段上传的连接数（默认 1,4）\n"
+                        "  --order  : seq | swap | shuffleN | reverseN，后两种在每 N 块内打乱 / 倒序（默认 seq,swap,reverse32）\n"
+                        "  --size   : 上传的数据量（默认 128M），文件写在 DIR/recv 下，每次比对后删除\n"
+                        "  --dir    : 服务器的工作目录（默认新建 /tmp/bench_transfer.XXXXXX，全部成功后删除）\n"
+                        "  --max-steady-allocs : 缓冲池长满后的 malloc 次数超过 N 的组合算失败\n",
+                argv[0]);
+        return 1;
+    }
+    if (!o.server) {
+        if (default_server(server, sizeof(server)) < 0) return 1;
+        o.server = server;
+    }
+    if (access(o.server, X_OK) < 0) { perror(o.server); return 1; }
+    // 没给 --dir 时用临时目录，全部成功后删掉
+    char tmpdir[] = "/tmp/bench_transfer.XXXXXX";
+    int own_dir = !o.dir;
+    if (own_dir && !(o.dir = mkdtemp(tmpdir))) { perror("mkdtemp"); return 1; }
+    signal(SIGPIPE, SIG_IGN);
+    find_sys_enter_id();
+
+    uint8_t *data = malloc(o.size);
+    if (!data) { perror("malloc"); return 1; }
+    uint64_t seed = o.seed;
+    for (uint64_t i = 0; i < o.size; i += 8) {
+        uint64_t v = xorshift(&seed);
+        memcpy(data + i, &v, o.size - i < 8 ? o.size - i : 8);
+    }
+
+    // 每个组合换一个端口，避免上一个服务器的连接还在 TIME_WAIT
+    int port = o.port, failed = 0;
+    for (int m = 0; m < o.nmodes; ++m)
+    for (int c = 0; c < o.nchunks; ++c)
+    for (int w = 0; w < o.nwindows; ++w)
+    for (int n = 0; n < o.nconns; ++n)
+    for (int r = 0; r < o.norders; ++r)
+    for (int k = 0; k < o.repeat; ++k) {
+        if (run_case(&o, data, o.modes[m], (uint32_t)o.chunks[c], o.windows[w], (uint32_t)o.conns[n],
+                     &o.orders[r], port, &seed) < 0) {
+            failed++;
+        }
+        port = port < 65535 ? port + 1 : o.port;
+    }
+    free(data);
+    if (failed) {
+        fprintf(stderr, "%d case(s) failed, see %s/server.log\n", failed, o.dir);
+    } else if (own_dir) {
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/server.log", o.dir);
+        unlink(path);
+        snprintf(path, sizeof(path), "%s/recv", o.dir);
+        rmdir(path);
+        rmdir(o.dir);
+    }
+    return failed ? 1 : 0;
+}
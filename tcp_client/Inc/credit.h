@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * 信用流控和选择性重发（客户端一侧）。服务器的 FILE_CREDIT 报 ACK_SEQ（它下一个要落盘的 seq）
+ * 和从它起还能发的 seq 数，丢了块时还带 NACK 段。发送方在途的 seq 不超过信用；已发未确认的
+ * 块只记 offset 和长度，被 NACK 时按 offset 重读文件重发，不需要留着数据本身。
+ */
+
+// 同一个 seq 最多重发几次，还补不上就放弃这次上传
+#ifndef RETRANSMIT_MAX
+#define RETRANSMIT_MAX 8
+#endif
+
+typedef struct
+{
+    uint64_t off;
+    uint32_t len;
+    uint32_t tries;
+}credit_rec_t;
+
+typedef struct
+{
+    int       on;
+    int       dgram;      // UDP：每条应答是一个数据报，服务器超时补报的 NACK 可能包括还没发的 seq
+    int       fd;
+    int       file_fd;
+    uint32_t  ack;
+    uint32_t  credit;
+    credit_rec_t *rec;    // [base, base+n) 各 seq 的数据位置，存在 rec[seq & (cap-1)]
+    uint32_t  cap;
+    uint32_t  base;
+    uint32_t  n;
+    uint8_t  *buf;        // 重发时读文件用，按需分配
+    uint64_t  stalls;     // 因信用用完而等待的次数
+    uint64_t  resent;     // 重发的块数
+}credit_t;
+
+/* FILE_START 发出后调用；初始信用为 0，第一块数据之前要等服务器的第一条 FILE_CREDIT */
+void credit_init(credit_t *c, int fd, int file_fd, uint32_t next_seq);
+
+void credit_free(credit_t *c);
+
+/* 返回现在能发的 seq 数（1..want），一个都没有时阻塞等 FILE_CREDIT；出错或超时返回 -1。未开启时返回 want */
+int  credit_wait(credit_t *c, uint32_t next_seq, uint32_t want);
+
+/* seq 这一块（文件的 [off, off+len)）已经发出，确认之前被 NACK 就重发 */
+int  credit_sent(credit_t *c, uint32_t seq, uint64_t off, uint32_t len);
+
+/* FILE_END 之后等 ACK_SEQ 越过它，期间照常处理 NACK */
+int  credit_drain(credit_t *c, uint32_t next_seq);
+
+/* 最多等 timeout_ms 收一条 FILE_CREDIT 并处理（更新信用、重发 NACK 的块）：1 收到，0 超时，-1 出错 */
+int  credit_poll(credit_t *c, int timeout_ms);
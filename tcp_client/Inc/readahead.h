@@ -0,0 +1,64 @@
+#pragma once
+
+#include <stdint.h>
+#include <pthread.h>
+
+/*
+ * 读盘和发送分成两级流水：读线程用 pread 把 [lo, hi) 按块读进一个环形缓冲，
+ * 发送方从环里按顺序取块，用完归还。磁盘慢时发送方等读线程，socket 堵时读线程
+ * 最多领先 depth 块。开了压缩时中间再加一级：一组压缩线程按块并行压缩，
+ * 发送方仍按顺序拿到压缩好的块。
+ */
+
+typedef struct
+{
+    uint8_t *data;
+    uint64_t off;
+    uint32_t len;
+    uint32_t crc;       // 读线程读完顺手算好的 CRC32C
+    uint8_t *zdata;     // 压缩结果；zlen 为 0 表示没压（没开压缩或压不小）
+    uint32_t zlen;
+    int      ready;
+}ra_chunk_t;
+
+typedef struct
+{
+    ra_chunk_t *slots;
+    uint8_t    *mem;
+    uint8_t    *zmem;
+    uint32_t    zcap;
+    uint32_t    depth;
+    uint32_t    chunk;
+    uint64_t    head;       // 下一个要交给发送方的块
+    uint64_t    tail;       // 下一个要读进来的块
+    int         eof;
+    int         err;        // 读线程出错时的 errno
+    int         stop;       // 发送方放弃，读线程尽快退出
+
+    int         codec;
+    uint64_t    zq;         // 下一个要压缩的块
+    uint32_t    nworkers;
+    pthread_t  *workers;
+    pthread_cond_t  zwork;
+
+    int         file_fd;
+    uint64_t    lo, hi;
+
+    pthread_mutex_t mu;
+    pthread_cond_t  not_full;
+    pthread_cond_t  not_empty;
+    pthread_t       th;
+}readahead_t;
+
+/* 分配 depth 块、每块 chunk 字节的环并启动读线程；codec 非 0 时另起 nworkers 个压缩线程 */
+int  readahead_start(readahead_t *ra, int file_fd, uint64_t lo, uint64_t hi,
+                     uint32_t depth, uint32_t chunk, int codec, uint32_t nworkers);
+
+/* 取第 idx 个未归还的块（0 是最早的），必要时等待；读完返回 NULL，出错返回 NULL 且 ra->err 非 0 */
+const ra_chunk_t *readahead_peek(readahead_t *ra, uint32_t idx);
+
+/* 归还最早的 n 个块 */
+void readahead_release(readahead_t *ra, uint32_t n);
+
+/* 停止读线程并释放环 */
+void readahead_stop(readahead_t *ra);
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <stdint.h>
+#include <netinet/in.h>
+
+#include "tcp_protocol.h"
+
+#define CHUNK_SZ (64 * 1024)
+
+// 读盘流水线每条连接领先发送的块数
+#ifndef READAHEAD_DEPTH
+#define READAHEAD_DEPTH 8
+#endif
+
+// 每条连接的压缩线程数
+#ifndef COMPRESS_WORKERS
+#define COMPRESS_WORKERS 4
+#endif
+
+// 等服务器应答（FILE_ACCEPT / FILE_RANGES）的秒数
+#ifndef REPLY_TIMEOUT_S
+#define REPLY_TIMEOUT_S 5
+#endif
+
+#ifndef SEND_MAX_STREAMS
+#define SEND_MAX_STREAMS 64
+#endif
+
+// sendfiles 同时在传的文件数（每个占一个通道）
+#ifndef MUX_DEFAULT
+#define MUX_DEFAULT 16
+#endif
+
+#ifndef MUX_MAX
+#define MUX_MAX 256
+#endif
+
+// 进度行最多每隔多少毫秒刷新一次；stderr 不带缓冲且有锁，每块都写会把多条连接串行化
+#ifndef PROGRESS_MS
+#define PROGRESS_MS 200
+#endif
+
+// UDP 上传：默认块长（加上头不超过以太网 MTU，不会分片）、上限；默认请求的窗口（块数）
+#ifndef UDP_CHUNK_SZ
+#define UDP_CHUNK_SZ 1400
+#endif
+#ifndef UDP_CHUNK_MAX
+#define UDP_CHUNK_MAX 65000
+#endif
+#ifndef UDP_WINDOW
+#define UDP_WINDOW 1024
+#endif
+
+// UDP 上传：FILE_START / FILE_END 多久没被信用确认就重发，最多重发几次
+#ifndef UDP_RESEND_MS
+#define UDP_RESEND_MS 200
+#endif
+#ifndef UDP_RESEND_MAX
+#define UDP_RESEND_MAX 50
+#endif
+
+// echoload：默认连接数、每条连接在途的请求数；上限
+#ifndef ECHO_LOAD_CONNS
+#define ECHO_LOAD_CONNS 100
+#endif
+#ifndef ECHO_LOAD_INFLIGHT
+#define ECHO_LOAD_INFLIGHT 8
+#endif
+#ifndef ECHO_LOAD_MAX_CONNS
+#define ECHO_LOAD_MAX_CONNS 100000
+#endif
+#ifndef ECHO_LOAD_MAX_INFLIGHT
+#define ECHO_LOAD_MAX_INFLIGHT 4096
+#endif
+
+typedef struct {
+    uint32_t window;        // 请求服务器的重排窗口大小，0 表示用服务器默认
+    int      zerocopy;      // 数据块用 sendfile 直接从页缓存发出，用户态只拼头部
+    uint32_t streams;       // 分段上传的连接数，0/1 表示只用已有连接
+    uint32_t readahead;     // 读盘环的块数，0 表示 READAHEAD_DEPTH
+    int      compress;      // 在 FILE_START 里提供 codec，服务器同意后按块压缩
+    uint32_t compress_workers;  // 0 表示 COMPRESS_WORKERS
+    int      resume;        // 先问服务器已收范围，只补发缺的部分
+    int      delta;         // 增量同步：按服务器旧文件的块签名只发变化的部分
+    uint32_t delta_block;   // 签名块长，0 表示由服务器按旧文件大小定
+    int      credit;        // 信用流控：在途的 seq 不超过服务器 FILE_CREDIT 给的额度，被 NACK 的块重发
+    uint32_t mux;           // sendfiles 同时在传的文件数，0 表示 MUX_DEFAULT
+    int      udp;           // 走 UDP：每个数据报一帧，可靠性靠服务器的信用和 NACK
+    uint32_t udp_chunk;     // UDP 块长，0 表示 UDP_CHUNK_SZ
+    uint32_t rate_mbit;     // UDP 发送限速（Mbit/s），0 表示只受信用限制
+    struct sockaddr_in server;  // 额外连接的目标地址
+} send_opts_t;
+
+/* fd 是已连上的第一条连接；streams > 1 时其余连接在各自线程里建立 */
+int send_file(int fd, const char *path, const send_opts_t *opts);
+
+/* 增量同步，send_file 在 opts->delta 时转到这里 */
+int send_file_delta(int fd, const char *path, const send_opts_t *opts);
+
+/* UDP 上传，自己建 socket 发到 server；opts->window 为 0 时请求 UDP_WINDOW */
+int send_file_udp(const struct sockaddr_in *server, const char *path, const send_opts_t *opts);
+
+/* 多个文件在同一条连接上按通道交错发送，最多 opts->mux 个同时在传 */
+int send_files_mux(int fd, const char *const *paths, int npaths, const send_opts_t *opts);
+
+/* 距上次刷新进度不到 PROGRESS_MS 返回 0；几个线程同时到期只有一个拿到 1 */
+int progress_due(void);
+
+/* 等一条 type 类型的应答，timeout_s 为 0 表示一直等；成功时 m->payload 由调用者 free */
+int read_reply(int fd, uint8_t type, const char *what, int timeout_s, protocol_msg *m);
+
+/* 发 MSG_STATS 打印服务器指标；interval_s > 0 时每 interval_s 秒重复，count 为 0 表示一直打 */
+int query_stats(int fd, int interval_s, int count);
+
+typedef struct {
+    struct sockaddr_in server;
+    uint32_t conns;         // 连接总数
+    uint32_t threads;       // 工作线程数，连接平均分给各线程
+    uint32_t inflight;      // 每条连接保持在途的 ECHO 个数
+    uint32_t size;          // 每个请求的 payload 字节数
+    uint32_t duration_s;    // 持续发送的秒数
+    uint32_t interval_s;    // 每隔多少秒打一行吞吐和时延，0 表示只打最后的合计
+} echo_load_opts_t;
+
+/* 保持 conns 条连接各 inflight 个 ECHO 在途，按 seq 对上回包统计往返时延 */
+int echo_load(const echo_load_opts_t *o);
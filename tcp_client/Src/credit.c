@@ -0,0 +1,239 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include "credit.h"
+#include "tcp_protocol.h"
+#include "tcp_tlv.h"
+#include "tcp_client.h"
+#include "crc32c.h"
+
+// 一条 FILE_CREDIT 最大的长度（UDP 数据报和 TCP 帧一样）：ACK_SEQ、CREDIT 加上 NACK_MAX_RANGES 段 NACK 还有富余
+#define CREDIT_MAX_DATAGRAM 4096
+
+static inline int seq_before(uint32_t a, uint32_t b) {
+    return (int32_t)(a - b) < 0;
+}
+
+void credit_init(credit_t *c, int fd, int file_fd, uint32_t next_seq) {
+    credit_free(c);
+    c->on = 1;
+    c->fd = fd;
+    c->file_fd = file_fd;
+    c->ack = next_seq;
+    c->base = next_seq;
+}
+
+void credit_free(credit_t *c) {
+    free(c->rec);
+    free(c->buf);
+    uint64_t stalls = c->stalls, resent = c->resent;
+    memset(c, 0, sizeof(*c));
+    c->stalls = stalls;
+    c->resent = resent;
+}
+
+static credit_rec_t *find_rec(credit_t *c, uint32_t seq) {
+    if (seq - c->base >= c->n) return NULL;
+    return &c->rec[seq & (c->cap - 1)];
+}
+
+/* 容量翻倍，各记录按新的 cap 重新放 */
+static int grow_rec(credit_t *c) {
+    uint32_t cap = c->cap ? c->cap * 2 : 64;
+    credit_rec_t *nr = calloc(cap, sizeof(*nr));
+    if (!nr) return -1;
+    for (uint32_t i = 0; i < c->n; ++i) {
+        uint32_t seq = c->base + i;
+        nr[seq & (cap - 1)] = c->rec[seq & (c->cap - 1)];
+    }
+    free(c->rec);
+    c->rec = nr;
+    c->cap = cap;
+    return 0;
+}
+
+int credit_sent(credit_t *c, uint32_t seq, uint64_t off, uint32_t len) {
+    if (!c->on) return 0;
+    if (c->n == 0) c->base = seq;
+    if (seq_before(seq, c->base)) return 0;
+    uint32_t need = seq - c->base + 1;
+    while (need > c->cap) {
+        if (grow_rec(c) < 0) { perror("calloc"); return -1; }
+    }
+    if (need > c->n) c->n = need;
+    c->rec[seq & (c->cap - 1)] = (credit_rec_t){ .off = off, .len = len, .tries = 0 };
+    return 0;
+}
+
+static ssize_t pread_full(int fd, uint8_t *p, size_t n, off_t off) {
+    size_t got = 0;
+    while (got < n) {
+        ssize_t m = pread(fd, p + got, n - got, off + (off_t)got);
+        if (m < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (m == 0) break;
+        got += (size_t)m;
+    }
+    return (ssize_t)got;
+}
+
+/* 按记录的 offset 重读文件，以原来的 seq 发一个不压缩的 FILE_DATA */
+static int retransmit(credit_t *c, uint32_t seq, credit_rec_t *r) {
+    if (++r->tries > RETRANSMIT_MAX) {
+        fprintf(stderr, "seq=%u off=%llu still missing after %d retransmits\n",
+                seq, (unsigned long long)r->off, RETRANSMIT_MAX);
+        return -1;
+    }
+    if (!c->buf && !(c->buf = malloc(CHUNK_SZ))) { perror("malloc"); return -1; }
+    if (r->len > CHUNK_SZ || pread_full(c->file_fd, c->buf, r->len, (off_t)r->off) != (ssize_t)r->len) {
+        perror("pread retransmit");
+        return -1;
+    }
+
+    uint8_t framing[FILE_DATA_FRAMING_LEN];
+    struct iovec iov[3];
+    build_iov_file_data(r->off, c->buf, r->len, crc32c(0, c->buf, r->len), framing, iov);
+    protocol_msgv mv;
+    memset(&mv, 0, sizeof(mv));
+    mv.hdr.version_major = 1;
+    mv.hdr.version_minor = 0;
+    mv.hdr.message_type  = MSG_FILE_DATA;
+    mv.hdr.seq           = seq;
+    mv.iov               = iov;
+    mv.iovcnt            = 3;
+    if (send_messagev(c->fd, &mv, 1) < 0) { perror("send FILE_DATA retransmit"); return -1; }
+    c->resent++;
+    return 0;
+}
+
+/* 收下一条 FILE_CREDIT 之外的应答说明两边状态已经对不上 */
+static int on_credit(credit_t *c, protocol_msg *m) {
+    uint32_t ack = 0, credit = 0;
+    if (m->hdr.message_type != MSG_FILE_CREDIT ||
+        tlv_find_u32(m->payload, m->hdr.payload_length, TLV_ACK_SEQ, &ack) != 0 ||
+        tlv_find_u32(m->payload, m->hdr.payload_length, TLV_CREDIT, &credit) != 0) {
+        fprintf(stderr, "unexpected reply type %u while waiting for FILE_CREDIT\n",
+                (unsigned)m->hdr.message_type);
+        return -1;
+    }
+    // TCP 上应答按发出顺序到达，直接取最新的；UDP 上晚到的旧应答丢掉，它的 NACK 服务器会再报
+    if (c->dgram && seq_before(ack, c->ack)) return 0;
+    // ack 之前的记录不再需要
+    c->ack = ack;
+    c->credit = credit;
+    while (c->n && seq_before(c->base, ack)) {
+        c->base++;
+        c->n--;
+    }
+
+    int n = parse_payload_nacks(m->payload, m->hdr.payload_length, NULL, 0);
+    if (n <= 0) return n < 0 ? -1 : 0;
+    seq_range_t *nk = calloc((size_t)n, sizeof(*nk));
+    if (!nk) { perror("calloc"); return -1; }
+    parse_payload_nacks(m->payload, m->hdr.payload_length, nk, (uint32_t)n);
+    int rc = 0;
+    for (int i = 0; i < n && rc == 0; ++i) {
+        for (uint32_t k = 0; k < nk[i].count && rc == 0; ++k) {
+            uint32_t seq = nk[i].seq + k;
+            credit_rec_t *r = find_rec(c, seq);
+            if (!r) {
+                if (!c->dgram) fprintf(stderr, "NACK for seq=%u which is not in flight\n", seq);
+                continue;
+            }
+            rc = retransmit(c, seq, r);
+        }
+    }
+    free(nk);
+    return rc;
+}
+
+/* 数据报里只有一帧 FILE_CREDIT，按 TCP 那样先读头再读 payload 会把数据报截断 */
+static int credit_recv_dgram(credit_t *c) {
+    uint8_t buf[CREDIT_MAX_DATAGRAM];
+    ssize_t n = recv(c->fd, buf, sizeof(buf), 0);
+    if (n < 0) {
+        if (errno == EAGAIN || errno == EINTR) return 0;
+        perror("recv FILE_CREDIT");
+        return -1;
+    }
+    protocol_header wire;
+    protocol_msg m;
+    if ((size_t)n < PROTOCOL_HEADER_LEN) return 0;
+    memcpy(&wire, buf, PROTOCOL_HEADER_LEN);
+    protocol_header_to_host(&wire, &m.hdr);
+    if (m.hdr.payload_length != (size_t)n - PROTOCOL_HEADER_LEN) {
+        fprintf(stderr, "malformed datagram (len=%zd payload_length=%u)\n", n, m.hdr.payload_length);
+        return 0;
+    }
+    m.payload = buf + PROTOCOL_HEADER_LEN;
+    return on_credit(c, &m) < 0 ? -1 : 1;
+}
+
+int credit_poll(credit_t *c, int timeout_ms) {
+    struct pollfd pfd = { .fd = c->fd, .events = POLLIN };
+    int pr;
+    do pr = poll(&pfd, 1, timeout_ms); while (pr < 0 && errno == EINTR);
+    if (pr < 0) { perror("poll"); return -1; }
+    if (pr == 0) return 0;
+    if (c->dgram) return credit_recv_dgram(c);
+
+    // 每条应答都收进栈上的缓冲，不为它 malloc；TCP 上的应答和数据报一样不会超过这个长度
+    uint8_t buf[CREDIT_MAX_DATAGRAM];
+    protocol_msg m = {0};
+    int r = read_message_into(c->fd, &m, buf, sizeof(buf));
+    if (r != 0) {
+        if (r < 0) perror("read FILE_CREDIT");
+        else fprintf(stderr, "server closed before FILE_CREDIT\n");
+        return -1;
+    }
+    return on_credit(c, &m) < 0 ? -1 : 1;
+}
+
+static void credit_timeout(const credit_t *c, uint32_t next_seq) {
+    fprintf(stderr, "no FILE_CREDIT from server in %ds (ack=%u credit=%u next=%u)\n",
+            REPLY_TIMEOUT_S, c->ack, c->credit, next_seq);
+}
+
+/* 信用里还剩几个 seq 能发 */
+static uint32_t credit_room(const credit_t *c, uint32_t next_seq) {
+    uint32_t used = next_seq - c->ack;
+    return (int32_t)used < 0 ? c->credit : (used < c->credit ? c->credit - used : 0);
+}
+
+/* 只在信用不够时才去读 socket：先收掉已到的应答，还不够再阻塞等 */
+int credit_wait(credit_t *c, uint32_t next_seq, uint32_t want) {
+    if (!c->on) return (int)want;
+    int waited = 0;
+    for (;;) {
+        uint32_t room = credit_room(c, next_seq);
+        if (room >= want) return (int)want;
+        int r = credit_poll(c, room ? 0 : REPLY_TIMEOUT_S * 1000);
+        if (r < 0) return -1;
+        if (r == 0) {
+            if (room) return (int)room;
+            credit_timeout(c, next_seq);
+            return -1;
+        }
+        if (!room && !waited) { c->stalls++; waited = 1; }
+    }
+}
+
+/*
+ * 等到 ACK_SEQ 越过 FILE_END 再关连接：既确认服务器处理完了（缺的块也补齐了），也保证关闭时
+ * 接收缓冲里没有没读的应答（否则内核发 RST，服务器可能丢掉还没读的数据）。
+ */
+int credit_drain(credit_t *c, uint32_t next_seq) {
+    if (!c->on) return 0;
+    while (c->ack != next_seq) {
+        int r = credit_poll(c, REPLY_TIMEOUT_S * 1000);
+        if (r < 0) return -1;
+        if (r == 0) { credit_timeout(c, next_seq); return -1; }
+    }
+    return 0;
+}
@@ -0,0 +1,418 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include "tcp_protocol.h"
+#include "frame_decoder.h"
+#include "tcp_client.h"
+
+/*
+ * echo 压测：每个线程一个 epoll，管一部分非阻塞连接。每条连接始终保持 inflight 个 MSG_ECHO
+ * 在途，发出时按 seq % inflight 记下时刻，回包按 seq 对上（TCP 上回包按序到，对不上就是错位，
+ * 断开这条连接）。往返时延记进直方图：按 2 的幂分段、每段再分 HIST_SUB 格，相对误差不超过
+ * 1/HIST_SUB。各线程每 ECHO_PUBLISH_MS 把自己的直方图并进共享的一份，主线程每 interval 秒
+ * 取走打印一行吞吐和分位数，结束时打印全程的合计。
+ */
+
+#define HIST_SUB_BITS 5
+#define HIST_SUB (1u << HIST_SUB_BITS)
+#define HIST_BUCKETS (64 * HIST_SUB)
+
+#define ECHO_PUBLISH_MS 100
+#define ECHO_EVENTS     256
+// 时间到了以后再等这么久收在途的回包，之后还没回来的不算
+#define ECHO_DRAIN_MS   1000
+
+typedef struct
+{
+    uint64_t n[HIST_BUCKETS];
+    uint64_t count;
+    uint64_t max;
+}hist_t;
+
+typedef struct
+{
+    int             fd;
+    int             connected;
+    uint32_t        next_seq;       // 下一个要发的 seq
+    uint32_t        acked;          // 下一个应该回来的 seq
+    uint64_t       *ts;             // 发出时刻，按 seq % inflight 存
+    uint8_t        *out;            // 已拼好还没写出去的请求
+    uint32_t        out_off, out_len;
+    frame_decoder_t dec;
+}echo_conn_t;
+
+typedef struct
+{
+    const echo_load_opts_t *o;
+    uint32_t         first, nconns; // 负责的连接号 [first, first + nconns)
+    uint64_t         start;
+    hist_t           cur;           // 只有本线程写
+    uint64_t         cur_bad;
+    pthread_mutex_t  lock;          // 保护下面几项，主线程取走后清零
+    hist_t           pend;
+    uint64_t         pend_bad;
+    uint64_t         sent;
+    _Atomic uint32_t open;          // 已连上还没断的连接数
+    uint32_t         failed;        // 连不上或中途断开的连接数
+}echo_worker_t;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static uint32_t hist_index(uint64_t v)
+{
+    if (v < HIST_SUB) return (uint32_t)v;
+    uint32_t msb = 63u - (uint32_t)__builtin_clzll(v);
+    uint32_t sub = (uint32_t)(v >> (msb - HIST_SUB_BITS)) & (HIST_SUB - 1);
+    return (msb - HIST_SUB_BITS + 1) * HIST_SUB + sub;
+}
+
+/* 格子的下界，报分位数时用 */
+static uint64_t hist_value(uint32_t idx)
+{
+    if (idx < HIST_SUB) return idx;
+    uint32_t msb = idx / HIST_SUB + HIST_SUB_BITS - 1;
+    uint64_t sub = idx % HIST_SUB;
+    return (1ull << msb) | (sub << (msb - HIST_SUB_BITS));
+}
+
+static void hist_add(hist_t *h, uint64_t v)
+{
+    h->n[hist_index(v)]++;
+    h->count++;
+    if (v > h->max) h->max = v;
+}
+
+static void hist_merge(hist_t *dst, const hist_t *src)
+{
+    if (src->count == 0) return;
+    for (uint32_t i = 0; i < HIST_BUCKETS; ++i) dst->n[i] += src->n[i];
+    dst->count += src->count;
+    if (src->max > dst->max) dst->max = src->max;
+}
+
+static uint64_t hist_quantile(const hist_t *h, double q)
+{
+    if (h->count == 0) return 0;
+    uint64_t want = (uint64_t)((double)h->count * q);
+    if (want >= h->count) want = h->count - 1;
+    uint64_t seen = 0;
+    for (uint32_t i = 0; i < HIST_BUCKETS; ++i) {
+        seen += h->n[i];
+        if (seen > want) return hist_value(i);
+    }
+    return h->max;
+}
+
+static void publish(echo_worker_t *w)
+{
+    pthread_mutex_lock(&w->lock);
+    hist_merge(&w->pend, &w->cur);
+    w->pend_bad += w->cur_bad;
+    pthread_mutex_unlock(&w->lock);
+    if (w->cur.count) memset(&w->cur, 0, sizeof(w->cur));
+    w->cur_bad = 0;
+}
+
+static void conn_drop(echo_worker_t *w, echo_conn_t *c, int failed)
+{
+    if (c->fd < 0) return;
+    close(c->fd);
+    c->fd = -1;
+    if (c->connected) atomic_fetch_sub_explicit(&w->open, 1, memory_order_relaxed);
+    if (failed) w->failed++;
+}
+
+/* 在途不满 inflight 时补发，拼进 out 缓冲后尽量写出去；对端出错返回 -1 */
+static int conn_pump(echo_worker_t *w, echo_conn_t *c, int sending)
+{
+    const echo_load_opts_t *o = w->o;
+    uint32_t frame = (uint32_t)PROTOCOL_HEADER_LEN + o->size;
+    // 全写出去了才从头拼；out_len 总是 frame 的整数倍，新帧落在预填好 payload 的位置上
+    if (c->out_off == c->out_len) c->out_off = c->out_len = 0;
+    if (sending) {
+        uint64_t now = now_ns();
+        uint32_t room = o->inflight * frame - c->out_len;
+        while (c->next_seq - c->acked < o->inflight && room >= frame) {
+            protocol_header h = {0}, wire;
+            h.version_major  = 1;
+            h.message_type   = MSG_ECHO;
+            h.payload_length = o->size;
+            h.seq            = c->next_seq;
+            protocol_header_to_wire(&h, &wire);
+            memcpy(c->out + c->out_len, &wire, PROTOCOL_HEADER_LEN);
+            // payload 在建连时已经填好，每个帧位置上的内容都一样，这里只写头
+            c->ts[c->next_seq % o->inflight] = now;
+            c->next_seq++;
+            c->out_len += frame;
+            room -= frame;
+            w->sent++;
+        }
+    }
+    while (c->out_off < c->out_len) {
+        ssize_t m = send(c->fd, c->out + c->out_off, c->out_len - c->out_off, MSG_NOSIGNAL);
+        if (m < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            return -1;
+        }
+        c->out_off += (uint32_t)m;
+    }
+    return 0;
+}
+
+/* 收完内核里的回包并记时延；对端关闭、出错或回包错位返回 -1 */
+static int conn_read(echo_worker_t *w, echo_conn_t *c)
+{
+    const echo_load_opts_t *o = w->o;
+    for (;;) {
+        ssize_t n = frame_decoder_recv(&c->dec, c->fd);
+        if (n == 0) return -1;
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+        }
+        uint64_t now = now_ns();
+        protocol_msg m;
+        int r;
+        while ((r = frame_decoder_next(&c->dec, &m)) == 1) {
+            if (m.hdr.message_type != MSG_ECHO || m.hdr.seq != c->acked ||
+                m.hdr.payload_length != o->size || c->acked == c->next_seq) {
+                w->cur_bad++;
+                return -1;
+            }
+            uint64_t ts = c->ts[c->acked % o->inflight];
+            hist_add(&w->cur, now > ts ? now - ts : 0);
+            c->acked++;
+        }
+        if (r < 0) { w->cur_bad++; return -1; }
+    }
+}
+
+static void *echo_worker(void *arg)
+{
+    echo_worker_t *w = arg;
+    const echo_load_opts_t *o = w->o;
+    uint32_t frame = (uint32_t)PROTOCOL_HEADER_LEN + o->size;
+    struct epoll_event evs[ECHO_EVENTS];
+    // 收缓冲按一整轮回包算，一次 recv 能收完所有在途的
+    uint32_t rcap = o->inflight * frame;
+    if (rcap > 256 * 1024) rcap = 256 * 1024;
+
+    int ep = epoll_create1(EPOLL_CLOEXEC);
+    echo_conn_t *cs = calloc(w->nconns, sizeof(*cs));
+    if (ep < 0 || !cs) {
+        perror("echoload setup");
+        if (ep >= 0) close(ep);
+        free(cs);
+        w->failed = w->nconns;
+        return NULL;
+    }
+
+    for (uint32_t i = 0; i < w->nconns; ++i) {
+        echo_conn_t *c = &cs[i];
+        c->fd = -1;
+        c->ts = calloc(o->inflight, sizeof(*c->ts));
+        c->out = malloc((size_t)o->inflight * frame);
+        if (!c->ts || !c->out || frame_decoder_init(&c->dec, rcap, o->size) < 0) {
+            perror("echoload conn");
+            w->failed++;
+            continue;
+        }
+        // 每个帧位置的 payload 先填好，之后补发只改头
+        for (uint32_t k = 0; k < o->inflight; ++k) {
+            memset(c->out + (size_t)k * frame + PROTOCOL_HEADER_LEN, 'e', o->size);
+        }
+        c->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (c->fd < 0) { perror("socket"); w->failed++; continue; }
+        int one = 1;
+        setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        if (connect(c->fd, (const struct sockaddr *)&o->server, sizeof(o->server)) < 0 && errno != EINPROGRESS) {
+            perror("connect");
+            conn_drop(w, c, 1);
+            continue;
+        }
+        struct epoll_event ev = { .events = EPOLLIN | EPOLLOUT | EPOLLET, .data.ptr = c };
+        if (epoll_ctl(ep, EPOLL_CTL_ADD, c->fd, &ev) < 0) { perror("epoll_ctl"); conn_drop(w, c, 1); }
+    }
+
+    uint64_t end = w->start + (uint64_t)o->duration_s * 1000000000ull;
+    uint64_t drain_end = end + ECHO_DRAIN_MS * 1000000ull;
+    uint64_t next_pub = w->start + ECHO_PUBLISH_MS * 1000000ull;
+    for (;;) {
+        uint64_t now = now_ns();
+        int sending = now < end;
+        if (now >= next_pub) {
+            publish(w);
+            next_pub += ECHO_PUBLISH_MS * 1000000ull;
+        }
+        if (!sending) {
+            // 时间到了不再发，等在途的回来
+            int outstanding = 0;
+            for (uint32_t i = 0; i < w->nconns && !outstanding; ++i) {
+                outstanding = cs[i].fd >= 0 && cs[i].connected && cs[i].acked != cs[i].next_seq;
+            }
+            if (!outstanding || now >= drain_end) break;
+        }
+
+        int n = epoll_wait(ep, evs, ECHO_EVENTS, 10);
+        if (n < 0 && errno != EINTR) { perror("epoll_wait"); break; }
+        for (int i = 0; i < n; ++i) {
+            echo_conn_t *c = evs[i].data.ptr;
+            if (c->fd < 0) continue;
+            if (!c->connected) {
+                int err = 0;
+                socklen_t len = sizeof(err);
+                getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+                if (err) {
+                    if (w->failed == 0) fprintf(stderr, "connect: %s\n", strerror(err));
+                    conn_drop(w, c, 1);
+                    continue;
+                }
+                if (!(evs[i].events & EPOLLOUT)) continue;
+                c->connected = 1;
+                atomic_fetch_add_explicit(&w->open, 1, memory_order_relaxed);
+            }
+            if ((evs[i].events & EPOLLIN) && conn_read(w, c) < 0) { conn_drop(w, c, 1); continue; }
+            if ((evs[i].events & (EPOLLERR | EPOLLHUP)) && !(evs[i].events & EPOLLIN)) { conn_drop(w, c, 1); continue; }
+            if (conn_pump(w, c, sending) < 0) conn_drop(w, c, 1);
+        }
+    }
+
+    publish(w);
+    for (uint32_t i = 0; i < w->nconns; ++i) {
+        conn_drop(w, &cs[i], 0);
+        frame_decoder_destroy(&cs[i].dec);
+        free(cs[i].ts);
+        free(cs[i].out);
+    }
+    free(cs);
+    close(ep);
+    return NULL;
+}
+
+/* 连接数多时把打开文件数的软上限提到硬上限 */
+static int raise_nofile(uint32_t need)
+{
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) < 0) return 0;
+    if (rl.rlim_cur >= need) return 0;
+    rl.rlim_cur = rl.rlim_max < need ? rl.rlim_max : need;
+    if (setrlimit(RLIMIT_NOFILE, &rl) < 0 || rl.rlim_cur < need) {
+        fprintf(stderr, "echoload: need %u open files, limit is %llu\n", need,
+                (unsigned long long)rl.rlim_cur);
+        return -1;
+    }
+    return 0;
+}
+
+static void print_rtt(const hist_t *h)
+{
+    printf("rtt us p50=%.1f p90=%.1f p99=%.1f p99.9=%.1f p99.99=%.1f max=%.1f",
+           hist_quantile(h, 0.50) / 1e3, hist_quantile(h, 0.90) / 1e3, hist_quantile(h, 0.99) / 1e3,
+           hist_quantile(h, 0.999) / 1e3, hist_quantile(h, 0.9999) / 1e3, h->max / 1e3);
+}
+
+int echo_load(const echo_load_opts_t *o)
+{
+    if (raise_nofile(o->conns + 64) < 0) return -1;
+    uint32_t threads = o->threads < o->conns ? o->threads : o->conns;
+    echo_worker_t *ws = calloc(threads, sizeof(*ws));
+    pthread_t *th = calloc(threads, sizeof(*th));
+    hist_t *iv = calloc(1, sizeof(*iv)), *total = calloc(1, sizeof(*total));
+    if (!ws || !th || !iv || !total) {
+        perror("calloc");
+        free(ws); free(th); free(iv); free(total);
+        return -1;
+    }
+
+    uint64_t start = now_ns();
+    uint32_t started = 0;
+    for (uint32_t i = 0; i < threads; ++i, ++started) {
+        echo_worker_t *w = &ws[i];
+        w->o = o;
+        w->first = (uint32_t)((uint64_t)o->conns * i / threads);
+        w->nconns = (uint32_t)((uint64_t)o->conns * (i + 1) / threads) - w->first;
+        w->start = start;
+        pthread_mutex_init(&w->lock, NULL);
+        if (pthread_create(&th[i], NULL, echo_worker, w) != 0) {
+            perror("pthread_create");
+            pthread_mutex_destroy(&w->lock);
+            break;
+        }
+    }
+
+    printf("echoload: %u connection(s) on %u thread(s), %u in flight each, %u-byte payload, %us\n",
+           o->conns, started, o->inflight, o->size, o->duration_s);
+    fflush(stdout);
+
+    // 每 interval 秒取走各线程发布的直方图打一行；最后一段在 drain 期间，不单独打
+    uint64_t last = start, bad = 0;
+    for (uint32_t k = 1; o->interval_s && (uint64_t)k * o->interval_s <= o->duration_s; ++k) {
+        uint64_t due = start + (uint64_t)k * o->interval_s * 1000000000ull;
+        uint64_t now = now_ns();
+        if (due > now) {
+            struct timespec ts = { .tv_sec = (time_t)((due - now) / 1000000000ull),
+                                   .tv_nsec = (long)((due - now) % 1000000000ull) };
+            while (nanosleep(&ts, &ts) < 0 && errno == EINTR) {}
+        }
+        memset(iv, 0, sizeof(*iv));
+        uint32_t open = 0;
+        for (uint32_t i = 0; i < started; ++i) {
+            pthread_mutex_lock(&ws[i].lock);
+            hist_merge(iv, &ws[i].pend);
+            bad += ws[i].pend_bad;
+            memset(&ws[i].pend, 0, sizeof(ws[i].pend));
+            ws[i].pend_bad = 0;
+            pthread_mutex_unlock(&ws[i].lock);
+            open += atomic_load_explicit(&ws[i].open, memory_order_relaxed);
+        }
+        hist_merge(total, iv);
+        now = now_ns();
+        printf("[%4us] conns=%u %.0f req/s ", k * o->interval_s, open,
+               (double)iv->count * 1e9 / (double)(now - last));
+        print_rtt(iv);
+        printf("\n");
+        fflush(stdout);
+        last = now;
+    }
+
+    uint64_t sent = 0;
+    uint32_t failed = 0;
+    for (uint32_t i = 0; i < started; ++i) {
+        pthread_join(th[i], NULL);
+        hist_merge(total, &ws[i].pend);
+        bad += ws[i].pend_bad;
+        sent += ws[i].sent;
+        failed += ws[i].failed;
+        pthread_mutex_destroy(&ws[i].lock);
+    }
+    failed += (uint32_t)(o->conns - (uint64_t)o->conns * started / threads);
+
+    double secs = o->duration_s ? (double)o->duration_s : 1.0;
+    printf("sent %llu, echoed %llu, %llu bad, %u connection(s) failed, %.0f req/s\n",
+           (unsigned long long)sent, (unsigned long long)total->count, (unsigned long long)bad, failed,
+           (double)total->count / secs);
+    print_rtt(total);
+    printf("\n");
+
+    int rc = total->count ? 0 : -1;
+    free(ws); free(th); free(iv); free(total);
+    return rc;
+}
@@ -9,6 +9,8 @@
 #include <stdatomic.h>
 #include "tcp_protocol.h" 
 #include "tcp_tlv.h"       
+#include "tcp_client.h"
+#include "chunk_codec.h"
 
 static _Atomic uint32_t g_seq = 0;
 
@@ -21,140 +23,126 @@ static void ignore_sigpipe(void) {
     signal(SIGPIPE, SIG_IGN);
 }
 
-#define CHUNK_SZ (64 * 1024)
-
-static int send_file(int fd, const char *path) {
-    FILE *fp = fopen(path, "rb");
-    if (!fp) { perror("fopen"); return -1; }
-
-    if (fseek(fp, 0, SEEK_END) != 0) { perror("fseek"); fclose(fp); return -1; }
-    long long sz_ll = ftell(fp);
-    if (sz_ll < 0) { perror("ftell"); fclose(fp); return -1; }
-    rewind(fp);
-    uint64_t fsize = (uint64_t)sz_ll;
-
-    const char *fname = strrchr(path, '/');  
-    fname = fname ? fname + 1 : path;
-
-    uint8_t start_payload[1024]; 
-    uint32_t start_len = 0;
-    if (build_payload_file_start(fname, fsize, start_payload, sizeof(start_payload), &start_len) < 0) {
-        fprintf(stderr, "build FILE_START payload failed\n");
-        fclose(fp);
-        return -1;
-    }
-
-    protocol_msg mstart = {0};
-    mstart.hdr.version_major  = 1;
-    mstart.hdr.version_minor  = 0;
-    mstart.hdr.message_type   = MSG_FILE_START;
-    mstart.hdr.payload_length = start_len;
-    mstart.hdr.seq            = next_seq(); 
-    mstart.payload            = start_payload;
-
-    if (send_message(fd, &mstart) < 0) {
-        perror("send FILE_START");
-        fclose(fp);
-        return -1;
-    }
-
-    uint8_t data_buf[CHUNK_SZ];
-    uint8_t data_payload[CHUNK_SZ + 32];
-    uint64_t offset = 0;
-    uint64_t sent_total = 0;
-
-    for (;;) {
-        // 读取 A
-        static uint8_t rawA[CHUNK_SZ];
-        size_t r1 = fread(rawA, 1, CHUNK_SZ, fp);
-        if (r1 == 0) break;
-
-        // “偷看”再读 B
-        static uint8_t rawB[CHUNK_SZ];
-        size_t r2 = fread(rawB, 1, CHUNK_SZ, fp);
-
-        if (r2 > 0) {
-            // 预留两个连续序号：A=base, B=base+1
-            uint32_t base = atomic_fetch_add_explicit(&g_seq, 2u, memory_order_relaxed);
-            uint32_t seqA = base;
-            uint32_t seqB = (base + 1u) & 0xFFFFFFFFu;
-
-            // 先发 B（offset_B = offset + r1）
-            static uint8_t payloadB[CHUNK_SZ + 32];
-            uint32_t lenB = 0;
-            if (build_payload_file_data(offset + r1, rawB, (uint32_t)r2,
-                                        payloadB, sizeof(payloadB), &lenB) < 0) {
-                fprintf(stderr, "build FILE_DATA B failed\n"); fclose(fp); return -1;
+static int parse_send_opts(int argc, char const *argv[], int first, send_opts_t *o) {
+    memset(o, 0, sizeof(*o));
+    for (int i = first; i < argc; ++i) {
+        const char *v = (i + 1 < argc) ? argv[i + 1] : NULL;
+        if (strcmp(argv[i], "--window") == 0 && v) {
+            o->window = (uint32_t)atoi(v);
+            ++i;
+        } else if (strcmp(argv[i], "--zerocopy") == 0) {
+            o->zerocopy = 1;
+        } else if (strcmp(argv[i], "--delta") == 0) {
+            o->delta = 1;
+        } else if (strcmp(argv[i], "--delta-block") == 0 && v) {
+            o->delta_block = (uint32_t)atoi(v);
+            ++i;
+        } else if (strcmp(argv[i], "--credit") == 0) {
+            o->credit = 1;
+        } else if (strcmp(argv[i], "--resume") == 0) {
+            o->resume = 1;
+        } else if (strcmp(argv[i], "--compress") == 0) {
+            o->compress = 1;
+        } else if (strcmp(argv[i], "--compress-workers") == 0 && v) {
+            o->compress_workers = (uint32_t)atoi(v);
+            ++i;
+        } else if (strcmp(argv[i], "--readahead") == 0 && v) {
+            o->readahead = (uint32_t)atoi(v);
+            ++i;
+        } else if (strcmp(argv[i], "--udp") == 0) {
+            o->udp = 1;
+        } else if (strcmp(argv[i], "--rate") == 0 && v) {
+            o->rate_mbit = (uint32_t)atoi(v);
+            ++i;
+        } else if (strcmp(argv[i], "--chunk") == 0 && v) {
+            int n = atoi(v);
+            if (n < 256 || n > UDP_CHUNK_MAX) {
+                fprintf(stderr, "--chunk must be 256..%d\n", UDP_CHUNK_MAX);
+                return -1;
             }
-            protocol_msg mB = {0};
-            mB.hdr.version_major = 1; mB.hdr.version_minor = 0;
-            mB.hdr.message_type = MSG_FILE_DATA; mB.hdr.payload_length = lenB;
-            mB.hdr.seq = seqB;
-            mB.payload = payloadB;
-            if (send_message(fd, &mB) < 0) { perror("send FILE_DATA B"); fclose(fp); return -1; }
-
-            // 再发 A（offset_A = offset）
-            static uint8_t payloadA[CHUNK_SZ + 32];
-            uint32_t lenA = 0;
-            if (build_payload_file_data(offset, rawA, (uint32_t)r1,
-                                        payloadA, sizeof(payloadA), &lenA) < 0) {
-                fprintf(stderr, "build FILE_DATA A failed\n"); fclose(fp); return -1;
+            o->udp_chunk = (uint32_t)n;
+            ++i;
+        } else if (strcmp(argv[i], "--mux") == 0 && v) {
+            int n = atoi(v);
+            if (n < 1 || n > MUX_MAX) {
+                fprintf(stderr, "--mux must be 1..%d\n", MUX_MAX);
+                return -1;
             }
-            protocol_msg mA = {0};
-            mA.hdr.version_major = 1; mA.hdr.version_minor = 0;
-            mA.hdr.message_type = MSG_FILE_DATA; mA.hdr.payload_length = lenA;
-            mA.hdr.seq = seqA;               // 注意：A 的 seq 比 B 小
-            mA.payload = payloadA;
-            if (send_message(fd, &mA) < 0) { perror("send FILE_DATA A"); fclose(fp); return -1; }
-
-            offset     += r1 + r2;
-            sent_total += r1 + r2;
-        } else {
-            // 最后一块只有 A：正常顺序即可
-            static uint8_t payload[CHUNK_SZ + 32];
-            uint32_t len = 0;
-            if (build_payload_file_data(offset, rawA, (uint32_t)r1,
-                                        payload, sizeof(payload), &len) < 0) {
-                fprintf(stderr, "build FILE_DATA failed\n"); fclose(fp); return -1;
+            o->mux = (uint32_t)n;
+            ++i;
+        } else if (strcmp(argv[i], "--streams") == 0 && v) {
+            int n = atoi(v);
+            if (n < 1 || n > SEND_MAX_STREAMS) {
+                fprintf(stderr, "--streams must be 1..%d\n", SEND_MAX_STREAMS);
+                return -1;
             }
-            protocol_msg m = {0};
-            m.hdr.version_major = 1; m.hdr.version_minor = 0;
-            m.hdr.message_type = MSG_FILE_DATA; m.hdr.payload_length = len;
-            m.hdr.seq = next_seq();          // 单块时随便取一个新 seq
-            m.payload = payload;
-            if (send_message(fd, &m) < 0) { perror("send FILE_DATA"); fclose(fp); return -1; }
-
-            offset     += r1;
-            sent_total += r1;
+            o->streams = (uint32_t)n;
+            ++i;
+        } else {
+            fprintf(stderr, "unknown option '%s'\n", argv[i]);
+            return -1;
         }
-
-        fprintf(stderr, "\r[client] sent %llu bytes", (unsigned long long)sent_total);
-        fflush(stderr);
     }
-    fclose(fp);
-    fprintf(stderr, "\n");
-
-    protocol_msg mend = {0};
-    mend.hdr.version_major  = 1;
-    mend.hdr.version_minor  = 0;
-    mend.hdr.message_type   = MSG_FILE_END;
-    mend.hdr.payload_length = 0;
-    mend.hdr.seq            = next_seq();
-    mend.payload            = NULL;
-
-    if (send_message(fd, &mend) < 0) {
-        perror("send FILE_END");
+    if (o->compress && o->zerocopy) {
+        fprintf(stderr, "--compress and --zerocopy cannot be combined\n");
         return -1;
     }
+    if (o->delta && (o->zerocopy || o->compress || o->resume || o->credit || o->streams > 1)) {
+        fprintf(stderr, "--delta cannot be combined with --zerocopy, --compress, --resume, --credit or --streams\n");
+        return -1;
+    }
+    if (o->udp && (o->zerocopy || o->compress || o->resume || o->delta || o->credit || o->streams > 1)) {
+        fprintf(stderr, "--udp only supports --window, --rate and --chunk\n");
+        return -1;
+    }
+    if (!o->udp && (o->rate_mbit || o->udp_chunk)) {
+        fprintf(stderr, "--rate and --chunk need --udp\n");
+        return -1;
+    }
+    if (o->compress && codec_supported() == 0) {
+        fprintf(stderr, "--compress: built without a compression library\n");
+        return -1;
+    }
+    return 0;
+}
 
-    fprintf(stderr, "[client] send file done.\n");
+static int parse_echo_load_opts(int argc, char const *argv[], int first, echo_load_opts_t *o) {
+    memset(o, 0, sizeof(*o));
+    o->conns      = ECHO_LOAD_CONNS;
+    o->threads    = 4;
+    o->inflight   = ECHO_LOAD_INFLIGHT;
+    o->size       = 64;
+    o->duration_s = 10;
+    o->interval_s = 1;
+    for (int i = first; i < argc; ++i) {
+        const char *v = (i + 1 < argc) ? argv[i + 1] : NULL;
+        uint32_t *dst = NULL;
+        long lo = 0, hi = 0;
+        if (strcmp(argv[i], "--conns") == 0 && v)         { dst = &o->conns;      lo = 1; hi = ECHO_LOAD_MAX_CONNS; }
+        else if (strcmp(argv[i], "--threads") == 0 && v)  { dst = &o->threads;    lo = 1; hi = 256; }
+        else if (strcmp(argv[i], "--inflight") == 0 && v) { dst = &o->inflight;   lo = 1; hi = ECHO_LOAD_MAX_INFLIGHT; }
+        else if (strcmp(argv[i], "--size") == 0 && v)     { dst = &o->size;       lo = 0; hi = CHUNK_SZ; }
+        else if (strcmp(argv[i], "--duration") == 0 && v) { dst = &o->duration_s; lo = 1; hi = 86400; }
+        else if (strcmp(argv[i], "--interval") == 0 && v) { dst = &o->interval_s; lo = 0; hi = 86400; }
+        else {
+            fprintf(stderr, "unknown echoload option '%s'\n", argv[i]);
+            return -1;
+        }
+        long n = atol(v);
+        if (n < lo || n > hi) {
+            fprintf(stderr, "%s must be %ld..%ld\n", argv[i], lo, hi);
+            return -1;
+        }
+        *dst = (uint32_t)n;
+        ++i;
+    }
     return 0;
 }
 
 int main(int argc, char const *argv[]) {
     if (argc < 3) {
-        fprintf(stderr, "用法:\n  %s <SERVER_IP> <PORT>\n  %s <SERVER_IP> <PORT> sendfile <PATH>\n",
-                argv[0], argv[0]);
+        fprintf(stderr, "用法:\n  %s <SERVER_IP> <PORT>\n  %s <SERVER_IP> <PORT> sendfile <PATH> [--window N] [--zerocopy] [--streams N] [--readahead N] [--compress] [--compress-workers N] [--resume] [--credit] [--delta [--delta-block N]]\n  %s <SERVER_IP> <PORT> sendfile <PATH> --udp [--window N] [--rate MBIT] [--chunk BYTES]\n  %s <SERVER_IP> <PORT> sendfiles <PATH>... [--mux N] [--window N]\n  %s <SERVER_IP> <PORT> stats [--interval S] [--count N]\n  %s <SERVER_IP> <PORT> echoload [--conns N] [--threads N] [--inflight N] [--size BYTES] [--duration S] [--interval S]\n",
+                argv[0], argv[0], argv[0], argv[0], argv[0], argv[0]);
         return 1;
     }
 
@@ -171,22 +159,92 @@ int main(int argc, char const *argv[]) {
         perror("inet_pton"); close(fd); return 1;
     }
 
+    // echoload 自己建一批非阻塞连接，不用这条
+    if (argc >= 4 && strcmp(argv[3], "echoload") == 0) {
+        close(fd);
+        echo_load_opts_t lo;
+        if (parse_echo_load_opts(argc, argv, 4, &lo) < 0) return 1;
+        lo.server = svr;
+        return (echo_load(&lo) == 0) ? 0 : 1;
+    }
+
+    send_opts_t opts;
+    int sending = argc >= 4 && strcmp(argv[3], "sendfile") == 0;
+    if (sending) {
+        if (argc < 5) {
+            fprintf(stderr, "缺少文件路径\n");
+            close(fd);
+            return 1;
+        }
+        if (parse_send_opts(argc, argv, 5, &opts) < 0) {
+            close(fd);
+            return 1;
+        }
+        opts.server = svr;
+        // UDP 上传自己建 socket，不用这条 TCP 连接
+        if (opts.udp) {
+            close(fd);
+            return (send_file_udp(&svr, argv[4], &opts) == 0) ? 0 : 1;
+        }
+    }
+
     if (connect(fd, (struct sockaddr*)&svr, sizeof(svr)) < 0) {
         perror("connect"); close(fd); return 1;
     }
 
-    if (argc >= 4 && strcmp(argv[3], "sendfile") == 0) {
-        if (argc < 5) {
+    if (sending) {
+        int sr = send_file(fd, argv[4], &opts);
+        close(fd);
+        return (sr == 0) ? 0 : 1;
+    }
+
+    if (argc >= 4 && strcmp(argv[3], "sendfiles") == 0) {
+        int first = 4;
+        while (first < argc && strncmp(argv[first], "--", 2) != 0) ++first;
+        if (first == 4) {
             fprintf(stderr, "缺少文件路径\n");
             close(fd);
             return 1;
         }
-        int sr = send_file(fd, argv[4]);
+        if (parse_send_opts(argc, argv, first, &opts) < 0) {
+            close(fd);
+            return 1;
+        }
+        if (opts.zerocopy || opts.streams > 1 || opts.compress || opts.resume || opts.delta || opts.credit ||
+            opts.udp) {
+            fprintf(stderr, "sendfiles only supports --mux and --window\n");
+            close(fd);
+            return 1;
+        }
+        int sr = send_files_mux(fd, argv + 4, first - 4, &opts);
+        close(fd);
+        return (sr == 0) ? 0 : 1;
+    }
+
+    if (argc >= 4 && strcmp(argv[3], "stats") == 0) {
+        int interval = 0, count = 0;
+        for (int i = 4; i < argc; ++i) {
+            const char *v = (i + 1 < argc) ? argv[i + 1] : NULL;
+            if (strcmp(argv[i], "--interval") == 0 && v) { interval = atoi(v); ++i; }
+            else if (strcmp(argv[i], "--count") == 0 && v) { count = atoi(v); ++i; }
+            else {
+                fprintf(stderr, "unknown stats option '%s'\n", argv[i]);
+                close(fd);
+                return 1;
+            }
+        }
+        if (interval < 0 || count < 0) {
+            fprintf(stderr, "--interval/--count must be >= 0\n");
+            close(fd);
+            return 1;
+        }
+        int sr = query_stats(fd, interval, count);
         close(fd);
         return (sr == 0) ? 0 : 1;
     }
 
     char line[4096];
+    uint8_t reply[sizeof(line)];
     while (fgets(line, sizeof(line), stdin)) {
         size_t len = strlen(line);
 
@@ -204,7 +262,7 @@ int main(int argc, char const *argv[]) {
         }
 
         protocol_msg in = {0};
-        int r = read_message(fd, &in);
+        int r = read_message_into(fd, &in, reply, sizeof(reply));
         if (r == 1) {
             fprintf(stderr, "server closed\n");
             break;
@@ -216,7 +274,6 @@ int main(int argc, char const *argv[]) {
         if (in.hdr.payload_length > 0 && in.payload) {
             write(STDOUT_FILENO, in.payload, in.hdr.payload_length);
         }
-        free(in.payload);
     }
 
     close(fd);
@@ -0,0 +1,219 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "readahead.h"
+#include "crc32c.h"
+#include "chunk_codec.h"
+
+static ssize_t pread_full(int fd, uint8_t *p, size_t n, off_t off)
+{
+    size_t got = 0;
+    while (got < n) {
+        ssize_t m = pread(fd, p + got, n - got, off + (off_t)got);
+        if (m < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (m == 0) break;
+        got += (size_t)m;
+    }
+    return (ssize_t)got;
+}
+
+static void *reader_main(void *arg)
+{
+    readahead_t *ra = arg;
+    uint64_t off = ra->lo;
+
+    while (off < ra->hi) {
+        pthread_mutex_lock(&ra->mu);
+        while (!ra->stop && ra->tail - ra->head >= ra->depth)
+            pthread_cond_wait(&ra->not_full, &ra->mu);
+        int stop = ra->stop;
+        ra_chunk_t *c = &ra->slots[ra->tail % ra->depth];
+        pthread_mutex_unlock(&ra->mu);
+        if (stop) return NULL;
+
+        // 提示内核把环后面那一块也提前读进页缓存
+        uint64_t ahead = off + (uint64_t)ra->depth * ra->chunk;
+        if (ahead < ra->hi) {
+            posix_fadvise(ra->file_fd, (off_t)ahead,
+                          (off_t)(ra->hi - ahead < ra->chunk ? ra->hi - ahead : ra->chunk),
+                          POSIX_FADV_WILLNEED);
+        }
+
+        uint64_t left = ra->hi - off;
+        size_t want = left < ra->chunk ? (size_t)left : ra->chunk;
+        ssize_t got = pread_full(ra->file_fd, c->data, want, (off_t)off);
+        // 数据刚读进来还在缓存里，在读线程上算 CRC，不占发送线程
+        if (got > 0) c->crc = crc32c(0, c->data, (size_t)got);
+
+        pthread_mutex_lock(&ra->mu);
+        if (got < 0) {
+            ra->err = errno;
+        } else if (got > 0) {
+            c->off = off;
+            c->len = (uint32_t)got;
+            c->zlen = 0;
+            c->ready = (ra->codec == CODEC_NONE);
+            ra->tail++;
+        }
+        // 读不满说明文件被截短了，当作 EOF
+        if (got <= 0 || (size_t)got < want) ra->eof = 1;
+        int done = ra->eof || ra->err;
+        pthread_cond_signal(&ra->not_empty);
+        if (ra->codec != CODEC_NONE) pthread_cond_broadcast(&ra->zwork);
+        pthread_mutex_unlock(&ra->mu);
+        if (done) return NULL;
+        off += (uint64_t)got;
+    }
+
+    pthread_mutex_lock(&ra->mu);
+    ra->eof = 1;
+    pthread_cond_signal(&ra->not_empty);
+    pthread_cond_broadcast(&ra->zwork);
+    pthread_mutex_unlock(&ra->mu);
+    return NULL;
+}
+
+/* 压缩线程：按读入顺序认领块，锁外压缩，压完标记 ready */
+static void *compress_main(void *arg)
+{
+    readahead_t *ra = arg;
+    pthread_mutex_lock(&ra->mu);
+    for (;;) {
+        while (!ra->stop && ra->zq == ra->tail && !ra->eof && !ra->err)
+            pthread_cond_wait(&ra->zwork, &ra->mu);
+        if (ra->stop || ra->zq == ra->tail) break;
+        ra_chunk_t *c = &ra->slots[ra->zq % ra->depth];
+        ra->zq++;
+        pthread_mutex_unlock(&ra->mu);
+
+        int z = codec_compress(ra->codec, c->data, c->len, c->zdata, ra->zcap);
+
+        pthread_mutex_lock(&ra->mu);
+        c->zlen = z > 0 ? (uint32_t)z : 0;
+        c->ready = 1;
+        pthread_cond_broadcast(&ra->not_empty);
+    }
+    pthread_mutex_unlock(&ra->mu);
+    return NULL;
+}
+
+static void free_ring(readahead_t *ra)
+{
+    free(ra->slots);
+    free(ra->mem);
+    free(ra->zmem);
+    free(ra->workers);
+}
+
+int readahead_start(readahead_t *ra, int file_fd, uint64_t lo, uint64_t hi,
+                    uint32_t depth, uint32_t chunk, int codec, uint32_t nworkers)
+{
+    memset(ra, 0, sizeof(*ra));
+    if (depth < 2) depth = 2;
+    ra->depth = depth;
+    ra->chunk = chunk;
+    ra->file_fd = file_fd;
+    ra->lo = lo;
+    ra->hi = hi;
+
+    ra->codec = codec;
+    ra->nworkers = (codec != CODEC_NONE) ? (nworkers ? nworkers : 1) : 0;
+
+    ra->slots = calloc(depth, sizeof(*ra->slots));
+    ra->mem = malloc((size_t)depth * chunk);
+    if (ra->nworkers) {
+        ra->zcap = codec_bound(codec, chunk);
+        ra->zmem = malloc((size_t)depth * ra->zcap);
+        ra->workers = calloc(ra->nworkers, sizeof(*ra->workers));
+    }
+    if (!ra->slots || !ra->mem || (ra->nworkers && (!ra->zmem || !ra->workers))) {
+        free_ring(ra);
+        return -1;
+    }
+    for (uint32_t i = 0; i < depth; ++i) {
+        ra->slots[i].data = ra->mem + (size_t)i * chunk;
+        if (ra->zmem) ra->slots[i].zdata = ra->zmem + (size_t)i * ra->zcap;
+    }
+
+    if (hi > lo) posix_fadvise(file_fd, (off_t)lo, (off_t)(hi - lo), POSIX_FADV_SEQUENTIAL);
+
+    pthread_mutex_init(&ra->mu, NULL);
+    pthread_cond_init(&ra->not_full, NULL);
+    pthread_cond_init(&ra->not_empty, NULL);
+    pthread_cond_init(&ra->zwork, NULL);
+    // 压缩线程起不来就少用几个，一个都没有时退回不压缩
+    uint32_t started = 0;
+    for (; started < ra->nworkers; ++started) {
+        if (pthread_create(&ra->workers[started], NULL, compress_main, ra) != 0) break;
+    }
+    ra->nworkers = started;
+    if (started == 0) ra->codec = CODEC_NONE;
+
+    int r = pthread_create(&ra->th, NULL, reader_main, ra);
+    if (r != 0) {
+        pthread_mutex_lock(&ra->mu);
+        ra->stop = 1;
+        pthread_cond_broadcast(&ra->zwork);
+        pthread_mutex_unlock(&ra->mu);
+        for (uint32_t i = 0; i < ra->nworkers; ++i) pthread_join(ra->workers[i], NULL);
+        pthread_mutex_destroy(&ra->mu);
+        pthread_cond_destroy(&ra->not_full);
+        pthread_cond_destroy(&ra->not_empty);
+        pthread_cond_destroy(&ra->zwork);
+        free_ring(ra);
+        errno = r;
+        return -1;
+    }
+    return 0;
+}
+
+const ra_chunk_t *readahead_peek(readahead_t *ra, uint32_t idx)
+{
+    const ra_chunk_t *c = NULL;
+    pthread_mutex_lock(&ra->mu);
+    for (;;) {
+        if (ra->tail - ra->head > idx) {
+            ra_chunk_t *s = &ra->slots[(ra->head + idx) % ra->depth];
+            if (s->ready) { c = s; break; }
+        } else if (ra->eof || ra->err) {
+            break;
+        }
+        pthread_cond_wait(&ra->not_empty, &ra->mu);
+    }
+    pthread_mutex_unlock(&ra->mu);
+    return c;
+}
+
+void readahead_release(readahead_t *ra, uint32_t n)
+{
+    pthread_mutex_lock(&ra->mu);
+    ra->head += n;
+    pthread_cond_signal(&ra->not_full);
+    pthread_mutex_unlock(&ra->mu);
+}
+
+void readahead_stop(readahead_t *ra)
+{
+    pthread_mutex_lock(&ra->mu);
+    ra->stop = 1;
+    pthread_cond_signal(&ra->not_full);
+    pthread_cond_broadcast(&ra->zwork);
+    pthread_mutex_unlock(&ra->mu);
+    pthread_join(ra->th, NULL);
+    for (uint32_t i = 0; i < ra->nworkers; ++i) pthread_join(ra->workers[i], NULL);
+
+    pthread_mutex_destroy(&ra->mu);
+    pthread_cond_destroy(&ra->not_full);
+    pthread_cond_destroy(&ra->not_empty);
+    pthread_cond_destroy(&ra->zwork);
+    free_ring(ra);
+    memset(ra, 0, sizeof(*ra));
+}
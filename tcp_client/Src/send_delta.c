@@ -0,0 +1,347 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "tcp_protocol.h"
+#include "tcp_tlv.h"
+#include "tcp_client.h"
+#include "crc32c.h"
+#include "delta.h"
+
+/*
+ * 增量同步。先用 SIG_REQUEST 拿服务器旧文件的块签名，然后在新文件上逐字节滚动
+ * 弱校验找相同的块：命中的发 FILE_COPY（服务器从旧文件复制），其余按不超过 CHUNK_SZ
+ * 的块发 FILE_DATA。两种消息按 offset 顺序共用一个 seq 空间，服务器照常按 offset 写。
+ */
+
+// 攒够这么多条消息合成一次 sendmsg
+#define DELTA_BATCH 32
+// 扫描缓冲至少这么大
+#define DELTA_SCAN_BUF (8 * 1024 * 1024)
+
+typedef struct {
+    int        fd;
+    uint32_t   seq;
+    uint32_t   crc;             // 整个新文件按 offset 顺序的 CRC32C
+
+    // 签名索引：按弱校验分桶的链表
+    const uint8_t *sigs;
+    uint32_t   nsig;
+    uint32_t   block;
+    int32_t   *head;
+    int32_t   *next;
+    uint32_t   mask;
+
+    // 新文件扫描缓冲，装着文件的 [bstart, bstart + filled)
+    int        file_fd;
+    uint64_t   fsize;
+    uint8_t   *buf;
+    size_t     cap;
+    uint64_t   bstart;
+    size_t     filled;
+
+    // 攒着还没发的 FILE_COPY：新文件 dst 处 len 字节来自旧文件 src
+    int        has_copy;
+    uint64_t   copy_dst, copy_src;
+    uint32_t   copy_len, copy_crc;
+
+    // 待发消息；FILE_DATA 的 iov 指向扫描缓冲，所以换缓冲前必须先发掉
+    protocol_msgv mv[DELTA_BATCH];
+    struct iovec  iov[DELTA_BATCH][3];
+    uint8_t       framing[DELTA_BATCH][FILE_COPY_PAYLOAD_LEN > FILE_DATA_FRAMING_LEN ?
+                                       FILE_COPY_PAYLOAD_LEN : FILE_DATA_FRAMING_LEN];
+    int           nq;
+
+    uint64_t   literal, copied;
+    uint64_t   ncopy_msgs;
+} delta_ctx_t;
+
+static inline uint32_t bucket_of(const delta_ctx_t *d, uint32_t weak)
+{
+    return (weak * 0x9E3779B1u) >> 7 & d->mask;
+}
+
+static int build_index(delta_ctx_t *d)
+{
+    uint32_t nb = 1024;
+    while (nb < d->nsig * 2u) nb *= 2;
+    d->mask = nb - 1;
+    d->head = malloc((size_t)nb * sizeof(*d->head));
+    d->next = malloc(((size_t)d->nsig + 1) * sizeof(*d->next));
+    if (!d->head || !d->next) return -1;
+    memset(d->head, 0xff, (size_t)nb * sizeof(*d->head));
+    // 倒着插，链表里同一桶的块按下标升序
+    for (uint32_t i = d->nsig; i-- > 0;) {
+        uint32_t h = bucket_of(d, delta_sig_at(d->sigs, i).weak);
+        d->next[i] = d->head[h];
+        d->head[h] = (int32_t)i;
+    }
+    return 0;
+}
+
+static int flush_queue(delta_ctx_t *d)
+{
+    if (d->nq == 0) return 0;
+    int r = send_messagev(d->fd, d->mv, d->nq);
+    d->nq = 0;
+    if (r < 0) perror("send delta");
+    return r;
+}
+
+static protocol_msgv *queue_msg(delta_ctx_t *d, uint8_t type, int iovcnt)
+{
+    if (d->nq == DELTA_BATCH && flush_queue(d) < 0) return NULL;
+    protocol_msgv *m = &d->mv[d->nq];
+    memset(m, 0, sizeof(*m));
+    m->hdr.version_major = 1;
+    m->hdr.version_minor = 0;
+    m->hdr.message_type  = type;
+    m->hdr.seq           = d->seq++;
+    m->iov               = d->iov[d->nq];
+    m->iovcnt            = iovcnt;
+    d->nq++;
+    return m;
+}
+
+/* 保证新文件的 [off, off+len) 在缓冲里并返回指针；keep 之前的数据不再需要 */
+static const uint8_t *view(delta_ctx_t *d, uint64_t off, uint32_t len, uint64_t keep)
+{
+    if (off >= d->bstart && off + len <= d->bstart + d->filled) return d->buf + (off - d->bstart);
+
+    if (flush_queue(d) < 0) return NULL;
+    if (keep > off) keep = off;
+    if (keep >= d->bstart && keep < d->bstart + d->filled) {
+        size_t drop = (size_t)(keep - d->bstart);
+        memmove(d->buf, d->buf + drop, d->filled - drop);
+        d->filled -= drop;
+    } else {
+        d->filled = 0;
+    }
+    d->bstart = keep;
+    while (d->filled < d->cap && d->bstart + d->filled < d->fsize) {
+        ssize_t m = pread(d->file_fd, d->buf + d->filled, d->cap - d->filled,
+                          (off_t)(d->bstart + d->filled));
+        if (m < 0 && errno == EINTR) continue;
+        if (m <= 0) break;
+        d->filled += (size_t)m;
+    }
+    if (off + len > d->bstart + d->filled) {
+        fprintf(stderr, "file changed while sending (short read at %llu)\n", (unsigned long long)off);
+        return NULL;
+    }
+    return d->buf + (off - d->bstart);
+}
+
+static int emit_copy(delta_ctx_t *d)
+{
+    if (!d->has_copy) return 0;
+    d->has_copy = 0;
+    protocol_msgv *m = queue_msg(d, MSG_FILE_COPY, 1);
+    if (!m) return -1;
+    uint8_t *fr = d->framing[m - d->mv];
+    file_copy_t fc = { .offset = d->copy_dst, .src_offset = d->copy_src,
+                       .len = d->copy_len, .crc = d->copy_crc };
+    uint32_t len = 0;
+    build_payload_file_copy(&fc, fr, FILE_COPY_PAYLOAD_LEN, &len);
+    d->iov[m - d->mv][0] = (struct iovec){ .iov_base = fr, .iov_len = len };
+    d->crc = crc32c_combine(d->crc, d->copy_crc, d->copy_len);
+    d->copied += d->copy_len;
+    d->ncopy_msgs++;
+    return 0;
+}
+
+/* 旧文件的 src 处 len 字节（crc 已知）正好是新文件的 dst 处；和上一段首尾相接就合并 */
+static int add_copy(delta_ctx_t *d, uint64_t dst, uint64_t src, uint32_t len, uint32_t crc)
+{
+    if (d->has_copy && d->copy_dst + d->copy_len == dst && d->copy_src + d->copy_len == src &&
+        d->copy_len + len <= CHUNK_SZ) {
+        d->copy_crc = crc32c_combine(d->copy_crc, crc, len);
+        d->copy_len += len;
+        return 0;
+    }
+    if (emit_copy(d) < 0) return -1;
+    d->has_copy = 1;
+    d->copy_dst = dst;
+    d->copy_src = src;
+    d->copy_len = len;
+    d->copy_crc = crc;
+    return 0;
+}
+
+/* 新文件 [lo, hi) 作为 FILE_DATA 发出，每块不超过 CHUNK_SZ */
+static int emit_literal(delta_ctx_t *d, uint64_t lo, uint64_t hi)
+{
+    if (lo < hi && emit_copy(d) < 0) return -1;
+    while (lo < hi) {
+        uint32_t n = (uint32_t)(hi - lo < CHUNK_SZ ? hi - lo : CHUNK_SZ);
+        const uint8_t *p = view(d, lo, n, lo);
+        if (!p) return -1;
+        protocol_msgv *m = queue_msg(d, MSG_FILE_DATA, 3);
+        if (!m) return -1;
+        uint32_t crc = crc32c(0, p, n);
+        build_iov_file_data(lo, p, n, crc, d->framing[m - d->mv], d->iov[m - d->mv]);
+        d->crc = crc32c_combine(d->crc, crc, n);
+        d->literal += n;
+        lo += n;
+    }
+    return 0;
+}
+
+/* 在签名里找和 p 处这一块相同的块，优先接着上一段复制的下一块；没有返回 -1 */
+static int64_t find_block(delta_ctx_t *d, uint32_t weak, const uint8_t *p, uint32_t *strong_out)
+{
+    uint32_t strong = 0;
+    int have_strong = 0;
+
+    if (d->has_copy) {
+        uint64_t want = (d->copy_src + d->copy_len) / d->block;
+        if ((d->copy_src + d->copy_len) % d->block == 0 && want < d->nsig) {
+            delta_sig_t s = delta_sig_at(d->sigs, (uint32_t)want);
+            if (s.weak == weak) {
+                strong = crc32c(0, p, d->block);
+                have_strong = 1;
+                if (s.strong == strong) { *strong_out = strong; return (int64_t)want; }
+            }
+        }
+    }
+    for (int32_t i = d->head[bucket_of(d, weak)]; i >= 0; i = d->next[i]) {
+        delta_sig_t s = delta_sig_at(d->sigs, (uint32_t)i);
+        if (s.weak != weak) continue;
+        if (!have_strong) { strong = crc32c(0, p, d->block); have_strong = 1; }
+        if (s.strong == strong) { *strong_out = strong; return i; }
+    }
+    return -1;
+}
+
+static int scan(delta_ctx_t *d)
+{
+    uint32_t B = d->block;
+    uint64_t pos = 0, lit = 0;
+    delta_roll_t roll;
+    int valid = 0;
+
+    while (d->nsig > 0 && pos + B <= d->fsize) {
+        // 多要一个字节给下一次滚动
+        uint32_t need = pos + B < d->fsize ? B + 1 : B;
+        const uint8_t *p = view(d, pos, need, lit);
+        if (!p) return -1;
+        if (!valid) { delta_roll_init(&roll, p, B); valid = 1; }
+
+        uint32_t strong = 0;
+        int64_t idx = find_block(d, delta_roll_digest(&roll), p, &strong);
+        if (idx >= 0) {
+            if (emit_literal(d, lit, pos) < 0) return -1;
+            uint64_t src = (uint64_t)idx * B;
+            if (B <= CHUNK_SZ) {
+                if (add_copy(d, pos, src, B, strong) < 0) return -1;
+            } else {
+                // 块比一条消息大：拆开，每段单独算 CRC
+                for (uint32_t o = 0; o < B; o += CHUNK_SZ) {
+                    uint32_t n = B - o < CHUNK_SZ ? B - o : CHUNK_SZ;
+                    const uint8_t *q = view(d, pos + o, n, pos + o);
+                    if (!q || add_copy(d, pos + o, src + o, n, crc32c(0, q, n)) < 0) return -1;
+                }
+            }
+            pos += B;
+            lit = pos;
+            valid = 0;
+            continue;
+        }
+
+        if (pos + B < d->fsize) delta_roll(&roll, p[0], p[B]);
+        pos++;
+        if (pos - lit >= CHUNK_SZ) {
+            if (emit_literal(d, lit, lit + CHUNK_SZ) < 0) return -1;
+            lit += CHUNK_SZ;
+        }
+    }
+    if (emit_literal(d, lit, d->fsize) < 0) return -1;
+    if (emit_copy(d) < 0) return -1;
+    return flush_queue(d);
+}
+
+static int send_simple(int fd, uint8_t type, uint32_t seq, const uint8_t *payload, uint32_t len)
+{
+    protocol_msg m = {0};
+    m.hdr.version_major  = 1;
+    m.hdr.version_minor  = 0;
+    m.hdr.message_type   = type;
+    m.hdr.payload_length = len;
+    m.hdr.seq            = seq;
+    m.payload            = (uint8_t *)payload;
+    return send_message(fd, &m);
+}
+
+int send_file_delta(int fd, const char *path, const send_opts_t *opts)
+{
+    delta_ctx_t *d = calloc(1, sizeof(*d));
+    if (!d) { perror("calloc"); return -1; }
+    d->fd = fd;
+    d->file_fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (d->file_fd < 0) { perror("open"); free(d); return -1; }
+
+    int rc = -1;
+    protocol_msg sig = {0};
+    struct stat sb;
+    if (fstat(d->file_fd, &sb) < 0) { perror("fstat"); goto out; }
+    d->fsize = (uint64_t)sb.st_size;
+    const char *fname = strrchr(path, '/');
+    fname = fname ? fname + 1 : path;
+
+    // SIG_REQUEST 和 FILE_START 都是文件名 + 大小 + 块长
+    uint8_t payload[1024];
+    uint32_t len = 0;
+    if (build_payload_file_start(fname, d->fsize, payload, sizeof(payload) - TLV_HEADER_LEN - TLV_U32_LEN, &len) < 0) {
+        fprintf(stderr, "build SIG_REQUEST payload failed\n");
+        goto out;
+    }
+    uint32_t base_len = len;
+    if (opts->delta_block) len = (uint32_t)(tlv_put_u32(payload + len, TLV_BLOCK_SIZE, opts->delta_block) - payload);
+    if (send_simple(fd, MSG_SIG_REQUEST, d->seq, payload, len) < 0) { perror("send SIG_REQUEST"); goto out; }
+
+    // 服务器要把旧文件读一遍才能回，不设超时
+    uint64_t old_size = 0;
+    if (read_reply(fd, MSG_SIGNATURES, "SIGNATURES", 0, &sig) < 0) goto out;
+    if (parse_payload_signatures(sig.payload, sig.hdr.payload_length, &d->block, &old_size,
+                                 &d->sigs, &d->nsig) < 0) {
+        fprintf(stderr, "bad SIGNATURES reply\n");
+        goto out;
+    }
+    if (build_index(d) < 0) { perror("malloc"); goto out; }
+    fprintf(stderr, "[client] delta: server has %llu bytes, block=%u, %u signatures\n",
+            (unsigned long long)old_size, d->block, d->nsig);
+
+    d->cap = DELTA_SCAN_BUF;
+    if (d->cap < 4 * ((size_t)d->block + CHUNK_SZ)) d->cap = 4 * ((size_t)d->block + CHUNK_SZ);
+    d->buf = malloc(d->cap);
+    if (!d->buf) { perror("malloc"); goto out; }
+    posix_fadvise(d->file_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    len = (uint32_t)(tlv_put_u32(payload + base_len, TLV_BLOCK_SIZE, d->block) - payload);
+    if (send_simple(fd, MSG_FILE_START, d->seq++, payload, len) < 0) { perror("send FILE_START"); goto out; }
+
+    if (scan(d) < 0) goto out;
+
+    uint8_t end_payload[TLV_HEADER_LEN + TLV_U32_LEN];
+    uint32_t end_len = (uint32_t)(tlv_put_u32(end_payload, TLV_CRC32, d->crc) - end_payload);
+    if (send_simple(fd, MSG_FILE_END, d->seq++, end_payload, end_len) < 0) { perror("send FILE_END"); goto out; }
+
+    fprintf(stderr, "[client] delta: copied %llu bytes in %llu messages, sent %llu literal bytes of %llu\n",
+            (unsigned long long)d->copied, (unsigned long long)d->ncopy_msgs,
+            (unsigned long long)d->literal, (unsigned long long)d->fsize);
+    fprintf(stderr, "[client] send file done.\n");
+    rc = 0;
+out:
+    free(sig.payload);
+    free(d->buf);
+    free(d->head);
+    free(d->next);
+    close(d->file_fd);
+    free(d);
+    return rc;
+}
@@ -0,0 +1,583 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/sendfile.h>
+#include <sys/random.h>
+#include "tcp_protocol.h"
+#include "tcp_tlv.h"
+#include "tcp_client.h"
+#include "readahead.h"
+#include "credit.h"
+#include "crc32c.h"
+#include "chunk_codec.h"
+
+/*
+ * 一条连接负责文件的 [lo, hi)。每条连接有自己的 seq 空间（服务器的重排窗口按连接算），
+ * 多条连接靠 FILE_START 里相同的 TLV_XFER_ID 在服务器端汇到同一个文件。
+ * 续传时只发 [lo, hi) 与 todo（服务器还缺的范围）的交集。
+ */
+typedef struct {
+    int         fd;             // <0 表示由线程自己连接
+    const char *path;
+    const char *fname;
+    uint64_t    fsize;
+    uint64_t    lo, hi;
+    uint32_t    seq;            // 本连接下一个 seq
+    uint32_t    crc;            // 本连接已发数据按 offset 顺序的 CRC32C
+    uint64_t    xfer_id;        // 0 表示单连接
+    uint32_t    streams;
+    uint64_t    resume_id;      // 0 表示不续传
+    const file_range_t *todo;   // 按 offset 排序的待发范围
+    uint32_t    ntodo;
+    int         codec;          // 服务器在 FILE_ACCEPT 里选定的 codec
+    uint64_t    nchunks;
+    uint64_t    zchunks;        // 压缩后发出的块数
+    uint64_t    wire;           // DATA/ZDATA 实际上线的字节
+    credit_t    cr;             // 信用流控和重发记录，没开 --credit 时不起作用
+    const send_opts_t *opts;
+    _Atomic uint64_t *sent;     // 所有连接合计已发字节，用于进度
+    int         rc;
+} stream_ctx_t;
+
+static inline uint32_t stream_seq(stream_ctx_t *st, uint32_t n) {
+    uint32_t s = st->seq;
+    st->seq += n;
+    return s;
+}
+
+static _Atomic uint64_t g_progress_ns;
+
+int progress_due(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    uint64_t now = (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+    uint64_t last = atomic_load_explicit(&g_progress_ns, memory_order_relaxed);
+    if (now - last < PROGRESS_MS * 1000000ull) return 0;
+    return atomic_compare_exchange_strong_explicit(&g_progress_ns, &last, now,
+                                                   memory_order_relaxed, memory_order_relaxed);
+}
+
+static void report_progress(stream_ctx_t *st, uint64_t n) {
+    uint64_t total = atomic_fetch_add_explicit(st->sent, n, memory_order_relaxed) + n;
+    if (!progress_due()) return;
+    fprintf(stderr, "\r[client] sent %llu bytes", (unsigned long long)total);
+    fflush(stderr);
+}
+
+static void init_data_msgv(protocol_msgv *m, uint32_t seq, const struct iovec *iov) {
+    memset(m, 0, sizeof(*m));
+    m->hdr.version_major = 1;
+    m->hdr.version_minor = 0;
+    m->hdr.message_type  = MSG_FILE_DATA;
+    m->hdr.seq           = seq;
+    m->iov               = iov;
+    m->iovcnt            = 3;
+}
+
+/* 压缩过的块发 ZDATA，否则发原始 DATA；CRC 总是原始数据的 */
+static int build_chunk_iov(stream_ctx_t *st, const ra_chunk_t *c, uint8_t *framing, struct iovec iov[3]) {
+    st->nchunks++;
+    if (c->zlen) {
+        st->zchunks++;
+        st->wire += c->zlen;
+        return build_iov_file_zdata(c->off, c->zdata, c->zlen, c->len, c->crc, framing, iov);
+    }
+    st->wire += c->len;
+    return build_iov_file_data(c->off, c->data, c->len, c->crc, framing, iov);
+}
+
+/*
+ * 读线程按块 pread 进环形缓冲并算好每块 CRC，当前线程从环里成对取块发送；
+ * TLV 前缀、数据和 CRC 以 iov 形式交给 send_messagev，数据不再拷成连续 payload。
+ * 协商出 codec 时由 readahead 的压缩线程先压好再交过来。
+ */
+static int send_data_copy(stream_ctx_t *st, int file_fd, uint64_t lo, uint64_t hi) {
+    readahead_t ra;
+    uint32_t depth = st->opts->readahead ? st->opts->readahead : READAHEAD_DEPTH;
+    uint32_t nworkers = st->opts->compress_workers ? st->opts->compress_workers : COMPRESS_WORKERS;
+    if (readahead_start(&ra, file_fd, lo, hi, depth, CHUNK_SZ, st->codec, nworkers) < 0) {
+        perror("readahead_start");
+        return -1;
+    }
+    int fd = st->fd;
+    int rc = -1;
+
+    for (;;) {
+        // 取 A，再“偷看”B
+        const ra_chunk_t *a = readahead_peek(&ra, 0);
+        if (!a) break;
+        const ra_chunk_t *b = readahead_peek(&ra, 1);
+        // 信用只够一个 seq 时 B 留到下一轮，A 按顺序单独发
+        int room = credit_wait(&st->cr, st->seq, b ? 2u : 1u);
+        if (room < 0) goto out;
+        if (room < 2) b = NULL;
+
+        uint8_t framingA[FILE_ZDATA_FRAMING_LEN], framingB[FILE_ZDATA_FRAMING_LEN];
+        struct iovec iovA[3], iovB[3];
+        protocol_msgv mv[2];
+
+        if (b) {
+            // 预留两个连续序号：A=base, B=base+1
+            uint32_t base = stream_seq(st, 2u);
+            uint32_t seqA = base;
+            uint32_t seqB = (base + 1u) & 0xFFFFFFFFu;
+
+            // 先 B 后 A，一次 sendmsg 发出
+            if (build_chunk_iov(st, b, framingB, iovB) < 0 ||
+                build_chunk_iov(st, a, framingA, iovA) < 0) {
+                fprintf(stderr, "build FILE_DATA failed\n"); goto out;
+            }
+            init_data_msgv(&mv[0], seqB, iovB);
+            init_data_msgv(&mv[1], seqA, iovA);   // 注意：A 的 seq 比 B 小
+            if (send_messagev(fd, mv, 2) < 0) { perror("send FILE_DATA B/A"); goto out; }
+            if (credit_sent(&st->cr, seqA, a->off, a->len) < 0 ||
+                credit_sent(&st->cr, seqB, b->off, b->len) < 0) goto out;
+            st->crc = crc32c_combine(st->crc, a->crc, a->len);
+            st->crc = crc32c_combine(st->crc, b->crc, b->len);
+            report_progress(st, (uint64_t)a->len + b->len);
+            readahead_release(&ra, 2);
+        } else {
+            // 最后一块只有 A：正常顺序即可
+            if (build_chunk_iov(st, a, framingA, iovA) < 0) {
+                fprintf(stderr, "build FILE_DATA failed\n"); goto out;
+            }
+            uint32_t seqA = stream_seq(st, 1u);
+            init_data_msgv(&mv[0], seqA, iovA);
+            if (send_messagev(fd, mv, 1) < 0) { perror("send FILE_DATA"); goto out; }
+            if (credit_sent(&st->cr, seqA, a->off, a->len) < 0) goto out;
+            st->crc = crc32c_combine(st->crc, a->crc, a->len);
+            report_progress(st, a->len);
+            readahead_release(&ra, 1);
+        }
+    }
+    if (ra.err) { errno = ra.err; perror("pread"); goto out; }
+    rc = 0;
+out:
+    readahead_stop(&ra);
+    return rc;
+}
+
+/*
+ * 一个 FILE_DATA 帧：协议头 + OFFSET TLV + DATA 的 TLV 头在用户态拼好，用 MSG_MORE
+ * 发出，让内核和后面的文件数据合成满 MSS 的段；数据本身由 sendfile 从页缓存直接送进
+ * socket，不经过用户态缓冲。
+ */
+static int send_chunk_sendfile(int fd, int file_fd, uint64_t off, uint32_t len, uint32_t seq) {
+    uint8_t head[PROTOCOL_HEADER_LEN + FILE_DATA_PREFIX_LEN];
+    uint32_t prefix_len = 0;
+    if (build_payload_file_data_prefix(off, len, head + PROTOCOL_HEADER_LEN,
+                                       FILE_DATA_PREFIX_LEN, &prefix_len) < 0) {
+        fprintf(stderr, "build FILE_DATA prefix failed\n");
+        return -1;
+    }
+
+    protocol_header hdr = {0};
+    hdr.version_major  = 1;
+    hdr.version_minor  = 0;
+    hdr.message_type   = MSG_FILE_DATA;
+    hdr.payload_length = prefix_len + len;
+    hdr.seq            = seq;
+    protocol_header wire;
+    protocol_header_to_wire(&hdr, &wire);
+    memcpy(head, &wire, PROTOCOL_HEADER_LEN);
+
+    size_t hlen = PROTOCOL_HEADER_LEN + prefix_len;
+    size_t hoff = 0;
+    while (hoff < hlen) {
+        ssize_t m = send(fd, head + hoff, hlen - hoff, MSG_MORE);
+        if (m < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        hoff += (size_t)m;
+    }
+
+    off_t pos = (off_t)off;
+    size_t left = len;
+    while (left > 0) {
+        ssize_t m = sendfile(fd, file_fd, &pos, left);
+        if (m < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (m == 0) {
+            // 文件在发送过程中被截短，帧已经发了一半，只能断开
+            errno = EIO;
+            return -1;
+        }
+        left -= (size_t)m;
+    }
+    return 0;
+}
+
+/* 与 send_data_copy 相同的分块和 seq 顺序，只是数据走 sendfile；数据不进用户态，所以不带 CRC */
+static int send_data_sendfile(stream_ctx_t *st, int file_fd, uint64_t lo, uint64_t hi) {
+    int fd = st->fd;
+    uint64_t offset = lo;
+
+    while (offset < hi) {
+        uint64_t left = hi - offset;
+        uint32_t r1 = (uint32_t)(left < CHUNK_SZ ? left : CHUNK_SZ);
+        left -= r1;
+        uint32_t r2 = (uint32_t)(left < CHUNK_SZ ? left : CHUNK_SZ);
+        int room = credit_wait(&st->cr, st->seq, r2 > 0 ? 2u : 1u);
+        if (room < 0) return -1;
+        if (room < 2) r2 = 0;
+
+        if (r2 > 0) {
+            uint32_t base = stream_seq(st, 2u);
+            if (send_chunk_sendfile(fd, file_fd, offset + r1, r2, base + 1u) < 0) {
+                perror("sendfile FILE_DATA B"); return -1;
+            }
+            if (send_chunk_sendfile(fd, file_fd, offset, r1, base) < 0) {
+                perror("sendfile FILE_DATA A"); return -1;
+            }
+            if (credit_sent(&st->cr, base, offset, r1) < 0 ||
+                credit_sent(&st->cr, base + 1u, offset + r1, r2) < 0) return -1;
+        } else {
+            uint32_t seq = stream_seq(st, 1u);
+            if (send_chunk_sendfile(fd, file_fd, offset, r1, seq) < 0) {
+                perror("sendfile FILE_DATA"); return -1;
+            }
+            if (credit_sent(&st->cr, seq, offset, r1) < 0) return -1;
+        }
+        offset += (uint64_t)r1 + r2;
+        report_progress(st, (uint64_t)r1 + r2);
+    }
+    return 0;
+}
+
+static int send_start(stream_ctx_t *st) {
+    uint8_t start_payload[1024];
+    uint32_t start_len = 0;
+    if (build_payload_file_start(st->fname, st->fsize, start_payload, sizeof(start_payload), &start_len) < 0) {
+        fprintf(stderr, "build FILE_START payload failed\n");
+        return -1;
+    }
+    uint32_t extra = 0;
+    if (st->opts->window) extra += TLV_HEADER_LEN + TLV_U32_LEN;
+    if (st->opts->compress) extra += TLV_HEADER_LEN + TLV_U32_LEN;
+    if (st->xfer_id) extra += 2 * TLV_HEADER_LEN + TLV_U64_LEN + TLV_U32_LEN;
+    if (st->resume_id) extra += TLV_HEADER_LEN + TLV_U64_LEN;
+    if (st->opts->credit) extra += TLV_HEADER_LEN + TLV_U32_LEN;
+    if (start_len + extra > sizeof(start_payload)) {
+        fprintf(stderr, "build FILE_START payload failed\n");
+        return -1;
+    }
+    uint8_t *w = start_payload + start_len;
+    if (st->opts->window) w = tlv_put_u32(w, TLV_WINDOW, st->opts->window);
+    if (st->opts->compress) w = tlv_put_u32(w, TLV_COMPRESS, codec_supported());
+    if (st->xfer_id) {
+        w = tlv_put_u64(w, TLV_XFER_ID, st->xfer_id);
+        w = tlv_put_u32(w, TLV_STREAMS, st->streams);
+    }
+    if (st->resume_id) w = tlv_put_u64(w, TLV_RESUME_ID, st->resume_id);
+    if (st->opts->credit) w = tlv_put_u32(w, TLV_CREDIT, 1);
+    start_len = (uint32_t)(w - start_payload);
+
+    protocol_msg mstart = {0};
+    mstart.hdr.version_major  = 1;
+    mstart.hdr.version_minor  = 0;
+    mstart.hdr.message_type   = MSG_FILE_START;
+    mstart.hdr.payload_length = start_len;
+    mstart.hdr.seq            = stream_seq(st, 1u);
+    mstart.payload            = start_payload;
+
+    if (send_message(st->fd, &mstart) < 0) {
+        perror("send FILE_START");
+        return -1;
+    }
+    return 0;
+}
+
+int read_reply(int fd, uint8_t type, const char *what, int timeout_s, protocol_msg *m) {
+    struct timeval old, tv = { .tv_sec = timeout_s, .tv_usec = 0 };
+    socklen_t olen = sizeof(old);
+    if (getsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &old, &olen) < 0) memset(&old, 0, sizeof(old));
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    memset(m, 0, sizeof(*m));
+    int r = read_message(fd, m);
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &old, sizeof(old));
+    if (r != 0) {
+        if (r < 0) fprintf(stderr, "read %s: %s\n", what, strerror(errno));
+        else fprintf(stderr, "server closed before %s\n", what);
+        return -1;
+    }
+    if (m->hdr.message_type != type) {
+        fprintf(stderr, "expected %s, got type %u\n", what, (unsigned)m->hdr.message_type);
+        free(m->payload);
+        return -1;
+    }
+    return 0;
+}
+
+/* 带了 TLV_COMPRESS 的 FILE_START 之后服务器先回 FILE_ACCEPT，里面是它选的 codec */
+static int await_accept(stream_ctx_t *st) {
+    protocol_msg m;
+    if (read_reply(st->fd, MSG_FILE_ACCEPT, "FILE_ACCEPT", REPLY_TIMEOUT_S, &m) < 0) return -1;
+    uint32_t c = CODEC_NONE;
+    tlv_find_u32(m.payload, m.hdr.payload_length, TLV_COMPRESS, &c);
+    free(m.payload);
+    st->codec = (c != CODEC_NONE && (codec_supported() & CODEC_MASK(c))) ? (int)c : CODEC_NONE;
+    return 0;
+}
+
+static int send_end(stream_ctx_t *st) {
+    uint8_t end_payload[TLV_HEADER_LEN + TLV_U32_LEN];
+    uint32_t end_len = 0;
+    if (!st->opts->zerocopy) {
+        end_len = (uint32_t)(tlv_put_u32(end_payload, TLV_CRC32, st->crc) - end_payload);
+    }
+
+    protocol_msg mend = {0};
+    mend.hdr.version_major  = 1;
+    mend.hdr.version_minor  = 0;
+    mend.hdr.message_type   = MSG_FILE_END;
+    mend.hdr.payload_length = end_len;
+    mend.hdr.seq            = stream_seq(st, 1u);
+    mend.payload            = end_len ? end_payload : NULL;
+
+    if (send_message(st->fd, &mend) < 0) {
+        perror("send FILE_END");
+        return -1;
+    }
+    return 0;
+}
+
+static int run_stream(stream_ctx_t *st) {
+    int file_fd = open(st->path, O_RDONLY | O_CLOEXEC);
+    if (file_fd < 0) { perror("open"); return -1; }
+
+    int r = send_start(st);
+    if (r == 0 && st->opts->credit) credit_init(&st->cr, st->fd, file_fd, st->seq);
+    if (r == 0 && st->opts->compress) r = await_accept(st);
+    for (uint32_t i = 0; r == 0 && i < st->ntodo; ++i) {
+        uint64_t lo = st->todo[i].off, hi = st->todo[i].off + st->todo[i].len;
+        if (lo < st->lo) lo = st->lo;
+        if (hi > st->hi) hi = st->hi;
+        if (lo >= hi) continue;
+        if (st->opts->zerocopy) {
+            posix_fadvise(file_fd, (off_t)lo, (off_t)(hi - lo), POSIX_FADV_SEQUENTIAL);
+            r = send_data_sendfile(st, file_fd, lo, hi);
+        } else {
+            r = send_data_copy(st, file_fd, lo, hi);
+        }
+    }
+    if (r == 0) r = send_end(st);
+    // 等最后的确认时还可能要按 NACK 重读文件，file_fd 之后再关
+    if (r == 0) r = credit_drain(&st->cr, st->seq);
+    credit_free(&st->cr);
+    close(file_fd);
+    return r;
+}
+
+static void *stream_thread(void *arg) {
+    stream_ctx_t *st = arg;
+    st->fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (st->fd < 0) { perror("socket"); st->rc = -1; return NULL; }
+    if (connect(st->fd, (const struct sockaddr *)&st->opts->server, sizeof(st->opts->server)) < 0) {
+        perror("connect");
+        st->rc = -1;
+    } else {
+        st->rc = run_stream(st);
+    }
+    close(st->fd);
+    return NULL;
+}
+
+/* 同一个本地文件（名字、大小、inode、修改时间都不变）每次得到同一个续传 id */
+static uint64_t file_resume_id(const char *path, const char *fname, uint64_t fsize) {
+    struct stat sb;
+    memset(&sb, 0, sizeof(sb));
+    if (stat(path, &sb) < 0) perror("stat");
+    uint64_t v[4] = { fsize, (uint64_t)sb.st_ino,
+                      (uint64_t)sb.st_mtim.tv_sec, (uint64_t)sb.st_mtim.tv_nsec };
+    // FNV-1a
+    uint64_t h = 1469598103934665603ull;
+    for (const char *p = fname; *p; ++p) h = (h ^ (uint8_t)*p) * 1099511628211ull;
+    const uint8_t *b = (const uint8_t *)v;
+    for (size_t i = 0; i < sizeof(v); ++i) h = (h ^ b[i]) * 1099511628211ull;
+    return h ? h : 1;
+}
+
+/*
+ * 续传：在第一条连接上发 FILE_QUERY，拿到服务器已落盘的范围，求出 [0, fsize) 里
+ * 还缺的部分。服务器没有记录时缺的就是整个文件。*todo 由调用者 free。
+ */
+static int query_missing(int fd, const char *fname, uint64_t fsize, uint64_t resume_id,
+                         file_range_t **todo, uint32_t *ntodo) {
+    uint8_t payload[1024];
+    uint32_t len = 0;
+    if (build_payload_file_start(fname, fsize, payload, sizeof(payload) - TLV_HEADER_LEN - TLV_U64_LEN, &len) < 0) {
+        fprintf(stderr, "build FILE_QUERY payload failed\n");
+        return -1;
+    }
+    len = (uint32_t)(tlv_put_u64(payload + len, TLV_RESUME_ID, resume_id) - payload);
+
+    protocol_msg q = {0};
+    q.hdr.version_major  = 1;
+    q.hdr.version_minor  = 0;
+    q.hdr.message_type   = MSG_FILE_QUERY;
+    q.hdr.payload_length = len;
+    q.payload            = payload;
+    if (send_message(fd, &q) < 0) { perror("send FILE_QUERY"); return -1; }
+
+    protocol_msg m;
+    if (read_reply(fd, MSG_FILE_RANGES, "FILE_RANGES", REPLY_TIMEOUT_S, &m) < 0) return -1;
+    int n = parse_payload_file_ranges(m.payload, m.hdr.payload_length, NULL, 0);
+    file_range_t *have = n > 0 ? calloc((size_t)n, sizeof(*have)) : NULL;
+    file_range_t *miss = calloc((size_t)(n > 0 ? n : 0) + 1, sizeof(*miss));
+    if (n < 0 || (n > 0 && !have) || !miss) {
+        fprintf(stderr, "bad FILE_RANGES reply\n");
+        free(m.payload); free(have); free(miss);
+        return -1;
+    }
+    if (n > 0) parse_payload_file_ranges(m.payload, m.hdr.payload_length, have, (uint32_t)n);
+    free(m.payload);
+
+    // 服务器按 offset 升序报不相交的范围；取补集
+    uint64_t pos = 0, got = 0;
+    uint32_t k = 0;
+    for (int i = 0; i < n; ++i) {
+        uint64_t lo = have[i].off, hi = have[i].off + have[i].len;
+        if (hi > fsize) hi = fsize;
+        if (lo < pos || lo >= hi) continue;
+        if (lo > pos) miss[k++] = (file_range_t){ .off = pos, .len = lo - pos };
+        got += hi - lo;
+        pos = hi;
+    }
+    if (pos < fsize) miss[k++] = (file_range_t){ .off = pos, .len = fsize - pos };
+    free(have);
+
+    fprintf(stderr, "[client] resume id=%016llx: server has %llu of %llu bytes, sending %llu in %u range(s)\n",
+            (unsigned long long)resume_id, (unsigned long long)got, (unsigned long long)fsize,
+            (unsigned long long)(fsize - got), k);
+    *todo = miss;
+    *ntodo = k;
+    return 0;
+}
+
+static uint64_t new_xfer_id(void) {
+    uint64_t id = 0;
+    if (getrandom(&id, sizeof(id), 0) != (ssize_t)sizeof(id)) {
+        id = ((uint64_t)time(NULL) << 32) ^ ((uint64_t)getpid() << 16) ^ (uint64_t)clock();
+    }
+    return id ? id : 1;
+}
+
+int send_file(int fd, const char *path, const send_opts_t *opts) {
+    if (opts->delta) return send_file_delta(fd, path, opts);
+
+    FILE *fp = fopen(path, "rb");
+    if (!fp) { perror("fopen"); return -1; }
+
+    if (fseek(fp, 0, SEEK_END) != 0) { perror("fseek"); fclose(fp); return -1; }
+    long long sz_ll = ftell(fp);
+    if (sz_ll < 0) { perror("ftell"); fclose(fp); return -1; }
+    fclose(fp);
+    uint64_t fsize = (uint64_t)sz_ll;
+
+    const char *fname = strrchr(path, '/');
+    fname = fname ? fname + 1 : path;
+
+    // 按整块切分，连接数不超过块数
+    uint64_t chunks = (fsize + CHUNK_SZ - 1) / CHUNK_SZ;
+    uint32_t streams = opts->streams ? opts->streams : 1;
+    if (chunks < streams) streams = chunks ? (uint32_t)chunks : 1;
+    uint64_t per = (chunks + streams - 1) / streams;
+
+    file_range_t whole = { .off = 0, .len = fsize };
+    file_range_t *todo = &whole, *missing = NULL;
+    uint32_t ntodo = 1;
+    uint64_t resume_id = 0;
+    if (opts->resume) {
+        resume_id = file_resume_id(path, fname, fsize);
+        if (query_missing(fd, fname, fsize, resume_id, &missing, &ntodo) < 0) return -1;
+        todo = missing;
+    }
+
+    stream_ctx_t *sts = calloc(streams, sizeof(*sts));
+    pthread_t *ths = calloc(streams, sizeof(*ths));
+    if (!sts || !ths) { perror("calloc"); free(sts); free(ths); free(missing); return -1; }
+
+    _Atomic uint64_t sent = 0;
+    uint64_t xfer_id = streams > 1 ? new_xfer_id() : 0;
+    for (uint32_t i = 0; i < streams; ++i) {
+        stream_ctx_t *st = &sts[i];
+        st->fd      = (i == 0) ? fd : -1;
+        st->path    = path;
+        st->fname   = fname;
+        st->fsize   = fsize;
+        st->lo      = (uint64_t)i * per * CHUNK_SZ;
+        st->hi      = (uint64_t)(i + 1) * per * CHUNK_SZ;
+        if (st->lo > fsize) st->lo = fsize;
+        if (st->hi > fsize) st->hi = fsize;
+        st->xfer_id = xfer_id;
+        st->streams = streams;
+        st->resume_id = resume_id;
+        st->todo    = todo;
+        st->ntodo   = ntodo;
+        st->opts    = opts;
+        st->sent    = &sent;
+    }
+    if (streams > 1) {
+        fprintf(stderr, "[client] xfer=%016llx streams=%u\n", (unsigned long long)xfer_id, streams);
+    }
+
+    // 第 0 条连接用调用者的 fd，在当前线程跑
+    uint32_t started = 1;
+    for (uint32_t i = 1; i < streams; ++i, ++started) {
+        if (pthread_create(&ths[i], NULL, stream_thread, &sts[i]) != 0) {
+            perror("pthread_create");
+            break;
+        }
+    }
+    int rc = run_stream(&sts[0]);
+    for (uint32_t i = 1; i < started; ++i) {
+        pthread_join(ths[i], NULL);
+        if (sts[i].rc < 0) rc = -1;
+    }
+    if (started < streams) rc = -1;
+    // 进度行是节流过的，补一行最终的合计
+    fprintf(stderr, "\r[client] sent %llu bytes\n", (unsigned long long)atomic_load(&sent));
+    if (opts->compress) {
+        uint64_t n = 0, z = 0, wire = 0;
+        for (uint32_t i = 0; i < streams; ++i) {
+            n += sts[i].nchunks;
+            z += sts[i].zchunks;
+            wire += sts[i].wire;
+        }
+        fprintf(stderr, "[client] codec=%d compressed %llu/%llu chunks, %llu of %llu data bytes on wire\n",
+                sts[0].codec, (unsigned long long)z, (unsigned long long)n,
+                (unsigned long long)wire, (unsigned long long)fsize);
+    }
+    if (opts->credit) {
+        uint64_t stalls = 0, resent = 0;
+        for (uint32_t i = 0; i < streams; ++i) {
+            stalls += sts[i].cr.stalls;
+            resent += sts[i].cr.resent;
+        }
+        fprintf(stderr, "[client] credit: waited for FILE_CREDIT %llu time(s), retransmitted %llu chunk(s)\n",
+                (unsigned long long)stalls, (unsigned long long)resent);
+    }
+    free(sts);
+    free(ths);
+    free(missing);
+    if (rc < 0) return -1;
+
+    fprintf(stderr, "[client] send file done.\n");
+    return 0;
+}
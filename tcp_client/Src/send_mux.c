@@ -0,0 +1,185 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "tcp_protocol.h"
+#include "tcp_tlv.h"
+#include "tcp_client.h"
+#include "crc32c.h"
+
+/*
+ * 一条连接上同时传多个文件：每个文件占一个通道（消息以 TLV_CHANNEL 开头），各有自己的
+ * seq 空间，服务器为每个通道单独建接收状态。最多 mux 个文件同时在传，每轮从每个在传的
+ * 文件取一块，连同新文件的 FILE_START 和传完的 FILE_END 一起交给一次 send_messagev，
+ * 小文件多时一轮就能发完好几个。
+ */
+
+#define MUX_MSGS_PER_FILE 3     // 一轮里一个文件最多 START + DATA + END
+
+typedef struct {
+    const char *path;
+    int      fd;                // <0 表示空槽
+    uint32_t chan;
+    uint32_t seq;
+    uint64_t off;
+    uint64_t size;
+    uint32_t crc;
+    int      done;              // 本轮发了 FILE_END，发完关掉
+    uint8_t *buf;               // CHUNK_SZ
+    uint8_t  head[TLV_CHANNEL_PREFIX_LEN];
+    uint8_t  start[1024];
+    uint8_t  framing[FILE_DATA_FRAMING_LEN];
+    uint8_t  end[TLV_HEADER_LEN + TLV_U32_LEN];
+    struct iovec iov[8];        // START 2 段 + DATA 4 段 + END 2 段
+} mux_file_t;
+
+static protocol_msgv *push_msg(protocol_msgv *mv, int *n, uint16_t type, uint32_t seq,
+                               const struct iovec *iov, int iovcnt) {
+    protocol_msgv *m = &mv[(*n)++];
+    memset(m, 0, sizeof(*m));
+    m->hdr.version_major = 1;
+    m->hdr.version_minor = 0;
+    m->hdr.message_type  = type;
+    m->hdr.seq           = seq;
+    m->iov               = iov;
+    m->iovcnt            = iovcnt;
+    return m;
+}
+
+/* 打开下一个文件占住空槽，排进 FILE_START；打不开的文件跳过 */
+static int mux_open(mux_file_t *f, const char *path, uint32_t chan, const send_opts_t *opts,
+                    protocol_msgv *mv, int *n) {
+    f->fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat sb;
+    if (f->fd < 0 || fstat(f->fd, &sb) < 0) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        if (f->fd >= 0) close(f->fd);
+        f->fd = -1;
+        return -1;
+    }
+    posix_fadvise(f->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    const char *fname = strrchr(path, '/');
+    fname = fname ? fname + 1 : path;
+
+    f->path = path;
+    f->chan = chan;
+    f->seq  = 0;
+    f->off  = 0;
+    f->size = (uint64_t)sb.st_size;
+    f->crc  = 0;
+    f->done = 0;
+    tlv_put_u32(f->head, TLV_CHANNEL, chan);
+
+    uint32_t len = 0;
+    uint32_t cap = sizeof(f->start) - (opts->window ? TLV_HEADER_LEN + TLV_U32_LEN : 0);
+    if (build_payload_file_start(fname, f->size, f->start, cap, &len) < 0) {
+        fprintf(stderr, "%s: build FILE_START payload failed\n", path);
+        close(f->fd);
+        f->fd = -1;
+        return -1;
+    }
+    if (opts->window) len = (uint32_t)(tlv_put_u32(f->start + len, TLV_WINDOW, opts->window) - f->start);
+
+    f->iov[0] = (struct iovec){ f->head, TLV_CHANNEL_PREFIX_LEN };
+    f->iov[1] = (struct iovec){ f->start, len };
+    push_msg(mv, n, MSG_FILE_START, f->seq++, &f->iov[0], 2);
+    return 0;
+}
+
+/* 取下一块排进 FILE_DATA；读到文件末尾再排 FILE_END */
+static int mux_step(mux_file_t *f, protocol_msgv *mv, int *n) {
+    if (f->off < f->size) {
+        uint64_t left = f->size - f->off;
+        size_t want = left < CHUNK_SZ ? (size_t)left : CHUNK_SZ;
+        ssize_t got = pread(f->fd, f->buf, want, (off_t)f->off);
+        if (got < 0) { fprintf(stderr, "%s: pread: %s\n", f->path, strerror(errno)); return -1; }
+        if (got == 0) {
+            // 文件被截短，按已发的部分收尾
+            f->size = f->off;
+        } else {
+            uint32_t crc = crc32c(0, f->buf, (size_t)got);
+            f->iov[2] = (struct iovec){ f->head, TLV_CHANNEL_PREFIX_LEN };
+            if (build_iov_file_data(f->off, f->buf, (uint32_t)got, crc, f->framing, &f->iov[3]) < 0) {
+                fprintf(stderr, "build FILE_DATA failed\n");
+                return -1;
+            }
+            push_msg(mv, n, MSG_FILE_DATA, f->seq++, &f->iov[2], 4);
+            f->crc = crc32c_combine(f->crc, crc, (uint64_t)got);
+            f->off += (uint64_t)got;
+        }
+    }
+    if (f->off >= f->size) {
+        uint32_t len = (uint32_t)(tlv_put_u32(f->end, TLV_CRC32, f->crc) - f->end);
+        f->iov[6] = (struct iovec){ f->head, TLV_CHANNEL_PREFIX_LEN };
+        f->iov[7] = (struct iovec){ f->end, len };
+        push_msg(mv, n, MSG_FILE_END, f->seq++, &f->iov[6], 2);
+        f->done = 1;
+    }
+    return 0;
+}
+
+int send_files_mux(int fd, const char *const *paths, int npaths, const send_opts_t *opts) {
+    uint32_t mux = opts->mux ? opts->mux : MUX_DEFAULT;
+    if ((int)mux > npaths) mux = npaths > 0 ? (uint32_t)npaths : 1;
+
+    mux_file_t *files = calloc(mux, sizeof(*files));
+    protocol_msgv *mv = calloc((size_t)mux * MUX_MSGS_PER_FILE, sizeof(*mv));
+    if (!files || !mv) { perror("calloc"); free(files); free(mv); return -1; }
+    int rc = 0;
+    for (uint32_t i = 0; i < mux; ++i) {
+        files[i].fd = -1;
+        files[i].buf = malloc(CHUNK_SZ);
+        if (!files[i].buf) { perror("malloc"); rc = -1; }
+    }
+
+    int next = 0, failed = 0, sent_files = 0;
+    uint32_t chan = 0;
+    uint64_t bytes = 0;
+    while (rc == 0) {
+        int n = 0, active = 0;
+        for (uint32_t i = 0; i < mux && rc == 0; ++i) {
+            mux_file_t *f = &files[i];
+            while (f->fd < 0 && next < npaths) {
+                if (mux_open(f, paths[next++], ++chan, opts, mv, &n) < 0) failed++;
+            }
+            if (f->fd < 0) continue;
+            active++;
+            uint64_t before = f->off;
+            if (mux_step(f, mv, &n) < 0) rc = -1;
+            bytes += f->off - before;
+        }
+        if (rc < 0 || active == 0) break;
+        if (send_messagev(fd, mv, n) < 0) { perror("send mux batch"); rc = -1; break; }
+
+        for (uint32_t i = 0; i < mux; ++i) {
+            mux_file_t *f = &files[i];
+            if (f->fd < 0 || !f->done) continue;
+            close(f->fd);
+            f->fd = -1;
+            sent_files++;
+        }
+        if (progress_due()) {
+            fprintf(stderr, "\r[client] sent %d/%d file(s), %llu bytes", sent_files, npaths,
+                    (unsigned long long)bytes);
+            fflush(stderr);
+        }
+    }
+    fprintf(stderr, "\r[client] sent %d/%d file(s), %llu bytes\n", sent_files, npaths,
+            (unsigned long long)bytes);
+
+    for (uint32_t i = 0; i < mux; ++i) {
+        if (files[i].fd >= 0) close(files[i].fd);
+        free(files[i].buf);
+    }
+    free(files);
+    free(mv);
+    if (rc < 0) return -1;
+    fprintf(stderr, "[client] %d file(s) on one connection, mux=%u%s\n", sent_files, mux,
+            failed ? ", some files skipped" : "");
+    return failed ? -1 : 0;
+}
@@ -0,0 +1,192 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include "tcp_protocol.h"
+#include "tcp_tlv.h"
+#include "tcp_client.h"
+#include "credit.h"
+#include "crc32c.h"
+
+/*
+ * UDP 上传：帧格式和 TCP 上的一样，每个数据报一帧，数据块切到不会分片的长度。可靠性靠
+ * 服务器的 FILE_CREDIT（ACK_SEQ / 信用 / NACK），丢了的块按 NACK 单独补，不会像单条 TCP
+ * 那样一次丢包就把窗口砍半，在带宽时延积大、有丢包的链路上能跑满 --rate。
+ * 服务器收不到东西时会定时重发信用；FILE_START、FILE_END 由这边重发，直到被信用确认。
+ */
+
+// UDP 的发送缓冲要装得下一个信用窗口的突发
+#ifndef UDP_SOCK_BUF
+#define UDP_SOCK_BUF (8 * 1024 * 1024)
+#endif
+
+typedef struct {
+    uint64_t rate;          // 字节/秒，0 表示不限速
+    uint64_t t0;
+    uint64_t sent;
+} pacer_t;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/*
+ * 按 rate 均匀发：已发字节应在的时刻还没到就睡到那时。等信用落后了太久就从现在重新计，
+ * 不把欠下的一口气补发出去。
+ */
+static void pace(pacer_t *p, size_t n) {
+    if (!p->rate) return;
+    uint64_t now = now_ns();
+    uint64_t due = p->t0 + p->sent * 1000000000ull / p->rate;
+    if (now > due + 50000000ull) {
+        p->t0 = now;
+        p->sent = 0;
+        due = now;
+    }
+    p->sent += n;
+    if (due > now + 100000ull) {
+        struct timespec ts = { .tv_sec = (time_t)((due - now) / 1000000000ull),
+                               .tv_nsec = (long)((due - now) % 1000000000ull) };
+        nanosleep(&ts, NULL);
+    }
+}
+
+static void init_msgv(protocol_msgv *m, uint16_t type, uint32_t seq, const struct iovec *iov, int iovcnt) {
+    memset(m, 0, sizeof(*m));
+    m->hdr.version_major = 1;
+    m->hdr.version_minor = 0;
+    m->hdr.message_type  = type;
+    m->hdr.seq           = seq;
+    m->iov               = iov;
+    m->iovcnt            = iovcnt;
+}
+
+/* 发出控制消息，等到信用确认到 want_ack（并且给了信用）；UDP_RESEND_MS 没等到就重发 */
+static int send_until_acked(credit_t *cr, protocol_msgv *m, uint32_t want_ack, const char *what) {
+    for (int tries = 0; tries <= UDP_RESEND_MAX; ++tries) {
+        if (send_messagev(cr->fd, m, 1) < 0) { fprintf(stderr, "send %s: %s\n", what, strerror(errno)); return -1; }
+        uint64_t deadline = now_ns() + UDP_RESEND_MS * 1000000ull;
+        for (;;) {
+            if (cr->ack == want_ack && cr->credit > 0) return 0;
+            uint64_t now = now_ns();
+            if (now >= deadline) break;
+            // 期间到的信用可能带 NACK，照常重发
+            if (credit_poll(cr, (int)((deadline - now + 999999ull) / 1000000ull)) < 0) return -1;
+        }
+    }
+    fprintf(stderr, "%s not acknowledged after %d resends\n", what, UDP_RESEND_MAX);
+    return -1;
+}
+
+int send_file_udp(const struct sockaddr_in *server, const char *path, const send_opts_t *opts) {
+    uint32_t chunk = opts->udp_chunk ? opts->udp_chunk : UDP_CHUNK_SZ;
+    uint32_t win = opts->window ? opts->window : UDP_WINDOW;
+    int file_fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (file_fd < 0) { perror("open"); return -1; }
+    struct stat sb;
+    if (fstat(file_fd, &sb) < 0) { perror("fstat"); close(file_fd); return -1; }
+    uint64_t fsize = (uint64_t)sb.st_size;
+    posix_fadvise(file_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    const char *fname = strrchr(path, '/');
+    fname = fname ? fname + 1 : path;
+
+    int fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) { perror("socket"); close(file_fd); return -1; }
+    int sz = UDP_SOCK_BUF;
+    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sz, sizeof(sz));
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &sz, sizeof(sz));
+    // connect 之后 send/recv 不用带地址，服务器没在听时也能从 ICMP 拿到 ECONNREFUSED
+    if (connect(fd, (const struct sockaddr *)server, sizeof(*server)) < 0) {
+        perror("connect");
+        close(fd);
+        close(file_fd);
+        return -1;
+    }
+
+    int rc = -1;
+    uint8_t *buf = malloc(chunk);
+    credit_t cr;
+    memset(&cr, 0, sizeof(cr));
+    if (!buf) { perror("malloc"); goto out; }
+
+    uint32_t seq = 0;
+    uint8_t start[1024];
+    uint32_t len = 0;
+    if (build_payload_file_start(fname, fsize, start, sizeof(start) - 2 * (TLV_HEADER_LEN + TLV_U32_LEN), &len) < 0) {
+        fprintf(stderr, "build FILE_START payload failed\n");
+        goto out;
+    }
+    uint8_t *w = tlv_put_u32(start + len, TLV_WINDOW, win);
+    w = tlv_put_u32(w, TLV_CREDIT, 1);
+    struct iovec siov = { start, (size_t)(w - start) };
+    protocol_msgv mv;
+    init_msgv(&mv, MSG_FILE_START, seq++, &siov, 1);
+
+    credit_init(&cr, fd, file_fd, seq);
+    cr.dgram = 1;
+    if (send_until_acked(&cr, &mv, seq, "FILE_START") < 0) goto out;
+
+    pacer_t pacer = { .rate = (uint64_t)opts->rate_mbit * 1000000ull / 8, .t0 = now_ns() };
+    uint64_t t_begin = now_ns();
+    uint64_t off = 0, chunks = 0;
+    uint32_t crc = 0;
+    while (off < fsize) {
+        // 先收掉已经到的信用，NACK 的块尽早重发
+        int r;
+        while ((r = credit_poll(&cr, 0)) > 0) {}
+        if (r < 0 || credit_wait(&cr, seq, 1) < 0) goto out;
+
+        uint64_t left = fsize - off;
+        size_t want = left < chunk ? (size_t)left : chunk;
+        ssize_t got = pread(file_fd, buf, want, (off_t)off);
+        if (got <= 0) { fprintf(stderr, "pread: %s\n", got < 0 ? strerror(errno) : "file shrank"); goto out; }
+
+        uint32_t ccrc = crc32c(0, buf, (size_t)got);
+        uint8_t framing[FILE_DATA_FRAMING_LEN];
+        struct iovec iov[3];
+        if (build_iov_file_data(off, buf, (uint32_t)got, ccrc, framing, iov) < 0) {
+            fprintf(stderr, "build FILE_DATA failed\n");
+            goto out;
+        }
+        init_msgv(&mv, MSG_FILE_DATA, seq, iov, 3);
+        pace(&pacer, PROTOCOL_HEADER_LEN + FILE_DATA_FRAMING_LEN + (size_t)got);
+        if (send_messagev(fd, &mv, 1) < 0) { perror("send FILE_DATA"); goto out; }
+        if (credit_sent(&cr, seq, off, (uint32_t)got) < 0) goto out;
+        seq++;
+        crc = crc32c_combine(crc, ccrc, (uint64_t)got);
+        off += (uint64_t)got;
+        if ((++chunks & 63) == 0 && progress_due()) {
+            fprintf(stderr, "\r[client] sent %llu bytes", (unsigned long long)off);
+            fflush(stderr);
+        }
+    }
+
+    uint8_t end[TLV_HEADER_LEN + TLV_U32_LEN];
+    struct iovec eiov = { end, (size_t)(tlv_put_u32(end, TLV_CRC32, crc) - end) };
+    init_msgv(&mv, MSG_FILE_END, seq, &eiov, 1);
+    if (send_until_acked(&cr, &mv, seq + 1u, "FILE_END") < 0) goto out;
+
+    double secs = (double)(now_ns() - t_begin) / 1e9;
+    fprintf(stderr, "\r[client] sent %llu bytes over UDP in %.2fs (%.1f MB/s), %llu chunk(s) of %u, "
+                    "retransmitted %llu, waited for FILE_CREDIT %llu time(s)\n",
+            (unsigned long long)fsize, secs, secs > 0 ? (double)fsize / secs / 1e6 : 0.0,
+            (unsigned long long)chunks, chunk,
+            (unsigned long long)cr.resent, (unsigned long long)cr.stalls);
+    rc = 0;
+out:
+    credit_free(&cr);
+    free(buf);
+    close(fd);
+    close(file_fd);
+    return rc;
+}
@@ -0,0 +1,80 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include "tcp_protocol.h"
+#include "tcp_tlv.h"
+#include "tcp_client.h"
+
+/*
+ * 向服务器要运行指标并打印。interval > 0 时每隔 interval 秒再要一次，名字以 _total 结尾的
+ * 累计计数额外打印这段时间里的每秒增量（帧率、吞吐等）。
+ */
+
+#define STATS_MAX 128
+
+typedef struct {
+    char     name[48];
+    uint64_t value;
+} stat_val_t;
+
+static int fetch_stats(int fd, stat_val_t *out, int cap) {
+    protocol_msg req = {0};
+    req.hdr.version_major = 1;
+    req.hdr.version_minor = 0;
+    req.hdr.message_type  = MSG_STATS;
+    if (send_message(fd, &req) < 0) { perror("send STATS"); return -1; }
+
+    protocol_msg m;
+    if (read_reply(fd, MSG_STATS, "STATS", REPLY_TIMEOUT_S, &m) < 0) return -1;
+    stat_entry_t ent[STATS_MAX];
+    int n = parse_payload_stats(m.payload, m.hdr.payload_length, ent, STATS_MAX);
+    if (n < 0) {
+        fprintf(stderr, "STATS invalid payload\n");
+        free(m.payload);
+        return -1;
+    }
+    if (n > cap) n = cap;
+    for (int i = 0; i < n; ++i) {
+        uint32_t len = ent[i].name_len < sizeof(out[i].name) - 1 ? ent[i].name_len : sizeof(out[i].name) - 1;
+        memcpy(out[i].name, ent[i].name, len);
+        out[i].name[len] = '\0';
+        out[i].value = ent[i].value;
+    }
+    free(m.payload);
+    return n;
+}
+
+static int is_counter(const char *name) {
+    size_t n = strlen(name);
+    return n > 6 && strcmp(name + n - 6, "_total") == 0;
+}
+
+int query_stats(int fd, int interval_s, int count) {
+    stat_val_t prev[STATS_MAX], cur[STATS_MAX];
+    int np = 0;
+    for (int round = 0; count <= 0 || round < count; ++round) {
+        if (round > 0) sleep((unsigned)interval_s);
+        int n = fetch_stats(fd, cur, STATS_MAX);
+        if (n < 0) return -1;
+        if (round > 0) printf("\n");
+        for (int i = 0; i < n; ++i) {
+            printf("%-24s %llu", cur[i].name, (unsigned long long)cur[i].value);
+            // 按名字在上一轮里找同一项；服务器每次的顺序一样，一般就在同一位置
+            const stat_val_t *p = (i < np && strcmp(prev[i].name, cur[i].name) == 0) ? &prev[i] : NULL;
+            for (int k = 0; !p && k < np; ++k) {
+                if (strcmp(prev[k].name, cur[i].name) == 0) p = &prev[k];
+            }
+            if (p && interval_s > 0 && is_counter(cur[i].name) && cur[i].value >= p->value) {
+                printf("  (%.1f/s)", (double)(cur[i].value - p->value) / interval_s);
+            }
+            printf("\n");
+        }
+        fflush(stdout);
+        if (interval_s <= 0) break;
+        memcpy(prev, cur, (size_t)n * sizeof(*cur));
+        np = n;
+    }
+    return 0;
+}
@@ -0,0 +1,34 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * 重排窗口的定长槽位分配器：一次 mmap 出 nslots * slot_size 的连续区域，
+ * 槽位用空闲栈回收，不经过全局 malloc。可选用大页（MAP_HUGETLB，
+ * 失败时退回普通页 + MADV_HUGEPAGE）。超过 slot_size 的数据单独 malloc。
+ */
+
+typedef struct
+{
+    uint8_t  *base;
+    size_t    map_len;
+    uint32_t  slot_size;
+    uint32_t  nslots;
+    uint32_t *free_stack;
+    uint32_t  n_free;
+    int       huge;         // 实际拿到了 MAP_HUGETLB
+}chunk_slab_t;
+
+int  chunk_slab_init(chunk_slab_t *s, uint32_t slot_size, uint32_t nslots, int want_huge);
+
+void chunk_slab_destroy(chunk_slab_t *s);
+
+static inline int chunk_slab_ready(const chunk_slab_t *s)
+{
+    return s->base != NULL;
+}
+
+/* 取一块至少 n 字节的存储，失败返回 NULL */
+uint8_t *chunk_slab_alloc(chunk_slab_t *s, uint32_t n);
+
+void chunk_slab_free(chunk_slab_t *s, uint8_t *p);
\ No newline at end of file
@@ -0,0 +1,125 @@
+#pragma once
+#include <stdint.h>
+#include <stdatomic.h>
+#include <time.h>
+
+/*
+ * 进程级的运行指标。每个线程一个分片，计数只由所属线程写（relaxed 读加写回，没有 lock 前缀），
+ * 读的时候把所有分片加起来；线程退出后分片留给下一个线程接着用，累计值不丢。
+ * 延迟直方图按 2 的幂分桶：第 k 桶是 [2^(k+9), 2^(k+10)) 纳秒（第 0 桶含更小的），
+ * 最后一桶是溢出。可以通过 MSG_STATS 或 --metrics-port 上的 Prometheus 文本随时读。
+ */
+
+enum {
+    MET_CONNS = 0,          // 接受的连接数（UDP 为新对端数）
+    MET_FRAMES_IN,
+    MET_FRAMES_OUT,
+    MET_BYTES_IN,           // 线路上的字节，含协议头
+    MET_BYTES_OUT,
+    MET_DISK_WRITES,
+    MET_DISK_BYTES,
+    MET_DROP_OLD,
+    MET_DROP_FAR,
+    MET_DROP_BUDGET,
+    MET_CRC_BAD,
+    MET_NACK,               // 要求客户端重发的 seq 数
+    MET_WRITE_ERRORS,       // 落盘写失败或写不全的次数
+    MET_POOL_GETS,          // io_uring 收包/写请求缓冲池的取用次数
+    MET_POOL_ALLOCS,        // 其中池子空了真正 malloc 的次数，池子长满后应当不再增长
+    MET_POOL_STEADY_ALLOCS, // 其中池子已经长满还要 malloc 的次数，应当为 0
+    MET_COUNTERS,
+};
+
+enum {
+    MET_CONNS_ACTIVE = 0,
+    MET_WIN_CHUNKS,         // 所有重排窗口里暂存的乱序块
+    MET_WIN_BYTES,
+    MET_WRITES_INFLIGHT,    // 已提交还没完成的异步落盘写（io_uring）
+    MET_GAUGES,
+};
+
+enum {
+    MET_H_DRAIN = 0,        // 乱序块在窗口里等了多久才落盘
+    MET_H_WRITE,            // 一次落盘写的耗时（io_uring 为提交到完成）
+    MET_HISTS,
+};
+
+#ifndef MET_HIST_BUCKETS
+#define MET_HIST_BUCKETS 24         // 最后一个有界的桶上限 2^33 ns ≈ 8.6 s
+#endif
+
+typedef struct metrics_shard
+{
+    _Atomic uint64_t c[MET_COUNTERS];
+    _Atomic uint64_t g[MET_GAUGES];     // 增减量的累计，按 int64 解释；各分片相加才是当前值
+    _Atomic uint64_t h[MET_HISTS][MET_HIST_BUCKETS + 1];
+    _Atomic uint64_t h_sum[MET_HISTS];  // 纳秒
+    _Atomic int      state;
+    struct metrics_shard *next;
+}metrics_shard_t;
+
+typedef struct
+{
+    uint64_t c[MET_COUNTERS];
+    int64_t  g[MET_GAUGES];
+    uint64_t h[MET_HISTS][MET_HIST_BUCKETS + 1];
+    uint64_t h_sum[MET_HISTS];
+    uint64_t h_count[MET_HISTS];
+    uint64_t uptime_ns;
+}metrics_snap_t;
+
+extern __thread metrics_shard_t *t_metrics;
+
+/* 本线程第一次记指标时认领或新建分片，失败返回 NULL（之后的指标丢掉） */
+metrics_shard_t *metrics_shard_slow(void);
+
+static inline metrics_shard_t *metrics_shard(void)
+{
+    metrics_shard_t *m = t_metrics;
+    return m ? m : metrics_shard_slow();
+}
+
+static inline void metrics_bump(_Atomic uint64_t *v, uint64_t n)
+{
+    atomic_store_explicit(v, atomic_load_explicit(v, memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+static inline void metrics_add(int id, uint64_t n)
+{
+    metrics_shard_t *m = metrics_shard();
+    if (m) metrics_bump(&m->c[id], n);
+}
+
+static inline void metrics_gauge(int id, int64_t d)
+{
+    metrics_shard_t *m = metrics_shard();
+    if (m) metrics_bump(&m->g[id], (uint64_t)d);
+}
+
+static inline uint64_t metrics_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static inline void metrics_observe(int id, uint64_t ns)
+{
+    metrics_shard_t *m = metrics_shard();
+    if (!m) return;
+    int k = ns < 1024 ? 0 : 64 - __builtin_clzll(ns) - 10;
+    if (k > MET_HIST_BUCKETS) k = MET_HIST_BUCKETS;
+    metrics_bump(&m->h[id][k], 1);
+    metrics_bump(&m->h_sum[id], ns);
+}
+
+/* 启动时调用一次，记下 uptime 的起点 */
+void metrics_init(void);
+
+void metrics_snapshot(metrics_snap_t *out);
+
+/* MSG_STATS 应答的 payload（一串 TLV_STAT），malloc 出来由调用方释放；失败返回 -1 */
+int metrics_build_stats(uint8_t **out, uint32_t *out_len);
+
+/* 在 127.0.0.1:port 上起一个线程，对每个连接回一份 Prometheus 文本格式的指标 */
+int metrics_serve(int port);
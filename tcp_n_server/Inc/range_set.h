@@ -0,0 +1,36 @@
+#pragma once
+#include <stdint.h>
+
+/*
+ * 按 offset 排序、互不相交也不相邻的 [off, end) 区间集合，插入时合并。
+ * 数据块大多按顺序到达，新区间通常接在最后一段后面，此时是 O(1)。
+ */
+
+typedef struct
+{
+    uint64_t off;
+    uint64_t end;
+}range_t;
+
+typedef struct
+{
+    range_t  *r;
+    uint32_t  n;
+    uint32_t  cap;
+}range_set_t;
+
+void range_set_clear(range_set_t *s);
+
+void range_set_free(range_set_t *s);
+
+/* 成功返回 0，内存不足返回 -1 */
+int range_set_add(range_set_t *s, uint64_t off, uint64_t len);
+
+/* 集合覆盖的总字节数 */
+uint64_t range_set_bytes(const range_set_t *s);
+
+/* [0, size) 是否已被完全覆盖 */
+static inline int range_set_full(const range_set_t *s, uint64_t size)
+{
+    return size == 0 || (s->n == 1 && s->r[0].off == 0 && s->r[0].end >= size);
+}
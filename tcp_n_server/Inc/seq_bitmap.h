@@ -0,0 +1,40 @@
+#pragma once
+#include <stdint.h>
+
+/*
+ * 以 base 为起点的 seq 完成位图，每个 seq 一位，按需倍增。
+ * next 是第一个还没收到的 seq，即连续完成前缀的末尾。容量不够时先把 next 之前
+ * 整字全满的部分滑出去（base 前移），所以限制的是 [next, 最大 seq] 的跨度，不是块的总数。
+ */
+
+#ifndef SEQ_BITMAP_MAX_BITS
+#define SEQ_BITMAP_MAX_BITS (1u << 26)    // 最多同时跟踪 64M 个块的跨度（8 MiB 位图）
+#endif
+
+typedef struct
+{
+    uint64_t *words;
+    uint32_t  nbits;       // 当前容量
+    uint32_t  base;
+    uint32_t  next;
+    uint32_t  count;       // 已置位数量
+    uint32_t  hi;          // 见过的最大 seq - base + 1
+}seq_bitmap_t;
+
+void seq_bitmap_reset(seq_bitmap_t *b, uint32_t base);
+
+void seq_bitmap_free(seq_bitmap_t *b);
+
+/* 保证 seq 能置位（必要时滑动或扩容），不改变已记录的内容；-1 表示超出可跟踪范围或内存不足 */
+int seq_bitmap_reserve(seq_bitmap_t *b, uint32_t seq);
+
+/* 返回 1 表示新置位，0 表示重复，-1 表示超出可跟踪范围或内存不足 */
+int seq_bitmap_set(seq_bitmap_t *b, uint32_t seq);
+
+int seq_bitmap_test(const seq_bitmap_t *b, uint32_t seq);
+
+/* [base, base+hi) 里还缺多少个 */
+static inline uint32_t seq_bitmap_missing(const seq_bitmap_t *b)
+{
+    return b->hi - b->count;
+}
\ No newline at end of file
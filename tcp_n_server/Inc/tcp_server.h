@@ -1,14 +1,327 @@
-#pragma once 
+#pragma once
 
+#include <stdio.h>
+#include <sys/types.h>
+#include <stdint.h>
 #include <arpa/inet.h>
 
+#include "tcp_protocol.h"
+#include "frame_decoder.h"
+#include "chunk_slab.h"
+#include "seq_bitmap.h"
+#include "range_set.h"
+
 #define RECV_DIR "recv"
 
-typedef struct 
+// 默认重排窗口大小；运行时可用 --window / --window-max 调整，也可由客户端按传输协商
+#ifndef SEQ_WINDOW
+#define SEQ_WINDOW 8
+#endif
+#ifndef SEQ_WINDOW_MAX
+#define SEQ_WINDOW_MAX 4096
+#endif
+// 所有连接窗口里暂存的乱序数据总量上限
+#ifndef WINDOW_BUDGET_BYTES
+#define WINDOW_BUDGET_BYTES (256ull * 1024 * 1024)
+#endif
+
+// 收包缓冲池的块大小：一个 64 KiB 数据块加上 TLV 头
+#ifndef MSG_POOL_BUF_SIZE
+#define MSG_POOL_BUF_SIZE (64 * 1024 + 64)
+#endif
+
+// 重排窗口槽位大小，超过的数据块退回 malloc
+#ifndef WINDOW_SLOT_SIZE
+#define WINDOW_SLOT_SIZE (64 * 1024)
+#endif
+
+// 每连接拆帧缓冲：一次 recv 能装下几个 64 KiB 数据块；单帧上限
+#ifndef FRAME_DECODER_CAP
+#define FRAME_DECODER_CAP (256 * 1024)
+#endif
+
+// epoll 模式每连接待发回包的高水位：超过就停止读新请求，发到一半以下再恢复
+#ifndef EPOLL_WBUF_HIGH
+#define EPOLL_WBUF_HIGH (4 * 1024 * 1024)
+#endif
+// io_uring 模式同样的高水位，超过后暂停这条连接的 recv
+#ifndef URING_WBUF_HIGH
+#define URING_WBUF_HIGH EPOLL_WBUF_HIGH
+#endif
+#ifndef FRAME_MAX_PAYLOAD
+#define FRAME_MAX_PAYLOAD (16 * 1024 * 1024)
+#endif
+
+// 续传：侧车文件后缀；每写入这么多字节同步一次数据并更新侧车；FILE_RANGES 最多报多少段
+#ifndef RESUME_SUFFIX
+#define RESUME_SUFFIX ".resume"
+#endif
+#ifndef RESUME_SYNC_BYTES
+#define RESUME_SYNC_BYTES (64ull * 1024 * 1024)
+#endif
+#ifndef RESUME_MAX_RANGES
+#define RESUME_MAX_RANGES 65536
+#endif
+
+// 一条 FILE_CREDIT 最多带几段 NACK；攒够这么多个丢失的 seq 就不等客户端用完信用，直接发
+#ifndef NACK_MAX_RANGES
+#define NACK_MAX_RANGES 64
+#endif
+#ifndef NACK_BATCH
+#define NACK_BATCH 16
+#endif
+
+// 一条连接上同时打开的多路复用通道数上限
+#ifndef MUX_MAX_CHANNELS
+#define MUX_MAX_CHANNELS 1024
+#endif
+
+// UDP 传输：比收到的最大 seq 落后这么多还没到的 seq 当作丢了；对端这么久没有消息就重发信用；
+// 这么久没有消息就丢掉它的状态
+#ifndef UDP_REORDER_SLACK
+#define UDP_REORDER_SLACK 32
+#endif
+#ifndef UDP_RTO_MS
+#define UDP_RTO_MS 100
+#endif
+#ifndef UDP_IDLE_S
+#define UDP_IDLE_S 30
+#endif
+// 单个数据报的最大长度
+#ifndef UDP_MAX_DATAGRAM
+#define UDP_MAX_DATAGRAM 65535
+#endif
+
+// 增量同步时新文件先写到 <path>.delta.<fd>，校验通过再替换
+#ifndef DELTA_SUFFIX
+#define DELTA_SUFFIX ".delta"
+#endif
+
+typedef struct
 {
     int fd;
     struct sockaddr_in addr;
 
 }client_ctx_t;
 
-ssize_t fwrite_all(FILE *fp, const uint8_t *p, size_t n);
\ No newline at end of file
+typedef enum
+{
+    SERVER_MODE_THREAD = 0,   // 每连接一个线程（阻塞 read_message）
+    SERVER_MODE_EPOLL,        // 固定数量 worker，非阻塞 + 边沿触发 epoll
+    SERVER_MODE_URING,        // 固定数量 worker，每个 worker 一个 io_uring
+}server_mode_t;
+
+typedef struct
+{
+    server_mode_t mode;
+    int port;
+    int workers;
+    int window_hugepages;     // 重排窗口 slab 尝试使用大页
+    int direct_write;         // 每块按 offset 直接 pwrite，不经过重排窗口
+    uint32_t window_size;     // 每次传输的初始窗口
+    uint32_t window_max;      // 自适应扩窗和客户端协商的上限
+    uint64_t window_budget;   // 全进程乱序暂存字节上限，0 表示不限
+    int udp_port;             // 非 0 时另起一个线程在这个端口收 UDP 传输
+    int metrics_port;         // 非 0 时在 127.0.0.1 的这个端口上提供 Prometheus 文本格式的指标
+}server_config_t;
+
+extern server_config_t g_cfg;
+
+typedef struct {
+    int      present;
+    uint32_t seq;
+    uint64_t offset;
+    uint8_t *data;
+    uint32_t len;
+    void    *owner;     // NULL: data 来自 slab；否则是后端 park 返回的凭据
+    int      has_crc;
+    uint32_t crc;
+    uint64_t parked_ns;  // 放进窗口的时刻，落盘时算等了多久
+} seq_chunk_t;
+
+/* 已落盘且带 CRC 的一段数据，FILE_END 时按 offset 拼出整段 CRC */
+typedef struct {
+    uint64_t off;
+    uint32_t len;
+    uint32_t crc;
+} crc_extent_t;
+
+typedef struct
+{
+    uint64_t cnt_in;
+    uint64_t cnt_flush;
+    uint64_t cnt_drop_old;
+    uint64_t cnt_drop_far;
+    uint64_t cnt_dup;
+    uint64_t cnt_drop_budget;
+    uint64_t cnt_grow;
+    uint64_t bytes_flush;     // 按 seq 落盘（直写模式下为写入）的数据字节
+    uint64_t cnt_crc_bad;     // 块 CRC 不符被丢弃
+    uint64_t cnt_inflate;     // 压缩块
+    uint64_t cnt_copy;        // 增量同步：从旧文件复制的块
+    uint64_t bytes_copy;
+    uint64_t cnt_nack;        // 信用流控下要求客户端重发的 seq 数
+}log_t;
+
+/* 多连接分段上传：同一个 TLV_XFER_ID 的各条连接共享一个输出文件 */
+typedef struct transfer transfer_t;
+
+/* 可续传的接收：记录已落盘范围，持久化到侧车文件 */
+typedef struct resume resume_t;
+
+typedef struct session session_t;
+
+/* 连接上的子通道表项，按通道号排序 */
+typedef struct chan_ent chan_ent_t;
+
+/*
+ * 与连接模型相关的 I/O 由各后端提供（多路复用的子通道和连接共用 fd / io）：
+ *   send      回包；线程模式直接阻塞 send，epoll/io_uring 模式写入发送缓冲
+ *   write_at  把 n 字节写到输出文件的 off 处；s->drain_owner 非 NULL 时 p 在它的缓冲里
+ *   close_out 可选，在 session 关闭 out 之前调用，释放后端挂在 s->out_io 上的状态
+ *   park      可选，接管当前帧 payload 里的 p（不拷贝），返回凭据，不支持返回 NULL
+ *   unpark    释放 park 返回的凭据
+ *   after_out 可选，out 上在途的写全部完成后调用 fn(arg, fd, ok)，fd 仍可 fdatasync，
+ *             ok 为 0 表示有写失败；没有它时写是同步的，调用方直接收尾
+ *   async_write 非 0 表示 write_at 只是提交，写完成时由后端自己把范围记进 s->resume
+ *   datagram  非 0 表示消息可能丢失、重复、乱序（UDP）：缺的 seq 不等丢弃就 NACK，
+ *             重复的 FILE_START / FILE_END 只重发信用，后端还要定时调用 session_tick
+ */
+typedef struct
+{
+    int  (*send)(session_t *s, protocol_msg *msg);
+    int  (*write_at)(session_t *s, const uint8_t *p, uint32_t n, uint64_t off);
+    void (*close_out)(session_t *s);
+    void *(*park)(session_t *s, const uint8_t *p, uint32_t n);
+    void (*unpark)(session_t *s, void *token);
+    void (*after_out)(session_t *s, void (*fn)(void *arg, int fd, int ok), void *arg);
+    int  async_write;
+    int  datagram;
+}session_ops_t;
+
+/*
+ * 一个文件的接收状态，与 I/O 模型无关。连接本身的 session 是通道 0；消息以 TLV_CHANNEL
+ * 开头时交给连接 session 的子通道表里对应的子 session，每个通道各有自己的输出文件、seq 和窗口。
+ */
+struct session
+{
+    int fd;
+    struct sockaddr_in addr;
+    const session_ops_t *ops;
+    void *io;
+
+    int   out_fd;
+    void *out_io;             // 后端挂在输出文件上的状态（io_uring：在途写共享的 fd）
+    char  out_name[512];
+    uint64_t expect_size;
+    uint64_t wrote;
+    uint32_t expected_seq;
+    log_t log;
+    seq_chunk_t *window;
+    uint32_t win_size;
+    void    *drain_owner;     // 正在落盘的窗口块的 park 凭据，write_at 可以直接引用它而不拷贝
+    chunk_slab_t slab;        // 首次有块提前到达时才映射
+    seq_bitmap_t seen;        // 直写模式下已落盘的 seq
+    transfer_t *xfer;         // 分段上传时所属的传输，否则为 NULL
+    crc_extent_t *ext;
+    uint32_t n_ext;
+    uint32_t cap_ext;
+    int      codec;           // FILE_START 协商出的压缩 codec
+    uint8_t *zbuf;            // 解压 / FILE_COPY 读旧文件用的缓冲，按需增长
+    uint32_t zcap;
+    resume_t *resume;         // FILE_START 带 TLV_RESUME_ID 时的续传记录
+    int      delta;           // 增量同步中：out_fd 是 <delta_dst>.delta.<fd>
+    int      base_fd;         // 增量同步的旧文件，没有时为 -1
+    char     delta_dst[520];
+    int      credit;          // 客户端要求信用流控：按进度回 FILE_CREDIT
+    uint32_t acked;           // 上次 FILE_CREDIT 报的 ACK_SEQ
+    uint32_t granted;         // 上次给的信用
+    uint32_t hi_seq;          // 收到过的最大数据 seq
+    uint32_t *nack;           // 丢掉、等客户端重发的 seq，随下一条 FILE_CREDIT 发出
+    uint32_t n_nack;
+    uint32_t cap_nack;
+    int      end_pending;     // FILE_END 到了但还有缺的 seq，等重发补齐再收尾
+    uint32_t end_seq;
+    int      end_has_crc;
+    uint32_t end_crc;
+    uint32_t start_seq;       // 数据报后端：当前传输的 FILE_START，重复到达时认得出来
+    int      started;
+    int      finished;        // 数据报后端：end_seq 的 FILE_END 已收尾
+    uint32_t gap_scan;        // 数据报后端：之前的空缺已经检查过（NACK 过）
+    uint32_t chan;            // 多路复用通道号，0 是连接本身
+    chan_ent_t *chans;        // 仅通道 0：活跃的子通道
+    uint32_t n_chans;
+    uint32_t cap_chans;
+};
+
+void session_init(session_t *s, int fd, const struct sockaddr_in *addr,
+                  const session_ops_t *ops, void *io);
+
+/* 处理一条完整消息；payload 仍归调用者所有。返回 <0 表示应断开连接 */
+int session_on_message(session_t *s, protocol_msg *msg);
+
+/*
+ * 数据报后端的重传定时器：对端 UDP_RTO_MS 没有消息时调用。传输进行中就把信用范围内
+ * 还缺的 seq 全部 NACK 并重发信用（丢的可能是数据、重发的数据，也可能是上一条信用）。
+ */
+int session_tick(session_t *s);
+
+/* 把拆帧缓冲里所有完整的帧依次交给 session；返回 <0 表示应断开连接 */
+int session_drain_frames(session_t *s, frame_decoder_t *dec);
+
+/* 关闭未完成的文件并释放窗口（连同所有子通道），不关闭 fd */
+void session_close(session_t *s);
+
+/* 默认的 write_at：pwrite 到 s->out_fd */
+int session_pwrite_at(session_t *s, const uint8_t *p, uint32_t n, uint64_t off);
+
+/*
+ * 加入 id 对应的分段传输，不存在则创建并打开 path（第一个到达的流负责截断文件，
+ * 续传时 resumed 非 0，不截断）。文件名或大小和已有传输不一致、或流数已满时返回 NULL。
+ */
+transfer_t *transfer_join(uint64_t id, uint32_t streams, const char *path, uint64_t size,
+                          int resumed);
+
+/* 传输共享的输出 fd，session 各自 dup 一份 */
+int transfer_fd(const transfer_t *t);
+
+/* 一个流收到 FILE_END：累加它的统计；所有流都结束后打印一次汇总并释放传输。
+ * crc_state：1 本流整段 CRC 相符，0 不符，-1 客户端没带 */
+void transfer_stream_end(transfer_t *t, const log_t *log, uint32_t missing, int crc_state);
+
+/* 一个流在 FILE_END 之前断开或被新的 FILE_START 覆盖 */
+void transfer_stream_abort(transfer_t *t);
+
+/*
+ * 打开 path 的续传记录并返回一个引用。侧车文件的大小和 id 都对得上时沿用其中的范围、
+ * 不截断数据文件，否则从头开始。*have 是已有的字节数。同一文件正被另一个 id 接收时返回 NULL。
+ */
+resume_t *resume_open(const char *path, uint64_t size, uint64_t id, uint64_t *have);
+
+/* 续传记录持有的数据文件 fd，session 各自 dup 一份 */
+int resume_fd(const resume_t *r);
+
+resume_t *resume_ref(resume_t *r);
+
+/* [off, off+len) 已经写进数据文件（write 返回即可）；按量攒够后由后台线程同步、写侧车 */
+void resume_add(resume_t *r, uint64_t off, uint64_t len);
+
+/* 释放引用；最后一个引用释放后由后台线程同步数据，收全则删除侧车，否则写回侧车 */
+void resume_put(resume_t *r);
+
+/* 已落盘的范围：0 有记录，1 没有（或大小/id 不符），<0 出错 */
+int resume_query(const char *path, uint64_t size, uint64_t id, range_set_t *out);
+
+/* 非续传上传会截断文件，旧侧车随之作废 */
+void resume_forget(const char *path);
+
+void *handle_client(void *arg);
+
+int run_epoll_server(int listen_fd, int workers);
+
+int run_uring_server(int listen_fd, int workers);
+
+/* UDP 传输：一个线程收所有对端的数据报，每个对端地址一个 session；arg 是已绑定的 socket（intptr_t） */
+void *run_udp_server(void *arg);
+
+ssize_t pwrite_all(int fd, const uint8_t *p, size_t n, off_t off);
\ No newline at end of file
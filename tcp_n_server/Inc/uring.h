@@ -0,0 +1,71 @@
+#pragma once
+
+#include <stdint.h>
+#include <linux/io_uring.h>
+
+/*
+ * 最小化的 io_uring 封装（不依赖 liburing），只提供服务器用到的部分：
+ * SQ/CQ 映射、取 SQE、提交并等待、遍历 CQE，以及 provided buffer ring。
+ */
+
+typedef struct
+{
+    int ring_fd;
+
+    // SQ
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned sq_entries;
+    unsigned sqe_tail;     // 本地已填写但尚未发布的 tail
+
+    // CQ
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    void  *sq_ptr;
+    size_t sq_sz;
+    void  *cq_ptr;
+    size_t cq_sz;
+    size_t sqes_sz;
+}uring_t;
+
+typedef struct
+{
+    struct io_uring_buf_ring *br;
+    uint8_t  *base;
+    uint32_t  buf_size;
+    uint16_t  count;
+    uint16_t  mask;
+    uint16_t  bgid;
+    size_t    br_sz;
+}uring_bufring_t;
+
+int  uring_init(uring_t *u, unsigned entries);
+void uring_exit(uring_t *u);
+
+/* SQ 满时先提交已有的 SQE 再取；返回的 SQE 已清零 */
+struct io_uring_sqe *uring_get_sqe(uring_t *u);
+
+/* 发布本地 SQE 并进入内核，至少等待 wait_nr 个完成 */
+int uring_submit_and_wait(uring_t *u, unsigned wait_nr);
+
+/* 取一个 CQE，没有则返回 NULL；处理完后必须 uring_cqe_seen */
+struct io_uring_cqe *uring_peek_cqe(uring_t *u);
+void uring_cqe_seen(uring_t *u);
+
+int  uring_bufring_init(uring_t *u, uring_bufring_t *b, uint16_t bgid,
+                        uint16_t count, uint32_t buf_size);
+void uring_bufring_exit(uring_t *u, uring_bufring_t *b);
+
+static inline uint8_t *uring_buf_addr(const uring_bufring_t *b, uint16_t bid)
+{
+    return b->base + (size_t)bid * b->buf_size;
+}
+
+/* 把用完的 buffer 还给内核 */
+void uring_bufring_recycle(uring_bufring_t *b, uint16_t bid);
\ No newline at end of file
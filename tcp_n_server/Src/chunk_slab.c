@@ -0,0 +1,68 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "chunk_slab.h"
+
+#define HUGE_PAGE_SIZE (2u * 1024 * 1024)
+
+int chunk_slab_init(chunk_slab_t *s, uint32_t slot_size, uint32_t nslots, int want_huge)
+{
+    memset(s, 0, sizeof(*s));
+    size_t len = (size_t)slot_size * nslots;
+    void *p = MAP_FAILED;
+
+    if (want_huge) {
+        size_t hlen = (len + HUGE_PAGE_SIZE - 1) & ~((size_t)HUGE_PAGE_SIZE - 1);
+        p = mmap(NULL, hlen, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED) {
+            len = hlen;
+            s->huge = 1;
+        }
+    }
+    if (p == MAP_FAILED) {
+        p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) return -1;
+#ifdef MADV_HUGEPAGE
+        if (want_huge) madvise(p, len, MADV_HUGEPAGE);
+#endif
+    }
+
+    s->free_stack = malloc(sizeof(uint32_t) * nslots);
+    if (!s->free_stack) { munmap(p, len); return -1; }
+    for (uint32_t i = 0; i < nslots; ++i) s->free_stack[i] = nslots - 1 - i;
+
+    s->base = p;
+    s->map_len = len;
+    s->slot_size = slot_size;
+    s->nslots = nslots;
+    s->n_free = nslots;
+    return 0;
+}
+
+void chunk_slab_destroy(chunk_slab_t *s)
+{
+    if (s->base) munmap(s->base, s->map_len);
+    free(s->free_stack);
+    memset(s, 0, sizeof(*s));
+}
+
+uint8_t *chunk_slab_alloc(chunk_slab_t *s, uint32_t n)
+{
+    if (n > s->slot_size || s->n_free == 0) return malloc(n ? n : 1);
+    uint32_t idx = s->free_stack[--s->n_free];
+    return s->base + (size_t)idx * s->slot_size;
+}
+
+void chunk_slab_free(chunk_slab_t *s, uint8_t *p)
+{
+    if (!p) return;
+    if (p < s->base || p >= s->base + (size_t)s->slot_size * s->nslots) {
+        free(p);
+        return;
+    }
+    uint32_t idx = (uint32_t)((size_t)(p - s->base) / s->slot_size);
+    s->free_stack[s->n_free++] = idx;
+}
\ No newline at end of file
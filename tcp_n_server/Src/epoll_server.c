@@ -0,0 +1,333 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <pthread.h>
+
+#include "tcp_server.h"
+#include "tcp_protocol.h"
+#include "log.h"
+#include "metrics.h"
+
+#define EPOLL_MAX_EVENTS 256
+// 一次唤醒里每条连接最多 recv 几次，读不完的排到就绪队列尾，先轮到别的连接
+#define EPOLL_READ_BUDGET 16
+
+/*
+ * 每个 worker 拥有自己的 epoll 实例，监听 fd 以 EPOLLEXCLUSIVE 加入所有 worker，
+ * 由内核挑一个 worker 唤醒去 accept；accept 到的连接就留在该 worker 上，不跨线程。
+ * 连接以边沿触发注册，因此每次可读都必须读到 EAGAIN 为止。
+ */
+
+typedef struct epoll_conn
+{
+    session_t sess;
+    int       epfd;
+
+    // 拆帧缓冲：半帧留在里面，下次可读时接着拼
+    frame_decoder_t dec;
+
+    // 发送缓冲：回包先拼到这里，写不完就等 EPOLLOUT
+    uint8_t  *wbuf;
+    size_t    wlen;
+    size_t    woff;
+    size_t    wcap;
+    int       want_out;
+    int       paused;       // 待发超过 EPOLL_WBUF_HIGH，暂时不读，去掉了 EPOLLIN
+    int       resume_read;  // 还有数据没读（刚恢复或用完了读配额），不等 EPOLLIN 直接读
+    int       peer_closed;  // 对端已经 shutdown(SHUT_WR)，只等剩下的回包发完
+    int       on_ready;
+    struct epoll_conn *ready_next;
+}epoll_conn_t;
+
+typedef struct
+{
+    int listen_fd;
+    int epfd;
+    epoll_conn_t *ready;    // resume_read 的连接，处理完本轮事件后接着读
+}epoll_worker_t;
+
+static int set_nonblock(int fd)
+{
+    int fl = fcntl(fd, F_GETFL, 0);
+    if (fl < 0) return -1;
+    return fcntl(fd, F_SETFL, fl | O_NONBLOCK);
+}
+
+static int conn_set_events(epoll_conn_t *c, int want_out, int paused)
+{
+    if (c->want_out == want_out && c->paused == paused) return 0;
+    struct epoll_event ev;
+    ev.events = EPOLLRDHUP | EPOLLET | (paused ? 0 : EPOLLIN) | (want_out ? EPOLLOUT : 0);
+    ev.data.ptr = c;
+    if (epoll_ctl(c->epfd, EPOLL_CTL_MOD, c->sess.fd, &ev) < 0) return -1;
+    c->want_out = want_out;
+    c->paused = paused;
+    return 0;
+}
+
+static int conn_update_events(epoll_conn_t *c, int want_out)
+{
+    // 暂停读的连接发到高水位一半以下就恢复
+    int paused = c->paused && c->wlen - c->woff > EPOLL_WBUF_HIGH / 2;
+    if (c->paused && !paused) c->resume_read = 1;
+    return conn_set_events(c, want_out, paused);
+}
+
+static int conn_flush(epoll_conn_t *c)
+{
+    while (c->woff < c->wlen) {
+        ssize_t m = send(c->sess.fd, c->wbuf + c->woff, c->wlen - c->woff, 0);
+        if (m < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return conn_update_events(c, 1);
+            }
+            return -1;
+        }
+        c->woff += (size_t)m;
+    }
+    c->woff = c->wlen = 0;
+    return conn_update_events(c, 0);
+}
+
+static int conn_send(session_t *s, protocol_msg *msg)
+{
+    epoll_conn_t *c = s->io;
+    size_t need = PROTOCOL_HEADER_LEN + msg->hdr.payload_length;
+
+    if (c->woff > 0 && c->woff == c->wlen) c->woff = c->wlen = 0;
+    if (c->wlen + need > c->wcap) {
+        size_t cap = c->wcap ? c->wcap : 4096;
+        while (cap < c->wlen + need) cap *= 2;
+        uint8_t *nb = realloc(c->wbuf, cap);
+        if (!nb) return -1;
+        c->wbuf = nb;
+        c->wcap = cap;
+    }
+
+    protocol_header wire;
+    protocol_header_to_wire(&msg->hdr, &wire);
+    memcpy(c->wbuf + c->wlen, &wire, PROTOCOL_HEADER_LEN);
+    if (msg->hdr.payload_length)
+        memcpy(c->wbuf + c->wlen + PROTOCOL_HEADER_LEN, msg->payload, msg->hdr.payload_length);
+    c->wlen += need;
+
+    // 已经在等 EPOLLOUT 的话，直接交给下一次可写事件
+    if (c->want_out) return 0;
+    return conn_flush(c);
+}
+
+static const session_ops_t epoll_ops = {
+    .send      = conn_send,
+    .write_at  = session_pwrite_at,
+    .close_out = NULL,
+};
+
+static void ready_push(epoll_worker_t *w, epoll_conn_t *c)
+{
+    if (c->on_ready) return;
+    c->on_ready = 1;
+    c->ready_next = w->ready;
+    w->ready = c;
+}
+
+static void conn_destroy(epoll_worker_t *w, epoll_conn_t *c)
+{
+    if (c->on_ready) {
+        epoll_conn_t **pp = &w->ready;
+        while (*pp != c) pp = &(*pp)->ready_next;
+        *pp = c->ready_next;
+    }
+    epoll_ctl(c->epfd, EPOLL_CTL_DEL, c->sess.fd, NULL);
+    session_close(&c->sess);
+    close(c->sess.fd);
+    frame_decoder_destroy(&c->dec);
+    free(c->wbuf);
+    LOG_I("[thread %lu] fd=%d exit\n", (unsigned long)pthread_self(), c->sess.fd);
+    free(c);
+    metrics_gauge(MET_CONNS_ACTIVE, -1);
+}
+
+/* 返回 0 表示已读到 EAGAIN，1 表示对端关闭，<0 表示出错 */
+static int conn_on_readable(epoll_conn_t *c)
+{
+    // 对端发得够快时一直读不到 EAGAIN，不设上限会饿死同一 worker 上的其他连接
+    for (int budget = EPOLL_READ_BUDGET; ; --budget) {
+        if (budget == 0) {
+            c->resume_read = 1;
+            return 0;
+        }
+        // 对端只发不收时回包会越积越多：超过高水位先停读，等 conn_flush 发下去
+        if (c->wlen - c->woff > EPOLL_WBUF_HIGH) {
+            return conn_set_events(c, 1, 1) < 0 ? -1 : 0;
+        }
+        if (session_drain_frames(&c->sess, &c->dec) < 0) return -1;
+        if (c->wlen - c->woff > EPOLL_WBUF_HIGH) continue;
+
+        ssize_t m = frame_decoder_recv(&c->dec, c->sess.fd);
+        if (m < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+            return -1;
+        }
+        if (m == 0) {
+            if (frame_decoder_pending(&c->dec) == 0) return 1;
+            errno = EPIPE;
+            return -1;
+        }
+    }
+}
+
+static void worker_accept(epoll_worker_t *w)
+{
+    for (;;) {
+        struct sockaddr_in cli;
+        socklen_t len = sizeof(cli);
+        int cli_fd = accept4(w->listen_fd, (struct sockaddr *)&cli, &len, SOCK_NONBLOCK);
+        if (cli_fd < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) LOG_ERRNO("accept4");
+            return;
+        }
+
+        epoll_conn_t *c = calloc(1, sizeof(*c));
+        if (!c) { LOG_ERRNO("calloc"); close(cli_fd); continue; }
+        c->epfd = w->epfd;
+        if (frame_decoder_init(&c->dec, FRAME_DECODER_CAP, FRAME_MAX_PAYLOAD) < 0) {
+            LOG_ERRNO("frame_decoder_init");
+            close(cli_fd);
+            free(c);
+            continue;
+        }
+        session_init(&c->sess, cli_fd, &cli, &epoll_ops, c);
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+        ev.data.ptr = c;
+        if (epoll_ctl(w->epfd, EPOLL_CTL_ADD, cli_fd, &ev) < 0) {
+            LOG_ERRNO("epoll_ctl ADD");
+            frame_decoder_destroy(&c->dec);
+            close(cli_fd);
+            free(c);
+            continue;
+        }
+
+        metrics_add(MET_CONNS, 1);
+        metrics_gauge(MET_CONNS_ACTIVE, 1);
+
+        char ip[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &cli.sin_addr, ip, sizeof(ip));
+        LOG_I("[thread %lu] accepted %s:%d fd=%d\n",
+                (unsigned long)pthread_self(), ip, ntohs(cli.sin_port), cli_fd);
+    }
+}
+
+/* 处理一条连接的读写；返回非 0 时连接已经销毁 */
+static int conn_on_event(epoll_worker_t *w, epoll_conn_t *c, uint32_t e)
+{
+    int r = 0;
+    if (e & EPOLLOUT) {
+        if (conn_flush(c) < 0) r = -1;
+    }
+    if (r == 0 && !c->peer_closed &&
+        (c->resume_read || (e & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)))) {
+        c->resume_read = 0;
+        r = conn_on_readable(c);
+        if (r == 1) {
+            printf("client closed\n");
+            // 对端可能半关闭后还在等最后的 ACK：wbuf 里的回包发完再销毁，发不完的等 EPOLLOUT
+            c->peer_closed = 1;
+            r = conn_flush(c) < 0 ? -1 : 0;
+        } else if (r < 0) {
+            LOG_ERRNO("conn_on_readable");
+        }
+    }
+    if (r == 0 && c->peer_closed && c->woff == c->wlen) r = 1;
+    if (r != 0) {
+        conn_destroy(w, c);
+        return r;
+    }
+    if (c->resume_read && !c->peer_closed) ready_push(w, c);
+    return 0;
+}
+
+static void *epoll_worker(void *arg)
+{
+    epoll_worker_t *w = arg;
+    struct epoll_event evs[EPOLL_MAX_EVENTS];
+
+    for (;;) {
+        int n = epoll_wait(w->epfd, evs, EPOLL_MAX_EVENTS, w->ready ? 0 : -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            LOG_ERRNO("epoll_wait");
+            break;
+        }
+        for (int i = 0; i < n; ++i) {
+            epoll_conn_t *c = evs[i].data.ptr;
+            if (c == NULL) {
+                worker_accept(w);
+                continue;
+            }
+            conn_on_event(w, c, evs[i].events);
+        }
+
+        // 上一轮没读完的连接各再读一份配额；摘下整条队列，读不完的重新排上
+        epoll_conn_t *c = w->ready;
+        w->ready = NULL;
+        while (c) {
+            epoll_conn_t *next = c->ready_next;
+            c->on_ready = 0;
+            conn_on_event(w, c, 0);
+            c = next;
+        }
+    }
+    close(w->epfd);
+    return NULL;
+}
+
+int run_epoll_server(int listen_fd, int workers)
+{
+    if (workers <= 0) workers = 1;
+    if (set_nonblock(listen_fd) < 0) { LOG_ERRNO("fcntl O_NONBLOCK"); return -1; }
+
+    epoll_worker_t *ws = calloc((size_t)workers, sizeof(*ws));
+    pthread_t *ths = calloc((size_t)workers, sizeof(*ths));
+    if (!ws || !ths) { LOG_ERRNO("calloc"); free(ws); free(ths); return -1; }
+
+    int started = 0;
+    for (int i = 0; i < workers; ++i) {
+        ws[i].listen_fd = listen_fd;
+        ws[i].epfd = epoll_create1(EPOLL_CLOEXEC);
+        if (ws[i].epfd < 0) { LOG_ERRNO("epoll_create1"); break; }
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+        ev.data.ptr = NULL;
+        if (epoll_ctl(ws[i].epfd, EPOLL_CTL_ADD, listen_fd, &ev) < 0) {
+            LOG_ERRNO("epoll_ctl listen");
+            close(ws[i].epfd);
+            break;
+        }
+        if (pthread_create(&ths[i], NULL, epoll_worker, &ws[i]) != 0) {
+            LOG_ERRNO("pthread_create");
+            close(ws[i].epfd);
+            break;
+        }
+        started++;
+    }
+
+    if (started == 0) { free(ws); free(ths); return -1; }
+    printf("epoll mode: %d worker(s)\n", started);
+    for (int i = 0; i < started; ++i) pthread_join(ths[i], NULL);
+    free(ws);
+    free(ths);
+    return 0;
+}
\ No newline at end of file
@@ -4,248 +4,1323 @@
 #include <string.h>
 #include <stdint.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
 #include <signal.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <pthread.h>
-#include <sys/stat.h>
+#include <stdatomic.h>
 
 #include "tcp_server.h"
 #include "tcp_protocol.h"
 #include "tcp_tlv.h"
+#include "crc32c.h"
+#include "chunk_codec.h"
+#include "delta.h"
+#include "log.h"
+#include "metrics.h"
+
+static inline int seq_before(uint32_t a, uint32_t b) {
+    return (int32_t)(a - b) < 0;
+}
+static inline uint32_t seq_distance(uint32_t a, uint32_t b) {
+    return (uint32_t)(a - b);
+}
 
-#ifndef SEQ_WINDOW
-#define SEQ_WINDOW 8
-#endif
+// 槽位借用的是本次 session_on_message 的 payload，不需要释放
+#define SLOT_BORROWED ((void *)1)
 
-typedef struct {
-    int      present;
-    uint32_t seq;
-    uint64_t offset;
-    uint8_t *data;
-    uint32_t len;
-} seq_chunk_t;
+// 全进程所有窗口里暂存的乱序数据字节数，受 g_cfg.window_budget 约束
+static _Atomic uint64_t g_window_bytes = 0;
 
-typedef struct 
+static int budget_charge(uint32_t len)
 {
-    uint64_t cnt_in;
-    uint64_t cnt_flush;
-    uint64_t cnt_drop_old;
-    uint64_t cnt_drop_far; 
-}log_t;
+    uint64_t now = atomic_fetch_add_explicit(&g_window_bytes, len, memory_order_relaxed) + len;
+    if (g_cfg.window_budget && now > g_cfg.window_budget) {
+        atomic_fetch_sub_explicit(&g_window_bytes, len, memory_order_relaxed);
+        return -1;
+    }
+    metrics_gauge(MET_WIN_CHUNKS, 1);
+    metrics_gauge(MET_WIN_BYTES, len);
+    return 0;
+}
 
+static void budget_release(uint32_t len)
+{
+    atomic_fetch_sub_explicit(&g_window_bytes, len, memory_order_relaxed);
+    metrics_gauge(MET_WIN_CHUNKS, -1);
+    metrics_gauge(MET_WIN_BYTES, -(int64_t)len);
+}
 
-static inline int seq_before(uint32_t a, uint32_t b) {
-    return (int32_t)(a - b) < 0;
+static void release_slot(session_t *s, seq_chunk_t *slot)
+{
+    if (slot->owner != SLOT_BORROWED) budget_release(slot->len);
+    if (slot->owner == NULL) {
+        chunk_slab_free(&s->slab, slot->data);
+    } else if (slot->owner != SLOT_BORROWED) {
+        s->ops->unpark(s, slot->owner);
+    }
+    slot->data = NULL;
+    slot->owner = NULL;
+    slot->present = 0;
 }
-static inline uint32_t seq_distance(uint32_t a, uint32_t b) {
-    return (uint32_t)(a - b);
+
+static void record_extent(session_t *s, uint64_t off, uint32_t len, uint32_t crc)
+{
+    if (s->n_ext == s->cap_ext) {
+        uint32_t cap = s->cap_ext ? s->cap_ext * 2 : 64;
+        crc_extent_t *ne = realloc(s->ext, (size_t)cap * sizeof(*ne));
+        if (!ne) { LOG_ERRNO("realloc"); return; }
+        s->ext = ne;
+        s->cap_ext = cap;
+    }
+    s->ext[s->n_ext++] = (crc_extent_t){ .off = off, .len = len, .crc = crc };
+}
+
+static int cmp_extent(const void *a, const void *b)
+{
+    const crc_extent_t *x = a, *y = b;
+    return (x->off > y->off) - (x->off < y->off);
+}
+
+/*
+ * 把已落盘各块的 CRC 按 offset 拼成整段 CRC 和 want 比较；有缺口也算不符。
+ * 续传时客户端只补发缺的部分，本来就不连续，拼的是发出的各段，缺口不算错。
+ */
+static int verify_range_crc(session_t *s, uint32_t want, int allow_gaps)
+{
+    qsort(s->ext, s->n_ext, sizeof(*s->ext), cmp_extent);
+    uint32_t crc = 0;
+    for (uint32_t i = 0; i < s->n_ext; ++i) {
+        if (!allow_gaps && i > 0 && s->ext[i].off != s->ext[i - 1].off + s->ext[i - 1].len) return 0;
+        crc = crc32c_combine(crc, s->ext[i].crc, s->ext[i].len);
+    }
+    return crc == want;
+}
+
+static const char *crc_state_str(int st)
+{
+    return st == 1 ? "ok" : (st == 0 ? "BAD" : "-");
+}
+
+/* 回包；子通道的回包在 payload 前面加上 TLV_CHANNEL，客户端按它分给对应的传输 */
+static int session_send(session_t *s, protocol_msg *msg)
+{
+    metrics_add(MET_FRAMES_OUT, 1);
+    metrics_add(MET_BYTES_OUT, PROTOCOL_HEADER_LEN + msg->hdr.payload_length +
+                               (s->chan ? TLV_CHANNEL_PREFIX_LEN : 0));
+    if (s->chan == 0) return s->ops->send(s, msg);
+    uint32_t len = msg->hdr.payload_length;
+    uint8_t *buf = malloc(TLV_CHANNEL_PREFIX_LEN + (size_t)len);
+    if (!buf) return -1;
+    uint8_t *w = tlv_put_u32(buf, TLV_CHANNEL, s->chan);
+    if (len) memcpy(w, msg->payload, len);
+    protocol_msg m = *msg;
+    m.hdr.payload_length = TLV_CHANNEL_PREFIX_LEN + len;
+    m.payload = buf;
+    int r = s->ops->send(s, &m);
+    free(buf);
+    return r;
+}
+
+/* 写到输出文件；同步写的后端写完就记进续传范围，异步的由后端在写完成时记 */
+static int session_write(session_t *s, const uint8_t *p, uint32_t n, uint64_t off)
+{
+    if (s->ops->write_at(s, p, n, off) < 0) {
+        metrics_add(MET_WRITE_ERRORS, 1);
+        return -1;
+    }
+    if (s->resume && !s->ops->async_write) resume_add(s->resume, off, n);
+    return 0;
 }
 
-static int drain_inorder(FILE *out, seq_chunk_t *win,
-                         uint32_t *expected_seq, uint64_t *wrote,
-                         uint64_t *cnt_flush) 
+/* 信用流控下记下丢掉的 seq，下一条 FILE_CREDIT 要求客户端重发 */
+static void nack_add(session_t *s, uint32_t seq)
 {
+    if (!s->credit) return;
+    if (s->n_nack == s->cap_nack) {
+        uint32_t cap = s->cap_nack ? s->cap_nack * 2 : 64;
+        uint32_t *nn = realloc(s->nack, (size_t)cap * sizeof(*nn));
+        if (!nn) { LOG_ERRNO("realloc"); return; }
+        s->nack = nn;
+        s->cap_nack = cap;
+    }
+    s->nack[s->n_nack++] = seq;
+}
+
+static int drain_inorder(session_t *s)
+{
+    seq_chunk_t *win = s->window;
     for (;;) {
-        seq_chunk_t *slot = &win[*expected_seq % SEQ_WINDOW];
-        if (!slot->present || slot->seq != *expected_seq) break;
+        seq_chunk_t *slot = &win[s->expected_seq % s->win_size];
+        if (!slot->present || slot->seq != s->expected_seq) break;
+
+        s->drain_owner = slot->owner != SLOT_BORROWED ? slot->owner : NULL;
+        int wr = session_write(s, slot->data, slot->len, slot->offset);
+        s->drain_owner = NULL;
+        if (wr < 0) return -1;
+
+        s->wrote = slot->offset + slot->len;
+        s->log.bytes_flush += slot->len;
+        if (slot->has_crc) record_extent(s, slot->offset, slot->len, slot->crc);
+        if (slot->owner != SLOT_BORROWED) metrics_observe(MET_H_DRAIN, metrics_now() - slot->parked_ns);
+        release_slot(s, slot);
+        s->expected_seq = (s->expected_seq + 1u) & 0xFFFFFFFFu;
+
+        s->log.cnt_flush += 1;
+    }
+    return 0;
+}
+
+static void free_window(session_t *s) {
+    for (uint32_t i = 0; i < s->win_size; ++i) {
+        if (s->window[i].present) release_slot(s, &s->window[i]);
+    }
+}
+
+/* 按新大小重新分配槽位数组；窗口里的 seq 都在 [expected, expected+旧大小) 内，换模后不会冲突 */
+static int resize_window(session_t *s, uint32_t size)
+{
+    seq_chunk_t *nw = calloc(size, sizeof(seq_chunk_t));
+    if (!nw) return -1;
+    for (uint32_t i = 0; i < s->win_size; ++i) {
+        if (s->window[i].present) nw[s->window[i].seq % size] = s->window[i];
+    }
+    free(s->window);
+    s->window = nw;
+    s->win_size = size;
+    return 0;
+}
+
+/* seq 落在窗口外时尝试把窗口扩到能装下它（2 的幂，不超过 window_max） */
+static int grow_window(session_t *s, uint32_t dist)
+{
+    if (dist >= g_cfg.window_max) return -1;
+    uint32_t size = s->win_size ? s->win_size : 1;
+    while (size <= dist) size *= 2;
+    if (size > g_cfg.window_max) size = g_cfg.window_max;
+    if (resize_window(s, size) < 0) return -1;
+    s->log.cnt_grow++;
+    LOG_I("[%lu] window grown to %u (dist=%u)\n",
+            (unsigned long)pthread_self(), size, dist);
+    return 0;
+}
+
+/*
+ * 把一块数据放进窗口槽位：正好是下一个要落盘的 seq 时直接借用 payload
+ * （紧接着就会被 drain 掉）；否则优先让后端接管收包缓冲，再不行拷进 slab。
+ */
+static int park_chunk(session_t *s, seq_chunk_t *slot, uint32_t seq,
+                      const uint8_t *data, uint32_t len)
+{
+    if (seq == s->expected_seq) {
+        slot->data = (uint8_t *)data;
+        slot->owner = SLOT_BORROWED;
+        return 0;
+    }
+    if (budget_charge(len) < 0) return -2;
+    slot->parked_ns = metrics_now();
+    if (s->ops->park) {
+        void *token = s->ops->park(s, data, len);
+        if (token) {
+            slot->data = (uint8_t *)data;
+            slot->owner = token;
+            return 0;
+        }
+    }
+    // slab 只按配置的初始窗口映射：协商或扩出来的大窗口不能让一条连接占住 window_max 个槽的映射，
+    // 多出来的槽位走 chunk_slab_alloc 的 malloc 退路，和 slab 一样逐块计入 window_budget
+    uint32_t nslots = s->win_size < g_cfg.window_size ? s->win_size : g_cfg.window_size;
+    if (!chunk_slab_ready(&s->slab) &&
+        chunk_slab_init(&s->slab, WINDOW_SLOT_SIZE, nslots ? nslots : 1, g_cfg.window_hugepages) < 0) {
+        LOG_ERRNO("chunk_slab_init");
+    }
+    slot->data = chunk_slab_alloc(&s->slab, len);
+    if (!slot->data) { budget_release(len); return -1; }
+    memcpy(slot->data, data, len);
+    slot->owner = NULL;
+    return 0;
+}
+
+
+int session_pwrite_at(session_t *s, const uint8_t *p, uint32_t n, uint64_t off)
+{
+    uint64_t t0 = metrics_now();
+    ssize_t wn = pwrite_all(s->out_fd, p, n, (off_t)off);
+    if (wn < 0 || (size_t)wn != n) { LOG_ERRNO("pwrite_all"); return -1; }
+    metrics_observe(MET_H_WRITE, metrics_now() - t0);
+    metrics_add(MET_DISK_WRITES, 1);
+    metrics_add(MET_DISK_BYTES, n);
+    return 0;
+}
+
+static void close_out(session_t *s)
+{
+    if (s->out_fd >= 0) {
+        if (s->ops->close_out) s->ops->close_out(s);
+        close(s->out_fd);
+        s->out_fd = -1;
+    }
+    // 最后一个引用放掉时会同步数据并更新侧车
+    if (s->resume) {
+        resume_put(s->resume);
+        s->resume = NULL;
+    }
+}
+
+void session_init(session_t *s, int fd, const struct sockaddr_in *addr,
+                  const session_ops_t *ops, void *io)
+{
+    memset(s, 0, sizeof(*s));
+    s->fd = fd;
+    if (addr) s->addr = *addr;
+    s->ops = ops;
+    s->io = io;
+    s->out_fd = -1;
+    s->base_fd = -1;
+}
+
+/* 带上连接 fd 和通道号，同名文件的两个增量同步同时进行时各写各的临时文件 */
+static void delta_tmp_path(const session_t *s, char *out, size_t cap)
+{
+    snprintf(out, cap, "%s%s.%d.%u", s->delta_dst, DELTA_SUFFIX, s->fd, s->chan);
+}
+
+/* 丢掉增量同步状态；abandon 非 0 时临时文件也删掉（没等到 FILE_END） */
+static void drop_delta(session_t *s, int abandon)
+{
+    if (!s->delta) return;
+    if (abandon) {
+        char tmp[540];
+        delta_tmp_path(s, tmp, sizeof(tmp));
+        unlink(tmp);
+    }
+    if (s->base_fd >= 0) close(s->base_fd);
+    s->base_fd = -1;
+    s->delta = 0;
+}
+
+static void leave_transfer(session_t *s)
+{
+    if (!s->xfer) return;
+    transfer_stream_abort(s->xfer);
+    s->xfer = NULL;
+}
+
+static void chan_close_all(session_t *s);
+
+void session_close(session_t *s)
+{
+    chan_close_all(s);
+    close_out(s);
+    leave_transfer(s);
+    drop_delta(s, 1);
+    free_window(s);
+    free(s->window);
+    s->window = NULL;
+    s->win_size = 0;
+    chunk_slab_destroy(&s->slab);
+    seq_bitmap_free(&s->seen);
+    free(s->ext);
+    s->ext = NULL;
+    s->n_ext = s->cap_ext = 0;
+    free(s->zbuf);
+    s->zbuf = NULL;
+    s->zcap = 0;
+    free(s->nack);
+    s->nack = NULL;
+    s->n_nack = s->cap_nack = 0;
+}
+
+/* 客户端在 FILE_START 里带了 TLV_COMPRESS 时，回一个 FILE_ACCEPT 告诉它用哪个 codec */
+static int negotiate_codec(session_t *s, protocol_msg *msg)
+{
+    uint32_t offered = 0;
+    s->codec = CODEC_NONE;
+    if (tlv_find_u32(msg->payload, msg->hdr.payload_length, TLV_COMPRESS, &offered) != 0) return 0;
+    s->codec = codec_pick(offered);
+
+    uint8_t buf[TLV_HEADER_LEN + TLV_U32_LEN];
+    protocol_msg rep = {0};
+    rep.hdr.version_major  = 1;
+    rep.hdr.version_minor  = 0;
+    rep.hdr.message_type   = MSG_FILE_ACCEPT;
+    rep.hdr.seq            = msg->hdr.seq;
+    rep.hdr.payload_length = (uint32_t)(tlv_put_u32(buf, TLV_COMPRESS, (uint32_t)s->codec) - buf);
+    rep.payload            = buf;
+    return session_send(s, &rep);
+}
+
+/*
+ * 信用流控：告诉客户端 expected_seq 之前都已落盘，从它开始还能发多少个 seq。
+ * 信用是窗口大小，全局乱序暂存预算紧张时按剩余预算能装下的块数收紧
+ * （正好是 expected_seq 的块直接落盘不占预算，所以至少给 1）。
+ */
+static uint32_t credit_avail(const session_t *s)
+{
+    uint32_t c = s->win_size ? s->win_size : 1;
+    if (g_cfg.window_budget && !g_cfg.direct_write) {
+        uint64_t used = atomic_load_explicit(&g_window_bytes, memory_order_relaxed);
+        uint64_t left = used < g_cfg.window_budget ? g_cfg.window_budget - used : 0;
+        uint64_t slots = left / WINDOW_SLOT_SIZE + 1;
+        if (slots < c) c = (uint32_t)slots;
+    }
+    return c;
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * 回一条 FILE_CREDIT。攒下的 NACK 按 seq 排序合成段一起带上，已经补上的（落到
+ * expected_seq 之前的）跳过；一条装不下的留给下一条。
+ */
+static int send_credit(session_t *s)
+{
+    uint8_t buf[2 * (TLV_HEADER_LEN + TLV_U32_LEN) + NACK_MAX_RANGES * (TLV_HEADER_LEN + TLV_NACK_LEN)];
+    s->acked = s->expected_seq;
+    s->granted = credit_avail(s);
+    uint8_t *w = tlv_put_u32(buf, TLV_ACK_SEQ, s->acked);
+    w = tlv_put_u32(w, TLV_CREDIT, s->granted);
+
+    // 换成相对 expected_seq 的距离再排序，seq 回绕也不乱；已经补上的距离为负，排到最后
+    uint32_t base = s->expected_seq;
+    for (uint32_t k = 0; k < s->n_nack; ++k) s->nack[k] -= base;
+    qsort(s->nack, s->n_nack, sizeof(*s->nack), cmp_u32);
+    uint32_t i = 0, nr = 0;
+    while (i < s->n_nack && nr < NACK_MAX_RANGES && !seq_before(s->nack[i] + base, base)) {
+        uint32_t lo = s->nack[i], n = 1;
+        for (++i; i < s->n_nack && s->nack[i] - lo <= n; ++i) {
+            if (s->nack[i] - lo == n) n++;
+        }
+        w = tlv_put_nack(w, lo + base, n);
+        s->log.cnt_nack += n;
+        metrics_add(MET_NACK, n);
+        nr++;
+    }
+    if (i < s->n_nack && seq_before(s->nack[i] + base, base)) i = s->n_nack;
+    for (uint32_t k = i; k < s->n_nack; ++k) s->nack[k - i] = s->nack[k] + base;
+    s->n_nack -= i;
+
+    protocol_msg rep = {0};
+    rep.hdr.version_major  = 1;
+    rep.hdr.version_minor  = 0;
+    rep.hdr.message_type   = MSG_FILE_CREDIT;
+    rep.hdr.seq            = s->acked;
+    rep.hdr.payload_length = (uint32_t)(w - buf);
+    rep.payload            = buf;
+    return session_send(s, &rep);
+}
+
+/*
+ * 进度超过上次信用的一半再回，客户端用满信用前总能收到下一条，又不至于每块一条。
+ * 有 NACK 时攒够一批、或客户端已经发到信用末尾（它在等我们）就立即回；
+ * 数据报后端上丢包是常态，有就立即回，重发越早窗口卡得越短。
+ */
+static int maybe_credit(session_t *s)
+{
+    if (!s->credit) return 0;
+    if (s->n_nack && (s->ops->datagram || s->n_nack >= NACK_BATCH ||
+                      seq_distance(s->hi_seq + 1u, s->acked) >= s->granted)) {
+        return send_credit(s);
+    }
+    uint32_t half = s->granted / 2 ? s->granted / 2 : 1;
+    if (seq_distance(s->expected_seq, s->acked) < half) return 0;
+    return send_credit(s);
+}
+
+/* s->zbuf 至少 n 字节 */
+static uint8_t *scratch(session_t *s, uint32_t n)
+{
+    if (n > FRAME_MAX_PAYLOAD) return NULL;
+    if (n > s->zcap) {
+        uint8_t *nb = realloc(s->zbuf, n);
+        if (!nb) return NULL;
+        s->zbuf = nb;
+        s->zcap = n;
+    }
+    return s->zbuf;
+}
+
+/* 解压到 s->zbuf，返回原始数据；失败返回 NULL */
+static const uint8_t *inflate_chunk(session_t *s, const file_data_view_t *fv)
+{
+    if (s->codec == CODEC_NONE || !scratch(s, fv->raw_len)) return NULL;
+    if (codec_decompress(s->codec, fv->data, fv->len, s->zbuf, fv->raw_len) < 0) return NULL;
+    return s->zbuf;
+}
+
+/* 客户端给的文件名只取最后一段，落在 RECV_DIR 下 */
+static void recv_path(const char *name, char *out, size_t cap)
+{
+    const char *fname = strrchr(name, '/');
+    fname = fname ? fname + 1 : name;
+    snprintf(out, cap, "%s/%s", RECV_DIR, fname);
+}
+
+/* FILE_QUERY：报告某次续传已经落盘的范围，客户端只补发其余部分；没有记录时回空表 */
+static int on_file_query(session_t *s, protocol_msg *msg)
+{
+    char name[512] = {0};
+    char path[520] = {0};
+    uint64_t size = 0, id = 0;
+    range_set_t have = {0};
+
+    if (parse_payload_file_start(msg->payload, msg->hdr.payload_length, name, sizeof(name), &size) < 0 ||
+        tlv_find_u64(msg->payload, msg->hdr.payload_length, TLV_RESUME_ID, &id) != 0) {
+        LOG_W("FILE_QUERY invalid payload\n");
+    } else {
+        recv_path(name, path, sizeof(path));
+        if (resume_query(path, size, id, &have) < 0) LOG_ERRNO("resume_query");
+    }
+
+    uint32_t n = have.n < RESUME_MAX_RANGES ? have.n : RESUME_MAX_RANGES;
+    uint8_t *buf = malloc((size_t)n * (TLV_HEADER_LEN + TLV_RANGE_LEN) + 1);
+    if (!buf) { LOG_ERRNO("malloc"); range_set_free(&have); return -1; }
+    uint8_t *w = buf;
+    for (uint32_t i = 0; i < n; ++i) w = tlv_put_range(w, have.r[i].off, have.r[i].end - have.r[i].off);
+
+    protocol_msg rep = {0};
+    rep.hdr.version_major  = 1;
+    rep.hdr.version_minor  = 0;
+    rep.hdr.message_type   = MSG_FILE_RANGES;
+    rep.hdr.seq            = msg->hdr.seq;
+    rep.hdr.payload_length = (uint32_t)(w - buf);
+    rep.payload            = buf;
+    int r = session_send(s, &rep);
+    LOG_I("QUERY file='%s' have=%llu in %u range(s)\n", path,
+            (unsigned long long)range_set_bytes(&have), n);
+    free(buf);
+    range_set_free(&have);
+    return r;
+}
+
+/* SIG_REQUEST：给 recv/ 里的旧文件算块签名；没有旧文件时回空签名，客户端就全量发 */
+static int on_sig_request(session_t *s, protocol_msg *msg)
+{
+    char name[512] = {0};
+    char path[520] = {0};
+    uint64_t new_size = 0, old_size = 0;
+    uint32_t req = 0, block = 0, n = 0;
+    delta_sig_t *sigs = NULL;
+
+    if (parse_payload_file_start(msg->payload, msg->hdr.payload_length, name, sizeof(name), &new_size) < 0) {
+        LOG_W("SIG_REQUEST invalid payload\n");
+    } else {
+        recv_path(name, path, sizeof(path));
+        tlv_find_u32(msg->payload, msg->hdr.payload_length, TLV_BLOCK_SIZE, &req);
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        struct stat sb;
+        if (fd >= 0 && fstat(fd, &sb) == 0) old_size = (uint64_t)sb.st_size;
+        block = delta_pick_block(old_size, req);
+        // 和签名应答一起算在这个 worker 上；大文件会占住它一阵，换来的是少传整个文件
+        if (fd >= 0 && delta_signatures(fd, old_size, block, &sigs, &n) < 0) {
+            LOG_ERRNO("delta_signatures");
+            old_size = 0;
+        }
+        if (fd >= 0) close(fd);
+    }
+    if (block == 0) block = delta_pick_block(0, 0);
+
+    uint32_t cap = delta_sigs_payload_len(n);
+    uint8_t *buf = malloc(cap);
+    uint32_t len = 0;
+    if (!buf || build_payload_signatures(block, old_size, sigs, n, buf, cap, &len) < 0) {
+        LOG_ERRNO("build SIGNATURES");
+        free(buf);
+        free(sigs);
+        return -1;
+    }
+    free(sigs);
+
+    protocol_msg rep = {0};
+    rep.hdr.version_major  = 1;
+    rep.hdr.version_minor  = 0;
+    rep.hdr.message_type   = MSG_SIGNATURES;
+    rep.hdr.seq            = msg->hdr.seq;
+    rep.hdr.payload_length = len;
+    rep.payload            = buf;
+    int r = session_send(s, &rep);
+    LOG_I("SIGS file='%s' old=%llu block=%u n=%u\n", path,
+            (unsigned long long)old_size, block, n);
+    free(buf);
+    return r;
+}
+
+/* 增量同步：新文件写到 <path>.delta，FILE_COPY 从旧文件读，FILE_END 整文件校验通过才替换 */
+static void open_delta(session_t *s, const char *path, protocol_msg *msg)
+{
+    uint64_t id = 0;
+    if (tlv_find_u64(msg->payload, msg->hdr.payload_length, TLV_XFER_ID, &id) == 0 ||
+        tlv_find_u64(msg->payload, msg->hdr.payload_length, TLV_RESUME_ID, &id) == 0) {
+        LOG_W("FILE_START: delta sync cannot be striped or resumed\n");
+        return;
+    }
+    snprintf(s->delta_dst, sizeof(s->delta_dst), "%s", path);
+    char tmp[540];
+    delta_tmp_path(s, tmp, sizeof(tmp));
+
+    s->out_fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (s->out_fd < 0) { LOG_ERRNO("open"); return; }
+    s->base_fd = open(path, O_RDONLY | O_CLOEXEC);
+    s->delta = 1;
+    memset(&s->log, 0, sizeof(s->log));
+    LOG_I("START file='%s' size=%llu delta base=%s\n", path,
+            (unsigned long long)s->expect_size, s->base_fd >= 0 ? "yes" : "none");
+}
+
+static void on_file_start(session_t *s, protocol_msg *msg)
+{
+    close_out(s);
+    leave_transfer(s);
+    drop_delta(s, 1);
+    memset(s->out_name, 0, sizeof(s->out_name));
+    s->expect_size = 0;
+    s->wrote = 0;
+    s->n_ext = 0;
+    s->credit = 0;
+    s->n_nack = 0;
+    s->end_pending = 0;
+    s->hi_seq = msg->hdr.seq;
+    s->start_seq = msg->hdr.seq;
+    s->started = 1;
+    s->finished = 0;
+    s->gap_scan = (msg->hdr.seq + 1u) & 0xFFFFFFFFu;
+
+    int parse_r = parse_payload_file_start(msg->payload, msg->hdr.payload_length,
+                                           s->out_name, sizeof(s->out_name),
+                                           &s->expect_size);
+
+    if (parse_r < 0) {
+        LOG_W("FILE_START invalid payload, code=%d\n", parse_r);
+        return;
+    }
+    if (negotiate_codec(s, msg) < 0) LOG_ERRNO("send FILE_ACCEPT");
+
+    s->expected_seq = (msg->hdr.seq + 1u) & 0xFFFFFFFFu;
+    free_window(s);
+    seq_bitmap_reset(&s->seen, s->expected_seq);
+
+    // 客户端可以在 FILE_START 里带 TLV_WINDOW 请求窗口大小，服务器按 window_max 截断
+    uint32_t win = g_cfg.window_size;
+    uint32_t req = 0;
+    if (tlv_find_u32(msg->payload, msg->hdr.payload_length, TLV_WINDOW, &req) == 0 && req > 0) {
+        win = (req < g_cfg.window_max) ? req : g_cfg.window_max;
+    }
+    if (resize_window(s, win) < 0) {
+        LOG_ERRNO("resize_window");
+        return;
+    }
+    uint32_t want_credit = 0;
+    s->credit = tlv_find_u32(msg->payload, msg->hdr.payload_length, TLV_CREDIT, &want_credit) == 0;
+    char safe_name[520];
+    recv_path(s->out_name, safe_name, sizeof(safe_name));
 
-        if (fseeko(out, (off_t)slot->offset, SEEK_SET) != 0) { perror("fseeko"); return -1; }
-        ssize_t wn = fwrite_all(out, slot->data, slot->len);  
-        if (wn < 0 || (size_t)wn != slot->len) { perror("fwrite_all"); return -1; }
+    uint32_t block = 0;
+    if (tlv_find_u32(msg->payload, msg->hdr.payload_length, TLV_BLOCK_SIZE, &block) == 0) {
+        open_delta(s, safe_name, msg);
+        return;
+    }
+
+    // 续传：侧车对得上就不截断文件，已收范围在 FILE_QUERY 时已经告诉过客户端
+    uint64_t resume_id = 0, have = 0;
+    if (tlv_find_u64(msg->payload, msg->hdr.payload_length, TLV_RESUME_ID, &resume_id) == 0) {
+        s->resume = resume_open(safe_name, s->expect_size, resume_id, &have);
+        if (!s->resume) return;
+    } else {
+        resume_forget(safe_name);
+    }
+
+    // 分段上传：各连接按自己的 seq 走窗口，共用一个输出文件
+    uint64_t xfer_id = 0;
+    uint32_t streams = 0;
+    if (tlv_find_u64(msg->payload, msg->hdr.payload_length, TLV_XFER_ID, &xfer_id) == 0 &&
+        tlv_find_u32(msg->payload, msg->hdr.payload_length, TLV_STREAMS, &streams) == 0 &&
+        streams > 0) {
+        s->xfer = transfer_join(xfer_id, streams, safe_name, s->expect_size, s->resume != NULL);
+        if (!s->xfer) { close_out(s); return; }
+        s->out_fd = dup(transfer_fd(s->xfer));
+        if (s->out_fd < 0) { LOG_ERRNO("dup"); close_out(s); leave_transfer(s); return; }
+        memset(&s->log, 0, sizeof(s->log));
+        return;
+    }
+
+    if (s->resume) {
+        s->out_fd = dup(resume_fd(s->resume));
+        if (s->out_fd < 0) { LOG_ERRNO("dup"); close_out(s); return; }
+        memset(&s->log, 0, sizeof(s->log));
+        return;
+    }
+
+    s->out_fd = open(safe_name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (s->out_fd < 0) {
+        LOG_ERRNO("open");
+    } else {
+        LOG_I("START file='%s' size=%llu\n", safe_name,
+                (unsigned long long)s->expect_size);
+    }
+}
+
+/*
+ * 重排窗口模式：立即按 offset 写一次，同时按 seq 进窗口顺序落盘。先写的这一次保证块在窗口
+ * 放不下（太远、超预算）时也已经落盘：不走信用流控的客户端收不到 NACK，不会重发。
+ * 先写失败时窗口落盘还会再写一次；块又进不了窗口的话就只能靠 NACK 补发。
+ */
+static void on_file_data_window(session_t *s, uint32_t seq, uint64_t offset,
+                                const uint8_t *data_ptr, uint32_t data_len,
+                                int has_crc, uint32_t crc)
+{
+    int written = session_write(s, data_ptr, data_len, offset) == 0;
+    if (!written) {
+        LOG_W("[%lu] write seq=%u off=%llu failed\n",
+                (unsigned long)pthread_self(), seq, (unsigned long long)offset);
+    }
+    uint32_t dist = seq_distance(seq, s->expected_seq);
+
+    s->log.cnt_in++;
+    if (!s->window) {
+        if (!written) nack_add(s, seq);
+        return;
+    }
+
+    if (seq_before(seq, s->expected_seq)) {
+        s->log.cnt_drop_old++;
+        metrics_add(MET_DROP_OLD, 1);
+        LOG_W("[%lu] DROP old seq=%u expect=%u\n",
+                (unsigned long)pthread_self(), seq, s->expected_seq);
+        return;
+    }
+    if (dist >= s->win_size && grow_window(s, dist) < 0) {
+        s->log.cnt_drop_far++;
+        metrics_add(MET_DROP_FAR, 1);
+        nack_add(s, seq);
+        LOG_W("[%lu] DROP too-far seq=%u expect=%u (dist=%u >= %u)\n",
+                (unsigned long)pthread_self(), seq, s->expected_seq, dist, s->win_size);
+        return;
+    }
+
+    seq_chunk_t *slot = &s->window[seq % s->win_size];
+    if (slot->present) release_slot(s, slot);
+    slot->seq = seq;
+    slot->offset = offset;
+    slot->len = data_len;
+    slot->has_crc = has_crc;
+    slot->crc = crc;
+    int pr = park_chunk(s, slot, seq, data_ptr, data_len);
+    if (pr == -2) {
+        s->log.cnt_drop_budget++;
+        metrics_add(MET_DROP_BUDGET, 1);
+        nack_add(s, seq);
+        LOG_W("[%lu] DROP over budget seq=%u len=%u\n",
+                (unsigned long)pthread_self(), seq, data_len);
+        return;
+    }
+    if (pr < 0) { LOG_ERRNO("park_chunk"); nack_add(s, seq); return; }
+    slot->present = 1;
+
+    drain_inorder(s);
+}
+
+/* 直写模式：每块按 offset 写一次，seq 只在位图里记完成情况 */
+static void on_file_data_direct(session_t *s, uint32_t seq, uint64_t offset,
+                                const uint8_t *data_ptr, uint32_t data_len,
+                                int has_crc, uint32_t crc)
+{
+    s->log.cnt_in++;
+
+    if (seq_before(seq, s->seen.base)) {
+        s->log.cnt_drop_old++;
+        metrics_add(MET_DROP_OLD, 1);
+        LOG_W("[%lu] DROP old seq=%u base=%u\n",
+                (unsigned long)pthread_self(), seq, s->seen.base);
+        return;
+    }
+    if (seq_bitmap_test(&s->seen, seq)) {
+        s->log.cnt_dup++;
+        return;
+    }
+    // 先确认位图记得下再写，否则已落盘的块会被当成丢弃、NACK 后重写一遍
+    if (seq_bitmap_reserve(&s->seen, seq) < 0) {
+        s->log.cnt_drop_far++;
+        metrics_add(MET_DROP_FAR, 1);
+        nack_add(s, seq);
+        LOG_W("[%lu] seq=%u beyond bitmap range\n", (unsigned long)pthread_self(), seq);
+        return;
+    }
+    if (session_write(s, data_ptr, data_len, offset) < 0) { nack_add(s, seq); return; }
+    seq_bitmap_set(&s->seen, seq);
+    s->wrote += data_len;
+    s->log.bytes_flush += data_len;
+    if (has_crc) record_extent(s, offset, data_len, crc);
+    s->expected_seq = s->seen.next;
+    s->log.cnt_flush++;
+}
+
+/* 校验块 CRC 后交给窗口或直写；FILE_DATA 和 FILE_COPY 都走这里 */
+static void accept_chunk(session_t *s, uint32_t seq, uint64_t offset,
+                         const uint8_t *data_ptr, uint32_t data_len, int has_crc, uint32_t crc)
+{
+    // 数据刚从 socket 收进来还在缓存里，校验不符的块不落盘
+    if (has_crc && crc32c(0, data_ptr, data_len) != crc) {
+        s->log.cnt_crc_bad++;
+        metrics_add(MET_CRC_BAD, 1);
+        nack_add(s, seq);
+        LOG_W("[%lu] DROP crc mismatch seq=%u off=%llu\n",
+                (unsigned long)pthread_self(), seq, (unsigned long long)offset);
+        return;
+    }
+
+    if (g_cfg.direct_write)
+        on_file_data_direct(s, seq, offset, data_ptr, data_len, has_crc, crc);
+    else
+        on_file_data_window(s, seq, offset, data_ptr, data_len, has_crc, crc);
+}
+
+static ssize_t pread_full(int fd, uint8_t *p, size_t n, off_t off)
+{
+    size_t got = 0;
+    while (got < n) {
+        ssize_t m = pread(fd, p + got, n - got, off + (off_t)got);
+        if (m < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (m == 0) break;
+        got += (size_t)m;
+    }
+    return (ssize_t)got;
+}
+
+/*
+ * FILE_COPY：从旧文件读出这一段，之后和 FILE_DATA 完全一样（按 offset 写、占一个 seq）。
+ * 客户端按它算的块 CRC 发过来，签名碰撞或旧文件在签名之后被改过都会在这里被发现。
+ */
+static void on_file_copy(session_t *s, protocol_msg *msg)
+{
+    if (s->out_fd < 0 || !s->delta) { LOG_W("FILE_COPY without delta START\n"); return; }
+
+    file_copy_t fc;
+    int parse_r = parse_payload_file_copy(msg->payload, msg->hdr.payload_length, &fc);
+    if (parse_r < 0) {
+        LOG_W("FILE_COPY invalid payload, code=%d\n", parse_r);
+        return;
+    }
+    uint8_t *buf = scratch(s, fc.len);
+    if (s->base_fd < 0 || !buf ||
+        pread_full(s->base_fd, buf, fc.len, (off_t)fc.src_offset) != (ssize_t)fc.len) {
+        s->log.cnt_crc_bad++;
+        metrics_add(MET_CRC_BAD, 1);
+        nack_add(s, msg->hdr.seq);
+        LOG_W("[%lu] DROP copy seq=%u src=%llu len=%u: base unreadable\n",
+                (unsigned long)pthread_self(), msg->hdr.seq,
+                (unsigned long long)fc.src_offset, fc.len);
+        return;
+    }
+    uint64_t bad = s->log.cnt_crc_bad;
+    accept_chunk(s, msg->hdr.seq, fc.offset, buf, fc.len, 1, fc.crc);
+    if (s->log.cnt_crc_bad == bad) {
+        s->log.cnt_copy++;
+        s->log.bytes_copy += fc.len;
+    }
+}
+
+static void on_file_data(session_t *s, protocol_msg *msg)
+{
+    if (s->out_fd < 0) { LOG_W("FILE_DATA without START\n"); return; }
+
+    file_data_view_t fv;
+    int parse_r = parse_payload_file_data_view(msg->payload, msg->hdr.payload_length, &fv);
+
+    if (parse_r < 0) {
+        LOG_W("FILE_DATA invalid payload, code=%d\n", parse_r);
+        return;
+    }
+
+    uint64_t offset = fv.offset;
+    const uint8_t *data_ptr = fv.data;
+    uint32_t data_len = fv.len;
+    uint32_t crc = fv.crc;
+    int has_crc = fv.has_crc;
+
+    // 压缩块先解压到会话缓冲，后面的窗口/直写逻辑只看到原始数据
+    if (fv.compressed) {
+        data_ptr = inflate_chunk(s, &fv);
+        if (!data_ptr) {
+            s->log.cnt_crc_bad++;
+            metrics_add(MET_CRC_BAD, 1);
+            nack_add(s, msg->hdr.seq);
+            LOG_W("[%lu] DROP bad compressed chunk seq=%u codec=%d\n",
+                    (unsigned long)pthread_self(), msg->hdr.seq, s->codec);
+            return;
+        }
+        data_len = fv.raw_len;
+        s->log.cnt_inflate++;
+    }
+
+    accept_chunk(s, msg->hdr.seq, offset, data_ptr, data_len, has_crc, crc);
+}
+
+/* 增量同步替换新文件要用到的东西，异步写的后端要等写完才能做，所以从 session 里拷出来 */
+typedef struct
+{
+    int ok;
+    uint64_t copied;
+    uint64_t literal;
+    char tmp[540];
+    char dst[520];
+}delta_commit_t;
+
+/* 写都完成之后：新文件刷到盘上再 rename 过去；校验没过或写失败就删掉临时文件 */
+static void commit_delta(void *arg, int fd, int io_ok)
+{
+    delta_commit_t *dc = arg;
+    int ok = dc->ok && io_ok;
+    if (ok && fdatasync(fd) < 0) { LOG_ERRNO("fdatasync"); ok = 0; }
+    if (ok && rename(dc->tmp, dc->dst) < 0) { LOG_ERRNO("rename"); ok = 0; }
+    if (ok) {
+        resume_forget(dc->dst);
+        LOG_I("DELTA file='%s' rebuilt: copied=%llu literal=%llu bytes\n", dc->dst,
+                (unsigned long long)dc->copied, (unsigned long long)dc->literal);
+    } else {
+        unlink(dc->tmp);
+        LOG_W("WARN: delta rebuild of '%s' failed, old file kept\n", dc->dst);
+    }
+    free(dc);
+}
+
+/*
+ * 增量同步收尾：整文件 CRC 相符且字节数齐了才用新文件替换旧文件，否则旧文件不动。
+ * 要在 close_out 之前调用；io_uring 上 FILE_DATA / FILE_COPY 的写可能还在途，
+ * 替换挂到 after_out 上，等它们都落完再做。
+ */
+static void finish_delta(session_t *s, int crc_state)
+{
+    delta_commit_t *dc = malloc(sizeof(*dc));
+    if (!dc) {
+        LOG_ERRNO("malloc");
+        drop_delta(s, 1);
+        return;
+    }
+    dc->ok = crc_state == 1 && s->log.bytes_flush == s->expect_size;
+    dc->copied = s->log.bytes_copy;
+    dc->literal = s->log.bytes_flush - s->log.bytes_copy;
+    delta_tmp_path(s, dc->tmp, sizeof(dc->tmp));
+    snprintf(dc->dst, sizeof(dc->dst), "%s", s->delta_dst);
+    if (s->ops->after_out) s->ops->after_out(s, commit_delta, dc);
+    else commit_delta(dc, s->out_fd, 1);
+    drop_delta(s, 0);
+}
+
+static void on_file_end(session_t *s)
+{
+    if (s->out_fd < 0) {
+        LOG_W("END without open file\n");
+        free_window(s);
+        return;
+    }
 
-        *wrote = slot->offset + slot->len;
-        free(slot->data); slot->data = NULL;
-        slot->present = 0;
-        *expected_seq = (*expected_seq + 1u) & 0xFFFFFFFFu;
+    // 续传只补发缺的部分，本连接写的字节数和文件大小对不上是正常的，完整性看续传记录
+    int resumed = s->resume != NULL;
+    if (!g_cfg.direct_write) drain_inorder(s);
+    int crc_state = s->end_has_crc ? verify_range_crc(s, s->end_crc, resumed) : -1;
 
-        if (cnt_flush) *cnt_flush += 1;
+    if (s->xfer) {
+        uint32_t missing = 0;
+        if (g_cfg.direct_write) missing = seq_bitmap_missing(&s->seen);
+        close_out(s);
+        transfer_stream_end(s->xfer, &s->log, missing, crc_state);
+        s->xfer = NULL;
+        free_window(s);
+        return;
+    }
+
+    if (s->delta) finish_delta(s, crc_state);
+
+    if (g_cfg.direct_write) {
+        close_out(s);
+        LOG_I(
+            "[summary] file='%s' recv=%llu written=%llu dup=%llu drop_old=%llu drop_far=%llu crc_bad=%llu z=%llu copy=%llu nack=%llu missing=%u wrote=%llu/%llu crc=%s direct\n",
+            s->out_name,
+            (unsigned long long)s->log.cnt_in,
+            (unsigned long long)s->log.cnt_flush,
+            (unsigned long long)s->log.cnt_dup,
+            (unsigned long long)s->log.cnt_drop_old,
+            (unsigned long long)s->log.cnt_drop_far,
+            (unsigned long long)s->log.cnt_crc_bad,
+            (unsigned long long)s->log.cnt_inflate,
+            (unsigned long long)s->log.cnt_copy,
+            (unsigned long long)s->log.cnt_nack,
+            seq_bitmap_missing(&s->seen),
+            (unsigned long long)s->wrote,
+            (unsigned long long)s->expect_size,
+            crc_state_str(crc_state)
+        );
+        if (seq_bitmap_missing(&s->seen) != 0 ||
+            (!resumed && s->expect_size != 0 && s->wrote != s->expect_size)) {
+            LOG_W("WARN: incomplete transfer\n");
+        }
+        if (crc_state == 0) LOG_W("WARN: crc mismatch\n");
+        return;
+    }
+
+    close_out(s);
+
+    LOG_I(
+        "[summary] file='%s' recv=%llu flushed≈%llu drop_old=%llu drop_far=%llu drop_budget=%llu crc_bad=%llu z=%llu copy=%llu nack=%llu wrote=%llu/%llu crc=%s win=%u grow=%llu\n",
+        s->out_name,
+        (unsigned long long)s->log.cnt_in,
+        (unsigned long long)s->log.cnt_flush,
+        (unsigned long long)s->log.cnt_drop_old,
+        (unsigned long long)s->log.cnt_drop_far,
+        (unsigned long long)s->log.cnt_drop_budget,
+        (unsigned long long)s->log.cnt_crc_bad,
+        (unsigned long long)s->log.cnt_inflate,
+        (unsigned long long)s->log.cnt_copy,
+        (unsigned long long)s->log.cnt_nack,
+        (unsigned long long)s->wrote,
+        (unsigned long long)s->expect_size,
+        crc_state_str(crc_state),
+        s->win_size,
+        (unsigned long long)s->log.cnt_grow
+    );
+    if (!resumed && s->expect_size != 0 && s->wrote != s->expect_size) {
+        LOG_W("WARN: size mismatch\n");
+    }
+    if (crc_state == 0) LOG_W("WARN: crc mismatch\n");
+    free_window(s);
+}
+
+/* 收尾并回最后一条信用，它的 ACK_SEQ 越过 FILE_END，客户端收到就知道这次传输处理完了 */
+static int end_transfer(session_t *s)
+{
+    s->end_pending = 0;
+    s->finished = 1;
+    on_file_end(s);
+    if (!s->credit) return 0;
+    s->credit = 0;
+    s->n_nack = 0;
+    s->expected_seq = (s->end_seq + 1u) & 0xFFFFFFFFu;
+    return send_credit(s);
+}
+
+/* seq 已经在窗口里（直写模式：已经落盘） */
+static int seq_present(session_t *s, uint32_t seq)
+{
+    if (g_cfg.direct_write) return seq_bitmap_test(&s->seen, seq);
+    const seq_chunk_t *slot = &s->window[seq % s->win_size];
+    return slot->present && slot->seq == seq;
+}
+
+/* [expected_seq, end) 里还没收到的 seq 都记进 NACK；只看信用范围，客户端不会发到更远 */
+static uint32_t nack_gaps(session_t *s, uint32_t end)
+{
+    uint32_t gaps = 0;
+    uint32_t span = seq_before(end, s->expected_seq) ? 0 : seq_distance(end, s->expected_seq);
+    if (span > s->win_size) span = s->win_size;
+    for (uint32_t k = 0; k < span; ++k) {
+        uint32_t seq = s->expected_seq + k;
+        if (!seq_present(s, seq)) { nack_add(s, seq); gaps++; }
+    }
+    return gaps;
+}
+
+/*
+ * 数据报后端：比收到的最大 seq 落后 UDP_REORDER_SLACK 以上还没到的 seq 当作丢了。
+ * 每个 seq 在这里只报一次，重发的块又丢了由 session_tick 补报。
+ */
+static void nack_lost(session_t *s)
+{
+    if (seq_before(s->gap_scan, s->expected_seq)) s->gap_scan = s->expected_seq;
+    uint32_t lim = s->expected_seq + s->win_size;
+    while (seq_before(s->gap_scan + UDP_REORDER_SLACK, s->hi_seq) && seq_before(s->gap_scan, lim)) {
+        if (!seq_present(s, s->gap_scan)) nack_add(s, s->gap_scan);
+        s->gap_scan++;
+    }
+}
+
+/*
+ * FILE_END：信用流控下还有没补上的 seq 时先不收尾，把缺的一次性 NACK 出去，
+ * 等重发的块补齐（expected_seq 追到 FILE_END）再收尾。
+ */
+static int on_file_end_msg(session_t *s, protocol_msg *msg)
+{
+    s->end_seq = msg->hdr.seq;
+    s->end_has_crc = tlv_find_u32(msg->payload, msg->hdr.payload_length, TLV_CRC32, &s->end_crc) == 0;
+    if (s->credit && s->out_fd >= 0 && s->window) {
+        if (!g_cfg.direct_write) drain_inorder(s);
+        if (s->expected_seq != s->end_seq) {
+            s->n_nack = 0;
+            uint32_t gaps = nack_gaps(s, s->end_seq);
+            s->end_pending = 1;
+            LOG_I("[%lu] END seq=%u waiting for %u missing seq(s) from %u\n",
+                    (unsigned long)pthread_self(), s->end_seq, gaps, s->expected_seq);
+            return send_credit(s);
+        }
+    }
+    return end_transfer(s);
+}
+
+/* 一块数据处理完：补齐了挂起的 FILE_END 就收尾，否则按需回信用 */
+static int after_chunk(session_t *s, uint32_t seq)
+{
+    if (seq_before(s->hi_seq, seq)) s->hi_seq = seq;
+    if (s->ops->datagram && s->credit && s->out_fd >= 0 && s->window) nack_lost(s);
+    if (s->end_pending && s->expected_seq == s->end_seq) return end_transfer(s);
+    if (s->end_pending && s->n_nack) return send_credit(s);
+    return maybe_credit(s);
+}
+
+/* 数据报后端上客户端等不到信用会重发 FILE_START / FILE_END，已经处理过的只重发信用 */
+static int is_dup_control(const session_t *s, const protocol_msg *msg)
+{
+    if (!s->ops->datagram) return 0;
+    if (msg->hdr.message_type == MSG_FILE_START) return s->started && msg->hdr.seq == s->start_seq;
+    if (msg->hdr.message_type == MSG_FILE_END) return s->finished && msg->hdr.seq == s->end_seq;
+    return 0;
+}
+
+/* 回一份当前的运行指标 */
+static int on_stats(session_t *s, protocol_msg *msg)
+{
+    uint8_t *buf = NULL;
+    uint32_t len = 0;
+    if (metrics_build_stats(&buf, &len) < 0) return -1;
+    protocol_msg rep = {0};
+    rep.hdr.version_major  = 1;
+    rep.hdr.version_minor  = 0;
+    rep.hdr.message_type   = MSG_STATS;
+    rep.hdr.seq            = msg->hdr.seq;
+    rep.hdr.payload_length = len;
+    rep.payload            = buf;
+    int r = session_send(s, &rep);
+    free(buf);
+    return r;
+}
+
+static int session_dispatch(session_t *s, protocol_msg *msg)
+{
+    LOG_D("[thread %lu] recv type=%u len=%u seq=%u\n",
+            (unsigned long)pthread_self(),
+            msg->hdr.message_type,
+            msg->hdr.payload_length,
+            msg->hdr.seq);
+
+    if (is_dup_control(s, msg)) {
+        if ((s->credit || s->finished) && send_credit(s) < 0) { LOG_ERRNO("send FILE_CREDIT"); return -1; }
+        return 0;
+    }
+
+    switch (msg->hdr.message_type) {
+    case MSG_ECHO: {
+        protocol_msg rep = *msg;
+        if (session_send(s, &rep) < 0) { LOG_ERRNO("send_message"); return -1; }
+        break;
+    }
+    case MSG_FILE_START:
+        on_file_start(s, msg);
+        // 打开失败不给初始信用，客户端等不到就会放弃
+        if (s->credit && s->out_fd >= 0 && send_credit(s) < 0) { LOG_ERRNO("send FILE_CREDIT"); return -1; }
+        break;
+    case MSG_FILE_DATA:
+        on_file_data(s, msg);
+        if (after_chunk(s, msg->hdr.seq) < 0) { LOG_ERRNO("send FILE_CREDIT"); return -1; }
+        break;
+    case MSG_FILE_END:
+        if (on_file_end_msg(s, msg) < 0) { LOG_ERRNO("send FILE_CREDIT"); return -1; }
+        break;
+    case MSG_FILE_COPY:
+        on_file_copy(s, msg);
+        if (after_chunk(s, msg->hdr.seq) < 0) { LOG_ERRNO("send FILE_CREDIT"); return -1; }
+        break;
+    case MSG_SIG_REQUEST:
+        if (on_sig_request(s, msg) < 0) { LOG_ERRNO("send SIGNATURES"); return -1; }
+        break;
+    case MSG_FILE_QUERY:
+        if (on_file_query(s, msg) < 0) { LOG_ERRNO("send FILE_RANGES"); return -1; }
+        break;
+    case MSG_STATS:
+        if (on_stats(s, msg) < 0) { LOG_ERRNO("send STATS"); return -1; }
+        break;
+    default:
+        LOG_W("unknown msg_type=%u\n", msg->hdr.message_type);
+        break;
     }
     return 0;
 }
 
-static void free_window(seq_chunk_t *win) {
-    for (int i = 0; i < SEQ_WINDOW; ++i) {
-        if (win[i].present) { free(win[i].data); win[i].data = NULL; }
-        win[i].present = 0;
+/* 多路复用：连接 session 上按通道号排序的子 session 表，通道数一般不多，二分查找 */
+struct chan_ent
+{
+    uint32_t   id;
+    session_t *s;
+};
+
+static uint32_t chan_lower(const session_t *s, uint32_t id)
+{
+    uint32_t lo = 0, hi = s->n_chans;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (s->chans[mid].id < id) lo = mid + 1;
+        else hi = mid;
     }
+    return lo;
 }
 
+/* 找通道 id 的子 session；没有且 create 非 0 时新建一个，和连接共用 fd / ops / io */
+static session_t *chan_get(session_t *s, uint32_t id, int create)
+{
+    uint32_t i = chan_lower(s, id);
+    if (i < s->n_chans && s->chans[i].id == id) return s->chans[i].s;
+    if (!create) return NULL;
+    if (s->n_chans >= MUX_MAX_CHANNELS) {
+        LOG_W("channel %u: more than %u channels on one connection\n", id, MUX_MAX_CHANNELS);
+        return NULL;
+    }
+    if (s->n_chans == s->cap_chans) {
+        uint32_t cap = s->cap_chans ? s->cap_chans * 2 : 16;
+        chan_ent_t *nc = realloc(s->chans, (size_t)cap * sizeof(*nc));
+        if (!nc) { LOG_ERRNO("realloc"); return NULL; }
+        s->chans = nc;
+        s->cap_chans = cap;
+    }
+    session_t *t = malloc(sizeof(*t));
+    if (!t) { LOG_ERRNO("malloc"); return NULL; }
+    session_init(t, s->fd, &s->addr, s->ops, s->io);
+    t->chan = id;
+    memmove(&s->chans[i + 1], &s->chans[i], (size_t)(s->n_chans - i) * sizeof(*s->chans));
+    s->chans[i] = (chan_ent_t){ .id = id, .s = t };
+    s->n_chans++;
+    return t;
+}
+
+static void chan_drop(session_t *s, uint32_t id)
+{
+    uint32_t i = chan_lower(s, id);
+    if (i >= s->n_chans || s->chans[i].id != id) return;
+    session_close(s->chans[i].s);
+    free(s->chans[i].s);
+    memmove(&s->chans[i], &s->chans[i + 1], (size_t)(s->n_chans - i - 1) * sizeof(*s->chans));
+    s->n_chans--;
+}
+
+static void chan_close_all(session_t *s)
+{
+    for (uint32_t i = 0; i < s->n_chans; ++i) {
+        session_close(s->chans[i].s);
+        free(s->chans[i].s);
+    }
+    free(s->chans);
+    s->chans = NULL;
+    s->n_chans = s->cap_chans = 0;
+}
+
+int session_tick(session_t *s)
+{
+    for (uint32_t i = 0; i < s->n_chans; ++i) {
+        if (session_tick(s->chans[i].s) < 0) return -1;
+    }
+    if (!s->credit || s->out_fd < 0 || !s->window) return 0;
+    s->n_nack = 0;
+    nack_gaps(s, s->end_pending ? s->end_seq : s->acked + s->granted);
+    return send_credit(s);
+}
+
+/*
+ * 以 TLV_CHANNEL 开头的消息去掉这个前缀后交给对应通道；能开始一次交互的消息才新建通道。
+ * 通道上没有打开的文件（传输结束、或只是一问一答）时立即释放，表里只留活跃的传输。
+ */
+int session_on_message(session_t *s, protocol_msg *msg)
+{
+    metrics_add(MET_FRAMES_IN, 1);
+    metrics_add(MET_BYTES_IN, PROTOCOL_HEADER_LEN + msg->hdr.payload_length);
+    const uint8_t *p = msg->payload;
+    uint32_t len = msg->hdr.payload_length, chan = 0;
+    if (!tlv_take_channel(&p, &len, &chan) || chan == 0) return session_dispatch(s, msg);
+
+    uint16_t type = msg->hdr.message_type;
+    int opens = type == MSG_FILE_START || type == MSG_FILE_QUERY ||
+                type == MSG_SIG_REQUEST || type == MSG_ECHO || type == MSG_STATS;
+    session_t *t = chan_get(s, chan, opens);
+    if (!t) {
+        LOG_W("channel %u: dropping type=%u seq=%u\n", chan, type, msg->hdr.seq);
+        return 0;
+    }
+    protocol_msg m = *msg;
+    m.payload = len ? (void *)p : NULL;
+    m.hdr.payload_length = len;
+    int r = session_dispatch(t, &m);
+    if (t->out_fd < 0 && !t->end_pending) chan_drop(s, chan);
+    return r;
+}
+
+int session_drain_frames(session_t *s, frame_decoder_t *dec)
+{
+    protocol_msg msg;
+    int r;
+    while ((r = frame_decoder_next(dec, &msg)) == 1) {
+        if (session_on_message(s, &msg) < 0) return -1;
+    }
+    if (r < 0) {
+        LOG_W("bad frame: payload too large (max %u)\n", dec->max_payload);
+        return -1;
+    }
+    return 0;
+}
+
+static int thread_send(session_t *s, protocol_msg *msg)
+{
+    return send_message(s->fd, msg);
+}
+
+static const session_ops_t thread_ops = {
+    .send      = thread_send,
+    .write_at  = session_pwrite_at,
+    .close_out = NULL,
+};
+
 void *handle_client(void *arg)
 {
     client_ctx_t *ctx = arg;
     char ip[INET_ADDRSTRLEN];
     inet_ntop(AF_INET, &ctx->addr.sin_addr, ip, sizeof(ip));
     int port = ntohs(ctx->addr.sin_port);
-    fprintf(stderr, "[thread %lu] accepted %s:%d\n",
+    LOG_I("[thread %lu] accepted %s:%d\n",
             (unsigned long)pthread_self(), ip, port);
 
-    FILE *out = NULL;           
-    char  out_name[512] = {0};  
-    uint64_t expect_size = 0;
-    uint64_t wrote = 0;
-    uint32_t expected_seq = 0;
-    log_t log = {0};
-    seq_chunk_t window[SEQ_WINDOW] = {0};
+    metrics_add(MET_CONNS, 1);
+    metrics_gauge(MET_CONNS_ACTIVE, 1);
+
+    session_t sess;
+    session_init(&sess, ctx->fd, &ctx->addr, &thread_ops, NULL);
+    frame_decoder_t dec;
+    if (frame_decoder_init(&dec, FRAME_DECODER_CAP, FRAME_MAX_PAYLOAD) < 0) {
+        LOG_ERRNO("frame_decoder_init");
+        metrics_gauge(MET_CONNS_ACTIVE, -1);
+        close(ctx->fd);
+        free(ctx);
+        return NULL;
+    }
     for (;;) {
-        protocol_msg msg = {0};
-        int r = read_message(ctx->fd, &msg);
-        if (r == 1) { printf("client closed\n"); break; }
-        if (r < 0)   { perror("read_message"); break; }
-
-        fprintf(stderr, "[thread %lu] recv type=%u len=%u seq=%u\n",
-                (unsigned long)pthread_self(),
-                msg.hdr.message_type,
-                msg.hdr.payload_length,
-                msg.hdr.seq);
-
-        switch (msg.hdr.message_type) {
-        case MSG_ECHO: {
-            protocol_msg rep = msg; 
-            if (send_message(ctx->fd, &rep) < 0) perror("send_message");
-            free(msg.payload);
-            break;
-        }
-        case MSG_FILE_START: {
-            if (out) { fclose(out); out = NULL; }
-            memset(out_name, 0, sizeof(out_name));
-            expect_size = 0;
-            wrote = 0;
-            
-            int parse_r = parse_payload_file_start(msg.payload, msg.hdr.payload_length,
-                                                   out_name, sizeof(out_name), 
-                                                   &expect_size);
-            
-            if (parse_r < 0) {
-                fprintf(stderr, "FILE_START invalid payload, code=%d\n", parse_r);
-                free(msg.payload); 
-                break;
-            }
-
-            expected_seq = (msg.hdr.seq + 1u) & 0xFFFFFFFFu;
-            free_window(window);
-            char safe_name[520];
-            const char *fname = strrchr(out_name, '/');
-            fname = fname ? fname + 1 : out_name;
-            snprintf(safe_name, sizeof(safe_name), "%s/%s", RECV_DIR, fname);
-
-            out = fopen(safe_name, "wb");
-            if (!out) {
-                perror("fopen");
-            } else {
-                fprintf(stderr, "START file='%s' size=%llu\n", safe_name,
-                        (unsigned long long)expect_size);
-            }
-            free(msg.payload);
-            break;
-        }
-        case MSG_FILE_DATA: {
-            if (!out) { fprintf(stderr,"FILE_DATA without START\n"); free(msg.payload); break; }
-
-            uint64_t offset = 0;
-            const uint8_t *data_ptr = NULL;
-            uint32_t data_len = 0;
-
-            int parse_r = parse_payload_file_data(msg.payload, msg.hdr.payload_length,
-                                                  &offset, &data_ptr, &data_len);
-            
-            if (parse_r < 0) {
-                fprintf(stderr,"FILE_DATA invalid payload, code=%d\n", parse_r); 
-                free(msg.payload); 
-                break; 
-            }
-
-            if (offset != wrote) {
-                fseeko(out, (off_t)offset, SEEK_SET);
-            }
-
-            ssize_t wn = fwrite_all(out, data_ptr, data_len);
-            if (wn < 0 || (size_t)wn != data_len) {
-                perror("fwrite_all");
-            }
-            uint32_t seq = msg.hdr.seq;
-            uint32_t dist = seq_distance(seq, expected_seq);
-
-            log.cnt_in++;
-
-            if (seq_before(seq, expected_seq)) {
-                log.cnt_drop_old++;
-                fprintf(stderr, "[%lu] DROP old seq=%u expect=%u\n",
-                        (unsigned long)pthread_self(), seq, expected_seq);
-                free(msg.payload);
-                break;
-            }
-            if (dist >= SEQ_WINDOW) {
-                log.cnt_drop_far++;
-                fprintf(stderr, "[%lu] DROP too-far seq=%u expect=%u (dist=%u >= %d)\n",
-                        (unsigned long)pthread_self(), seq, expected_seq, dist, SEQ_WINDOW);
-                free(msg.payload);
-                break;
-            }
-
-            seq_chunk_t *slot = &window[seq % SEQ_WINDOW];
-            if (slot->present && slot->seq != seq) {
-                free(slot->data);
-                slot->present = 0;
-            }
-            slot->seq = seq;
-            slot->offset = offset;
-            slot->len = data_len;
-            slot->data = (uint8_t*)malloc(data_len);
-            if (!slot->data) { perror("malloc"); free(msg.payload); break; }
-            memcpy(slot->data, data_ptr, data_len);
-            slot->present = 1;
-
-            if (drain_inorder(out, window, &expected_seq, &wrote,&log.cnt_flush) < 0) {
-                free(msg.payload);
-                break;
-            }
-
-            free(msg.payload);
-            break;
-        }
-        case MSG_FILE_END: {
-            if (out) {
-                drain_inorder(out, window, &expected_seq, &wrote,&log.cnt_flush);
-                fflush(out);
-                fclose(out);
-                out = NULL;
-
-                fprintf(stderr,
-                    "[summary] file='%s' recv=%llu flushed≈%llu drop_old=%llu drop_far=%llu wrote=%llu/%llu win=%d\n",
-                    out_name,
-                    (unsigned long long)log.cnt_in,
-                    (unsigned long long)log.cnt_flush,   // 如果你没有传计数器，这里用 0 或先去掉
-                    (unsigned long long)log.cnt_drop_old,
-                    (unsigned long long)log.cnt_drop_far,
-                    (unsigned long long)wrote,
-                    (unsigned long long)expect_size,
-                    SEQ_WINDOW
-                );
-                if (expect_size != 0 && wrote != expect_size) { 
-                    fprintf(stderr, "WARN: size mismatch\n");
-                }
-            } else {
-                fprintf(stderr,"END without open file\n");
-            }
-            free(msg.payload);
-            free_window(window);
-            break;
-        }
-        default:
-            fprintf(stderr,"unknown msg_type=%u\n", msg.hdr.message_type);
-            free(msg.payload);
+        ssize_t m = frame_decoder_recv(&dec, ctx->fd);
+        if (m == 0) {
+            if (frame_decoder_pending(&dec)) LOG_W("client closed mid-frame\n");
+            else printf("client closed\n");
             break;
         }
+        if (m < 0) { LOG_ERRNO("recv"); break; }
+        if (session_drain_frames(&sess, &dec) < 0) break;
     }
 
-    if (out) { 
-        fclose(out);
-    }
+    session_close(&sess);
+    frame_decoder_destroy(&dec);
     close(ctx->fd);
     free(ctx);
-    fprintf(stderr, "[thread %lu] exit\n", (unsigned long)pthread_self());
+    metrics_gauge(MET_CONNS_ACTIVE, -1);
+    LOG_I("[thread %lu] exit\n", (unsigned long)pthread_self());
     return NULL;
 }
\ No newline at end of file
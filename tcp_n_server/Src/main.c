@@ -15,28 +15,178 @@
 #include "tcp_server.h"
 #include "tcp_protocol.h"
 #include "tcp_tlv.h"
+#include "log.h"
+#include "metrics.h"
 
 #define PORT 9000
 #define BUFSZ 8192
 #define backlog_limit 128
+#define DEFAULT_WORKERS 4
 
-extern void *handle_client(void *arg);
+server_config_t g_cfg = {
+    .mode    = SERVER_MODE_THREAD,
+    .port    = PORT,
+    .workers = DEFAULT_WORKERS,
+    .window_size   = SEQ_WINDOW,
+    .window_max    = SEQ_WINDOW_MAX,
+    .window_budget = WINDOW_BUDGET_BYTES,
+};
 
-ssize_t fwrite_all(FILE *fp, const uint8_t *p, size_t n) {
-    size_t off = 0;
-    while (off < n) {
-        size_t m = fwrite(p + off, 1, n - off, fp);
-        if (m == 0) {
-            if (ferror(fp)) return -1;   // I/O 出错
+/* 解析带 K/M/G 后缀的字节数 */
+static int parse_size(const char *v, uint64_t *out)
+{
+    char *end = NULL;
+    unsigned long long n = strtoull(v, &end, 10);
+    if (end == v) return -1;
+    switch (*end) {
+    case 'k': case 'K': n <<= 10; end++; break;
+    case 'm': case 'M': n <<= 20; end++; break;
+    case 'g': case 'G': n <<= 30; end++; break;
+    default: break;
+    }
+    if (*end != '\0') return -1;
+    *out = n;
+    return 0;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "用法:\n  %s [--mode thread|epoll|uring] [--workers N] [--port PORT] [--hugepages] [--direct]\n"
+            "     [--window N] [--window-max N] [--window-budget BYTES[K|M|G]] [--udp-port PORT]\n"
+            "     [--log-level debug|info|warn|error] [--log-rate N] [--metrics-port PORT]\n"
+            "  thread : 每个连接一个线程（默认）\n"
+            "  epoll  : N 个 worker 线程，非阻塞边沿触发\n"
+            "  uring  : N 个 worker 线程，每个一个 io_uring（多发 recv + 定位写）\n"
+            "  --hugepages : 重排窗口的 slab 使用大页\n"
+            "  --direct    : 每块按 offset 直接 pwrite，seq 只记完成位图；最早缺的块和最新块的 seq 相距不超过 64M\n"
+            "  --window N        : 初始重排窗口（默认 %d），乱序超出时自动扩大\n"
+            "  --window-max N    : 窗口上限，也是客户端可协商的最大值（默认 %d）\n"
+            "  --window-budget B : 全进程暂存乱序数据上限，0 为不限（默认 %llu MiB）\n"
+            "  --udp-port PORT   : 同时在这个端口收 UDP 传输（信用 / NACK 保证可靠）\n"
+            "  --log-level L     : debug|info|warn|error（默认 info），debug 会逐条记收到的消息\n"
+            "  --log-rate N      : 每个线程每级每秒最多记 N 条日志，0 为不限（默认 %d）\n"
+            "  --metrics-port P  : 在 127.0.0.1:P 上提供 Prometheus 文本格式的指标\n",
+            prog, SEQ_WINDOW, SEQ_WINDOW_MAX,
+            (unsigned long long)(WINDOW_BUDGET_BYTES >> 20), LOG_RATE_DEFAULT);
+}
+
+static int parse_args(int argc, char **argv)
+{
+    for (int i = 1; i < argc; ++i) {
+        const char *a = argv[i];
+        const char *v = (i + 1 < argc) ? argv[i + 1] : NULL;
+        if (strcmp(a, "--mode") == 0 && v) {
+            if (strcmp(v, "thread") == 0)      g_cfg.mode = SERVER_MODE_THREAD;
+            else if (strcmp(v, "epoll") == 0)  g_cfg.mode = SERVER_MODE_EPOLL;
+            else if (strcmp(v, "uring") == 0)  g_cfg.mode = SERVER_MODE_URING;
+            else { fprintf(stderr, "unknown mode '%s'\n", v); return -1; }
+            ++i;
+        } else if (strcmp(a, "--workers") == 0 && v) {
+            g_cfg.workers = atoi(v);
+            if (g_cfg.workers <= 0) { fprintf(stderr, "bad --workers '%s'\n", v); return -1; }
+            ++i;
+        } else if (strcmp(a, "--port") == 0 && v) {
+            g_cfg.port = atoi(v);
+            ++i;
+        } else if (strcmp(a, "--hugepages") == 0) {
+            g_cfg.window_hugepages = 1;
+        } else if (strcmp(a, "--direct") == 0) {
+            g_cfg.direct_write = 1;
+        } else if (strcmp(a, "--window") == 0 && v) {
+            int n = atoi(v);
+            if (n <= 0) { fprintf(stderr, "bad --window '%s'\n", v); return -1; }
+            g_cfg.window_size = (uint32_t)n;
+            ++i;
+        } else if (strcmp(a, "--window-max") == 0 && v) {
+            int n = atoi(v);
+            if (n <= 0) { fprintf(stderr, "bad --window-max '%s'\n", v); return -1; }
+            g_cfg.window_max = (uint32_t)n;
+            ++i;
+        } else if (strcmp(a, "--udp-port") == 0 && v) {
+            g_cfg.udp_port = atoi(v);
+            if (g_cfg.udp_port <= 0 || g_cfg.udp_port > 65535) { fprintf(stderr, "bad --udp-port '%s'\n", v); return -1; }
+            ++i;
+        } else if (strcmp(a, "--metrics-port") == 0 && v) {
+            g_cfg.metrics_port = atoi(v);
+            if (g_cfg.metrics_port <= 0 || g_cfg.metrics_port > 65535) {
+                fprintf(stderr, "bad --metrics-port '%s'\n", v);
+                return -1;
+            }
+            ++i;
+        } else if (strcmp(a, "--log-level") == 0 && v) {
+            if (log_set_level_name(v) < 0) { fprintf(stderr, "bad --log-level '%s'\n", v); return -1; }
+            ++i;
+        } else if (strcmp(a, "--log-rate") == 0 && v) {
+            int n = atoi(v);
+            if (n < 0) { fprintf(stderr, "bad --log-rate '%s'\n", v); return -1; }
+            for (int l = 0; l < LOG_LEVELS; ++l) log_set_rate(l, (uint32_t)n);
+            ++i;
+        } else if (strcmp(a, "--window-budget") == 0 && v) {
+            if (parse_size(v, &g_cfg.window_budget) < 0) {
+                fprintf(stderr, "bad --window-budget '%s'\n", v);
+                return -1;
+            }
+            ++i;
+        } else {
+            return -1;
+        }
+    }
+    if (g_cfg.window_size > g_cfg.window_max) g_cfg.window_size = g_cfg.window_max;
+    return 0;
+}
+
+ssize_t pwrite_all(int fd, const uint8_t *p, size_t n, off_t off) {
+    size_t done = 0;
+    while (done < n) {
+        ssize_t m = pwrite(fd, p + done, n - done, off + (off_t)done);
+        if (m < 0) {
+            if (errno == EINTR) continue;
             return -1;
         }
-        off += m;
+        if (m == 0) return -1;
+        done += (size_t)m;
+    }
+    return (ssize_t)done;
+}
+
+/* UDP 传输和 TCP 共用 recv/ 和全局配置，在自己的线程里跑 */
+static int start_udp(int port)
+{
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0) { perror("socket udp"); return -1; }
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t)port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("bind udp");
+        close(fd);
+        return -1;
     }
-    return (ssize_t)off;
+
+    pthread_t th;
+    if (pthread_create(&th, NULL, run_udp_server, (void *)(intptr_t)fd) != 0) {
+        perror("pthread_create");
+        close(fd);
+        return -1;
+    }
+    pthread_detach(th);
+    printf("UDP transfers on 0.0.0.0:%d\n", port);
+    return 0;
 }
 
-int main(void) {
+int main(int argc, char **argv) {
+    if (parse_args(argc, argv) < 0) {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
     signal(SIGPIPE, SIG_IGN);  
+    // 连接线程的日志走异步缓冲，不在 stderr 的锁上互相等
+    if (log_init() < 0) { perror("log_init"); exit(EXIT_FAILURE); }
+    metrics_init();
 
     int socket_fd = socket(AF_INET, SOCK_STREAM, 0);
     if (socket_fd < 0) { perror("socket"); exit(EXIT_FAILURE); }
@@ -47,7 +197,7 @@ int main(void) {
     struct sockaddr_in addr;
     memset(&addr, 0, sizeof(addr));
     addr.sin_family = AF_INET;
-    addr.sin_port = htons(PORT);
+    addr.sin_port = htons((uint16_t)g_cfg.port);
     addr.sin_addr.s_addr = htonl(INADDR_ANY);
 
     if (bind(socket_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
@@ -71,14 +221,28 @@ int main(void) {
         printf("Created directory: %s\n", RECV_DIR);
     }
 
-    printf("Server listening on 0.0.0.0:%d ...\n", PORT);
+    if (g_cfg.udp_port && start_udp(g_cfg.udp_port) < 0) exit(EXIT_FAILURE);
+    if (g_cfg.metrics_port && metrics_serve(g_cfg.metrics_port) < 0) exit(EXIT_FAILURE);
+
+    printf("Server listening on 0.0.0.0:%d ...\n", g_cfg.port);
+    if (g_cfg.mode == SERVER_MODE_EPOLL) {
+        int r = run_epoll_server(socket_fd, g_cfg.workers);
+        close(socket_fd);
+        return (r == 0) ? 0 : 1;
+    }
+    if (g_cfg.mode == SERVER_MODE_URING) {
+        int r = run_uring_server(socket_fd, g_cfg.workers);
+        close(socket_fd);
+        return (r == 0) ? 0 : 1;
+    }
+
     for(;;)
     {
         struct sockaddr_in cli;
         socklen_t len = sizeof(cli);
         int cli_fd = accept(socket_fd, (struct sockaddr *)&cli, &len);
         if (cli_fd < 0) {
-            perror("accept");
+            LOG_ERRNO("accept");
             if(errno == EINTR) continue;
             continue;
         }
@@ -0,0 +1,322 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include "metrics.h"
+#include "tcp_tlv.h"
+#include "log.h"
+
+enum {
+    SHARD_FREE = 0,
+    SHARD_OWNED,
+};
+
+typedef struct
+{
+    const char *stat;       // MSG_STATS 里的名字
+    const char *prom;       // Prometheus 的名字，可以带标签；同一族的要相邻
+    const char *help;
+}metric_info_t;
+
+static const metric_info_t counter_info[MET_COUNTERS] = {
+    [MET_CONNS]       = { "connections_total", "tcp_server_connections_total",
+                          "Accepted TCP connections and new UDP peers." },
+    [MET_FRAMES_IN]   = { "frames_in_total", "tcp_server_frames_received_total", "Frames received." },
+    [MET_FRAMES_OUT]  = { "frames_out_total", "tcp_server_frames_sent_total", "Frames sent." },
+    [MET_BYTES_IN]    = { "bytes_in_total", "tcp_server_received_bytes_total",
+                          "Bytes received, frame headers included." },
+    [MET_BYTES_OUT]   = { "bytes_out_total", "tcp_server_sent_bytes_total",
+                          "Bytes sent, frame headers included." },
+    [MET_DISK_WRITES] = { "disk_writes_total", "tcp_server_disk_writes_total", "Completed writes to output files." },
+    [MET_DISK_BYTES]  = { "disk_bytes_total", "tcp_server_disk_written_bytes_total", "Bytes written to output files." },
+    [MET_DROP_OLD]    = { "drop_old_total", "tcp_server_chunks_dropped_total{reason=\"old\"}", "Data chunks dropped." },
+    [MET_DROP_FAR]    = { "drop_far_total", "tcp_server_chunks_dropped_total{reason=\"far\"}", NULL },
+    [MET_DROP_BUDGET] = { "drop_budget_total", "tcp_server_chunks_dropped_total{reason=\"budget\"}", NULL },
+    [MET_CRC_BAD]     = { "crc_bad_total", "tcp_server_chunks_dropped_total{reason=\"crc\"}", NULL },
+    [MET_NACK]        = { "nack_total", "tcp_server_nacked_seqs_total", "Sequence numbers the client was asked to resend." },
+    [MET_WRITE_ERRORS] = { "write_errors_total", "tcp_server_disk_write_errors_total",
+                           "Writes to output files that failed or came up short." },
+    [MET_POOL_GETS]   = { "pool_gets_total", "tcp_server_buffer_pool_gets_total",
+                          "Buffers taken from the io_uring receive and write-request pools." },
+    [MET_POOL_ALLOCS] = { "pool_allocs_total", "tcp_server_buffer_pool_allocs_total",
+                          "Pool requests that had to fall back to malloc." },
+    [MET_POOL_STEADY_ALLOCS] = { "pool_steady_allocs_total", "tcp_server_buffer_pool_steady_allocs_total",
+                                 "Pool mallocs made after the pool had grown to its full depth." },
+};
+
+static const metric_info_t gauge_info[MET_GAUGES] = {
+    [MET_CONNS_ACTIVE] = { "connections_active", "tcp_server_connections_active", "Open connections and UDP peers." },
+    [MET_WIN_CHUNKS]   = { "window_chunks", "tcp_server_reorder_window_chunks",
+                           "Out-of-order chunks parked in reorder windows." },
+    [MET_WIN_BYTES]    = { "window_bytes", "tcp_server_reorder_window_bytes",
+                           "Bytes parked in reorder windows." },
+    [MET_WRITES_INFLIGHT] = { "writes_inflight", "tcp_server_disk_writes_inflight",
+                              "Asynchronous file writes submitted but not yet completed." },
+};
+
+static const metric_info_t hist_info[MET_HISTS] = {
+    [MET_H_DRAIN] = { "drain_ns", "tcp_server_reorder_drain_seconds",
+                      "Time an out-of-order chunk waits in the reorder window before it is written." },
+    [MET_H_WRITE] = { "write_ns", "tcp_server_disk_write_seconds", "Latency of one write to an output file." },
+};
+
+__thread metrics_shard_t *t_metrics;
+
+static _Atomic(metrics_shard_t *) g_shards;
+static pthread_key_t  g_shard_key;
+static pthread_once_t g_shard_once = PTHREAD_ONCE_INIT;
+static uint64_t       g_start_ns;
+
+static void shard_release(void *arg)
+{
+    metrics_shard_t *m = arg;
+    atomic_store_explicit(&m->state, SHARD_FREE, memory_order_release);
+}
+
+static void shard_key_init(void)
+{
+    pthread_key_create(&g_shard_key, shard_release);
+}
+
+metrics_shard_t *metrics_shard_slow(void)
+{
+    pthread_once(&g_shard_once, shard_key_init);
+    metrics_shard_t *m;
+    for (m = atomic_load_explicit(&g_shards, memory_order_acquire); m; m = m->next) {
+        int expect = SHARD_FREE;
+        if (atomic_compare_exchange_strong(&m->state, &expect, SHARD_OWNED)) break;
+    }
+    if (!m) {
+        m = calloc(1, sizeof(*m));
+        if (!m) return NULL;
+        atomic_init(&m->state, SHARD_OWNED);
+        metrics_shard_t *old = atomic_load_explicit(&g_shards, memory_order_relaxed);
+        do {
+            m->next = old;
+        } while (!atomic_compare_exchange_weak_explicit(&g_shards, &old, m,
+                                                        memory_order_release, memory_order_relaxed));
+    }
+    t_metrics = m;
+    pthread_setspecific(g_shard_key, m);
+    return m;
+}
+
+void metrics_init(void)
+{
+    g_start_ns = metrics_now();
+}
+
+void metrics_snapshot(metrics_snap_t *out)
+{
+    memset(out, 0, sizeof(*out));
+    for (metrics_shard_t *m = atomic_load_explicit(&g_shards, memory_order_acquire); m; m = m->next) {
+        for (int i = 0; i < MET_COUNTERS; ++i)
+            out->c[i] += atomic_load_explicit(&m->c[i], memory_order_relaxed);
+        for (int i = 0; i < MET_GAUGES; ++i)
+            out->g[i] += (int64_t)atomic_load_explicit(&m->g[i], memory_order_relaxed);
+        for (int i = 0; i < MET_HISTS; ++i) {
+            for (int k = 0; k <= MET_HIST_BUCKETS; ++k)
+                out->h[i][k] += atomic_load_explicit(&m->h[i][k], memory_order_relaxed);
+            out->h_sum[i] += atomic_load_explicit(&m->h_sum[i], memory_order_relaxed);
+        }
+    }
+    for (int i = 0; i < MET_HISTS; ++i) {
+        for (int k = 0; k <= MET_HIST_BUCKETS; ++k) out->h_count[i] += out->h[i][k];
+    }
+    out->uptime_ns = metrics_now() - g_start_ns;
+}
+
+/* 第 k 桶的上界（纳秒） */
+static uint64_t bucket_le_ns(int k)
+{
+    return 1ull << (k + 10);
+}
+
+/* 累计到 q 比例所在桶的上界；没有样本为 0 */
+static uint64_t hist_quantile(const metrics_snap_t *s, int id, double q)
+{
+    uint64_t n = s->h_count[id];
+    if (n == 0) return 0;
+    uint64_t want = (uint64_t)(q * (double)n);
+    if (want == 0) want = 1;
+    uint64_t acc = 0;
+    for (int k = 0; k <= MET_HIST_BUCKETS; ++k) {
+        acc += s->h[id][k];
+        if (acc >= want) return bucket_le_ns(k);
+    }
+    return bucket_le_ns(MET_HIST_BUCKETS);
+}
+
+int metrics_build_stats(uint8_t **out, uint32_t *out_len)
+{
+    metrics_snap_t s;
+    metrics_snapshot(&s);
+
+    // 名字都不超过 32 字节
+    size_t cap = (size_t)(MET_COUNTERS + MET_GAUGES + 5 * MET_HISTS + 1) * (TLV_HEADER_LEN + TLV_U64_LEN + 32);
+    uint8_t *buf = malloc(cap);
+    if (!buf) return -1;
+    uint8_t *w = buf;
+    w = tlv_put_stat(w, "uptime_ms", s.uptime_ns / 1000000u);
+    for (int i = 0; i < MET_COUNTERS; ++i) w = tlv_put_stat(w, counter_info[i].stat, s.c[i]);
+    for (int i = 0; i < MET_GAUGES; ++i)
+        w = tlv_put_stat(w, gauge_info[i].stat, s.g[i] > 0 ? (uint64_t)s.g[i] : 0);
+    for (int i = 0; i < MET_HISTS; ++i) {
+        char name[32];
+        snprintf(name, sizeof(name), "%s_count_total", hist_info[i].stat);
+        w = tlv_put_stat(w, name, s.h_count[i]);
+        snprintf(name, sizeof(name), "%s_sum_total", hist_info[i].stat);
+        w = tlv_put_stat(w, name, s.h_sum[i]);
+        snprintf(name, sizeof(name), "%s_p50", hist_info[i].stat);
+        w = tlv_put_stat(w, name, hist_quantile(&s, i, 0.50));
+        snprintf(name, sizeof(name), "%s_p99", hist_info[i].stat);
+        w = tlv_put_stat(w, name, hist_quantile(&s, i, 0.99));
+        snprintf(name, sizeof(name), "%s_p999", hist_info[i].stat);
+        w = tlv_put_stat(w, name, hist_quantile(&s, i, 0.999));
+    }
+    *out = buf;
+    *out_len = (uint32_t)(w - buf);
+    return 0;
+}
+
+/* 名字里 '{' 之前是指标族，同一族只写一次 HELP / TYPE */
+static void prom_head(FILE *f, const metric_info_t *mi, const char *type)
+{
+    if (!mi->help) return;
+    const char *brace = strchr(mi->prom, '{');
+    int n = brace ? (int)(brace - mi->prom) : (int)strlen(mi->prom);
+    fprintf(f, "# HELP %.*s %s\n# TYPE %.*s %s\n", n, mi->prom, mi->help, n, mi->prom, type);
+}
+
+static char *format_prom(size_t *len)
+{
+    metrics_snap_t s;
+    metrics_snapshot(&s);
+    char *text = NULL;
+    FILE *f = open_memstream(&text, len);
+    if (!f) return NULL;
+
+    fprintf(f, "# HELP tcp_server_uptime_seconds Seconds since the server started.\n"
+               "# TYPE tcp_server_uptime_seconds gauge\ntcp_server_uptime_seconds %.3f\n",
+            (double)s.uptime_ns / 1e9);
+    for (int i = 0; i < MET_COUNTERS; ++i) {
+        prom_head(f, &counter_info[i], "counter");
+        fprintf(f, "%s %llu\n", counter_info[i].prom, (unsigned long long)s.c[i]);
+    }
+    for (int i = 0; i < MET_GAUGES; ++i) {
+        prom_head(f, &gauge_info[i], "gauge");
+        fprintf(f, "%s %lld\n", gauge_info[i].prom, (long long)s.g[i]);
+    }
+    for (int i = 0; i < MET_HISTS; ++i) {
+        const char *name = hist_info[i].prom;
+        prom_head(f, &hist_info[i], "histogram");
+        uint64_t acc = 0;
+        for (int k = 0; k < MET_HIST_BUCKETS; ++k) {
+            acc += s.h[i][k];
+            fprintf(f, "%s_bucket{le=\"%.9g\"} %llu\n", name, (double)bucket_le_ns(k) / 1e9,
+                    (unsigned long long)acc);
+        }
+        fprintf(f, "%s_bucket{le=\"+Inf\"} %llu\n", name, (unsigned long long)s.h_count[i]);
+        fprintf(f, "%s_sum %.9f\n", name, (double)s.h_sum[i] / 1e9);
+        fprintf(f, "%s_count %llu\n", name, (unsigned long long)s.h_count[i]);
+    }
+    if (fclose(f) != 0) {
+        free(text);
+        return NULL;
+    }
+    return text;
+}
+
+static int write_all(int fd, const char *p, size_t n)
+{
+    while (n > 0) {
+        ssize_t w = send(fd, p, n, MSG_NOSIGNAL);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        p += w;
+        n -= (size_t)w;
+    }
+    return 0;
+}
+
+/* 读掉请求头（不管路径，都回指标），回一份 HTTP/1.0 应答后关闭 */
+static void serve_one(int fd)
+{
+    struct timeval tv = { .tv_sec = 1, .tv_usec = 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    char req[4096];
+    size_t got = 0;
+    while (got < sizeof(req) - 1) {
+        ssize_t n = recv(fd, req + got, sizeof(req) - 1 - got, 0);
+        if (n <= 0) break;
+        got += (size_t)n;
+        req[got] = '\0';
+        if (strstr(req, "\r\n\r\n") || strstr(req, "\n\n")) break;
+    }
+
+    size_t len = 0;
+    char *body = format_prom(&len);
+    if (!body) { LOG_ERRNO("metrics"); return; }
+    char head[160];
+    int hn = snprintf(head, sizeof(head),
+                      "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                      "Content-Length: %zu\r\nConnection: close\r\n\r\n", len);
+    if (write_all(fd, head, (size_t)hn) == 0) write_all(fd, body, len);
+    free(body);
+}
+
+static void *metrics_main(void *arg)
+{
+    int lfd = (int)(intptr_t)arg;
+    for (;;) {
+        int fd = accept(lfd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            LOG_ERRNO("metrics accept");
+            break;
+        }
+        serve_one(fd);
+        close(fd);
+    }
+    close(lfd);
+    return NULL;
+}
+
+int metrics_serve(int port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) { perror("socket metrics"); return -1; }
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    // 只在本机上开，指标不对外
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t)port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 16) < 0) {
+        perror("bind metrics");
+        close(fd);
+        return -1;
+    }
+
+    pthread_t th;
+    if (pthread_create(&th, NULL, metrics_main, (void *)(intptr_t)fd) != 0) {
+        perror("pthread_create");
+        close(fd);
+        return -1;
+    }
+    pthread_detach(th);
+    printf("Prometheus metrics on 127.0.0.1:%d\n", port);
+    return 0;
+}
@@ -0,0 +1,76 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "range_set.h"
+
+void range_set_clear(range_set_t *s)
+{
+    s->n = 0;
+}
+
+void range_set_free(range_set_t *s)
+{
+    free(s->r);
+    memset(s, 0, sizeof(*s));
+}
+
+static int reserve(range_set_t *s, uint32_t need)
+{
+    if (need <= s->cap) return 0;
+    uint32_t cap = s->cap ? s->cap * 2 : 16;
+    while (cap < need) cap *= 2;
+    range_t *nr = realloc(s->r, (size_t)cap * sizeof(*nr));
+    if (!nr) return -1;
+    s->r = nr;
+    s->cap = cap;
+    return 0;
+}
+
+int range_set_add(range_set_t *s, uint64_t off, uint64_t len)
+{
+    if (len == 0) return 0;
+    uint64_t end = off + len;
+
+    // 常见情况：接在最后一段后面或与之重叠
+    if (s->n > 0 && off >= s->r[s->n - 1].off) {
+        range_t *last = &s->r[s->n - 1];
+        if (off <= last->end) {
+            if (end > last->end) last->end = end;
+            return 0;
+        }
+    }
+
+    // 第一个 end >= off 的区间，从它开始可能需要合并
+    uint32_t lo = 0, hi = s->n;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (s->r[mid].end < off) lo = mid + 1;
+        else hi = mid;
+    }
+    uint32_t j = lo;
+    while (j < s->n && s->r[j].off <= end) j++;
+
+    if (j == lo) {
+        // 不与任何区间相交，插到 lo
+        if (reserve(s, s->n + 1) < 0) return -1;
+        memmove(&s->r[lo + 1], &s->r[lo], (size_t)(s->n - lo) * sizeof(range_t));
+        s->r[lo] = (range_t){ .off = off, .end = end };
+        s->n++;
+        return 0;
+    }
+
+    // [lo, j) 与新区间相交或相邻，合并成一段
+    if (s->r[lo].off < off) off = s->r[lo].off;
+    if (s->r[j - 1].end > end) end = s->r[j - 1].end;
+    s->r[lo] = (range_t){ .off = off, .end = end };
+    memmove(&s->r[lo + 1], &s->r[j], (size_t)(s->n - j) * sizeof(range_t));
+    s->n -= j - lo - 1;
+    return 0;
+}
+
+uint64_t range_set_bytes(const range_set_t *s)
+{
+    uint64_t n = 0;
+    for (uint32_t i = 0; i < s->n; ++i) n += s->r[i].end - s->r[i].off;
+    return n;
+}
@@ -0,0 +1,392 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+
+#include "tcp_server.h"
+#include "crc32c.h"
+#include "log.h"
+
+/*
+ * 续传记录。每个正在接收的文件一项，同一文件的各条连接共享（分段上传时），
+ * 记录已经写进数据文件的 [off, end) 区间。每攒够 RESUME_SYNC_BYTES 先
+ * fdatasync 数据文件，再把同步前的区间快照写进侧车文件 <path>.resume，
+ * 所以侧车里的范围一定已经在盘上。最后一个引用释放时：收全了删掉侧车，
+ * 否则同步一次留给下次续传。
+ *
+ * fdatasync 和侧车的写、rename 都交给一个后台检查点线程做：resume_add / resume_put
+ * 是从 worker（epoll 的事件循环、io_uring 的写完成）里调的，同步几十 MiB 脏数据会把
+ * 整个 worker 上的连接卡住。收尾中的记录留在表里，直到落完侧车才摘掉，期间同一文件的
+ * resume_open / resume_query / resume_forget 等它摘掉再继续，不会读到或覆盖半新的侧车。
+ */
+struct resume
+{
+    char     path[520];
+    char     side[540];
+    uint64_t size;
+    uint64_t id;
+    int      fd;
+    int      refs;            // 受 g_resume_lock 保护
+
+    pthread_mutex_t mu;       // 保护下面几项
+    range_set_t set;
+    uint64_t pending;         // 上次同步以后新记的字节
+    int      syncing;
+
+    int      jobs;            // RESUME_JOB_*，受 g_ckpt_lock 保护
+    struct resume *job_next;
+
+    struct resume *next;
+};
+
+enum { RESUME_JOB_SYNC = 1, RESUME_JOB_FINAL = 2 };
+
+// 侧车文件头，后面跟 n 个 range_t；crc 覆盖这 n 个区间
+typedef struct
+{
+    char     magic[8];
+    uint64_t size;
+    uint64_t id;
+    uint32_t n;
+    uint32_t crc;
+}resume_hdr_t;
+
+static const char RESUME_MAGIC[8] = "TCPRSM1";
+
+static pthread_mutex_t g_resume_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  g_resume_gone = PTHREAD_COND_INITIALIZER;
+static resume_t *g_resumes = NULL;
+
+// 检查点线程的任务队列；一条记录最多排一次，重复的任务合进 jobs
+static pthread_mutex_t g_ckpt_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  g_ckpt_cond = PTHREAD_COND_INITIALIZER;
+static pthread_once_t  g_ckpt_once = PTHREAD_ONCE_INIT;
+static int       g_ckpt_ok = 0;
+static resume_t *g_ckpt_head = NULL;
+static resume_t *g_ckpt_tail = NULL;
+
+static resume_t *find_locked(const char *path)
+{
+    for (resume_t *r = g_resumes; r; r = r->next) {
+        if (strcmp(r->path, path) == 0) return r;
+    }
+    return NULL;
+}
+
+static void unlink_locked(resume_t *r)
+{
+    for (resume_t **pp = &g_resumes; *pp; pp = &(*pp)->next) {
+        if (*pp == r) { *pp = r->next; return; }
+    }
+}
+
+/* 同一文件的记录正在收尾（引用已经放完）时等它落完侧车摘掉 */
+static resume_t *find_live_locked(const char *path)
+{
+    resume_t *r;
+    while ((r = find_locked(path)) != NULL && r->refs == 0)
+        pthread_cond_wait(&g_resume_gone, &g_resume_lock);
+    return r;
+}
+
+static void side_path(const char *path, char *out, size_t cap)
+{
+    snprintf(out, cap, "%s%s", path, RESUME_SUFFIX);
+}
+
+/* 读侧车；文件不存在、损坏、或大小/id 对不上都当作没有，返回 -1 */
+static int load_side(const char *side, uint64_t size, uint64_t id, range_set_t *out)
+{
+    range_set_clear(out);
+    FILE *fp = fopen(side, "rb");
+    if (!fp) return -1;
+
+    resume_hdr_t h;
+    range_t *rs = NULL;
+    int rc = -1;
+    if (fread(&h, sizeof(h), 1, fp) != 1) goto out;
+    if (memcmp(h.magic, RESUME_MAGIC, sizeof(h.magic)) != 0 || h.size != size || h.id != id) goto out;
+    if (h.n > RESUME_MAX_RANGES) goto out;
+    rs = malloc((size_t)h.n * sizeof(*rs) + 1);
+    if (!rs) goto out;
+    if (h.n && fread(rs, sizeof(*rs), h.n, fp) != h.n) goto out;
+    if (crc32c(0, rs, (size_t)h.n * sizeof(*rs)) != h.crc) goto out;
+    for (uint32_t i = 0; i < h.n; ++i) {
+        if (rs[i].off >= rs[i].end || rs[i].end > size) goto out;
+        if (range_set_add(out, rs[i].off, rs[i].end - rs[i].off) < 0) goto out;
+    }
+    rc = 0;
+out:
+    if (rc < 0) range_set_clear(out);
+    free(rs);
+    fclose(fp);
+    return rc;
+}
+
+/* 写临时文件、fsync、rename，崩溃时侧车要么是旧的要么是新的 */
+static int save_side(const resume_t *r, const range_t *rs, uint32_t n)
+{
+    char tmp[560];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", r->side);
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) { LOG_ERRNO("open resume"); return -1; }
+
+    resume_hdr_t h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, RESUME_MAGIC, sizeof(h.magic));
+    h.size = r->size;
+    h.id   = r->id;
+    h.n    = n;
+    h.crc  = crc32c(0, rs, (size_t)n * sizeof(*rs));
+
+    int rc = 0;
+    if (pwrite_all(fd, (const uint8_t *)&h, sizeof(h), 0) != (ssize_t)sizeof(h) ||
+        (n && pwrite_all(fd, (const uint8_t *)rs, (size_t)n * sizeof(*rs), sizeof(h)) !=
+                  (ssize_t)((size_t)n * sizeof(*rs))) ||
+        fsync(fd) < 0) {
+        LOG_ERRNO("write resume");
+        rc = -1;
+    }
+    close(fd);
+    if (rc == 0 && rename(tmp, r->side) < 0) { LOG_ERRNO("rename resume"); rc = -1; }
+    if (rc < 0) unlink(tmp);
+    return rc;
+}
+
+static range_t *snapshot_locked(const resume_t *r, uint32_t *n)
+{
+    range_t *rs = malloc((size_t)r->set.n * sizeof(*rs) + 1);
+    if (!rs) return NULL;
+    if (r->set.n) memcpy(rs, r->set.r, (size_t)r->set.n * sizeof(*rs));
+    *n = r->set.n;
+    return rs;
+}
+
+/* 周期检查点：快照里的区间都已 write 完，同步数据后再落侧车 */
+static void checkpoint(resume_t *r)
+{
+    uint32_t n = 0;
+    pthread_mutex_lock(&r->mu);
+    range_t *snap = snapshot_locked(r, &n);
+    pthread_mutex_unlock(&r->mu);
+
+    if (snap) {
+        if (fdatasync(r->fd) < 0) LOG_ERRNO("fdatasync");
+        else save_side(r, snap, n);
+        free(snap);
+    }
+
+    pthread_mutex_lock(&r->mu);
+    r->syncing = 0;
+    pthread_mutex_unlock(&r->mu);
+}
+
+/* 最后一个引用放掉之后：没有别的线程再改它了，同步、落侧车，再从表里摘掉 */
+static void finalize(resume_t *r)
+{
+    uint64_t have = range_set_bytes(&r->set);
+    if (fdatasync(r->fd) < 0) LOG_ERRNO("fdatasync");
+    if (range_set_full(&r->set, r->size)) {
+        unlink(r->side);
+        LOG_I("RESUME file='%s' complete\n", r->path);
+    } else {
+        save_side(r, r->set.r, r->set.n);
+        LOG_I("RESUME file='%s' have=%llu/%llu in %u range(s), kept %s\n",
+                r->path, (unsigned long long)have, (unsigned long long)r->size,
+                r->set.n, r->side);
+    }
+
+    pthread_mutex_lock(&g_resume_lock);
+    unlink_locked(r);
+    pthread_cond_broadcast(&g_resume_gone);
+    pthread_mutex_unlock(&g_resume_lock);
+
+    close(r->fd);
+    range_set_free(&r->set);
+    pthread_mutex_destroy(&r->mu);
+    free(r);
+}
+
+static void run_jobs(resume_t *r, int jobs)
+{
+    if (jobs & RESUME_JOB_FINAL) finalize(r);
+    else if (jobs & RESUME_JOB_SYNC) checkpoint(r);
+}
+
+static void *ckpt_loop(void *arg)
+{
+    (void)arg;
+    for (;;) {
+        pthread_mutex_lock(&g_ckpt_lock);
+        while (!g_ckpt_head) pthread_cond_wait(&g_ckpt_cond, &g_ckpt_lock);
+        resume_t *r = g_ckpt_head;
+        g_ckpt_head = r->job_next;
+        if (!g_ckpt_head) g_ckpt_tail = NULL;
+        int jobs = r->jobs;
+        r->jobs = 0;
+        pthread_mutex_unlock(&g_ckpt_lock);
+
+        run_jobs(r, jobs);
+    }
+    return NULL;
+}
+
+static void ckpt_start(void)
+{
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, ckpt_loop, NULL) != 0) {
+        LOG_ERRNO("pthread_create resume");
+        return;
+    }
+    pthread_detach(tid);
+    g_ckpt_ok = 1;
+}
+
+/* 交给检查点线程；线程起不来时就地做（和以前一样阻塞调用方） */
+static void post_job(resume_t *r, int job)
+{
+    pthread_once(&g_ckpt_once, ckpt_start);
+    if (!g_ckpt_ok) {
+        run_jobs(r, job);
+        return;
+    }
+    pthread_mutex_lock(&g_ckpt_lock);
+    if (!r->jobs) {
+        r->job_next = NULL;
+        if (g_ckpt_tail) g_ckpt_tail->job_next = r;
+        else g_ckpt_head = r;
+        g_ckpt_tail = r;
+        pthread_cond_signal(&g_ckpt_cond);
+    }
+    r->jobs |= job;
+    pthread_mutex_unlock(&g_ckpt_lock);
+}
+
+resume_t *resume_open(const char *path, uint64_t size, uint64_t id, uint64_t *have)
+{
+    pthread_mutex_lock(&g_resume_lock);
+    resume_t *r = find_live_locked(path);
+    if (r) {
+        if (r->size != size || r->id != id) {
+            LOG_W("resume '%s': busy with another transfer\n", path);
+            r = NULL;
+        } else {
+            r->refs++;
+            pthread_mutex_lock(&r->mu);
+            *have = range_set_bytes(&r->set);
+            pthread_mutex_unlock(&r->mu);
+        }
+        pthread_mutex_unlock(&g_resume_lock);
+        return r;
+    }
+
+    r = calloc(1, sizeof(*r));
+    if (!r) { pthread_mutex_unlock(&g_resume_lock); LOG_ERRNO("calloc"); return NULL; }
+    snprintf(r->path, sizeof(r->path), "%s", path);
+    side_path(path, r->side, sizeof(r->side));
+    r->size = size;
+    r->id   = id;
+    r->refs = 1;
+    pthread_mutex_init(&r->mu, NULL);
+
+    // 侧车对得上就接着写，否则从头开始
+    int fresh = load_side(r->side, size, id, &r->set) < 0;
+    int flags = O_WRONLY | O_CREAT | O_CLOEXEC | (fresh ? O_TRUNC : 0);
+    r->fd = open(path, flags, 0644);
+    if (r->fd < 0 || (fresh && save_side(r, NULL, 0) < 0)) {
+        pthread_mutex_unlock(&g_resume_lock);
+        if (r->fd < 0) LOG_ERRNO("open");
+        else close(r->fd);
+        range_set_free(&r->set);
+        pthread_mutex_destroy(&r->mu);
+        free(r);
+        return NULL;
+    }
+    r->next = g_resumes;
+    g_resumes = r;
+    pthread_mutex_unlock(&g_resume_lock);
+
+    *have = range_set_bytes(&r->set);
+    LOG_I("RESUME file='%s' id=%016llx have=%llu/%llu%s\n", path,
+            (unsigned long long)id, (unsigned long long)*have,
+            (unsigned long long)size, fresh ? " (new)" : "");
+    return r;
+}
+
+int resume_fd(const resume_t *r)
+{
+    return r->fd;
+}
+
+resume_t *resume_ref(resume_t *r)
+{
+    pthread_mutex_lock(&g_resume_lock);
+    r->refs++;
+    pthread_mutex_unlock(&g_resume_lock);
+    return r;
+}
+
+void resume_add(resume_t *r, uint64_t off, uint64_t len)
+{
+    int sync = 0;
+    pthread_mutex_lock(&r->mu);
+    if (range_set_add(&r->set, off, len) < 0) LOG_ERRNO("range_set_add");
+    r->pending += len;
+    if (r->pending >= RESUME_SYNC_BYTES && !r->syncing) {
+        r->syncing = 1;
+        r->pending = 0;
+        sync = 1;
+    }
+    pthread_mutex_unlock(&r->mu);
+    // 调用方是 worker，同步和落侧车交给检查点线程，这里只记账
+    if (sync) post_job(r, RESUME_JOB_SYNC);
+}
+
+void resume_put(resume_t *r)
+{
+    pthread_mutex_lock(&g_resume_lock);
+    int last = --r->refs == 0;
+    pthread_mutex_unlock(&g_resume_lock);
+    // 留在表里直到检查点线程收完尾，同一文件的新请求会等它
+    if (last) post_job(r, RESUME_JOB_FINAL);
+}
+
+int resume_query(const char *path, uint64_t size, uint64_t id, range_set_t *out)
+{
+    range_set_clear(out);
+    pthread_mutex_lock(&g_resume_lock);
+    resume_t *r = find_live_locked(path);
+    if (r && (r->size != size || r->id != id)) r = NULL;
+    if (r) r->refs++;
+    pthread_mutex_unlock(&g_resume_lock);
+
+    if (!r) {
+        char side[540];
+        side_path(path, side, sizeof(side));
+        return load_side(side, size, id, out) == 0 ? 0 : 1;
+    }
+
+    // 传输还开着（例如旧连接还没断干净）：把已 write 的区间同步后再报
+    int rc = 0;
+    pthread_mutex_lock(&r->mu);
+    for (uint32_t i = 0; i < r->set.n && rc == 0; ++i)
+        rc = range_set_add(out, r->set.r[i].off, r->set.r[i].end - r->set.r[i].off);
+    pthread_mutex_unlock(&r->mu);
+    if (fdatasync(r->fd) < 0) { LOG_ERRNO("fdatasync"); range_set_clear(out); }
+    resume_put(r);
+    return rc < 0 ? -1 : 0;
+}
+
+void resume_forget(const char *path)
+{
+    char side[540];
+    side_path(path, side, sizeof(side));
+    // 收尾中的旧记录还会写侧车，等它落完再删
+    pthread_mutex_lock(&g_resume_lock);
+    find_live_locked(path);
+    pthread_mutex_unlock(&g_resume_lock);
+    if (unlink(side) < 0 && errno != ENOENT) LOG_ERRNO("unlink resume");
+}
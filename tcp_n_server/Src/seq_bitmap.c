@@ -0,0 +1,85 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "seq_bitmap.h"
+
+void seq_bitmap_reset(seq_bitmap_t *b, uint32_t base)
+{
+    if (b->words) memset(b->words, 0, (size_t)(b->nbits / 64) * sizeof(uint64_t));
+    b->base = base;
+    b->next = base;
+    b->count = 0;
+    b->hi = 0;
+}
+
+void seq_bitmap_free(seq_bitmap_t *b)
+{
+    free(b->words);
+    memset(b, 0, sizeof(*b));
+}
+
+static int grow(seq_bitmap_t *b, uint32_t need_bits)
+{
+    if (need_bits > SEQ_BITMAP_MAX_BITS) return -1;
+    uint32_t nbits = b->nbits ? b->nbits : 4096;
+    while (nbits < need_bits) nbits *= 2;
+    uint64_t *nw = realloc(b->words, (size_t)(nbits / 64) * sizeof(uint64_t));
+    if (!nw) return -1;
+    memset(nw + b->nbits / 64, 0, (size_t)((nbits - b->nbits) / 64) * sizeof(uint64_t));
+    b->words = nw;
+    b->nbits = nbits;
+    return 0;
+}
+
+/* 把 next 之前整字全满的部分移出去；滑掉的都是已置位的，count 和 hi 同减，缺的个数不变 */
+static void slide(seq_bitmap_t *b)
+{
+    uint32_t words = (b->next - b->base) / 64;
+    if (words == 0) return;
+    uint32_t total = b->nbits / 64;
+    memmove(b->words, b->words + words, (size_t)(total - words) * sizeof(uint64_t));
+    memset(b->words + total - words, 0, (size_t)words * sizeof(uint64_t));
+    b->base += words * 64;
+    b->count -= words * 64;
+    b->hi -= words * 64;
+}
+
+int seq_bitmap_reserve(seq_bitmap_t *b, uint32_t seq)
+{
+    if (seq - b->base < b->nbits) return 0;
+    slide(b);
+    uint32_t i = seq - b->base;
+    if (i < b->nbits) return 0;
+    return grow(b, i + 1);
+}
+
+int seq_bitmap_test(const seq_bitmap_t *b, uint32_t seq)
+{
+    uint32_t i = seq - b->base;
+    if (i >= b->hi) return 0;
+    return (b->words[i / 64] >> (i % 64)) & 1u;
+}
+
+int seq_bitmap_set(seq_bitmap_t *b, uint32_t seq)
+{
+    if (seq_bitmap_reserve(b, seq) < 0) return -1;
+    uint32_t i = seq - b->base;
+
+    uint64_t bit = (uint64_t)1 << (i % 64);
+    if (b->words[i / 64] & bit) return 0;
+    b->words[i / 64] |= bit;
+    b->count++;
+    if (i + 1 > b->hi) b->hi = i + 1;
+
+    // 推进连续前缀：整字全满时一次跳 64 位
+    uint32_t n = b->next - b->base;
+    while (n < b->hi) {
+        uint64_t w = b->words[n / 64];
+        if ((n % 64) == 0 && w == ~(uint64_t)0) { n += 64; continue; }
+        if (!((w >> (n % 64)) & 1u)) break;
+        n++;
+    }
+    if (n > b->hi) n = b->hi;
+    b->next = b->base + n;
+    return 1;
+}
\ No newline at end of file
@@ -0,0 +1,170 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+
+#include "tcp_server.h"
+#include "log.h"
+
+/*
+ * 分段上传的传输表。每条连接仍然有自己的 session、seq 空间和重排窗口，
+ * 这里只负责：同一 id 的连接写同一个文件，以及所有流结束后汇总一次。
+ * 表很小（同时进行的分段传输数），用一把锁加链表即可。
+ */
+struct transfer
+{
+    uint64_t id;
+    char     path[520];
+    uint64_t size;
+    int      fd;
+    uint32_t streams;     // 客户端声明的连接数
+    uint32_t joined;
+    uint32_t ended;
+    uint32_t aborted;
+    uint32_t missing;
+    uint32_t crc_ok;
+    uint32_t crc_bad;
+    int      resumed;     // 文件里原有部分数据，字节数对不上不算缺
+    log_t    log;         // 各流统计之和
+    struct transfer *next;
+};
+
+static pthread_mutex_t g_xfer_lock = PTHREAD_MUTEX_INITIALIZER;
+static transfer_t *g_xfers = NULL;
+
+static transfer_t *find_locked(uint64_t id)
+{
+    for (transfer_t *t = g_xfers; t; t = t->next) {
+        if (t->id == id) return t;
+    }
+    return NULL;
+}
+
+static void unlink_locked(transfer_t *t)
+{
+    for (transfer_t **pp = &g_xfers; *pp; pp = &(*pp)->next) {
+        if (*pp == t) { *pp = t->next; return; }
+    }
+}
+
+transfer_t *transfer_join(uint64_t id, uint32_t streams, const char *path, uint64_t size,
+                          int resumed)
+{
+    pthread_mutex_lock(&g_xfer_lock);
+    transfer_t *t = find_locked(id);
+    if (t) {
+        if (t->streams != streams || t->size != size || strcmp(t->path, path) != 0) {
+            LOG_W("xfer %016llx: stream does not match '%s'\n",
+                    (unsigned long long)id, t->path);
+            t = NULL;
+        } else if (t->joined >= t->streams) {
+            LOG_W("xfer %016llx: more than %u streams\n",
+                    (unsigned long long)id, t->streams);
+            t = NULL;
+        } else {
+            t->joined++;
+        }
+        pthread_mutex_unlock(&g_xfer_lock);
+        return t;
+    }
+
+    t = calloc(1, sizeof(*t));
+    if (!t) { pthread_mutex_unlock(&g_xfer_lock); LOG_ERRNO("calloc"); return NULL; }
+    t->fd = open(path, O_WRONLY | O_CREAT | O_CLOEXEC | (resumed ? 0 : O_TRUNC), 0644);
+    if (t->fd < 0) {
+        pthread_mutex_unlock(&g_xfer_lock);
+        LOG_ERRNO("open");
+        free(t);
+        return NULL;
+    }
+    t->id = id;
+    snprintf(t->path, sizeof(t->path), "%s", path);
+    t->size = size;
+    t->streams = streams;
+    t->resumed = resumed;
+    t->joined = 1;
+    t->next = g_xfers;
+    g_xfers = t;
+    pthread_mutex_unlock(&g_xfer_lock);
+
+    LOG_I("START file='%s' size=%llu xfer=%016llx streams=%u\n", path,
+            (unsigned long long)size, (unsigned long long)id, streams);
+    return t;
+}
+
+int transfer_fd(const transfer_t *t)
+{
+    return t->fd;
+}
+
+static void finish(transfer_t *t)
+{
+    close(t->fd);
+    LOG_I(
+        "[summary] file='%s' streams=%u recv=%llu written=%llu dup=%llu drop_old=%llu drop_far=%llu drop_budget=%llu crc_bad=%llu z=%llu nack=%llu missing=%u wrote=%llu/%llu crc=%s striped\n",
+        t->path, t->streams,
+        (unsigned long long)t->log.cnt_in,
+        (unsigned long long)t->log.cnt_flush,
+        (unsigned long long)t->log.cnt_dup,
+        (unsigned long long)t->log.cnt_drop_old,
+        (unsigned long long)t->log.cnt_drop_far,
+        (unsigned long long)t->log.cnt_drop_budget,
+        (unsigned long long)t->log.cnt_crc_bad,
+        (unsigned long long)t->log.cnt_inflate,
+        (unsigned long long)t->log.cnt_nack,
+        t->missing,
+        (unsigned long long)t->log.bytes_flush,
+        (unsigned long long)t->size,
+        t->crc_bad ? "BAD" : (t->crc_ok == t->streams ? "ok" : "-")
+    );
+    if (t->aborted) {
+        LOG_W("WARN: %u of %u streams closed before FILE_END\n", t->aborted, t->streams);
+    } else if (t->missing != 0 || (!t->resumed && t->log.bytes_flush != t->size)) {
+        LOG_W("WARN: incomplete transfer\n");
+    }
+    if (t->crc_bad) LOG_W("WARN: crc mismatch on %u stream(s)\n", t->crc_bad);
+    free(t);
+}
+
+/* 已经算完账的流数达到声明的连接数时从表里摘掉，返回需要 finish 的传输 */
+static transfer_t *settle_locked(transfer_t *t)
+{
+    if (t->ended + t->aborted < t->streams) return NULL;
+    unlink_locked(t);
+    return t;
+}
+
+void transfer_stream_end(transfer_t *t, const log_t *log, uint32_t missing, int crc_state)
+{
+    pthread_mutex_lock(&g_xfer_lock);
+    t->log.cnt_in          += log->cnt_in;
+    t->log.cnt_flush       += log->cnt_flush;
+    t->log.cnt_drop_old    += log->cnt_drop_old;
+    t->log.cnt_drop_far    += log->cnt_drop_far;
+    t->log.cnt_dup         += log->cnt_dup;
+    t->log.cnt_drop_budget += log->cnt_drop_budget;
+    t->log.cnt_grow        += log->cnt_grow;
+    t->log.bytes_flush     += log->bytes_flush;
+    t->log.cnt_crc_bad     += log->cnt_crc_bad;
+    t->log.cnt_inflate     += log->cnt_inflate;
+    t->log.cnt_nack        += log->cnt_nack;
+    t->missing += missing;
+    if (crc_state == 1) t->crc_ok++;
+    else if (crc_state == 0) t->crc_bad++;
+    t->ended++;
+    transfer_t *done = settle_locked(t);
+    pthread_mutex_unlock(&g_xfer_lock);
+    if (done) finish(done);
+}
+
+void transfer_stream_abort(transfer_t *t)
+{
+    pthread_mutex_lock(&g_xfer_lock);
+    t->aborted++;
+    transfer_t *done = settle_locked(t);
+    pthread_mutex_unlock(&g_xfer_lock);
+    if (done) finish(done);
+}
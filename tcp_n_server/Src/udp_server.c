@@ -0,0 +1,200 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <pthread.h>
+
+#include "tcp_server.h"
+#include "tcp_protocol.h"
+#include "log.h"
+#include "metrics.h"
+
+// 一次唤醒最多连收几个数据报再看定时器
+#define UDP_RECV_BATCH 256
+
+// 收发缓冲尽量开大，高带宽时延积的链路上一个信用窗口的数据要能在内核里排得下
+#ifndef UDP_SOCK_BUF
+#define UDP_SOCK_BUF (8 * 1024 * 1024)
+#endif
+
+/*
+ * UDP 传输：一个线程收所有对端的数据报，按源地址找到（或新建）对端的 session。数据报里
+ * 的帧和 TCP 上的一样是 protocol_header + payload，一个数据报装一帧或几帧完整的帧，回包
+ * 用 sendmsg 发回源地址。UDP 不保证送达，靠 session 的信用 / NACK 和这里的定时器补：对端
+ * UDP_RTO_MS 没有消息就 session_tick 一次，UDP_IDLE_S 没有消息就丢掉它的状态。
+ */
+
+typedef struct udp_peer
+{
+    session_t sess;
+    uint64_t  last_rx_ms;
+    uint64_t  last_tick_ms;
+    struct udp_peer *next;
+}udp_peer_t;
+
+typedef struct
+{
+    int         fd;
+    udp_peer_t *peers;        // 对端一般不多，链表线性查找
+    uint8_t    *buf;
+}udp_server_t;
+
+static uint64_t now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000u + (uint64_t)ts.tv_nsec / 1000000u;
+}
+
+static int udp_send(session_t *s, protocol_msg *msg)
+{
+    protocol_header wire;
+    protocol_header_to_wire(&msg->hdr, &wire);
+    struct iovec iov[2] = {
+        { &wire, PROTOCOL_HEADER_LEN },
+        { msg->payload, msg->hdr.payload_length },
+    };
+    struct msghdr mh;
+    memset(&mh, 0, sizeof(mh));
+    mh.msg_name    = &s->addr;
+    mh.msg_namelen = sizeof(s->addr);
+    mh.msg_iov     = iov;
+    mh.msg_iovlen  = msg->hdr.payload_length ? 2 : 1;
+    if (sendmsg(s->fd, &mh, 0) < 0) {
+        // 发送缓冲满或对端暂时不可达：和线路上丢了一样，由定时器重发
+        if (errno == EAGAIN || errno == ENOBUFS || errno == ECONNREFUSED) return 0;
+        return -1;
+    }
+    return 0;
+}
+
+static const session_ops_t udp_ops = {
+    .send      = udp_send,
+    .write_at  = session_pwrite_at,
+    .close_out = NULL,
+    .datagram  = 1,
+};
+
+static const char *peer_str(const struct sockaddr_in *a, char *out, size_t cap)
+{
+    char ip[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &a->sin_addr, ip, sizeof(ip));
+    snprintf(out, cap, "%s:%d", ip, ntohs(a->sin_port));
+    return out;
+}
+
+static udp_peer_t *peer_get(udp_server_t *u, const struct sockaddr_in *from, uint64_t now)
+{
+    for (udp_peer_t *p = u->peers; p; p = p->next) {
+        if (p->sess.addr.sin_addr.s_addr == from->sin_addr.s_addr &&
+            p->sess.addr.sin_port == from->sin_port) return p;
+    }
+    udp_peer_t *p = calloc(1, sizeof(*p));
+    if (!p) { LOG_ERRNO("calloc"); return NULL; }
+    session_init(&p->sess, u->fd, from, &udp_ops, NULL);
+    p->last_rx_ms = p->last_tick_ms = now;
+    p->next = u->peers;
+    u->peers = p;
+    metrics_add(MET_CONNS, 1);
+    metrics_gauge(MET_CONNS_ACTIVE, 1);
+    char name[32];
+    LOG_I("[udp] new peer %s\n", peer_str(from, name, sizeof(name)));
+    return p;
+}
+
+static void peer_drop(udp_server_t *u, udp_peer_t *p, const char *why)
+{
+    for (udp_peer_t **pp = &u->peers; *pp; pp = &(*pp)->next) {
+        if (*pp != p) continue;
+        *pp = p->next;
+        break;
+    }
+    char name[32];
+    LOG_I("[udp] peer %s %s\n", peer_str(&p->sess.addr, name, sizeof(name)), why);
+    session_close(&p->sess);
+    free(p);
+    metrics_gauge(MET_CONNS_ACTIVE, -1);
+}
+
+/* 一个数据报里的帧依次交给对端的 session；截断的帧（连同后面的）丢掉 */
+static void on_datagram(udp_server_t *u, const struct sockaddr_in *from, size_t n, uint64_t now)
+{
+    udp_peer_t *p = peer_get(u, from, now);
+    if (!p) return;
+    p->last_rx_ms = now;
+
+    const uint8_t *q = u->buf;
+    while (n >= PROTOCOL_HEADER_LEN) {
+        protocol_header wire;
+        protocol_msg msg;
+        memcpy(&wire, q, PROTOCOL_HEADER_LEN);
+        protocol_header_to_host(&wire, &msg.hdr);
+        if (msg.hdr.payload_length > n - PROTOCOL_HEADER_LEN) {
+            LOG_W("[udp] truncated frame type=%u len=%u\n",
+                    msg.hdr.message_type, msg.hdr.payload_length);
+            return;
+        }
+        msg.payload = msg.hdr.payload_length ? (void *)(q + PROTOCOL_HEADER_LEN) : NULL;
+        if (session_on_message(&p->sess, &msg) < 0) {
+            LOG_ERRNO("udp send");
+            peer_drop(u, p, "dropped after send error");
+            return;
+        }
+        q += PROTOCOL_HEADER_LEN + msg.hdr.payload_length;
+        n -= PROTOCOL_HEADER_LEN + msg.hdr.payload_length;
+    }
+}
+
+static void run_timers(udp_server_t *u, uint64_t now)
+{
+    udp_peer_t *p = u->peers;
+    while (p) {
+        udp_peer_t *next = p->next;
+        if (now - p->last_rx_ms >= UDP_IDLE_S * 1000ull) {
+            peer_drop(u, p, "idle, dropped");
+        } else if (now - p->last_rx_ms >= UDP_RTO_MS && now - p->last_tick_ms >= UDP_RTO_MS) {
+            p->last_tick_ms = now;
+            if (session_tick(&p->sess) < 0) peer_drop(u, p, "dropped after send error");
+        }
+        p = next;
+    }
+}
+
+void *run_udp_server(void *arg)
+{
+    udp_server_t u = { .fd = (int)(intptr_t)arg };
+    u.buf = malloc(UDP_MAX_DATAGRAM);
+    if (!u.buf) { LOG_ERRNO("malloc"); return NULL; }
+    int sz = UDP_SOCK_BUF;
+    setsockopt(u.fd, SOL_SOCKET, SO_RCVBUF, &sz, sizeof(sz));
+    setsockopt(u.fd, SOL_SOCKET, SO_SNDBUF, &sz, sizeof(sz));
+
+    for (;;) {
+        struct pollfd pfd = { .fd = u.fd, .events = POLLIN };
+        int pr = poll(&pfd, 1, UDP_RTO_MS / 2);
+        if (pr < 0 && errno != EINTR) { LOG_ERRNO("poll"); break; }
+        for (int k = 0; pr > 0 && k < UDP_RECV_BATCH; ++k) {
+            struct sockaddr_in from;
+            socklen_t flen = sizeof(from);
+            ssize_t n = recvfrom(u.fd, u.buf, UDP_MAX_DATAGRAM, MSG_DONTWAIT,
+                                 (struct sockaddr *)&from, &flen);
+            if (n < 0) {
+                if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) LOG_ERRNO("recvfrom");
+                break;
+            }
+            on_datagram(&u, &from, (size_t)n, now_ms());
+        }
+        run_timers(&u, now_ms());
+    }
+
+    while (u.peers) peer_drop(&u, u.peers, "closed");
+    free(u.buf);
+    return NULL;
+}
@@ -0,0 +1,201 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "uring.h"
+
+static int sys_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_uring_register(int fd, unsigned op, void *arg, unsigned nr)
+{
+    return (int)syscall(__NR_io_uring_register, fd, op, arg, nr);
+}
+
+int uring_init(uring_t *u, unsigned entries)
+{
+    memset(u, 0, sizeof(*u));
+
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    // CQ 比 SQ 大，多发 recv 一次提交会产生很多完成
+    p.flags = IORING_SETUP_CQSIZE;
+    p.cq_entries = entries * 4;
+
+    int fd = sys_uring_setup(entries, &p);
+    if (fd < 0) return -1;
+    u->ring_fd = fd;
+
+    u->sq_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    u->cq_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    int single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single) {
+        if (u->cq_sz > u->sq_sz) u->sq_sz = u->cq_sz;
+        u->cq_sz = u->sq_sz;
+    }
+
+    u->sq_ptr = mmap(NULL, u->sq_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     fd, IORING_OFF_SQ_RING);
+    if (u->sq_ptr == MAP_FAILED) goto fail;
+    if (single) {
+        u->cq_ptr = u->sq_ptr;
+    } else {
+        u->cq_ptr = mmap(NULL, u->cq_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         fd, IORING_OFF_CQ_RING);
+        if (u->cq_ptr == MAP_FAILED) { u->cq_ptr = NULL; goto fail; }
+    }
+
+    u->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+    u->sqes = mmap(NULL, u->sqes_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   fd, IORING_OFF_SQES);
+    if (u->sqes == MAP_FAILED) { u->sqes = NULL; goto fail; }
+
+    uint8_t *sq = u->sq_ptr;
+    u->sq_head  = (unsigned *)(sq + p.sq_off.head);
+    u->sq_tail  = (unsigned *)(sq + p.sq_off.tail);
+    u->sq_mask  = (unsigned *)(sq + p.sq_off.ring_mask);
+    u->sq_array = (unsigned *)(sq + p.sq_off.array);
+    u->sq_entries = p.sq_entries;
+    u->sqe_tail = *u->sq_tail;
+
+    uint8_t *cq = u->cq_ptr;
+    u->cq_head = (unsigned *)(cq + p.cq_off.head);
+    u->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    u->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    u->cqes    = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    return 0;
+
+fail:
+    uring_exit(u);
+    return -1;
+}
+
+void uring_exit(uring_t *u)
+{
+    if (u->sqes) munmap(u->sqes, u->sqes_sz);
+    if (u->cq_ptr && u->cq_ptr != u->sq_ptr) munmap(u->cq_ptr, u->cq_sz);
+    if (u->sq_ptr && u->sq_ptr != MAP_FAILED) munmap(u->sq_ptr, u->sq_sz);
+    if (u->ring_fd > 0) close(u->ring_fd);
+    memset(u, 0, sizeof(*u));
+}
+
+static unsigned uring_flush_sq(uring_t *u)
+{
+    unsigned tail = *u->sq_tail;
+    unsigned n = u->sqe_tail - tail;
+    for (unsigned i = 0; i < n; ++i) {
+        unsigned idx = (tail + i) & *u->sq_mask;
+        u->sq_array[idx] = idx;
+    }
+    __atomic_store_n(u->sq_tail, u->sqe_tail, __ATOMIC_RELEASE);
+    return n;
+}
+
+struct io_uring_sqe *uring_get_sqe(uring_t *u)
+{
+    unsigned head = __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+    if (u->sqe_tail - head >= u->sq_entries) {
+        if (uring_submit_and_wait(u, 0) < 0) return NULL;
+        head = __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+        if (u->sqe_tail - head >= u->sq_entries) return NULL;
+    }
+    struct io_uring_sqe *sqe = &u->sqes[u->sqe_tail & *u->sq_mask];
+    u->sqe_tail++;
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+int uring_submit_and_wait(uring_t *u, unsigned wait_nr)
+{
+    unsigned n = uring_flush_sq(u);
+    unsigned flags = wait_nr ? IORING_ENTER_GETEVENTS : 0;
+    for (;;) {
+        int r = sys_uring_enter(u->ring_fd, n, wait_nr, flags);
+        if (r < 0 && errno == EINTR) {
+            // 只重新提交内核还没消费的部分
+            n = *u->sq_tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+            continue;
+        }
+        return r;
+    }
+}
+
+struct io_uring_cqe *uring_peek_cqe(uring_t *u)
+{
+    unsigned head = *u->cq_head;
+    unsigned tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+    if (head == tail) return NULL;
+    return &u->cqes[head & *u->cq_mask];
+}
+
+void uring_cqe_seen(uring_t *u)
+{
+    __atomic_store_n(u->cq_head, *u->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+int uring_bufring_init(uring_t *u, uring_bufring_t *b, uint16_t bgid,
+                       uint16_t count, uint32_t buf_size)
+{
+    memset(b, 0, sizeof(*b));
+    if (count == 0 || (count & (count - 1)) != 0) { errno = EINVAL; return -1; }
+
+    b->br_sz = (size_t)count * sizeof(struct io_uring_buf);
+    b->br = mmap(NULL, b->br_sz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (b->br == MAP_FAILED) { b->br = NULL; return -1; }
+
+    b->base = malloc((size_t)count * buf_size);
+    if (!b->base) { munmap(b->br, b->br_sz); b->br = NULL; return -1; }
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (unsigned long)b->br;
+    reg.ring_entries = count;
+    reg.bgid = bgid;
+    if (sys_uring_register(u->ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        free(b->base);
+        munmap(b->br, b->br_sz);
+        memset(b, 0, sizeof(*b));
+        return -1;
+    }
+
+    b->buf_size = buf_size;
+    b->count = count;
+    b->mask = (uint16_t)(count - 1);
+    b->bgid = bgid;
+    b->br->tail = 0;
+    for (uint16_t i = 0; i < count; ++i) uring_bufring_recycle(b, i);
+    return 0;
+}
+
+void uring_bufring_exit(uring_t *u, uring_bufring_t *b)
+{
+    if (!b->br) return;
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.bgid = b->bgid;
+    sys_uring_register(u->ring_fd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+    munmap(b->br, b->br_sz);
+    free(b->base);
+    memset(b, 0, sizeof(*b));
+}
+
+void uring_bufring_recycle(uring_bufring_t *b, uint16_t bid)
+{
+    uint16_t tail = b->br->tail;
+    struct io_uring_buf *buf = &b->br->bufs[tail & b->mask];
+    buf->addr = (unsigned long)uring_buf_addr(b, bid);
+    buf->len = b->buf_size;
+    buf->bid = bid;
+    __atomic_store_n(&b->br->tail, (uint16_t)(tail + 1), __ATOMIC_RELEASE);
+}
\ No newline at end of file
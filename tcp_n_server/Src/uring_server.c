@@ -0,0 +1,757 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <pthread.h>
+
+#include "tcp_server.h"
+#include "tcp_protocol.h"
+#include "uring.h"
+#include "msg_pool.h"
+#include "log.h"
+#include "metrics.h"
+
+#define URING_ENTRIES   256
+#define URING_BUF_COUNT 256            // 必须是 2 的幂
+#define URING_BUF_SIZE  (32 * 1024)
+#define URING_BGID      1
+// 每个 worker 排队和在途的文件写请求上限：磁盘跟不上时停止收新数据，降到一半以下再恢复
+#define URING_MAX_WRITES (URING_ENTRIES * 2)
+// 每个 worker 借出的收包块上限；收包池留 URING_MAX_WRITES 块，余下的一半给一帧里多出来的拷贝
+#define URING_MAX_BLOCKS (URING_MAX_WRITES / 2)
+
+/*
+ * 每个 worker 一个 ring：监听 fd 上挂一个多发 accept，每条连接挂一个多发 recv
+ * （数据落在 worker 的 provided buffer ring 里），文件数据用带 offset 的 WRITE
+ * 直接写到 recv/ 下的文件。一轮 CQE 处理中产生的所有 SQE 在下一次
+ * io_uring_enter 时一起提交。SQ 满了取不到 SQE 的文件写不能丢（会在文件里留洞），
+ * 先挂到 worker 的待提交队列，下一轮进内核之前补交。
+ *
+ * 背压：worker 的写请求到 URING_MAX_WRITES、借出的收包块到 URING_MAX_BLOCKS、或连接待发回包
+ * 到 URING_WBUF_HIGH 时，这条连接在帧边界暂停：取消多发 recv，已经收进来还没处理的字节存进 stash。写完成、回包发出去降到
+ * 一半以下时先处理 stash，再重新挂 recv。借出的块和写请求因此不超过两个池子的容量，
+ * 池子长满以后收发不再 malloc。重排窗口停放的块要等缺的 seq 到了才释放，不能让它们占满
+ * 收包块上限把自己的连接卡住，所以借出过半后 park 不再接管收包块，窗口改拷进 slab。
+ *
+ * user_data 低 3 位是操作类型，其余位是对象指针（malloc 至少 8 字节对齐）。
+ */
+enum
+{
+    UD_ACCEPT = 0,
+    UD_RECV   = 1,
+    UD_SEND   = 2,
+    UD_WRITE  = 3,
+    UD_CANCEL = 4,
+};
+#define UD_TAG_MASK ((uint64_t)7)
+
+static inline uint64_t ud_make(void *p, unsigned tag) { return (uint64_t)(uintptr_t)p | tag; }
+static inline unsigned ud_tag(uint64_t ud) { return (unsigned)(ud & UD_TAG_MASK); }
+static inline void    *ud_ptr(uint64_t ud) { return (void *)(uintptr_t)(ud & ~UD_TAG_MASK); }
+
+// 输出文件：写请求完成前不能关闭 fd，所以按引用计数管理；最后一个引用放掉时调 done
+typedef struct
+{
+    int fd;
+    int refs;
+    int failed;             // 有写请求出错或写短了
+    void (*done)(void *arg, int fd, int ok);
+    void *done_arg;
+}uring_file_t;
+
+// 收到的一帧 payload：带引用计数，写请求可以直接引用而不再拷贝
+typedef struct
+{
+    msg_pool_t *pool;
+    int refs;
+    uint32_t len;
+    _Alignas(16) uint8_t data[];
+}rx_block_t;
+
+typedef struct write_req
+{
+    struct write_req *next;   // 在待提交队列里时用
+    uring_file_t *file;
+    rx_block_t   *block;      // 非 NULL 时 buf 指向 block 内部
+    uint8_t      *buf;
+    uint32_t      len;
+    uint32_t      done;
+    uint64_t      off;
+    resume_t     *resume;     // 续传时持有一个引用，写完成后才记范围
+    uint64_t      t0;         // 提交时刻，完成时记写延迟
+}write_req_t;
+
+typedef struct uring_worker uring_worker_t;
+
+typedef struct uring_conn
+{
+    session_t sess;
+    uring_worker_t *w;
+    int refs;                 // 打开状态 1 + 挂着的 recv + 在途的 send + 在暂停链表里
+    int closing;
+    int recv_armed;           // 多发 recv 还挂着（取消了也要等它的最后一个 CQE）
+    int recv_cancel;          // 已经为暂停提交了取消
+    int paused;
+    int peer_closed;          // 对端已关闭：stash 处理完、回包发完再关
+    struct uring_conn *paused_next;
+
+    // 暂停后收到、还没喂给帧状态机的字节，按顺序排在后面收到的数据之前
+    uint8_t  *stash;
+    size_t    slen, soff, scap;
+
+    protocol_header hdr_wire;
+    uint32_t  hdr_got;
+    protocol_msg msg;
+    rx_block_t *block;
+    uint32_t  payload_got;
+
+    // wbuf 在途时内核正在读，新回包追加到 pbuf，发完再交换
+    uint8_t  *wbuf;
+    size_t    wlen, woff, wcap;
+    uint8_t  *pbuf;
+    size_t    plen, pcap;
+    int       send_inflight;
+}uring_conn_t;
+
+struct uring_worker
+{
+    uring_t ring;
+    uring_bufring_t bufs;
+    int listen_fd;
+    msg_pool_t data_pool;   // rx_block 和重排窗口落盘时的拷贝
+    msg_pool_t req_pool;    // write_req_t
+    write_req_t *wq_head;   // 取不到 SQE 的写请求，按顺序补交
+    write_req_t *wq_tail;
+    uint32_t     writes;    // 排队和在途的写请求
+    uring_conn_t *paused;   // 暂停中的连接，链表各持一个引用
+};
+
+/* 从池里取缓冲，顺带记下是否落到了 malloc、是不是池子长满之后的 malloc */
+static void *pool_get(msg_pool_t *pool, uint32_t size)
+{
+    uint64_t n_alloc = pool->n_alloc, n_over = pool->n_over;
+    void *p = msg_pool_get(pool, size);
+    metrics_add(MET_POOL_GETS, 1);
+    if (pool->n_alloc != n_alloc) metrics_add(MET_POOL_ALLOCS, 1);
+    if (pool->n_over != n_over) metrics_add(MET_POOL_STEADY_ALLOCS, 1);
+    return p;
+}
+
+static void block_unref(rx_block_t *b)
+{
+    if (b && --b->refs == 0) msg_pool_put(b->pool, b);
+}
+
+static void file_unref(uring_file_t *f)
+{
+    if (f && --f->refs == 0) {
+        if (f->done) f->done(f->done_arg, f->fd, !f->failed);
+        close(f->fd);
+        free(f);
+    }
+}
+
+static void conn_put(uring_conn_t *c)
+{
+    if (--c->refs > 0) return;
+    close(c->sess.fd);
+    block_unref(c->block);
+    free(c->wbuf);
+    free(c->pbuf);
+    free(c->stash);
+    LOG_I("[thread %lu] fd=%d exit\n", (unsigned long)pthread_self(), c->sess.fd);
+    free(c);
+    metrics_gauge(MET_CONNS_ACTIVE, -1);
+}
+
+static int arm_accept(uring_worker_t *w)
+{
+    struct io_uring_sqe *sqe = uring_get_sqe(&w->ring);
+    if (!sqe) return -1;
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = w->listen_fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->user_data = ud_make(w, UD_ACCEPT);
+    return 0;
+}
+
+static int arm_recv(uring_conn_t *c)
+{
+    struct io_uring_sqe *sqe = uring_get_sqe(&c->w->ring);
+    if (!sqe) return -1;
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = c->sess.fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = c->w->bufs.bgid;
+    sqe->user_data = ud_make(c, UD_RECV);
+    c->refs++;
+    c->recv_armed = 1;
+    return 0;
+}
+
+/* 取消挂着的多发 recv；取不到 SQE 时返回 -1，调用方下次再试 */
+static int cancel_recv(uring_conn_t *c)
+{
+    struct io_uring_sqe *sqe = uring_get_sqe(&c->w->ring);
+    if (!sqe) return -1;
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = ud_make(c, UD_RECV);
+    sqe->user_data = ud_make(NULL, UD_CANCEL);
+    c->recv_cancel = 1;
+    return 0;
+}
+
+static int submit_send(uring_conn_t *c)
+{
+    struct io_uring_sqe *sqe = uring_get_sqe(&c->w->ring);
+    if (!sqe) return -1;
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = c->sess.fd;
+    sqe->addr = (unsigned long)(c->wbuf + c->woff);
+    sqe->len = (uint32_t)(c->wlen - c->woff);
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = ud_make(c, UD_SEND);
+    c->send_inflight = 1;
+    c->refs++;
+    return 0;
+}
+
+static int submit_write(uring_worker_t *w, write_req_t *req)
+{
+    struct io_uring_sqe *sqe = uring_get_sqe(&w->ring);
+    if (!sqe) return -1;
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->fd = req->file->fd;
+    sqe->addr = (unsigned long)(req->buf + req->done);
+    sqe->len = req->len - req->done;
+    sqe->off = req->off + req->done;
+    sqe->user_data = ud_make(req, UD_WRITE);
+    return 0;
+}
+
+/* 提交一个写请求；SQ 满时排进待提交队列，由 worker 循环在下次进内核前补交 */
+static void queue_write(uring_worker_t *w, write_req_t *req)
+{
+    if (!w->wq_head && submit_write(w, req) == 0) return;
+    req->next = NULL;
+    if (w->wq_tail) w->wq_tail->next = req;
+    else w->wq_head = req;
+    w->wq_tail = req;
+}
+
+static void flush_write_queue(uring_worker_t *w)
+{
+    while (w->wq_head) {
+        write_req_t *req = w->wq_head;
+        if (submit_write(w, req) < 0) return;
+        w->wq_head = req->next;
+        if (!w->wq_head) w->wq_tail = NULL;
+    }
+}
+
+static void write_req_free(uring_worker_t *w, write_req_t *req)
+{
+    if (req->block) block_unref(req->block);
+    else msg_pool_put(&w->data_pool, req->buf);
+    file_unref(req->file);
+    if (req->resume) resume_put(req->resume);
+    msg_pool_put(&w->req_pool, req);
+    w->writes--;
+    metrics_gauge(MET_WRITES_INFLIGHT, -1);
+}
+
+static void conn_close(uring_conn_t *c)
+{
+    if (c->closing) return;
+    c->closing = 1;
+
+    // 取消挂着的 recv；shutdown 让在途的 send 尽快完成
+    if (c->recv_armed) cancel_recv(c);
+    shutdown(c->sess.fd, SHUT_RDWR);
+    session_close(&c->sess);
+    conn_put(c);
+}
+
+static int buf_append(uint8_t **buf, size_t *len, size_t *cap, protocol_msg *msg)
+{
+    size_t need = PROTOCOL_HEADER_LEN + msg->hdr.payload_length;
+    if (*len + need > *cap) {
+        size_t ncap = *cap ? *cap : 4096;
+        while (ncap < *len + need) ncap *= 2;
+        uint8_t *nb = realloc(*buf, ncap);
+        if (!nb) return -1;
+        *buf = nb;
+        *cap = ncap;
+    }
+    protocol_header wire;
+    protocol_header_to_wire(&msg->hdr, &wire);
+    memcpy(*buf + *len, &wire, PROTOCOL_HEADER_LEN);
+    if (msg->hdr.payload_length)
+        memcpy(*buf + *len + PROTOCOL_HEADER_LEN, msg->payload, msg->hdr.payload_length);
+    *len += need;
+    return 0;
+}
+
+static int conn_send(session_t *s, protocol_msg *msg)
+{
+    uring_conn_t *c = s->io;
+    if (c->send_inflight) return buf_append(&c->pbuf, &c->plen, &c->pcap, msg);
+    if (buf_append(&c->wbuf, &c->wlen, &c->wcap, msg) < 0) return -1;
+    return submit_send(c);
+}
+
+static int conn_write_at(session_t *s, const uint8_t *p, uint32_t n, uint64_t off)
+{
+    uring_conn_t *c = s->io;
+    uring_file_t *f = s->out_io;
+    if (!f) {
+        f = malloc(sizeof(*f));
+        if (!f) { LOG_ERRNO("malloc"); return -1; }
+        // dup 一份，session 关闭 out_fd 后在途的写仍然有效
+        memset(f, 0, sizeof(*f));
+        f->fd = dup(s->out_fd);
+        f->refs = 1;
+        if (f->fd < 0) { LOG_ERRNO("dup"); free(f); return -1; }
+        s->out_io = f;
+    }
+
+    write_req_t *req = pool_get(&c->w->req_pool, sizeof(*req));
+    if (!req) { LOG_ERRNO("msg_pool_get"); return -1; }
+    memset(req, 0, sizeof(*req));
+    req->file = f;
+    req->len = n;
+    req->off = off;
+    req->t0 = metrics_now();
+
+    // 数据就在当前帧或正在落盘的停放块里：引用整块；否则（slab 里的、解压出来的）拷贝一份
+    rx_block_t *b = s->drain_owner ? s->drain_owner : c->block;
+    if (b && p >= b->data && p + n <= b->data + b->len) {
+        b->refs++;
+        req->block = b;
+        req->buf = (uint8_t *)p;
+    } else {
+        req->buf = pool_get(&c->w->data_pool, n);
+        if (!req->buf) { LOG_ERRNO("msg_pool_get"); msg_pool_put(&c->w->req_pool, req); return -1; }
+        memcpy(req->buf, p, n);
+    }
+    f->refs++;
+    if (s->resume) req->resume = resume_ref(s->resume);
+    c->w->writes++;
+    metrics_gauge(MET_WRITES_INFLIGHT, 1);
+
+    queue_write(c->w, req);
+    return 0;
+}
+
+/* 收尾挂到输出文件上，等在途的写都完成；一次都没写过就直接做 */
+static void conn_after_out(session_t *s, void (*fn)(void *arg, int fd, int ok), void *arg)
+{
+    uring_file_t *f = s->out_io;
+    if (!f) { fn(arg, s->out_fd, 1); return; }
+    f->done = fn;
+    f->done_arg = arg;
+}
+
+static void conn_close_out(session_t *s)
+{
+    file_unref(s->out_io);
+    s->out_io = NULL;
+}
+
+static void *conn_park(session_t *s, const uint8_t *p, uint32_t n)
+{
+    uring_conn_t *c = s->io;
+    rx_block_t *b = c->block;
+    if (!b || p < b->data || p + n > b->data + b->len) return NULL;
+    if (c->w->data_pool.n_out >= URING_MAX_BLOCKS / 2) return NULL;
+    b->refs++;
+    return b;
+}
+
+static void conn_unpark(session_t *s, void *token)
+{
+    (void)s;
+    block_unref(token);
+}
+
+static const session_ops_t uring_ops = {
+    .send      = conn_send,
+    .write_at  = conn_write_at,
+    .close_out = conn_close_out,
+    .park      = conn_park,
+    .unpark    = conn_unpark,
+    .after_out = conn_after_out,
+    .async_write = 1,
+};
+
+/* 待发回包（在途的 wbuf 剩余加上排着的 pbuf） */
+static size_t conn_pending(const uring_conn_t *c)
+{
+    return c->wlen - c->woff + c->plen;
+}
+
+static int conn_over_limit(const uring_conn_t *c)
+{
+    const uring_worker_t *w = c->w;
+    return w->writes >= URING_MAX_WRITES || w->data_pool.n_out >= URING_MAX_BLOCKS ||
+           conn_pending(c) >= URING_WBUF_HIGH;
+}
+
+static int worker_below_half(const uring_worker_t *w)
+{
+    return w->writes <= URING_MAX_WRITES / 2 && w->data_pool.n_out <= URING_MAX_BLOCKS / 2;
+}
+
+static int conn_below_half(const uring_conn_t *c)
+{
+    return worker_below_half(c->w) && conn_pending(c) <= URING_WBUF_HIGH / 2;
+}
+
+/* 停止收新数据：挂进 worker 的暂停链表，取消多发 recv（已经投递的 CQE 照常到，数据进 stash） */
+static void conn_pause(uring_conn_t *c)
+{
+    uring_worker_t *w = c->w;
+    c->paused = 1;
+    c->refs++;
+    c->paused_next = w->paused;
+    w->paused = c;
+    if (c->recv_armed && !c->recv_cancel) cancel_recv(c);
+}
+
+static int stash_append(uring_conn_t *c, const uint8_t *p, size_t n)
+{
+    if (c->soff == c->slen) c->soff = c->slen = 0;
+    if (c->slen + n > c->scap) {
+        size_t ncap = c->scap ? c->scap : URING_BUF_SIZE;
+        while (ncap < c->slen + n) ncap *= 2;
+        uint8_t *nb = realloc(c->stash, ncap);
+        if (!nb) return -1;
+        c->stash = nb;
+        c->scap = ncap;
+    }
+    memcpy(c->stash + c->slen, p, n);
+    c->slen += n;
+    return 0;
+}
+
+/*
+ * 把一段收到的字节喂给帧状态机，每凑齐一帧就交给 session。每帧开始前检查背压，
+ * 超过上限就暂停并停在帧边界，*used 是实际消费的字节数。
+ */
+static int conn_feed(uring_conn_t *c, const uint8_t *p, uint32_t n, uint32_t *used)
+{
+    uint32_t total = n;
+    while (n > 0 && !c->paused) {
+        if (c->hdr_got == 0 && conn_over_limit(c)) {
+            conn_pause(c);
+            break;
+        }
+        if (c->hdr_got < PROTOCOL_HEADER_LEN) {
+            uint32_t take = (uint32_t)PROTOCOL_HEADER_LEN - c->hdr_got;
+            if (take > n) take = n;
+            memcpy((uint8_t *)&c->hdr_wire + c->hdr_got, p, take);
+            c->hdr_got += take; p += take; n -= take;
+            if (c->hdr_got < PROTOCOL_HEADER_LEN) break;
+
+            protocol_header_to_host(&c->hdr_wire, &c->msg.hdr);
+            if (c->msg.hdr.payload_length > FRAME_MAX_PAYLOAD) {
+                LOG_W("bad frame: payload too large (max %u)\n", FRAME_MAX_PAYLOAD);
+                errno = EMSGSIZE;
+                return -1;
+            }
+            c->payload_got = 0;
+            // 上面已限制在 FRAME_MAX_PAYLOAD 内，按 size_t 算不会回绕
+            size_t need = sizeof(rx_block_t) + (size_t)c->msg.hdr.payload_length;
+            c->block = pool_get(&c->w->data_pool, (uint32_t)need);
+            if (!c->block) { errno = ENOMEM; return -1; }
+            c->block->pool = &c->w->data_pool;
+            c->block->refs = 1;
+            c->block->len = c->msg.hdr.payload_length;
+            c->msg.payload = c->msg.hdr.payload_length ? c->block->data : NULL;
+        }
+
+        uint32_t plen = c->msg.hdr.payload_length;
+        if (c->payload_got < plen) {
+            uint32_t take = plen - c->payload_got;
+            if (take > n) take = n;
+            memcpy(c->block->data + c->payload_got, p, take);
+            c->payload_got += take; p += take; n -= take;
+            if (c->payload_got < plen) break;
+        }
+
+        int sr = session_on_message(&c->sess, &c->msg);
+        block_unref(c->block);
+        c->block = NULL;
+        c->msg.payload = NULL;
+        c->hdr_got = 0;
+        c->payload_got = 0;
+        if (sr < 0) return -1;
+    }
+    *used = total - n;
+    return 0;
+}
+
+/* 收到的一段数据：暂停中或 stash 里还有没处理的就排到后面，否则直接喂，剩下的进 stash */
+static int conn_input(uring_conn_t *c, const uint8_t *p, uint32_t n)
+{
+    if (c->paused || c->soff < c->slen) return stash_append(c, p, n);
+    uint32_t used;
+    if (conn_feed(c, p, n, &used) < 0) return -1;
+    return used < n ? stash_append(c, p + used, n - used) : 0;
+}
+
+/* 对端半关闭后可能还在等最后的 ACK：回包发完再关，还有在途或待发的交给 on_send */
+static void conn_finish(uring_conn_t *c)
+{
+    c->peer_closed = 1;
+    if (!c->send_inflight && conn_pending(c) == 0) conn_close(c);
+}
+
+/* 解除暂停：先处理 stash，全部处理完才重新挂 recv；暂停期间对端已关闭的这时收尾 */
+static void conn_resume(uring_conn_t *c)
+{
+    c->paused = 0;
+    while (c->soff < c->slen && !c->paused && !c->closing) {
+        size_t left = c->slen - c->soff;
+        uint32_t used, n = left > UINT32_MAX ? UINT32_MAX : (uint32_t)left;
+        if (conn_feed(c, c->stash + c->soff, n, &used) < 0) {
+            LOG_ERRNO("conn_feed");
+            conn_close(c);
+            return;
+        }
+        c->soff += used;
+    }
+    if (c->paused || c->closing) return;
+    if (c->peer_closed) {
+        conn_finish(c);
+        return;
+    }
+    if (!c->recv_armed && arm_recv(c) < 0) conn_close(c);
+}
+
+/* 把降到一半以下的暂停连接恢复，其余留在链表里；已经关闭的顺带摘掉 */
+static void resume_paused(uring_worker_t *w)
+{
+    uring_conn_t *list = w->paused;
+    w->paused = NULL;
+    while (list) {
+        uring_conn_t *c = list;
+        list = c->paused_next;
+        if (!c->closing && !conn_below_half(c)) {
+            c->paused_next = w->paused;
+            w->paused = c;
+            continue;
+        }
+        if (!c->closing) conn_resume(c);
+        conn_put(c);
+    }
+}
+
+static void on_accept(uring_worker_t *w, struct io_uring_cqe *cqe)
+{
+    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+        if (arm_accept(w) < 0) LOG_E("re-arm accept failed\n");
+    }
+    if (cqe->res < 0) {
+        if (cqe->res != -ECANCELED) LOG_W("accept: %s\n", strerror(-cqe->res));
+        return;
+    }
+
+    int cli_fd = cqe->res;
+    uring_conn_t *c = calloc(1, sizeof(*c));
+    if (!c) { LOG_ERRNO("calloc"); close(cli_fd); return; }
+
+    struct sockaddr_in cli;
+    socklen_t len = sizeof(cli);
+    memset(&cli, 0, sizeof(cli));
+    getpeername(cli_fd, (struct sockaddr *)&cli, &len);
+
+    c->w = w;
+    c->refs = 1;
+    session_init(&c->sess, cli_fd, &cli, &uring_ops, c);
+    metrics_add(MET_CONNS, 1);
+    metrics_gauge(MET_CONNS_ACTIVE, 1);
+    if (arm_recv(c) < 0) {
+        LOG_E("arm recv failed\n");
+        conn_put(c);
+        return;
+    }
+
+    char ip[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &cli.sin_addr, ip, sizeof(ip));
+    LOG_I("[thread %lu] accepted %s:%d fd=%d\n",
+            (unsigned long)pthread_self(), ip, ntohs(cli.sin_port), cli_fd);
+}
+
+static void on_recv(uring_worker_t *w, uring_conn_t *c, struct io_uring_cqe *cqe)
+{
+    int res = cqe->res;
+    int more = (cqe->flags & IORING_CQE_F_MORE) != 0;
+
+    if (cqe->flags & IORING_CQE_F_BUFFER) {
+        uint16_t bid = (uint16_t)(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+        if (res > 0 && !c->closing) {
+            if (conn_input(c, uring_buf_addr(&w->bufs, bid), (uint32_t)res) < 0) {
+                LOG_ERRNO("conn_feed");
+                conn_close(c);
+            }
+        }
+        uring_bufring_recycle(&w->bufs, bid);
+        // 别的连接处理完帧放回的收包块也可能让暂停的连接恢复
+        if (w->paused && worker_below_half(w)) resume_paused(w);
+    }
+
+    if (res == 0) {
+        if (!c->closing) printf("client closed\n");
+        // 暂停中还有没处理的数据，等恢复后处理完再关
+        if (c->paused) c->peer_closed = 1;
+        else conn_finish(c);
+    } else if (res < 0 && res != -ENOBUFS && !(res == -ECANCELED && c->recv_cancel)) {
+        if (res != -ECANCELED && !c->closing) LOG_W("recv: %s\n", strerror(-res));
+        conn_close(c);
+    } else if (more && c->paused && !c->recv_cancel && !c->closing) {
+        // 暂停时没取到 SQE 提交取消，再试一次
+        cancel_recv(c);
+    }
+
+    if (!more) {
+        // 多发 recv 结束（buffer 用光、出错或为暂停取消），没关闭也没暂停就重新挂上
+        c->recv_armed = 0;
+        c->recv_cancel = 0;
+        if (!c->closing && !c->paused && !c->peer_closed && arm_recv(c) < 0) conn_close(c);
+        conn_put(c);
+    }
+}
+
+static void on_send(uring_conn_t *c, struct io_uring_cqe *cqe)
+{
+    c->send_inflight = 0;
+    if (cqe->res < 0) {
+        if (!c->closing) LOG_W("send: %s\n", strerror(-cqe->res));
+        conn_close(c);
+    } else if (!c->closing) {
+        c->woff += (size_t)cqe->res;
+        if (c->woff == c->wlen) {
+            // 当前缓冲发完，换上积攒的 pbuf
+            uint8_t *tb = c->wbuf; size_t tc = c->wcap;
+            c->wbuf = c->pbuf; c->wlen = c->plen; c->wcap = c->pcap;
+            c->pbuf = tb; c->pcap = tc; c->plen = 0;
+            c->woff = 0;
+        }
+        if (c->woff < c->wlen && submit_send(c) < 0) conn_close(c);
+        else if (c->peer_closed && !c->paused && !c->send_inflight) conn_close(c);
+    }
+    if (c->paused && (c->closing || conn_below_half(c))) resume_paused(c->w);
+    conn_put(c);
+}
+
+static void on_write(uring_worker_t *w, write_req_t *req, struct io_uring_cqe *cqe)
+{
+    if (cqe->res < 0) {
+        req->file->failed = 1;
+        metrics_add(MET_WRITE_ERRORS, 1);
+        LOG_E("write off=%llu: %s\n",
+                (unsigned long long)(req->off + req->done), strerror(-cqe->res));
+    } else {
+        req->done += (uint32_t)cqe->res;
+        if (cqe->res > 0 && req->done < req->len) {
+            queue_write(w, req);
+            return;
+        }
+        if (req->done < req->len) {
+            req->file->failed = 1;
+            metrics_add(MET_WRITE_ERRORS, 1);
+            LOG_E("short write off=%llu\n", (unsigned long long)req->off);
+        } else {
+            metrics_observe(MET_H_WRITE, metrics_now() - req->t0);
+            metrics_add(MET_DISK_WRITES, 1);
+            metrics_add(MET_DISK_BYTES, req->len);
+            if (req->resume) resume_add(req->resume, req->off, req->len);
+        }
+    }
+    write_req_free(w, req);
+    if (w->paused && worker_below_half(w)) resume_paused(w);
+}
+
+static void *uring_worker_loop(void *arg)
+{
+    uring_worker_t *w = arg;
+    if (arm_accept(w) < 0) { LOG_E("arm accept failed\n"); return NULL; }
+
+    for (;;) {
+        flush_write_queue(w);
+        int r = uring_submit_and_wait(&w->ring, 1);
+        if (r < 0 && errno != EBUSY) {
+            LOG_ERRNO("io_uring_enter");
+            break;
+        }
+
+        struct io_uring_cqe *cqe;
+        while ((cqe = uring_peek_cqe(&w->ring)) != NULL) {
+            struct io_uring_cqe cp = *cqe;
+            uring_cqe_seen(&w->ring);
+
+            void *p = ud_ptr(cp.user_data);
+            switch (ud_tag(cp.user_data)) {
+            case UD_ACCEPT: on_accept(w, &cp); break;
+            case UD_RECV:   on_recv(w, p, &cp); break;
+            case UD_SEND:   on_send(p, &cp); break;
+            case UD_WRITE:  on_write(w, p, &cp); break;
+            default: break;
+            }
+        }
+    }
+    return NULL;
+}
+
+int run_uring_server(int listen_fd, int workers)
+{
+    if (workers <= 0) workers = 1;
+
+    uring_worker_t *ws = calloc((size_t)workers, sizeof(*ws));
+    pthread_t *ths = calloc((size_t)workers, sizeof(*ths));
+    if (!ws || !ths) { LOG_ERRNO("calloc"); free(ws); free(ths); return -1; }
+
+    int started = 0;
+    for (int i = 0; i < workers; ++i) {
+        uring_worker_t *w = &ws[i];
+        w->listen_fd = listen_fd;
+        // 背压把借出的缓冲限制在池子容量以内，长满以后都能回收。过了帧开头的检查后，一帧最多
+        // 再落一整个窗口，写请求很小，按这个余量留足
+        msg_pool_init(&w->data_pool, (uint32_t)sizeof(rx_block_t) + MSG_POOL_BUF_SIZE, URING_MAX_WRITES);
+        msg_pool_init(&w->req_pool, (uint32_t)sizeof(write_req_t), URING_MAX_WRITES + g_cfg.window_max);
+        if (uring_init(&w->ring, URING_ENTRIES) < 0) { LOG_ERRNO("io_uring_setup"); break; }
+        if (uring_bufring_init(&w->ring, &w->bufs, URING_BGID,
+                               URING_BUF_COUNT, URING_BUF_SIZE) < 0) {
+            LOG_ERRNO("io_uring buffer ring");
+            uring_exit(&w->ring);
+            break;
+        }
+        if (pthread_create(&ths[i], NULL, uring_worker_loop, w) != 0) {
+            LOG_ERRNO("pthread_create");
+            uring_bufring_exit(&w->ring, &w->bufs);
+            uring_exit(&w->ring);
+            break;
+        }
+        started++;
+    }
+
+    if (started == 0) { free(ws); free(ths); return -1; }
+    printf("io_uring mode: %d worker(s)\n", started);
+    for (int i = 0; i < started; ++i) {
+        pthread_join(ths[i], NULL);
+        uring_bufring_exit(&ws[i].ring, &ws[i].bufs);
+        uring_exit(&ws[i].ring);
+        msg_pool_destroy(&ws[i].data_pool);
+        msg_pool_destroy(&ws[i].req_pool);
+    }
+    free(ws);
+    free(ths);
+    return 0;
+}
\ No newline at end of file
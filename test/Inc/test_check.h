@@ -0,0 +1,27 @@
+#pragma once
+#include <stdio.h>
+
+/*
+ * 自检测试用的最小断言：失败时打印位置和表达式、记一次失败但继续跑，
+ * main 最后 return TEST_RESULT() 交给 ctest 判断通过与否。
+ */
+
+static int g_test_failures;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #cond); \
+            g_test_failures++; \
+        } \
+    } while (0)
+
+#define CHECK_EQ_U64(a, b) do { \
+        unsigned long long a_ = (unsigned long long)(a), b_ = (unsigned long long)(b); \
+        if (a_ != b_) { \
+            fprintf(stderr, "%s:%d: CHECK failed: %s == %s (%llu vs %llu)\n", \
+                    __FILE__, __LINE__, #a, #b, a_, b_); \
+            g_test_failures++; \
+        } \
+    } while (0)
+
+#define TEST_RESULT() (g_test_failures ? (fprintf(stderr, "%d check(s) failed\n", g_test_failures), 1) : 0)
@@ -0,0 +1,111 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "crc32c.h"
+#include "test_check.h"
+
+/* 逐位算的参照实现，和库里的查表 / 指令实现对拍 */
+static uint32_t crc32c_ref(uint32_t crc, const uint8_t *p, size_t len)
+{
+    crc = ~crc;
+    while (len--) {
+        crc ^= *p++;
+        for (int k = 0; k < 8; ++k) crc = (crc >> 1) ^ (0x82F63B78u & (0u - (crc & 1u)));
+    }
+    return ~crc;
+}
+
+static uint64_t g_x = 0x243F6A8885A308D3ull;
+
+static uint64_t rnd(void)
+{
+    g_x ^= g_x << 13; g_x ^= g_x >> 7; g_x ^= g_x << 17;
+    return g_x;
+}
+
+static void test_vectors(void)
+{
+    CHECK_EQ_U64(crc32c(0, "123456789", 9), 0xE3069283u);
+    CHECK_EQ_U64(crc32c(0, "", 0), 0);
+    uint8_t zeros[32] = {0};
+    CHECK_EQ_U64(crc32c(0, zeros, sizeof(zeros)), 0x8A9136AAu);
+
+    // 各种起始对齐和长度（覆盖指令实现按 8 字节走的主循环和首尾零头）
+    enum { N = 4096 };
+    uint8_t *buf = malloc(N + 16);
+    for (size_t i = 0; i < N + 16; ++i) buf[i] = (uint8_t)rnd();
+    for (size_t align = 0; align < 8; ++align) {
+        for (size_t len = 0; len < 300; ++len) {
+            if (crc32c(0, buf + align, len) != crc32c_ref(0, buf + align, len)) {
+                CHECK(!"crc32c differs from bitwise reference");
+                free(buf);
+                return;
+            }
+        }
+    }
+    CHECK_EQ_U64(crc32c(0, buf, N), crc32c_ref(0, buf, N));
+    // 分段续算等于一次算完
+    CHECK_EQ_U64(crc32c(crc32c(0, buf, 1000), buf + 1000, N - 1000), crc32c(0, buf, N));
+    free(buf);
+}
+
+/* combine(A, B) 必须等于 A+B 一次算出的 crc：各种切分点，含空段和单字节 */
+static void test_combine(void)
+{
+    enum { N = 70000 };
+    uint8_t *buf = malloc(N);
+    for (size_t i = 0; i < N; ++i) buf[i] = (uint8_t)rnd();
+    uint32_t whole = crc32c(0, buf, N);
+
+    static const size_t cuts[] = { 0, 1, 2, 7, 8, 63, 64, 65, 4095, 4096, 65536, N - 1, N };
+    for (size_t i = 0; i < sizeof(cuts) / sizeof(cuts[0]); ++i) {
+        size_t c = cuts[i];
+        uint32_t a = crc32c(0, buf, c);
+        uint32_t b = crc32c(0, buf + c, N - c);
+        CHECK_EQ_U64(crc32c_combine(a, b, N - c), whole);
+    }
+    for (int k = 0; k < 200; ++k) {
+        size_t c = rnd() % (N + 1);
+        uint32_t a = crc32c(0, buf, c), b = crc32c(0, buf + c, N - c);
+        if (crc32c_combine(a, b, N - c) != whole) {
+            CHECK(!"combine differs from one-shot crc");
+            break;
+        }
+    }
+
+    // 三段按两种结合顺序合并结果一样（分段上传时各连接的范围 crc 就是这样拼起来的）
+    size_t c1 = 12345, c2 = 50000;
+    uint32_t a = crc32c(0, buf, c1), b = crc32c(0, buf + c1, c2 - c1), c = crc32c(0, buf + c2, N - c2);
+    CHECK_EQ_U64(crc32c_combine(crc32c_combine(a, b, c2 - c1), c, N - c2), whole);
+    CHECK_EQ_U64(crc32c_combine(a, crc32c_combine(b, c, N - c2), N - c1), whole);
+    free(buf);
+
+    // 超过 4 GiB 的段长没法真的算一遍，用结合律检验：任意 crc 值、两段长度合起来跨过 2^32，
+    // 先合前两段和先合后两段必须一样（x^(8*len) 会用到 g_x2n 的高位）
+    for (int k = 0; k < 50; ++k) {
+        uint32_t ra = (uint32_t)rnd(), rb = (uint32_t)rnd(), rc = (uint32_t)rnd();
+        uint64_t l1 = (3ull << 30) + rnd() % 100000, l2 = (2ull << 30) + rnd() % 100000;
+        uint32_t left = crc32c_combine(crc32c_combine(ra, rb, l1), rc, l2);
+        uint32_t right = crc32c_combine(ra, crc32c_combine(rb, rc, l2), l1 + l2);
+        if (left != right) {
+            CHECK(!"combine not associative for lengths above 4 GiB");
+            break;
+        }
+    }
+
+    // B 是全零段时，合并等于在 A 后面补零再算
+    static uint8_t zs[5000];
+    uint8_t *ab = calloc(1, 100 + sizeof(zs));
+    for (int i = 0; i < 100; ++i) ab[i] = (uint8_t)rnd();
+    CHECK_EQ_U64(crc32c_combine(crc32c(0, ab, 100), crc32c(0, zs, sizeof(zs)), sizeof(zs)),
+                 crc32c(0, ab, 100 + sizeof(zs)));
+    free(ab);
+}
+
+int main(void)
+{
+    test_vectors();
+    test_combine();
+    return TEST_RESULT();
+}
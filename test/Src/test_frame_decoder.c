@@ -0,0 +1,159 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "tcp_protocol.h"
+#include "frame_decoder.h"
+#include "test_check.h"
+
+/* 拼一帧到 out，返回帧长；payload 按 seq 填可辨认的内容 */
+static uint32_t build_frame(uint8_t *out, uint16_t type, uint32_t seq, uint32_t len)
+{
+    protocol_header h = {0}, wire;
+    h.version_major  = 1;
+    h.message_type   = type;
+    h.payload_length = len;
+    h.seq            = seq;
+    protocol_header_to_wire(&h, &wire);
+    memcpy(out, &wire, PROTOCOL_HEADER_LEN);
+    for (uint32_t i = 0; i < len; ++i) out[PROTOCOL_HEADER_LEN + i] = (uint8_t)(seq * 31 + i);
+    return (uint32_t)PROTOCOL_HEADER_LEN + len;
+}
+
+static int payload_ok(const protocol_msg *m)
+{
+    const uint8_t *p = m->payload;
+    for (uint32_t i = 0; i < m->hdr.payload_length; ++i) {
+        if (p[i] != (uint8_t)(m->hdr.seq * 31 + i)) return 0;
+    }
+    return 1;
+}
+
+/* 几帧连在一起，一次喂一个字节：半帧时取不出，凑齐的那个字节之后正好取出一帧 */
+static void test_partial_frames(void)
+{
+    static const uint32_t lens[] = { 0, 1, 100, 5000, 0, 70000 };
+    enum { N = sizeof(lens) / sizeof(lens[0]) };
+    uint8_t *stream = malloc(200000);
+    uint32_t ends[N], total = 0;
+    for (uint32_t i = 0; i < N; ++i) {
+        total += build_frame(stream + total, MSG_FILE_DATA, i, lens[i]);
+        ends[i] = total;
+    }
+
+    frame_decoder_t d;
+    CHECK(frame_decoder_init(&d, 64, 1u << 20) == 0);
+    uint32_t got = 0;
+    for (uint32_t off = 0; off < total; ++off) {
+        CHECK(frame_decoder_feed(&d, stream + off, 1) == 0);
+        protocol_msg m;
+        int r;
+        while ((r = frame_decoder_next(&d, &m)) == 1) {
+            CHECK(got < N);
+            if (got >= N) break;
+            CHECK_EQ_U64(off + 1, ends[got]);
+            CHECK_EQ_U64(m.hdr.seq, got);
+            CHECK_EQ_U64(m.hdr.message_type, MSG_FILE_DATA);
+            CHECK_EQ_U64(m.hdr.payload_length, lens[got]);
+            CHECK(payload_ok(&m));
+            got++;
+        }
+        CHECK(r == 0);
+    }
+    CHECK_EQ_U64(got, N);
+    CHECK_EQ_U64(frame_decoder_pending(&d), 0);
+    frame_decoder_destroy(&d);
+
+    // 整段一次喂进去，所有帧都能连续取出
+    CHECK(frame_decoder_init(&d, 16, 1u << 20) == 0);
+    CHECK(frame_decoder_feed(&d, stream, total) == 0);
+    protocol_msg m;
+    got = 0;
+    while (frame_decoder_next(&d, &m) == 1) {
+        CHECK_EQ_U64(m.hdr.payload_length, lens[got]);
+        CHECK(payload_ok(&m));
+        got++;
+    }
+    CHECK_EQ_U64(got, N);
+    frame_decoder_destroy(&d);
+    free(stream);
+}
+
+/* 正好等于 max_payload 的帧能收，大一个字节的报 EMSGSIZE，且不会先按声明长度扩容 */
+static void test_max_payload(void)
+{
+    uint8_t buf[PROTOCOL_HEADER_LEN + 256];
+    frame_decoder_t d;
+    protocol_msg m;
+
+    CHECK(frame_decoder_init(&d, 64, 256) == 0);
+    uint32_t n = build_frame(buf, MSG_ECHO, 7, 256);
+    CHECK(frame_decoder_feed(&d, buf, n) == 0);
+    CHECK(frame_decoder_next(&d, &m) == 1);
+    CHECK_EQ_U64(m.hdr.payload_length, 256);
+    frame_decoder_destroy(&d);
+
+    CHECK(frame_decoder_init(&d, 64, 255) == 0);
+    CHECK(frame_decoder_feed(&d, buf, PROTOCOL_HEADER_LEN) == 0);
+    errno = 0;
+    CHECK(frame_decoder_next(&d, &m) == -1);
+    CHECK(errno == EMSGSIZE);
+    frame_decoder_destroy(&d);
+
+    // 声明 4 GiB 的头：喂后面的数据时缓冲满了也不能按声明长度去扩
+    protocol_header h = {0}, wire;
+    h.message_type = MSG_ECHO;
+    h.payload_length = 0xFFFFFFFFu;
+    protocol_header_to_wire(&h, &wire);
+    CHECK(frame_decoder_init(&d, 64, 1u << 20) == 0);
+    CHECK(frame_decoder_feed(&d, &wire, PROTOCOL_HEADER_LEN) == 0);
+    uint8_t junk[128] = {0};
+    errno = 0;
+    CHECK(frame_decoder_feed(&d, junk, sizeof(junk)) == -1);
+    CHECK(errno == EMSGSIZE);
+    CHECK(d.cap <= 128);
+    errno = 0;
+    CHECK(frame_decoder_next(&d, &m) == -1);
+    CHECK(errno == EMSGSIZE);
+    frame_decoder_destroy(&d);
+}
+
+/* 通过 socket 收：半帧时 next 返回 0，补齐后取出；对端关闭时 recv 返回 0 */
+static void test_recv(void)
+{
+    int sv[2];
+    CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+    uint8_t buf[PROTOCOL_HEADER_LEN + 3000];
+    uint32_t n = build_frame(buf, MSG_ECHO, 3, 3000);
+
+    frame_decoder_t d;
+    protocol_msg m;
+    CHECK(frame_decoder_init(&d, 1024, 4096) == 0);
+    CHECK(write(sv[1], buf, 5) == 5);
+    CHECK(frame_decoder_recv(&d, sv[0]) == 5);
+    CHECK(frame_decoder_next(&d, &m) == 0);
+    CHECK(write(sv[1], buf + 5, n - 5) == (ssize_t)(n - 5));
+    while (frame_decoder_pending(&d) < n) {
+        if (frame_decoder_recv(&d, sv[0]) <= 0) break;
+    }
+    CHECK(frame_decoder_next(&d, &m) == 1);
+    CHECK_EQ_U64(m.hdr.seq, 3);
+    CHECK(payload_ok(&m));
+    CHECK(frame_decoder_next(&d, &m) == 0);
+
+    close(sv[1]);
+    CHECK(frame_decoder_recv(&d, sv[0]) == 0);
+    close(sv[0]);
+    frame_decoder_destroy(&d);
+}
+
+int main(void)
+{
+    test_partial_frames();
+    test_max_payload();
+    test_recv();
+    return TEST_RESULT();
+}
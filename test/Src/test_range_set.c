@@ -0,0 +1,118 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "range_set.h"
+#include "test_check.h"
+
+#define UNIVERSE 4096
+
+/* 有序、互不相交也不相邻，并且覆盖的字节和参照的逐字节标记完全一致 */
+static int matches(const range_set_t *s, const uint8_t *ref)
+{
+    uint64_t pos = 0;
+    for (uint32_t i = 0; i < s->n; ++i) {
+        const range_t *r = &s->r[i];
+        if (r->off >= r->end) return 0;
+        if (i > 0 && r->off <= s->r[i - 1].end) return 0;
+        for (; pos < r->off; ++pos) if (ref[pos]) return 0;
+        for (; pos < r->end; ++pos) if (!ref[pos]) return 0;
+    }
+    for (; pos < UNIVERSE; ++pos) if (ref[pos]) return 0;
+    return 1;
+}
+
+static void test_cases(void)
+{
+    range_set_t s;
+    memset(&s, 0, sizeof(s));
+
+    CHECK(range_set_full(&s, 0));
+    CHECK(!range_set_full(&s, 1));
+    CHECK(range_set_add(&s, 10, 0) == 0);
+    CHECK_EQ_U64(s.n, 0);
+
+    // 顺序追加、相邻的合并成一段
+    CHECK(range_set_add(&s, 0, 10) == 0);
+    CHECK(range_set_add(&s, 10, 10) == 0);
+    CHECK_EQ_U64(s.n, 1);
+    CHECK(range_set_full(&s, 20));
+    CHECK(!range_set_full(&s, 21));
+
+    // 中间留洞
+    CHECK(range_set_add(&s, 30, 10) == 0);
+    CHECK(range_set_add(&s, 50, 10) == 0);
+    CHECK(range_set_add(&s, 70, 10) == 0);
+    CHECK_EQ_U64(s.n, 4);
+    CHECK_EQ_U64(range_set_bytes(&s), 50);
+
+    // 插到最前面、被已有区间包含
+    CHECK(range_set_add(&s, 25, 2) == 0);
+    CHECK(range_set_add(&s, 32, 3) == 0);
+    CHECK_EQ_U64(s.n, 5);
+
+    // 一段同时连上左右好几段：[20,75) 把 [0,20) 到 [70,80) 全部并起来
+    CHECK(range_set_add(&s, 20, 55) == 0);
+    CHECK_EQ_U64(s.n, 1);
+    CHECK_EQ_U64(s.r[0].off, 0);
+    CHECK_EQ_U64(s.r[0].end, 80);
+    CHECK(range_set_full(&s, 80));
+
+    // 落在最后一段起点之前、与之相交的区间走二分那条路
+    range_set_clear(&s);
+    CHECK(range_set_add(&s, 100, 10) == 0);
+    CHECK(range_set_add(&s, 95, 10) == 0);
+    CHECK_EQ_U64(s.n, 1);
+    CHECK_EQ_U64(s.r[0].off, 95);
+    CHECK_EQ_U64(s.r[0].end, 110);
+
+    // 接近 2^64 的 offset 不溢出
+    range_set_clear(&s);
+    CHECK(range_set_add(&s, UINT64_MAX - 100, 50) == 0);
+    CHECK(range_set_add(&s, UINT64_MAX - 50, 50) == 0);
+    CHECK_EQ_U64(s.n, 1);
+    CHECK_EQ_U64(range_set_bytes(&s), 100);
+    range_set_free(&s);
+}
+
+/* 随机插入和逐字节参照对比，多数顺序到达、少数乱序和重叠，模拟续传记录的实际用法 */
+static void test_random(void)
+{
+    static uint8_t ref[UNIVERSE];
+    uint64_t x = 0x9E3779B97F4A7C15ull;
+    for (int round = 0; round < 200; ++round) {
+        range_set_t s;
+        memset(&s, 0, sizeof(s));
+        memset(ref, 0, sizeof(ref));
+        uint64_t cursor = 0;
+        for (int k = 0; k < 300; ++k) {
+            x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+            uint64_t off, len = 1 + x % 64;
+            if ((x >> 20) % 4 != 0) {
+                off = cursor % UNIVERSE;
+                cursor += len + (x >> 30) % 3;
+            } else {
+                off = (x >> 8) % UNIVERSE;
+            }
+            if (off + len > UNIVERSE) len = UNIVERSE - off;
+            CHECK(range_set_add(&s, off, len) == 0);
+            memset(ref + off, 1, len);
+            if (!matches(&s, ref)) {
+                CHECK(!"range set diverged from reference");
+                round = 200;
+                break;
+            }
+        }
+        uint64_t bytes = 0;
+        for (uint32_t i = 0; i < UNIVERSE; ++i) bytes += ref[i];
+        CHECK_EQ_U64(range_set_bytes(&s), bytes);
+        range_set_free(&s);
+    }
+}
+
+int main(void)
+{
+    test_cases();
+    test_random();
+    return TEST_RESULT();
+}
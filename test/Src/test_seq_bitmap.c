@@ -0,0 +1,114 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "seq_bitmap.h"
+#include "test_check.h"
+
+/* 按顺序和两两交换的顺序置位，next 和 missing 跟着走 */
+static void test_prefix(void)
+{
+    seq_bitmap_t b;
+    memset(&b, 0, sizeof(b));
+    seq_bitmap_reset(&b, 100);
+
+    CHECK(seq_bitmap_set(&b, 101) == 1);
+    CHECK_EQ_U64(b.next, 100);
+    CHECK_EQ_U64(seq_bitmap_missing(&b), 1);
+    CHECK(seq_bitmap_test(&b, 101));
+    CHECK(!seq_bitmap_test(&b, 100));
+    CHECK(!seq_bitmap_test(&b, 5000));
+
+    CHECK(seq_bitmap_set(&b, 100) == 1);
+    CHECK_EQ_U64(b.next, 102);
+    CHECK_EQ_U64(seq_bitmap_missing(&b), 0);
+    CHECK(seq_bitmap_set(&b, 100) == 0);
+
+    // 跨过 64 位的字边界，整字全满时一次跳过
+    for (uint32_t s = 300; s >= 102; --s) CHECK(seq_bitmap_set(&b, s) == 1);
+    CHECK_EQ_U64(b.next, 301);
+    CHECK_EQ_U64(seq_bitmap_missing(&b), 0);
+    seq_bitmap_free(&b);
+}
+
+/* seq 从 32 位回绕前开始：base 附近的减法按无符号回绕，不能把回绕后的 seq 当成很远 */
+static void test_wrap(void)
+{
+    seq_bitmap_t b;
+    memset(&b, 0, sizeof(b));
+    uint32_t base = 0xFFFFFFF0u;
+    seq_bitmap_reset(&b, base);
+    for (uint32_t k = 0; k < 64; k += 2) {
+        CHECK(seq_bitmap_set(&b, base + k + 1) == 1);
+        CHECK(seq_bitmap_set(&b, base + k) == 1);
+    }
+    CHECK_EQ_U64(b.next, (uint32_t)(base + 64));
+    CHECK(seq_bitmap_test(&b, 5));
+    CHECK(seq_bitmap_test(&b, 0xFFFFFFFFu));
+    CHECK(!seq_bitmap_test(&b, (uint32_t)(base + 64)));
+    seq_bitmap_free(&b);
+}
+
+/* reserve 只保证位置、不置位；超出 SEQ_BITMAP_MAX_BITS 跨度的 seq 被拒绝且不改状态 */
+static void test_reserve_limit(void)
+{
+    seq_bitmap_t b;
+    memset(&b, 0, sizeof(b));
+    seq_bitmap_reset(&b, 0);
+    CHECK(seq_bitmap_reserve(&b, 10000) == 0);
+    CHECK(!seq_bitmap_test(&b, 10000));
+    CHECK_EQ_U64(seq_bitmap_missing(&b), 0);
+    CHECK(b.nbits > 10000);
+
+    // 0 还没收到，base 滑不动
+    CHECK(seq_bitmap_reserve(&b, SEQ_BITMAP_MAX_BITS) == -1);
+    CHECK(seq_bitmap_set(&b, SEQ_BITMAP_MAX_BITS) == -1);
+    CHECK(seq_bitmap_set(&b, SEQ_BITMAP_MAX_BITS - 1) == 1);
+    CHECK_EQ_U64(b.base, 0);
+    CHECK_EQ_U64(seq_bitmap_missing(&b), SEQ_BITMAP_MAX_BITS - 1);
+    seq_bitmap_free(&b);
+}
+
+/*
+ * 总块数远超 SEQ_BITMAP_MAX_BITS，但在途跨度小：容量用完时 base 滑过已满的整字，
+ * 位图不再增长，缺的个数和 next 始终正确。
+ */
+static void test_slide(void)
+{
+    seq_bitmap_t b;
+    memset(&b, 0, sizeof(b));
+    uint32_t base = 0xFFFF0000u;
+    seq_bitmap_reset(&b, base);
+    uint32_t total = SEQ_BITMAP_MAX_BITS + 100000;
+    uint32_t cap = 0;
+    for (uint32_t k = 0; k < total; k += 2) {
+        if (seq_bitmap_set(&b, base + k + 1) != 1) { CHECK(!"set odd"); break; }
+        if (seq_bitmap_missing(&b) != 1) { CHECK(!"missing 1"); break; }
+        if (seq_bitmap_set(&b, base + k) != 1) { CHECK(!"set even"); break; }
+        if (b.next != (uint32_t)(base + k + 2)) { CHECK(!"next"); break; }
+        if (b.nbits > cap) cap = b.nbits;
+    }
+    CHECK_EQ_U64(seq_bitmap_missing(&b), 0);
+    CHECK(cap <= 8192);
+    CHECK(b.base != base);
+    // 滑出去的 seq 已在 base 之前；之后的重复仍能识别
+    CHECK(seq_bitmap_set(&b, b.next - 1) == 0);
+
+    // 留一个洞，后面继续收：洞挡住滑动，位图按跨度增长，补上洞后 next 一次追上
+    uint32_t hole = b.next;
+    for (uint32_t k = 1; k < 20000; ++k) CHECK(seq_bitmap_set(&b, hole + k) == 1);
+    CHECK_EQ_U64(b.next, hole);
+    CHECK_EQ_U64(seq_bitmap_missing(&b), 1);
+    CHECK(seq_bitmap_set(&b, hole) == 1);
+    CHECK_EQ_U64(b.next, hole + 20000);
+    seq_bitmap_free(&b);
+}
+
+int main(void)
+{
+    test_prefix();
+    test_wrap();
+    test_reserve_limit();
+    test_slide();
+    return TEST_RESULT();
+}
@@ -0,0 +1,223 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+/*
+ * 本地丢包 / 乱序 / 时延模拟：在 LISTEN_PORT 上收客户端的数据报转给服务器，服务器的回包
+ * 转回给最近一个发过来的客户端地址。两个方向各自按比例丢包，没丢的按 --delay 推迟发出，
+ * 其中按 --reorder 的比例再多推迟 --reorder-ms，被后面的数据报超过去。
+ * 用来在回环上测 UDP 传输的重传和重排，例如：
+ *   udp_sim 9101 127.0.0.1 9100 --loss 2 --reorder 1 --delay 5
+ *   tcp_client 127.0.0.1 9101 sendfile big.bin --udp
+ */
+
+#define SIM_MAX_DATAGRAM 65535
+
+typedef struct pkt
+{
+    uint64_t    due_us;
+    int         to_server;
+    uint32_t    len;
+    struct pkt *prev, *next;
+    uint8_t     data[];
+}pkt_t;
+
+typedef struct
+{
+    double   loss;            // 百分比
+    double   reorder;
+    uint32_t delay_ms;
+    uint32_t reorder_ms;
+    uint64_t seed;
+}sim_opts_t;
+
+typedef struct
+{
+    uint64_t in[2], dropped[2], reordered[2], out[2];
+}sim_stats_t;
+
+static volatile sig_atomic_t g_stop = 0;
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    g_stop = 1;
+}
+
+static uint64_t now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+}
+
+/* xorshift64*，同一个 --seed 每次丢的是同一批 */
+static double rand_pct(uint64_t *s)
+{
+    *s ^= *s >> 12;
+    *s ^= *s << 25;
+    *s ^= *s >> 27;
+    return (double)((*s * 2685821657736338717ull) >> 11) / (double)(1ull << 53) * 100.0;
+}
+
+/* 按到期时间插进队列；大多数数据报到期时间最晚，从尾部往前找 */
+static void enqueue(pkt_t **head, pkt_t **tail, pkt_t *p)
+{
+    pkt_t *at = *tail;
+    while (at && at->due_us > p->due_us) at = at->prev;
+    p->prev = at;
+    p->next = at ? at->next : *head;
+    if (p->next) p->next->prev = p; else *tail = p;
+    if (at) at->next = p; else *head = p;
+}
+
+static int parse_opts(int argc, char **argv, sim_opts_t *o)
+{
+    memset(o, 0, sizeof(*o));
+    o->reorder_ms = 2;
+    o->seed = 0x9e3779b97f4a7c15ull;
+    for (int i = 4; i < argc; ++i) {
+        const char *v = (i + 1 < argc) ? argv[i + 1] : NULL;
+        if (strcmp(argv[i], "--loss") == 0 && v) {
+            o->loss = atof(v);
+        } else if (strcmp(argv[i], "--reorder") == 0 && v) {
+            o->reorder = atof(v);
+        } else if (strcmp(argv[i], "--delay") == 0 && v) {
+            o->delay_ms = (uint32_t)atoi(v);
+        } else if (strcmp(argv[i], "--reorder-ms") == 0 && v) {
+            o->reorder_ms = (uint32_t)atoi(v);
+        } else if (strcmp(argv[i], "--seed") == 0 && v) {
+            o->seed = strtoull(v, NULL, 10) | 1u;
+        } else {
+            fprintf(stderr, "unknown option '%s'\n", argv[i]);
+            return -1;
+        }
+        ++i;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    sim_opts_t o;
+    if (argc < 4 || parse_opts(argc, argv, &o) < 0) {
+        fprintf(stderr, "用法: %s <LISTEN_PORT> <SERVER_IP> <SERVER_PORT> [--loss PCT] [--reorder PCT]"
+                        " [--delay MS] [--reorder-ms MS] [--seed N]\n", argv[0]);
+        return 1;
+    }
+
+    int lfd = socket(AF_INET, SOCK_DGRAM, 0);
+    int ufd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (lfd < 0 || ufd < 0) { perror("socket"); return 1; }
+    int sz = 8 * 1024 * 1024;
+    setsockopt(lfd, SOL_SOCKET, SO_RCVBUF, &sz, sizeof(sz));
+    setsockopt(ufd, SOL_SOCKET, SO_RCVBUF, &sz, sizeof(sz));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons((uint16_t)atoi(argv[1]));
+    if (bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) < 0) { perror("bind"); return 1; }
+
+    struct sockaddr_in svr;
+    memset(&svr, 0, sizeof(svr));
+    svr.sin_family = AF_INET;
+    svr.sin_port = htons((uint16_t)atoi(argv[3]));
+    if (inet_pton(AF_INET, argv[2], &svr.sin_addr) != 1) { perror("inet_pton"); return 1; }
+    if (connect(ufd, (struct sockaddr *)&svr, sizeof(svr)) < 0) { perror("connect"); return 1; }
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    fprintf(stderr, "udp_sim :%s -> %s:%s loss=%.2f%% reorder=%.2f%% (+%ums) delay=%ums\n",
+            argv[1], argv[2], argv[3], o.loss, o.reorder, o.reorder_ms, o.delay_ms);
+
+    struct sockaddr_in cli;
+    int have_cli = 0;
+    pkt_t *head = NULL, *tail = NULL;
+    sim_stats_t st;
+    memset(&st, 0, sizeof(st));
+    uint8_t *buf = malloc(SIM_MAX_DATAGRAM);
+    if (!buf) { perror("malloc"); return 1; }
+
+    while (!g_stop) {
+        uint64_t now = now_us();
+        int timeout = -1;
+        if (head) timeout = head->due_us > now ? (int)((head->due_us - now + 999) / 1000) : 0;
+        struct pollfd pfd[2] = { { .fd = lfd, .events = POLLIN }, { .fd = ufd, .events = POLLIN } };
+        int pr = poll(pfd, 2, timeout);
+        if (pr < 0) {
+            if (errno == EINTR) continue;
+            perror("poll");
+            break;
+        }
+
+        // 两个方向都读到 EAGAIN，数据报按方向各自丢包 / 推迟
+        for (int dir = 0; dir < 2 && pr > 0; ++dir) {
+            if (!(pfd[dir].revents & POLLIN)) continue;
+            for (;;) {
+                struct sockaddr_in from;
+                socklen_t flen = sizeof(from);
+                ssize_t n = recvfrom(pfd[dir].fd, buf, SIM_MAX_DATAGRAM, MSG_DONTWAIT,
+                                     (struct sockaddr *)&from, &flen);
+                if (n < 0) {
+                    if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR &&
+                        errno != ECONNREFUSED) perror("recvfrom");
+                    break;
+                }
+                int to_server = dir == 0;
+                if (to_server) { cli = from; have_cli = 1; }
+                st.in[to_server]++;
+                if (rand_pct(&o.seed) < o.loss) { st.dropped[to_server]++; continue; }
+
+                pkt_t *p = malloc(sizeof(*p) + (size_t)n);
+                if (!p) { perror("malloc"); continue; }
+                p->to_server = to_server;
+                p->len = (uint32_t)n;
+                memcpy(p->data, buf, (size_t)n);
+                p->due_us = now_us() + (uint64_t)o.delay_ms * 1000u;
+                if (rand_pct(&o.seed) < o.reorder) {
+                    p->due_us += (uint64_t)o.reorder_ms * 1000u;
+                    st.reordered[to_server]++;
+                }
+                enqueue(&head, &tail, p);
+            }
+        }
+
+        now = now_us();
+        while (head && head->due_us <= now) {
+            pkt_t *p = head;
+            head = p->next;
+            if (head) head->prev = NULL; else tail = NULL;
+            ssize_t w;
+            if (p->to_server) w = send(ufd, p->data, p->len, 0);
+            else w = have_cli ? sendto(lfd, p->data, p->len, 0, (struct sockaddr *)&cli, sizeof(cli)) : -1;
+            if (w >= 0) st.out[p->to_server]++;
+            free(p);
+        }
+    }
+
+    fprintf(stderr, "udp_sim: to server in=%llu dropped=%llu reordered=%llu out=%llu; "
+                    "to client in=%llu dropped=%llu reordered=%llu out=%llu\n",
+            (unsigned long long)st.in[1], (unsigned long long)st.dropped[1],
+            (unsigned long long)st.reordered[1], (unsigned long long)st.out[1],
+            (unsigned long long)st.in[0], (unsigned long long)st.dropped[0],
+            (unsigned long long)st.reordered[0], (unsigned long long)st.out[0]);
+    while (head) {
+        pkt_t *p = head;
+        head = p->next;
+        free(p);
+    }
+    free(buf);
+    close(lfd);
+    close(ufd);
+    return 0;
+}